@@ -66,16 +66,7 @@ struct AuthResultsState {
         h += "; ";
 
         /* DKIM */
-        h += "dkim=";
-        switch (dkim.result) {
-        case DkimResult::Pass:      h += "pass"; break;
-        case DkimResult::Fail:      h += "fail"; break;
-        case DkimResult::TempError: h += "temperror"; break;
-        case DkimResult::PermError: h += "permerror"; break;
-        case DkimResult::None:      h += "none"; break;
-        }
-        if (!dkim.headerDomain.empty())
-            h += " header.d=" + dkim.headerDomain;
+        appendDkim(h);
         h += "; ";
 
         /* DMARC */
@@ -95,4 +86,25 @@ struct AuthResultsState {
 
         return h;
     }
+
+    // Only the methods this hop actually evaluated
+    std::string dkimHeaderValue(const std::string& authServId) const {
+        std::string h = authServId + "; ";
+        appendDkim(h);
+        return h;
+    }
+
+private:
+    void appendDkim(std::string& h) const {
+        h += "dkim=";
+        switch (dkim.result) {
+        case DkimResult::Pass:      h += "pass"; break;
+        case DkimResult::Fail:      h += "fail"; break;
+        case DkimResult::TempError: h += "temperror"; break;
+        case DkimResult::PermError: h += "permerror"; break;
+        case DkimResult::None:      h += "none"; break;
+        }
+        if (!dkim.headerDomain.empty())
+            h += " header.d=" + dkim.headerDomain;
+    }
 };
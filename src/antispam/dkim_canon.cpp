@@ -1,8 +1,17 @@
 // src/antispam/dkim_canon.cpp
 #include "dkim_canon.h"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
-#include <sstream>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define DKIM_SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 static std::string toLower(std::string s) {
     std::transform(s.begin(), s.end(), s.begin(),
@@ -10,75 +19,408 @@ static std::string toLower(std::string s) {
     return s;
 }
 
+/* ===================== Byte scanning ===================== */
+
+// Offset of the first byte canonicalization has to look at, or n;
+// everything before it is copied as is. That is CR and LF, and when
+// relaxed also HTAB and any SP not followed by an ordinary byte (a lone
+// SP between words already is its own canonical form). A SP in the last
+// position is reported, since the byte after it is not known yet.
+using ScanFn = size_t (*)(const char* p, size_t n, bool wsp);
+
+static bool special(char c) {
+    return c == '\r' || c == '\n' || c == ' ' || c == '\t';
+}
+
+static size_t scanScalar(const char* p, size_t n, bool wsp) {
+    for (size_t i = 0; i < n; ++i) {
+        char c = p[i];
+        if (c == '\r' || c == '\n')
+            return i;
+        if (wsp && (c == '\t' || (c == ' ' && (i + 1 == n || special(p[i + 1])))))
+            return i;
+    }
+    return n;
+}
+
+#ifdef DKIM_SCAN_X86
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DKIM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DKIM_TARGET_AVX2
+#endif
+
+static unsigned lowestBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return idx;
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// SSE2 is part of x86-64, so this is the floor on every 64-bit build
+static size_t scanSse2(const char* p, size_t n, bool wsp) {
+    const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+    const __m128i sp = _mm_set1_epi8(' '), ht = _mm_set1_epi8('\t');
+    size_t i = 0;
+    // 17 bytes per step: each SP is judged by the byte after it
+    for (; i + 17 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf));
+        if (wsp) {
+            __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1));
+            __m128i nextSpecial = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(next, cr), _mm_cmpeq_epi8(next, lf)),
+                _mm_or_si128(_mm_cmpeq_epi8(next, sp), _mm_cmpeq_epi8(next, ht)));
+            hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, ht),
+                _mm_and_si128(_mm_cmpeq_epi8(v, sp), nextSpecial)));
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+        if (mask)
+            return i + lowestBit(mask);
+    }
+    return i + scanScalar(p + i, n - i, wsp);
+}
+
+DKIM_TARGET_AVX2
+static size_t scanAvx2(const char* p, size_t n, bool wsp) {
+    const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+    const __m256i sp = _mm256_set1_epi8(' '), ht = _mm256_set1_epi8('\t');
+    size_t i = 0;
+    for (; i + 33 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf));
+        if (wsp) {
+            __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 1));
+            __m256i nextSpecial = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(next, cr), _mm256_cmpeq_epi8(next, lf)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(next, sp), _mm256_cmpeq_epi8(next, ht)));
+            hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, ht),
+                _mm256_and_si256(_mm256_cmpeq_epi8(v, sp), nextSpecial)));
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask)
+            return i + lowestBit(mask);
+    }
+    return i + scanSse2(p + i, n - i, wsp);
+}
+
+static bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+        return false;   // OS does not save YMM state
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // DKIM_SCAN_X86
+
+static ScanFn pickScan() {
+#ifdef DKIM_SCAN_X86
+    return cpuHasAvx2() ? scanAvx2 : scanSse2;
+#else
+    return scanScalar;
+#endif
+}
+
+static ScanFn kernelFn(DkimCanon::ScanKernel kernel) {
+    switch (kernel) {
+    case DkimCanon::ScanKernel::Scalar: return scanScalar;
+#ifdef DKIM_SCAN_X86
+    case DkimCanon::ScanKernel::Sse2:   return scanSse2;
+    case DkimCanon::ScanKernel::Avx2:   return cpuHasAvx2() ? scanAvx2 : nullptr;
+#endif
+    default:                            return nullptr;
+    }
+}
+
+// Chosen on first use unless a kernel was selected
+static std::atomic<ScanFn> g_scan{nullptr};
+
+static size_t scanSpecial(const char* p, size_t n, bool wsp) {
+    ScanFn scan = g_scan.load(std::memory_order_relaxed);
+    if (!scan) {
+        scan = pickScan();
+        g_scan.store(scan, std::memory_order_relaxed);
+    }
+    return scan(p, n, wsp);
+}
+
+bool DkimCanon::scanKernelSupported(ScanKernel kernel) {
+    return kernelFn(kernel) != nullptr;
+}
+
+bool DkimCanon::useScanKernel(ScanKernel kernel) {
+    ScanFn scan = kernelFn(kernel);
+    if (!scan)
+        return false;
+    g_scan.store(scan, std::memory_order_relaxed);
+    return true;
+}
+
 static std::string compressWsp(const std::string& s) {
     std::string out;
-    bool inWsp = false;
-    for (char c : s) {
-        if (c == ' ' || c == '\t') {
-            if (!inWsp) out.push_back(' ');
-            inWsp = true;
+    out.reserve(s.size());
+    size_t i = 0;
+    while (i < s.size()) {
+        size_t run = scanSpecial(s.data() + i, s.size() - i, true);
+        out.append(s, i, run);
+        i += run;
+        if (i == s.size())
+            break;
+        if (s[i] == ' ' || s[i] == '\t') {
+            out.push_back(' ');
+            while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) ++i;
         } else {
-            out.push_back(c);
-            inWsp = false;
+            out.push_back(s[i++]);  // CR / LF pass through
         }
     }
     return out;
 }
 
-std::string DkimCanon::canonicalizeBodyRelaxed(const std::string& body) {
-    std::string b;
-    for (size_t i = 0; i < body.size(); ++i) {
-        if (body[i] == '\r') continue;
-        if (body[i] == '\n') b += "\r\n";
-        else b += body[i];
+bool DkimCanon::parseCanonTag(const std::string& c, Mode& header, Mode& body) {
+    auto parse = [](const std::string& s, Mode& m) {
+        if (s.empty() || s == "simple") m = Mode::Simple;
+        else if (s == "relaxed") m = Mode::Relaxed;
+        else return false;
+        return true;
+    };
+    std::string v = toLower(c);
+    v.erase(std::remove_if(v.begin(), v.end(),
+        [](unsigned char ch) { return std::isspace(ch); }), v.end());
+    auto slash = v.find('/');
+    if (slash == std::string::npos)
+        return parse(v, header) && parse("", body);
+    return parse(v.substr(0, slash), header) && parse(v.substr(slash + 1), body);
+}
+
+/* ===================== Streaming body ===================== */
+
+DkimCanon::BodyHasher::BodyHasher(Mode mode, const EVP_MD* md, int64_t limit)
+    : mode_(mode), md_(md), limit_(limit), ctx_(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(ctx_, md_, nullptr);
+}
+
+DkimCanon::BodyHasher::~BodyHasher() {
+    EVP_MD_CTX_free(ctx_);
+}
+
+void DkimCanon::BodyHasher::flush() {
+    if (bufLen_) {
+        EVP_DigestUpdate(ctx_, buf_, bufLen_);
+        bufLen_ = 0;
+    }
+}
+
+void DkimCanon::BodyHasher::put(const char* p, size_t n) {
+    size_t take = n;
+    if (limit_ >= 0) {
+        uint64_t room = emitted_ < static_cast<uint64_t>(limit_)
+            ? static_cast<uint64_t>(limit_) - emitted_ : 0;
+        take = static_cast<size_t>(std::min<uint64_t>(n, room));
     }
+    emitted_ += n;
 
-    while (b.size() >= 2 && b.substr(b.size() - 2) == "\r\n") {
-        size_t pos = b.size() - 2;
-        if (pos == 0 || b.substr(pos - 2, 2) != "\r\n")
-            break;
-        b.erase(pos);
+    if (take >= sizeof(buf_)) {
+        flush();    // long line: straight to the digest, no copy
+        EVP_DigestUpdate(ctx_, p, take);
+        return;
     }
+    while (take) {
+        if (bufLen_ == sizeof(buf_))
+            flush();
+        size_t chunk = std::min(take, sizeof(buf_) - bufLen_);
+        std::memcpy(buf_ + bufLen_, p, chunk);
+        bufLen_ += chunk;
+        p += chunk;
+        take -= chunk;
+    }
+}
 
-    if (b.size() < 2 || b.substr(b.size() - 2) != "\r\n")
-        b += "\r\n";
+// First byte of a line's content: held-back empty lines turn out to be
+// inner ones, and a relaxed WSP run becomes one SP
+void DkimCanon::BodyHasher::beginContent() {
+    for (; blankLines_; --blankLines_)
+        put("\r\n", 2);
+    if (wsp_) {
+        put(" ", 1);
+        wsp_ = false;
+    }
+    lineContent_ = true;
+}
 
-    return b;
+void DkimCanon::BodyHasher::endLine() {
+    if (lineContent_)
+        put("\r\n", 2);
+    else
+        ++blankLines_;
+    lineContent_ = false;
+    wsp_ = false;       // relaxed: trailing WSP is dropped
 }
 
-std::vector<std::string> DkimCanon::canonicalizeHeadersRelaxed(
-    const std::string& headers,
-    const std::vector<std::string>& headerNames) {
+void DkimCanon::BodyHasher::update(const char* data, size_t len) {
+    if (done_)
+        return;
+    const bool relaxed = mode_ == Mode::Relaxed;
+    size_t i = 0;
+    while (i < len) {
+        char c = data[i];
+        if (cr_) {
+            cr_ = false;
+            if (c == '\n') {
+                endLine();
+                ++i;
+                continue;
+            }
+            beginContent();
+            put("\r", 1);  // bare CR is content
+        }
+        if (c == '\r') {
+            cr_ = true;
+            ++i;
+            continue;
+        }
+        if (c == '\n') {
+            endLine();      // bare LF from line-oriented callers
+            ++i;
+            continue;
+        }
+        if (relaxed && (c == ' ' || c == '\t')) {
+            wsp_ = true;
+            ++i;
+            continue;
+        }
 
-    std::vector<std::string> out;
-    std::istringstream iss(headers);
-    std::string line, current;
+        // Run of bytes that pass through unchanged
+        size_t j = i + 1 + scanSpecial(data + i + 1, len - i - 1, relaxed);
+        beginContent();
+        put(data + i, j - i);
+        i = j;
+    }
+}
 
-    std::vector<std::string> lines;
-    while (std::getline(iss, line)) {
-        if (!line.empty() && line.back() == '\r')
-            line.pop_back();
-        if (!line.empty() && (line[0] == ' ' || line[0] == '\t')) {
-            current += " " + line.substr(1);
-        } else {
-            if (!current.empty()) lines.push_back(current);
-            current = line;
+const std::string& DkimCanon::BodyHasher::finish() {
+    if (done_)
+        return digest_;
+    if (cr_) {
+        cr_ = false;
+        beginContent();
+        put("\r", 1);
+    }
+    if (lineContent_)
+        put("\r\n", 2);  // last line had no CRLF
+    if (emitted_ == 0 && mode_ == Mode::Simple)
+        put("\r\n", 2);  // simple: empty body is one CRLF
+    flush();
+
+    unsigned char out[EVP_MAX_MD_SIZE];
+    unsigned int outLen = 0;
+    EVP_DigestFinal_ex(ctx_, out, &outLen);
+    digest_.assign(reinterpret_cast<const char*>(out), outLen);
+    done_ = true;
+    return digest_;
+}
+
+size_t DkimCanon::BodyHashSet::add(Mode mode, const EVP_MD* md, int64_t limit) {
+    for (size_t i = 0; i < hashers_.size(); ++i) {
+        const auto& h = *hashers_[i];
+        if (h.mode() == mode && h.md() == md && h.limit() == limit)
+            return i;
+    }
+    hashers_.push_back(std::make_unique<BodyHasher>(mode, md, limit));
+    return hashers_.size() - 1;
+}
+
+void DkimCanon::BodyHashSet::update(const char* data, size_t len) {
+    for (auto& h : hashers_)
+        h->update(data, len);
+}
+
+/* ===================== Headers ===================== */
+
+std::vector<DkimCanon::HeaderField> DkimCanon::parseHeaders(const std::string& headers) {
+    std::vector<HeaderField> fields;
+    size_t pos = 0;
+    while (pos < headers.size()) {
+        size_t end = headers.find('\n', pos);
+        if (end == std::string::npos) end = headers.size();
+        size_t lineEnd = (end > pos && headers[end - 1] == '\r') ? end - 1 : end;
+        std::string line = headers.substr(pos, lineEnd - pos);
+        pos = end + 1;
+
+        if (line.empty())
+            break;  // end of the header block
+        if (line[0] == ' ' || line[0] == '\t') {
+            if (!fields.empty())
+                fields.back().raw += "\r\n" + line;
+            continue;
         }
+        auto colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        name.erase(name.find_last_not_of(" \t") + 1);
+        fields.push_back(HeaderField{ toLower(name), line });
     }
-    if (!current.empty()) lines.push_back(current);
-
-    for (auto it = headerNames.rbegin(); it != headerNames.rend(); ++it) {
-        std::string want = toLower(*it);
-        for (auto rit = lines.rbegin(); rit != lines.rend(); ++rit) {
-            auto pos = rit->find(':');
-            if (pos == std::string::npos) continue;
-            std::string name = toLower(rit->substr(0, pos));
-            if (name == want) {
-                std::string value = rit->substr(pos + 1);
-                value.erase(0, value.find_first_not_of(" \t"));
-                value.erase(value.find_last_not_of(" \t") + 1);
-                value = compressWsp(value);
-                out.push_back(name + ":" + value);
+    return fields;
+}
+
+std::string DkimCanon::fromDomain(const std::vector<HeaderField>& fields) {
+    const HeaderField* from = nullptr;
+    for (const auto& f : fields) {
+        if (f.name != "from") continue;
+        if (from) return "";
+        from = &f;
+    }
+    if (!from)
+        return "";
+    auto at = from->raw.rfind('@');
+    if (at == std::string::npos)
+        return "";
+    auto end = from->raw.find_first_of("> \t\r\n;,", at);
+    return toLower(from->raw.substr(at + 1, end == std::string::npos ? std::string::npos : end - at - 1));
+}
+
+std::string DkimCanon::canonicalizeHeader(const HeaderField& field, Mode mode) {
+    if (mode == Mode::Simple)
+        return field.raw;
+
+    // Relaxed: lowercase name, unfold, one SP per WSP run, trim the value
+    std::string value = field.raw.substr(field.raw.find(':') + 1);
+    value.erase(std::remove(value.begin(), value.end(), '\r'), value.end());
+    value.erase(std::remove(value.begin(), value.end(), '\n'), value.end());
+    value = compressWsp(value);
+    value.erase(0, value.find_first_not_of(' '));
+    value.erase(value.find_last_not_of(' ') + 1);
+    return field.name + ":" + value;
+}
+
+std::vector<const DkimCanon::HeaderField*> DkimCanon::selectHeaders(
+    const std::vector<HeaderField>& fields,
+    const std::vector<std::string>& names) {
+
+    // Repeated names take successive instances from the bottom up
+    std::vector<const HeaderField*> out;
+    std::vector<bool> used(fields.size(), false);
+    for (const auto& n : names) {
+        std::string want = toLower(n);
+        for (size_t i = fields.size(); i-- > 0;) {
+            if (!used[i] && fields[i].name == want) {
+                used[i] = true;
+                out.push_back(&fields[i]);
                 break;
             }
         }
@@ -1,14 +1,111 @@
 // src/antispam/dkim_canon.h
 #pragma once
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <openssl/evp.h>
+
 namespace DkimCanon {
 
-std::string canonicalizeBodyRelaxed(const std::string& body);
+enum class Mode { Simple, Relaxed };
+
+// c= tag ("relaxed/simple"); missing parts default to simple. False if unknown
+bool parseCanonTag(const std::string& c, Mode& header, Mode& body);
+
+// One header field as received: lowercased name, raw text including any
+// folding, no final CRLF
+struct HeaderField {
+    std::string name;
+    std::string raw;
+};
+
+// Header block split into fields once; every signature canonicalizes from it
+std::vector<HeaderField> parseHeaders(const std::string& headers);
+
+// Domain of the single From: address, lowercased; "" if absent or repeated
+std::string fromDomain(const std::vector<HeaderField>& fields);
+
+// Byte-scan kernel behind the canonicalizers, picked from the CPU on first
+// use; selectable so tests can run every kernel the host supports
+enum class ScanKernel { Scalar, Sse2, Avx2 };
+bool scanKernelSupported(ScanKernel kernel);
+bool useScanKernel(ScanKernel kernel);      // false if unsupported, no change
+
+// RFC 6376 3.4.1 / 3.4.2, without the trailing CRLF
+std::string canonicalizeHeader(const HeaderField& field, Mode mode);
+
+// Fields named in h=, in h= order; names with no instance left add nothing
+std::vector<const HeaderField*> selectHeaders(
+    const std::vector<HeaderField>& fields,
+    const std::vector<std::string>& names);
+
+/**
+ * Streaming body canonicalizer + digest (RFC 6376 3.4.3, 3.4.4)
+ *
+ * Fed the body in arbitrary chunks as it arrives; empty lines are held
+ * back as a count until content follows, so trailing blank lines cost
+ * no memory. l= stops hashing after that many canonical bytes while the
+ * full canonical length is still counted.
+ */
+class BodyHasher {
+public:
+    BodyHasher(Mode mode, const EVP_MD* md, int64_t limit = -1);
+    ~BodyHasher();
+
+    BodyHasher(const BodyHasher&) = delete;
+    BodyHasher& operator=(const BodyHasher&) = delete;
+
+    void update(const char* data, size_t len);
+    void update(const std::string& s) { update(s.data(), s.size()); }
+
+    // Raw digest; further updates are ignored
+    const std::string& finish();
+
+    // Canonical body length, valid after finish()
+    uint64_t bodyLength() const { return emitted_; }
+
+    Mode mode() const { return mode_; }
+    const EVP_MD* md() const { return md_; }
+    int64_t limit() const { return limit_; }
+
+private:
+    void put(const char* p, size_t n);
+    void beginContent();
+    void endLine();
+    void flush();
+
+    Mode mode_;
+    const EVP_MD* md_;
+    int64_t limit_;
+    EVP_MD_CTX* ctx_;
+
+    uint64_t emitted_ = 0;      // canonical bytes produced (before l=)
+    uint64_t blankLines_ = 0;   // empty lines not yet known to be inner
+    bool lineContent_ = false;
+    bool wsp_ = false;          // relaxed: WSP run pending in this line
+    bool cr_ = false;           // CR seen, LF may follow in the next chunk
+    bool done_ = false;
+    std::string digest_;
+
+    char buf_[4096];
+    size_t bufLen_ = 0;
+};
+
+// Every body hash a message needs, computed in one pass; signatures with
+// the same canonicalization, hash and l= share a hasher
+class BodyHashSet {
+public:
+    size_t add(Mode mode, const EVP_MD* md, int64_t limit);
+    void update(const char* data, size_t len);
+    void update(const std::string& s) { update(s.data(), s.size()); }
+
+    BodyHasher& at(size_t index) { return *hashers_[index]; }
+    bool empty() const { return hashers_.empty(); }
 
-std::vector<std::string> canonicalizeHeadersRelaxed(
-    const std::string& headers,
-    const std::vector<std::string>& headerNames);
+private:
+    std::vector<std::unique_ptr<BodyHasher>> hashers_;
+};
 
 }
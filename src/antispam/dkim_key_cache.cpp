@@ -0,0 +1,211 @@
+#include "antispam/dkim_key_cache.h"
+#include "core/base64.h"
+#include "dns/dns_resolver.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include <openssl/x509.h>
+
+using SteadyClock = std::chrono::steady_clock;
+
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+static std::string trim(const std::string& s) {
+    auto b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string::npos)
+        return "";
+    auto e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+static std::string stripWsp(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s)
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n') out.push_back(c);
+    return out;
+}
+
+static std::vector<std::string> splitColon(const std::string& s) {
+    std::vector<std::string> out;
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t end = s.find(':', pos);
+        if (end == std::string::npos) end = s.size();
+        std::string item = toLower(trim(s.substr(pos, end - pos)));
+        if (!item.empty())
+            out.push_back(item);
+        pos = end + 1;
+    }
+    return out;
+}
+
+/* ===================== Key records ===================== */
+
+bool DkimPublicKey::allowsHash(const std::string& hash) const {
+    return hashes.empty() || std::find(hashes.begin(), hashes.end(), hash) != hashes.end();
+}
+
+DkimPublicKey DkimPublicKey::parse(const std::string& record) {
+    DkimPublicKey key;
+    key.status = DkimKeyStatus::Invalid;
+
+    bool first = true;
+    bool haveP = false;
+    std::string p;
+    size_t pos = 0;
+    while (pos < record.size()) {
+        size_t end = record.find(';', pos);
+        if (end == std::string::npos) end = record.size();
+        std::string spec = record.substr(pos, end - pos);
+        pos = end + 1;
+
+        auto eq = spec.find('=');
+        if (eq == std::string::npos) {
+            if (trim(spec).empty()) continue; // trailing ';'
+            return key;
+        }
+        std::string tag = trim(spec.substr(0, eq));
+        std::string value = trim(spec.substr(eq + 1));
+
+        if (tag == "v") {
+            if (!first || value != "DKIM1") return key;
+        } else if (tag == "k") {
+            key.keyType = toLower(value);
+        } else if (tag == "h") {
+            key.hashes = splitColon(value);
+        } else if (tag == "s") {
+            auto services = splitColon(value);
+            if (std::find(services.begin(), services.end(), "*") == services.end() &&
+                std::find(services.begin(), services.end(), "email") == services.end())
+                return key;
+        } else if (tag == "t") {
+            for (const auto& flag : splitColon(value)) {
+                if (flag == "y") key.testing = true;
+                else if (flag == "s") key.strictDomain = true;
+            }
+        } else if (tag == "p") {
+            haveP = true;
+            p = stripWsp(value);
+        }
+        first = false;
+    }
+
+    if (!haveP)
+        return key;
+    if (p.empty()) {
+        key.status = DkimKeyStatus::Revoked;
+        return key;
+    }
+
+    // p= is base64 DER (SubjectPublicKeyInfo) for rsa, the raw 32-byte
+    // point for ed25519 (RFC 8463) - never PEM
+    std::string der = base64Decode(p);
+    EVP_PKEY* pkey = nullptr;
+    if (key.keyType == "rsa") {
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(der.data());
+        pkey = d2i_PUBKEY(nullptr, &in, static_cast<long>(der.size()));
+        if (pkey && EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA) {
+            EVP_PKEY_free(pkey);
+            pkey = nullptr;
+        }
+    } else if (key.keyType == "ed25519") {
+        if (der.size() == 32)
+            pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr,
+                reinterpret_cast<const unsigned char*>(der.data()), der.size());
+    }
+    if (!pkey)
+        return key; // unknown k= or undecodable key
+
+    key.pkey.reset(pkey, EvpPkeyDeleter());
+    key.status = DkimKeyStatus::Ok;
+    return key;
+}
+
+/* ===================== Cache ===================== */
+
+DkimKeyCache& DkimKeyCache::instance() {
+    static DkimKeyCache cache;
+    return cache;
+}
+
+std::shared_ptr<DkimPublicKey> DkimKeyCache::fetch(const std::string& name) {
+    auto key = std::make_shared<DkimPublicKey>();
+    auto pkt = DnsResolver::instance().queryPacket(name, DnsRecordType::TXT);
+    if (!pkt || (pkt->rcode != DnsResponseCode::NoError &&
+                 pkt->rcode != DnsResponseCode::NxDomain)) {
+        key->status = DkimKeyStatus::TempFail;
+        return key;
+    }
+
+    uint32_t ttl = NEGATIVE_TTL_SEC;
+    key->status = DkimKeyStatus::NoKey;
+    for (const auto& a : pkt->answers) {
+        if (a.type != DnsRecordType::TXT)
+            continue;
+        // Several records are undefined behaviour (RFC 6376 3.6.2.2);
+        // the first usable one wins
+        DkimPublicKey parsed = DkimPublicKey::parse(a.data);
+        if (key->status == DkimKeyStatus::NoKey || parsed.ok()) {
+            *key = std::move(parsed);
+            ttl = a.ttl;
+        }
+        if (key->ok())
+            break;
+    }
+
+    ttl = std::clamp(ttl, MIN_TTL_SEC, MAX_TTL_SEC);
+    key->expires = SteadyClock::now() + std::chrono::seconds(ttl);
+    return key;
+}
+
+std::shared_ptr<const DkimPublicKey> DkimKeyCache::get(const std::string& selector,
+                                                       const std::string& domain) {
+    std::string name = toLower(selector) + "._domainkey." + toLower(domain);
+    if (!name.empty() && name.back() == '.')
+        name.pop_back();
+
+    auto now = SteadyClock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = keys_.find(name);
+        if (it != keys_.end() && it->second.key->expires > now) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            Metrics::instance().inc("dkim_key_cache_hits_total");
+            return it->second.key;
+        }
+    }
+    Metrics::instance().inc("dkim_key_cache_misses_total");
+
+    // Fetched without the lock; concurrent misses share the DNS query
+    std::shared_ptr<const DkimPublicKey> key = fetch(name);
+    if (key->status == DkimKeyStatus::TempFail)
+        return key;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(name);
+    if (it != keys_.end()) {
+        it->second.key = key;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+    } else {
+        if (keys_.size() >= MAX_KEYS) {
+            keys_.erase(lru_.back());
+            lru_.pop_back();
+        }
+        lru_.push_front(name);
+        keys_.emplace(name, Entry{ key, lru_.begin() });
+    }
+    Metrics::instance().set("dkim_key_cache_entries", static_cast<int>(keys_.size()));
+    return key;
+}
+
+size_t DkimKeyCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return keys_.size();
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <openssl/evp.h>
+
+/**
+ * DKIM Public Key Cache
+ *
+ * WHY REQUIRED:
+ * - Every signature names a key record (<s>._domainkey.<d>); fetching and
+ *   decoding it per message costs a TXT lookup and a DER/ASN.1 parse
+ * - A handful of selectors (large ESPs) sign most inbound mail, so parsed
+ *   EVP_PKEYs are kept per selector+domain until the record's DNS TTL
+ * - Key tags (v=, k=, h=, s=, t=, p=) are parsed once with the key; an
+ *   empty p= (revoked) or a broken record is remembered too, so bad
+ *   signers don't re-query on every message
+ * - Bounded by LRU; DNS failures are never cached
+ */
+enum class DkimKeyStatus {
+    Ok,
+    NoKey,      // NXDOMAIN or no DKIM record (PERMFAIL)
+    Revoked,    // p= present but empty
+    Invalid,    // syntax error, unknown k=, or undecodable key
+    TempFail    // DNS unreachable / SERVFAIL
+};
+
+struct EvpPkeyDeleter {
+    void operator()(EVP_PKEY* k) const noexcept {
+        if (k) EVP_PKEY_free(k);
+    }
+};
+
+struct DkimPublicKey {
+    DkimKeyStatus status = DkimKeyStatus::TempFail;
+    std::string keyType = "rsa";            // k=
+    std::vector<std::string> hashes;        // h=; empty = any
+    bool testing = false;                   // t=y
+    bool strictDomain = false;              // t=s: i= must equal d=
+    std::shared_ptr<EVP_PKEY> pkey;         // shared across verifiers
+    std::chrono::steady_clock::time_point expires;
+
+    bool ok() const { return status == DkimKeyStatus::Ok; }
+    bool allowsHash(const std::string& hash) const;
+
+    // Parse one key record (RFC 6376 3.6.1); never throws
+    static DkimPublicKey parse(const std::string& record);
+};
+
+class DkimKeyCache {
+public:
+    static DkimKeyCache& instance();
+
+    // Key for selector/domain; fetched on miss or expiry
+    std::shared_ptr<const DkimPublicKey> get(const std::string& selector,
+                                             const std::string& domain);
+
+    size_t size() const;
+
+private:
+    DkimKeyCache() = default;
+
+    std::shared_ptr<DkimPublicKey> fetch(const std::string& name);
+
+    static constexpr size_t MAX_KEYS = 4096;
+    static constexpr uint32_t MIN_TTL_SEC = 60;
+    static constexpr uint32_t MAX_TTL_SEC = 86400;
+    static constexpr uint32_t NEGATIVE_TTL_SEC = 300;
+
+    struct Entry {
+        std::shared_ptr<const DkimPublicKey> key;
+        std::list<std::string>::iterator lru;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> keys_;
+    std::list<std::string> lru_;            // most recently used first
+};
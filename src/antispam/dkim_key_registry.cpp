@@ -0,0 +1,170 @@
+#include "antispam/dkim_key_registry.h"
+#include "antispam/dkim_key_cache.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+DkimKeyRegistry& DkimKeyRegistry::instance() {
+    static DkimKeyRegistry registry;
+    return registry;
+}
+
+DkimKeyRegistry::~DkimKeyRegistry() {
+    stop();
+}
+
+void DkimKeyRegistry::configure(const std::vector<DkimSignConfig>& keys, int reloadIntervalSec) {
+    {
+        std::lock_guard<std::mutex> lock(configMutex_);
+        configs_ = keys;
+        failed_.clear();
+    }
+    reloader_.setInterval(reloadIntervalSec);
+    reload();
+
+    Logger::instance().log(LogLevel::Info,
+        "DKIM: " + std::to_string(keys.size()) + " signing key(s) configured");
+}
+
+void DkimKeyRegistry::start() {
+    reloader_.start();
+}
+
+void DkimKeyRegistry::stop() {
+    reloader_.stop();
+}
+
+std::shared_ptr<const DkimSigningKey> DkimKeyRegistry::load(const DkimSignConfig& cfg,
+                                                            long long mtime,
+                                                            std::string& error) {
+    std::ifstream file(cfg.privateKeyPath, std::ios::binary);
+    if (!file.is_open()) {
+        error = "cannot open " + cfg.privateKeyPath;
+        return nullptr;
+    }
+    std::string pem((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    BIO* bio = BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size()));
+    EVP_PKEY* raw = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+    if (!raw) {
+        error = cfg.privateKeyPath + " is not a PEM private key";
+        return nullptr;
+    }
+
+    auto key = std::make_shared<DkimSigningKey>();
+    key->cfg = cfg;
+    key->cfg.domain = toLower(cfg.domain);
+    key->pkey.reset(raw, EvpPkeyDeleter());
+    key->mtime = mtime;
+    switch (EVP_PKEY_base_id(raw)) {
+    case EVP_PKEY_RSA:     key->algorithm = "rsa-sha256"; break;
+    case EVP_PKEY_ED25519: key->algorithm = "ed25519-sha256"; break;
+    default:
+        error = cfg.privateKeyPath + ": only RSA and Ed25519 keys can sign";
+        return nullptr;
+    }
+    return key;
+}
+
+void DkimKeyRegistry::reload() {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    auto current = snapshot_.load();
+    auto next = std::make_shared<Snapshot>();
+
+    bool changed = !current;
+    size_t loaded = 0;
+    for (const auto& cfg : configs_) {
+        std::string domain = toLower(cfg.domain);
+
+        std::shared_ptr<const DkimSigningKey> old;
+        if (current) {
+            auto it = current->find(domain);
+            if (it != current->end())
+                for (const auto& k : it->second)
+                    if (k->cfg.selector == cfg.selector &&
+                        k->cfg.privateKeyPath == cfg.privateKeyPath) old = k;
+        }
+
+        std::error_code ec;
+        auto mtime = fs::last_write_time(cfg.privateKeyPath, ec);
+        long long stamp = static_cast<long long>(mtime.time_since_epoch().count());
+
+        std::string name = cfg.selector + "._domainkey." + domain;
+        if (ec) stamp = -1;
+
+        std::shared_ptr<const DkimSigningKey> key;
+        auto failed = failed_.find(name);
+        if (old && old->mtime == stamp && old->cfg.headersToSign == cfg.headersToSign) {
+            key = old;
+        } else if (failed != failed_.end() && failed->second == stamp) {
+            key = old;                                  // same broken file, already reported
+        } else {
+            std::string error;
+            key = ec ? nullptr : load(cfg, stamp, error);
+            if (!key) {
+                failed_[name] = stamp;
+                Metrics::instance().inc("dkim_key_reload_errors_total");
+                Logger::instance().log(LogLevel::Error,
+                    "DKIM: key " + name + ": " +
+                    (ec ? cfg.privateKeyPath + " unreadable: " + ec.message() : error) +
+                    (old ? " (keeping the previous key)" : ""));
+                key = old;
+            } else {
+                failed_.erase(name);
+                if (old)
+                    Logger::instance().log(LogLevel::Info, "DKIM: reloaded key " + name);
+            }
+            changed = changed || key != old;
+        }
+        if (!key)
+            continue;
+
+        auto& list = (*next)[domain];
+        list.push_back(key);
+        // RSA first: verifiers without Ed25519 support see it first
+        std::stable_sort(list.begin(), list.end(), [](const auto& a, const auto& b) {
+            return a->algorithm == "rsa-sha256" && b->algorithm != "rsa-sha256";
+        });
+        ++loaded;
+    }
+
+    if (current) {
+        size_t before = 0;
+        for (const auto& [d, keys] : *current) before += keys.size();
+        changed = changed || before != loaded;
+    }
+    if (changed)
+        snapshot_.store(std::shared_ptr<const Snapshot>(std::move(next)));
+    Metrics::instance().set("dkim_signing_keys", static_cast<int>(loaded));
+}
+
+std::vector<std::shared_ptr<const DkimSigningKey>>
+DkimKeyRegistry::keysFor(const std::string& domain) const {
+    auto snap = snapshot_.load();
+    if (!snap)
+        return {};
+    auto it = snap->find(toLower(domain));
+    return it == snap->end() ? std::vector<std::shared_ptr<const DkimSigningKey>>{} : it->second;
+}
+
+bool DkimKeyRegistry::empty() const {
+    auto snap = snapshot_.load();
+    return !snap || snap->empty();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "antispam/dkim_signer.h"
+#include "core/periodic_reloader.h"
+
+/**
+ * DKIM Signing Key Registry
+ *
+ * WHY REQUIRED:
+ * - Reading and parsing a PEM private key per message costs more than
+ *   the signature itself; keys are loaded once per domain + selector
+ * - One domain may hold an RSA and an Ed25519 key; both are returned so
+ *   mail is dual-signed (RFC 8463) and RSA-only verifiers still pass
+ * - Key files are re-checked every reload_interval; a changed file is
+ *   re-parsed and swapped in atomically, a broken one keeps the old key
+ * - Parsed EVP_PKEYs are immutable and shared across signing threads
+ */
+struct DkimSigningKey {
+    DkimSignConfig cfg;
+    std::string algorithm;              // rsa-sha256 | ed25519-sha256
+    std::shared_ptr<EVP_PKEY> pkey;
+    long long mtime = 0;                // key file write time when loaded
+};
+
+class DkimKeyRegistry {
+public:
+    static DkimKeyRegistry& instance();
+
+    void configure(const std::vector<DkimSignConfig>& keys, int reloadIntervalSec);
+    void start();
+    void stop();
+
+    // Re-read key files whose write time changed
+    void reload();
+
+    // Every key for the domain, RSA first; empty if none
+    std::vector<std::shared_ptr<const DkimSigningKey>> keysFor(const std::string& domain) const;
+    bool empty() const;
+
+private:
+    DkimKeyRegistry() = default;
+    ~DkimKeyRegistry();
+
+    using Snapshot = std::map<std::string, std::vector<std::shared_ptr<const DkimSigningKey>>>;
+
+    static std::shared_ptr<const DkimSigningKey> load(const DkimSignConfig& cfg,
+                                                      long long mtime,
+                                                      std::string& error);
+
+    SharedSnapshot<Snapshot> snapshot_;
+
+    std::mutex configMutex_;                        // configs_ and failed_
+    std::vector<DkimSignConfig> configs_;
+    std::map<std::string, long long> failed_;      // key name -> write time that failed
+
+    PeriodicReloader reloader_{ 60, [this] { reload(); } };   // last: stops first
+};
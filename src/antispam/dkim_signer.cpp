@@ -1,6 +1,7 @@
 // src/antispam/dkim_signer.cpp
 #include "dkim_signer.h"
 #include "dkim_canon.h"
+#include "dkim_key_registry.h"
 #include "core/logger.h"
 
 #include <openssl/evp.h>
@@ -8,12 +9,26 @@
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
 
-#include <fstream>
+#include <algorithm>
+#include <ctime>
 #include <sstream>
 #include <vector>
 #include <string>
 
-DkimSigner::DkimSigner(const DkimSignConfig& cfg) : cfg_(cfg) {}
+DkimSigner::DkimSigner(std::vector<std::shared_ptr<const DkimSigningKey>> keys)
+    : keys_(std::move(keys)) {}
+
+DkimSigner DkimSigner::forDomain(const std::string& domain) {
+    return DkimSigner(DkimKeyRegistry::instance().keysFor(domain));
+}
+
+
+DkimSigner DkimSigner::forMessage(const std::string& raw) {
+    std::string domain = DkimCanon::fromDomain(DkimCanon::parseHeaders(raw));
+    if (domain.empty())
+        return DkimSigner({});
+    return forDomain(domain);
+}
 
 
 // -------------------- Utilities --------------------
@@ -35,18 +50,35 @@ static std::string base64Encode(const unsigned char* data, size_t len) {
     return out;
 }
 
-static EVP_PKEY* loadPrivateKey(const std::string& path) {
-    std::ifstream file(path);
-    if (!file.is_open())
-        return nullptr;
+// RSA: PKCS#1 v1.5 over SHA-256 of the data. Ed25519 (RFC 8463 3):
+// PureEdDSA over the SHA-256 of the data
+static bool signData(const DkimSigningKey& key, const std::string& data,
+                     std::vector<unsigned char>& sig) {
+    bool ed25519 = key.algorithm == "ed25519-sha256";
 
-    std::string pem((std::istreambuf_iterator<char>(file)),
-                     std::istreambuf_iterator<char>());
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen = 0;
+    if (ed25519 &&
+        EVP_Digest(data.data(), data.size(), hash, &hashLen, EVP_sha256(), nullptr) != 1)
+        return false;
 
-    BIO* bio = BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size()));
-    EVP_PKEY* key = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
-    BIO_free(bio);
-    return key;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    size_t sigLen = 0;
+    bool ok = EVP_DigestSignInit(ctx, nullptr, ed25519 ? nullptr : EVP_sha256(),
+                                 nullptr, key.pkey.get()) == 1;
+    if (ok && ed25519) {
+        sig.resize(64);
+        sigLen = sig.size();
+        ok = EVP_DigestSign(ctx, sig.data(), &sigLen, hash, hashLen) == 1;
+    } else if (ok) {
+        ok = EVP_DigestSignUpdate(ctx, data.data(), data.size()) == 1 &&
+             EVP_DigestSignFinal(ctx, nullptr, &sigLen) == 1;
+        sig.resize(sigLen);
+        ok = ok && EVP_DigestSignFinal(ctx, sig.data(), &sigLen) == 1;
+    }
+    EVP_MD_CTX_free(ctx);
+    sig.resize(ok ? sigLen : 0);
+    return ok;
 }
 
 static std::vector<std::string> splitHeaderNames(const std::string& h) {
@@ -65,95 +97,91 @@ static std::vector<std::string> splitHeaderNames(const std::string& h) {
 
 std::string DkimSigner::sign(const std::string& headers,
                              const std::string& body) {
+    return sign(headers, body.data(), body.size());
+}
 
-    /* STEP 1 — Canonicalize body (relaxed) */
-    std::string canonBody =
-        DkimCanon::canonicalizeBodyRelaxed(body);
-
-    /* STEP 2 — Body hash (bh=) */
-    unsigned char bodyHash[EVP_MAX_MD_SIZE];
-    unsigned int bodyHashLen = 0;
-
-    EVP_MD_CTX* bodyCtx = EVP_MD_CTX_new();
-    EVP_DigestInit_ex(bodyCtx, EVP_sha256(), nullptr);
-    EVP_DigestUpdate(bodyCtx,
-                     canonBody.data(),
-                     canonBody.size());
-    EVP_DigestFinal_ex(bodyCtx,
-                       bodyHash,
-                       &bodyHashLen);
-    EVP_MD_CTX_free(bodyCtx);
-
-    std::string bh = base64Encode(bodyHash, bodyHashLen);
-
-    /* STEP 3 — DKIM-Signature header (b= EMPTY) */
-    std::ostringstream dkim;
-    dkim << "DKIM-Signature: v=1; a=rsa-sha256; c=relaxed/relaxed; "
-         << "d=" << cfg_.domain << "; "
-         << "s=" << cfg_.selector << "; "
-         << "h=" << cfg_.headersToSign << "; "
-         << "bh=" << bh << "; "
-         << "b=";
-
-    std::string dkimHeaderBare = dkim.str();
-
-    /* STEP 4 — Header canonicalization (CORRECT API USAGE) */
-    std::string headersForSigning =
-        headers + "\r\n" + dkimHeaderBare;
-
-    std::vector<std::string> headerNames =
-        splitHeaderNames(cfg_.headersToSign);
-
-    auto canonHeaders =
-        DkimCanon::canonicalizeHeadersRelaxed(
-            headersForSigning,
-            headerNames
-        );
-
-    std::string signingData;
-    for (const auto& h : canonHeaders)
-        signingData += h;
-
-    /* STEP 5 — RSA-SHA256 signing */
-    EVP_PKEY* key = loadPrivateKey(cfg_.privateKeyPath);
-    if (!key) {
-        Logger::instance().log(
-            LogLevel::Error,
-            "DKIM: failed to load private key");
-        return "";
+std::string DkimSigner::signMessage(const std::string& raw) {
+    // Body starts after the first empty line (CRLF or bare LF)
+    size_t pos = 0, bodyStart = raw.size();
+    while (pos < raw.size()) {
+        size_t end = raw.find('\n', pos);
+        if (end == std::string::npos) break;
+        size_t len = end - pos - (end > pos && raw[end - 1] == '\r' ? 1 : 0);
+        if (len == 0) {
+            bodyStart = end + 1;
+            break;
+        }
+        pos = end + 1;
     }
+    return sign(raw.substr(0, std::min(bodyStart, raw.size())),
+                raw.data() + bodyStart, raw.size() - bodyStart);
+}
 
-    EVP_MD_CTX* signCtx = EVP_MD_CTX_new();
-    EVP_DigestSignInit(signCtx,
-                       nullptr,
-                       EVP_sha256(),
-                       nullptr,
-                       key);
-
-    EVP_DigestSignUpdate(signCtx,
-                         signingData.data(),
-                         signingData.size());
-
-    size_t sigLen = 0;
-    EVP_DigestSignFinal(signCtx, nullptr, &sigLen);
-
-    std::vector<unsigned char> sig(sigLen);
-    EVP_DigestSignFinal(signCtx,
-                        sig.data(),
-                        &sigLen);
-
-    EVP_MD_CTX_free(signCtx);
-    EVP_PKEY_free(key);
-
-    std::string signature = base64Encode(sig.data(), sigLen);
+std::string DkimSigner::sign(const std::string& headers,
+                             const char* body, size_t bodyLen) {
+    if (keys_.empty())
+        return "";
 
-    /* STEP 6 — Final DKIM header */
-    std::string finalHeader =
-        dkimHeaderBare + signature;
+    /* STEP 1+2 — Relaxed body canonicalization and hash (bh=), one pass
+       shared by every key */
+    DkimCanon::BodyHasher bodyHasher(DkimCanon::Mode::Relaxed, EVP_sha256());
+    bodyHasher.update(body, bodyLen);
+    const std::string& bodyHash = bodyHasher.finish();
+
+    std::string bh = base64Encode(
+        reinterpret_cast<const unsigned char*>(bodyHash.data()), bodyHash.size());
+
+    auto fields = DkimCanon::parseHeaders(headers);
+    long long now = static_cast<long long>(std::time(nullptr));
+
+    std::string out;
+    for (const auto& key : keys_) {
+        const DkimSignConfig& cfg = key->cfg;
+
+        /* STEP 3 — DKIM-Signature header (b= EMPTY) */
+        std::ostringstream dkim;
+        dkim << "DKIM-Signature: v=1; a=" << key->algorithm << "; c=relaxed/relaxed; "
+             << "d=" << cfg.domain << "; "
+             << "s=" << cfg.selector << "; "
+             << "t=" << now << "; "
+             << "h=" << cfg.headersToSign << "; "
+             << "bh=" << bh << "; "
+             << "b=";
+
+        std::string dkimHeaderBare = dkim.str();
+
+        /* STEP 4 — Header canonicalization (RFC 6376 3.7): signed fields in
+           h= order, then the DKIM-Signature itself with b= empty, no CRLF.
+           Signatures added here never sign each other */
+        std::string signingData;
+        for (const auto* f : DkimCanon::selectHeaders(fields, splitHeaderNames(cfg.headersToSign))) {
+            signingData += DkimCanon::canonicalizeHeader(*f, DkimCanon::Mode::Relaxed);
+            signingData += "\r\n";
+        }
+        signingData += DkimCanon::canonicalizeHeader(
+            DkimCanon::HeaderField{ "dkim-signature", dkimHeaderBare },
+            DkimCanon::Mode::Relaxed);
+
+        /* STEP 5 — RSA-SHA256 / Ed25519-SHA256 signing */
+        std::vector<unsigned char> sig;
+        if (!signData(*key, signingData, sig)) {
+            Logger::instance().log(
+                LogLevel::Error,
+                "DKIM: " + key->algorithm + " signing failed for " +
+                cfg.selector + "._domainkey." + cfg.domain);
+            continue;
+        }
+
+        /* STEP 6 — Final DKIM header */
+        if (!out.empty())
+            out += "\r\n";
+        out += dkimHeaderBare + base64Encode(sig.data(), sig.size());
+    }
 
-    Logger::instance().log(
-        LogLevel::Info,
-        "DKIM: signed message for domain " + cfg_.domain);
+    if (!out.empty())
+        Logger::instance().log(
+            LogLevel::Debug,
+            "DKIM: signed message for domain " + keys_.front()->cfg.domain);
 
-    return finalHeader;
+    return out;
 }
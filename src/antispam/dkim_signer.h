@@ -1,20 +1,47 @@
 // src/antispam/dkim_signer.h
 #pragma once
+#include <memory>
 #include <string>
+#include <vector>
 
 struct DkimSignConfig {
     std::string domain;          // d=
     std::string selector;        // s=
-    std::string privateKeyPath;  // unused in dummy version
+    std::string privateKeyPath;  // PEM, RSA or Ed25519; a= follows the key type
     std::string headersToSign;   // e.g. "from:to:subject:date:mime-version"
 };
 
+struct DkimSigningKey;
+
+/**
+ * DKIM Signing
+ *
+ * WHY REQUIRED:
+ * - Every key of the domain signs: RSA and Ed25519 side by side (RFC 8463
+ *   dual signing); the body is canonicalized and hashed once for all
+ * - Keys come parsed from DkimKeyRegistry; nothing is read from disk here
+ */
 class DkimSigner {
 public:
-    explicit DkimSigner(const DkimSignConfig& cfg);
+    explicit DkimSigner(std::vector<std::shared_ptr<const DkimSigningKey>> keys);
+
+    // Signer with every registered key for the domain
+    static DkimSigner forDomain(const std::string& domain);
+    // ... for the domain of the message's From: header
+    static DkimSigner forMessage(const std::string& raw);
+
+    bool empty() const { return keys_.empty(); }
+
+    // One DKIM-Signature field per key, CRLF-joined, no final CRLF;
+    // "" if there is no key or signing failed
     std::string sign(const std::string& headers,
                      const std::string& body);
+    // Whole message; the body is hashed in place
+    std::string signMessage(const std::string& raw);
 
 private:
-    DkimSignConfig cfg_;
+    std::string sign(const std::string& headers,
+                     const char* body, size_t bodyLen);
+
+    std::vector<std::shared_ptr<const DkimSigningKey>> keys_;
 };
@@ -1,129 +1,409 @@
 #include "antispam/dkim_verifier.h"
 #include "antispam/dkim_canon.h"
-#include "dns/dns_resolver.h"
+#include "antispam/dkim_key_cache.h"
+#include "core/base64.h"
 #include "core/logger.h"
+#include "core/worker_pool.h"
+#include "dns/dns_resolver.h"
+#include "monitoring/metrics.h"
 
 #include <openssl/evp.h>
-#include <openssl/pem.h>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
 
-#include <sstream>
-#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <future>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
+
+/* ===================== Parsed message ===================== */
+
+struct DkimVerifier::Signature {
+    size_t field = 0;                       // index into Message::fields
+    DkimResult error = DkimResult::None;    // set when the field is unusable
+
+    std::string domain;                     // d=
+    std::string selector;                   // s=
+    std::string keyType;                    // a= before the dash
+    const EVP_MD* md = nullptr;             // a= after the dash
+    std::string identity;                   // i=
+    DkimCanon::Mode headerCanon = DkimCanon::Mode::Simple;
+    DkimCanon::Mode bodyCanon = DkimCanon::Mode::Simple;
+    std::vector<std::string> signedHeaders; // h=
+    std::string bodyHash;                   // bh=, decoded
+    std::string signature;                  // b=, decoded
+    int64_t length = -1;                    // l=
+
+    std::shared_ptr<const DkimPublicKey> key;   // resolved before verifying
+    std::shared_future<DnsResolver::Result> keyLookup;  // started at beginBody
+    size_t hasher = 0;
+    std::string computedBodyHash;
+    uint64_t bodyLength = 0;
+};
+
+struct DkimVerifier::Message {
+    std::vector<DkimCanon::HeaderField> fields;
+    std::vector<Signature> signatures;
+    std::string fromDomain;
+};
 
 /* ===================== Helpers ===================== */
 
-static std::string getTag(const std::string& h, const std::string& tag) {
-    auto pos = h.find(tag + "=");
-    if (pos == std::string::npos)
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+static std::string trim(const std::string& s) {
+    auto b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string::npos)
         return "";
-    pos += tag.size() + 1;
-    auto end = h.find(';', pos);
-    return h.substr(pos, end - pos);
+    auto e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
 }
 
-static EVP_PKEY* loadPublicKey(const std::string& txt) {
-    auto p = txt.find("p=");
-    if (p == std::string::npos)
-        return nullptr;
+static std::string stripWsp(const std::string& s) {
+    std::string out;
+    for (char c : s)
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n') out.push_back(c);
+    return out;
+}
 
-    std::string key = txt.substr(p + 2);
+// Tag-list of a field (RFC 6376 3.2); false on a duplicate or malformed tag
+static bool parseTagList(const std::string& raw, std::map<std::string, std::string>& tags) {
+    size_t pos = raw.find(':') + 1;
+    while (pos <= raw.size()) {
+        size_t end = raw.find(';', pos);
+        if (end == std::string::npos) end = raw.size();
+        std::string spec = raw.substr(pos, end - pos);
+        pos = end + 1;
 
-    BIO* bio = BIO_new_mem_buf(key.data(), (int)key.size());
-    EVP_PKEY* pub = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
-    BIO_free(bio);
-    return pub;
+        auto eq = spec.find('=');
+        if (eq == std::string::npos) {
+            if (trim(spec).empty()) continue;
+            return false;
+        }
+        std::string name = trim(spec.substr(0, eq));
+        if (name.empty() || !tags.emplace(name, trim(spec.substr(eq + 1))).second)
+            return false;
+    }
+    return true;
 }
 
-/* ===================== DKIM VERIFY ===================== */
+// Signature field with the b= value removed, as it is hashed (RFC 6376 3.7)
+static std::string withoutSignatureValue(const std::string& raw) {
+    size_t pos = raw.find(':') + 1;
+    while (pos < raw.size()) {
+        size_t end = raw.find(';', pos);
+        if (end == std::string::npos) end = raw.size();
+        size_t eq = raw.find('=', pos);
+        if (eq < end && trim(raw.substr(pos, eq - pos)) == "b")
+            return raw.substr(0, eq + 1) + raw.substr(end);
+        pos = end + 1;
+    }
+    return raw;
+}
 
-DkimAuthResult DkimVerifier::verify(const std::string& headers,
-                                   const std::string& body)
-{
-    DkimAuthResult out;
-    out.result = DkimResult::None;
-    out.headerDomain.clear();
+// Domain of the single From address; empty when absent or ambiguous
+static bool isSubdomain(const std::string& sub, const std::string& parent) {
+    return sub == parent ||
+           (sub.size() > parent.size() &&
+            sub.compare(sub.size() - parent.size(), parent.size(), parent) == 0 &&
+            sub[sub.size() - parent.size() - 1] == '.');
+}
 
-    /* ---- Locate DKIM-Signature ---- */
-    auto pos = headers.find("DKIM-Signature:");
-    if (pos == std::string::npos)
-        return out;
+static DkimVerifier::Signature parseSignature(const DkimCanon::HeaderField& field) {
+    DkimVerifier::Signature sig;
+    sig.error = DkimResult::PermError;
 
-    auto end = headers.find("\r\n", pos);
-    std::string dkimHeader = headers.substr(pos, end - pos);
+    std::map<std::string, std::string> tags;
+    if (!parseTagList(field.raw, tags))
+        return sig;
+    for (const char* required : { "v", "a", "b", "bh", "d", "h", "s" })
+        if (!tags.count(required)) return sig;
+    if (tags["v"] != "1")
+        return sig;
 
-    std::string domain   = getTag(dkimHeader, "d");
-    std::string selector = getTag(dkimHeader, "s");
-    std::string bh       = getTag(dkimHeader, "bh");
-    std::string b        = getTag(dkimHeader, "b");
-    std::string h        = getTag(dkimHeader, "h");
+    sig.domain = toLower(tags["d"]);
+    sig.selector = tags["s"];
+    if (sig.domain.empty() || sig.selector.empty())
+        return sig;
 
-    if (domain.empty() || selector.empty()) {
-        out.result = DkimResult::PermError;
-        return out;
+    std::string a = toLower(tags["a"]);
+    auto dash = a.find('-');
+    std::string hash = dash == std::string::npos ? "" : a.substr(dash + 1);
+    sig.keyType = a.substr(0, dash);
+    if (hash == "sha256") sig.md = EVP_sha256();
+    else if (hash == "sha1" && sig.keyType == "rsa") sig.md = EVP_sha1();
+    if (!sig.md || (sig.keyType != "rsa" && sig.keyType != "ed25519"))
+        return sig;
+
+    if (!DkimCanon::parseCanonTag(tags.count("c") ? tags["c"] : "", sig.headerCanon, sig.bodyCanon))
+        return sig;
+
+    // h= must cover From (RFC 6376 5.4)
+    std::string h = stripWsp(tags["h"]);
+    size_t pos = 0;
+    while (pos <= h.size()) {
+        size_t end = h.find(':', pos);
+        if (end == std::string::npos) end = h.size();
+        if (end > pos)
+            sig.signedHeaders.push_back(toLower(h.substr(pos, end - pos)));
+        pos = end + 1;
     }
+    if (std::find(sig.signedHeaders.begin(), sig.signedHeaders.end(), "from") ==
+        sig.signedHeaders.end())
+        return sig;
 
-    out.headerDomain = domain;
+    // i= must be within d= (RFC 6376 6.1.1)
+    if (tags.count("i")) {
+        sig.identity = tags["i"];
+        auto at = sig.identity.rfind('@');
+        if (at == std::string::npos || !isSubdomain(toLower(sig.identity.substr(at + 1)), sig.domain))
+            return sig;
+    }
 
-    /* ---- DNS TXT lookup ---- */
-    std::string name = selector + "._domainkey." + domain;
-    auto txts = DnsResolver::instance().lookupTxt(name);
-    if (txts.empty()) {
-        out.result = DkimResult::TempError;
-        return out;
+    if (tags.count("l")) {
+        std::string l = stripWsp(tags["l"]);
+        if (l.empty() || l.size() > 18 || l.find_first_not_of("0123456789") != std::string::npos)
+            return sig;
+        sig.length = std::stoll(l);
     }
 
-    EVP_PKEY* pub = loadPublicKey(txts[0]);
-    if (!pub) {
-        out.result = DkimResult::PermError;
-        return out;
+    if (tags.count("x")) {
+        std::string x = stripWsp(tags["x"]);
+        if (x.empty() || x.size() > 18 || x.find_first_not_of("0123456789") != std::string::npos)
+            return sig;
+        if (std::stoll(x) < static_cast<long long>(std::time(nullptr)))
+            return sig;     // expired
     }
 
-    /* ---- Canonicalize body ---- */
-    std::string canonBody =
-        DkimCanon::canonicalizeBodyRelaxed(body);
+    sig.bodyHash = base64Decode(stripWsp(tags["bh"]));
+    sig.signature = base64Decode(stripWsp(tags["b"]));
+    if (sig.bodyHash.empty() || sig.signature.empty())
+        return sig;
+
+    sig.error = DkimResult::None;
+    return sig;
+}
 
-    unsigned char bhRaw[EVP_MAX_MD_SIZE];
-    unsigned int bhLen = 0;
+// Body hash and header signature of one DKIM-Signature against its
+// already-resolved key; CPU only, safe on a pool thread
+static DkimResult verifySignature(const DkimVerifier::Message& msg,
+                                  const DkimVerifier::Signature& sig) {
+    if (sig.error != DkimResult::None)
+        return sig.error;
 
-    EVP_MD_CTX* bhCtx = EVP_MD_CTX_new();
-    EVP_DigestInit_ex(bhCtx, EVP_sha256(), nullptr);
-    EVP_DigestUpdate(bhCtx, canonBody.data(), canonBody.size());
-    EVP_DigestFinal_ex(bhCtx, bhRaw, &bhLen);
-    EVP_MD_CTX_free(bhCtx);
+    const auto& key = sig.key;
+    if (!key || key->status == DkimKeyStatus::TempFail)
+        return DkimResult::TempError;
+    if (!key->ok() || key->keyType != sig.keyType ||
+        !key->allowsHash(EVP_MD_size(sig.md) == 20 ? "sha1" : "sha256"))
+        return DkimResult::PermError;
+    if (key->strictDomain && !sig.identity.empty() &&
+        toLower(sig.identity.substr(sig.identity.rfind('@') + 1)) != sig.domain)
+        return DkimResult::PermError;
 
-    /* ---- Canonicalize headers ---- */
-    std::vector<std::string> headerList;
-    std::istringstream iss(h);
-    std::string tok;
-    while (std::getline(iss, tok, ':'))
-        headerList.push_back(tok);
+    if (sig.length >= 0 && static_cast<uint64_t>(sig.length) > sig.bodyLength)
+        return DkimResult::PermError;     // l= beyond the body
+    if (sig.computedBodyHash != sig.bodyHash)
+        return DkimResult::Fail;
 
-    auto canonHeaders =
-        DkimCanon::canonicalizeHeadersRelaxed(headers, headerList);
+    // Signed fields in h= order, then this signature with b= emptied
+    std::string data;
+    for (const auto* f : DkimCanon::selectHeaders(msg.fields, sig.signedHeaders)) {
+        data += DkimCanon::canonicalizeHeader(*f, sig.headerCanon);
+        data += "\r\n";
+    }
+    const auto& own = msg.fields[sig.field];
+    data += DkimCanon::canonicalizeHeader(
+        DkimCanon::HeaderField{ own.name, withoutSignatureValue(own.raw) }, sig.headerCanon);
 
-    /* ---- Verify RSA signature ---- */
+    const auto* sigBytes = reinterpret_cast<const unsigned char*>(sig.signature.data());
     EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, pub);
+    int ok = 0;
+    if (sig.keyType == "ed25519") {
+        // RFC 8463: PureEdDSA over the SHA-256 of the header data
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLen = 0;
+        EVP_Digest(data.data(), data.size(), digest, &digestLen, EVP_sha256(), nullptr);
+        if (EVP_DigestVerifyInit(ctx, nullptr, nullptr, nullptr, key->pkey.get()) == 1)
+            ok = EVP_DigestVerify(ctx, sigBytes, sig.signature.size(), digest, digestLen);
+    } else if (EVP_DigestVerifyInit(ctx, nullptr, sig.md, nullptr, key->pkey.get()) == 1) {
+        EVP_DigestVerifyUpdate(ctx, data.data(), data.size());
+        ok = EVP_DigestVerifyFinal(ctx, sigBytes, sig.signature.size());
+    }
+    EVP_MD_CTX_free(ctx);
+
+    return ok == 1 ? DkimResult::Pass : DkimResult::Fail;
+}
 
-    for (const auto& ch : canonHeaders) {
-        EVP_DigestVerifyUpdate(ctx, ch.data(), ch.size());
-        EVP_DigestVerifyUpdate(ctx, "\r\n", 2);
+/* ===================== DKIM VERIFY ===================== */
+
+DkimAuthResult DkimVerifier::verify(const std::string& headers,
+                                   const std::string& body)
+{
+    beginBody(headers);
+    updateBody(body.data(), body.size());
+    return finish();
+}
+
+void DkimVerifier::beginBody(const std::string& headers) {
+    msg_ = std::make_shared<Message>();
+    msg_->fields = DkimCanon::parseHeaders(headers);
+    msg_->fromDomain = DkimCanon::fromDomain(msg_->fields);
+
+    for (size_t i = 0; i < msg_->fields.size(); ++i) {
+        if (msg_->fields[i].name != "dkim-signature")
+            continue;
+        if (msg_->signatures.size() == MAX_SIGNATURES) {
+            Logger::instance().log(LogLevel::Warn,
+                "DKIM: more than " + std::to_string(MAX_SIGNATURES) + " signatures, rest ignored");
+            break;
+        }
+
+        Signature sig = parseSignature(msg_->fields[i]);
+        sig.field = i;
+        if (sig.error == DkimResult::None) {
+            // Body parameters are known before the body: hash while it
+            // arrives, and fetch the key meanwhile
+            sig.hasher = bodyHashes_.add(sig.bodyCanon, sig.md, sig.length);
+            sig.keyLookup = DnsResolver::instance().queryAsync(
+                sig.selector + "._domainkey." + sig.domain, DnsRecordType::TXT);
+        }
+        msg_->signatures.push_back(std::move(sig));
     }
+}
 
-    int ok = EVP_DigestVerifyFinal(
-        ctx,
-        reinterpret_cast<const unsigned char*>(b.data()),
-        b.size()
-    );
+void DkimVerifier::updateBody(const char* data, size_t len) {
+    bodyHashes_.update(data, len);
+}
 
-    EVP_MD_CTX_free(ctx);
-    EVP_PKEY_free(pub);
+DkimAuthResult DkimVerifier::finish(int maxKeyWaitMs) {
+    DkimAuthResult out;
+    out.result = DkimResult::None;
+    out.headerDomain.clear();
+
+    if (!msg_ || msg_->signatures.empty())
+        return out;
+
+    for (auto& sig : msg_->signatures) {
+        if (sig.error != DkimResult::None)
+            continue;
+        auto& hasher = bodyHashes_.at(sig.hasher);
+        sig.computedBodyHash = hasher.finish();
+        sig.bodyLength = hasher.bodyLength();
+    }
+
+    // Keys on this thread, so pool workers never block on DNS; the TXT
+    // queries went out at beginBody and are normally answered by now.
+    // One still out at the deadline makes its signature a temperror
+    auto keyDeadline = std::chrono::steady_clock::now() +
+                       std::chrono::milliseconds(std::max(0, maxKeyWaitMs));
+    for (auto& sig : msg_->signatures) {
+        if (sig.error != DkimResult::None)
+            continue;
+        if (maxKeyWaitMs >= 0 && sig.keyLookup.valid() &&
+            sig.keyLookup.wait_until(keyDeadline) != std::future_status::ready) {
+            sig.error = DkimResult::TempError;
+            Metrics::instance().inc("dkim_key_wait_timeouts_total");
+            continue;
+        }
+        sig.key = DkimKeyCache::instance().get(sig.selector, sig.domain);
+    }
+
+    // Best first: a pass for the From domain itself, a pass for a parent
+    // or subdomain of it, any other pass, then the errors
+    const std::string& from = msg_->fromDomain;
+    auto rank = [&](const Signature& s, DkimResult r) {
+        switch (r) {
+        case DkimResult::Pass:
+            if (s.domain == from) return 0;
+            return (isSubdomain(from, s.domain) || isSubdomain(s.domain, from)) ? 1 : 2;
+        case DkimResult::TempError: return 3;
+        case DkimResult::Fail:      return 4;
+        case DkimResult::PermError: return 5;
+        default:                    return 6;
+        }
+    };
+
+    struct Outcome {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<DkimResult> results;
+        std::vector<bool> done;
+        size_t remaining = 0;
+    };
+    auto outcome = std::make_shared<Outcome>();
+    const size_t n = msg_->signatures.size();
+    outcome->results.assign(n, DkimResult::None);
+    outcome->done.assign(n, false);
+    outcome->remaining = n;
+
+    std::shared_ptr<const Message> msg = msg_;
+    auto run = [msg, outcome](size_t i) {
+        // Every job must report, or finish() waits forever
+        DkimResult r = DkimResult::PermError;
+        try {
+            r = verifySignature(*msg, msg->signatures[i]);
+        } catch (const std::exception& ex) {
+            Logger::instance().log(LogLevel::Error,
+                std::string("DKIM: verification failed: ") + ex.what());
+        } catch (...) {
+            Logger::instance().log(LogLevel::Error, "DKIM: verification failed");
+        }
+        std::lock_guard<std::mutex> lock(outcome->mutex);
+        outcome->results[i] = r;
+        outcome->done[i] = true;
+        --outcome->remaining;
+        outcome->cv.notify_all();
+    };
 
-    out.result = (ok == 1)
-        ? DkimResult::Pass
-        : DkimResult::Fail;
+    // One signature verifies inline; several go to the crypto pool ahead
+    // of queued signing work, and whichever finish first can settle the
+    // result. Those still running at the deadline count as temperror
+    if (n == 1) {
+        run(0);
+    } else {
+        for (size_t i = 0; i < n; ++i)
+            WorkerPool::crypto().submitUrgent([run, i] { run(i); });
+    }
+
+    size_t best = n;
+    DkimResult bestResult = DkimResult::TempError;
+    {
+        auto pick = [&](bool expired) {
+            best = n;
+            for (size_t i = 0; i < n; ++i) {
+                if (!outcome->done[i] && !expired) continue;
+                DkimResult r = outcome->done[i] ? outcome->results[i] : DkimResult::TempError;
+                if (best == n || rank(msg->signatures[i], r) < rank(msg->signatures[best], bestResult)) {
+                    best = i;
+                    bestResult = r;
+                }
+            }
+            return best != n && !from.empty() && rank(msg->signatures[best], bestResult) == 0;
+        };
+
+        std::unique_lock<std::mutex> lock(outcome->mutex);
+        auto ready = [&] { return pick(false) || outcome->remaining == 0; };
+        if (maxKeyWaitMs < 0) {
+            outcome->cv.wait(lock, ready);
+        } else if (!outcome->cv.wait_for(lock, std::chrono::milliseconds(maxKeyWaitMs), ready)) {
+            pick(true);
+            Metrics::instance().inc("dkim_verify_wait_timeouts_total");
+        }
+        out.result = bestResult;
+        out.headerDomain = msg->signatures[best].domain;
+    }
 
+    Metrics::instance().inc("dkim_signatures_total", static_cast<int>(n));
+    if (out.result == DkimResult::Pass)
+        Metrics::instance().inc("dkim_pass_total");
     return out;
 }
@@ -1,9 +1,44 @@
 #pragma once
+#include <memory>
 #include <string>
+#include <vector>
 #include "antispam/auth_results.h"
+#include "antispam/dkim_canon.h"
 
+/**
+ * DKIM Verification
+ *
+ * WHY REQUIRED:
+ * - Mailing lists and ESPs add their own signatures; a message commonly
+ *   carries 2-4 and DMARC only needs one that passes for the From domain
+ * - The header block is parsed once and shared by every signature; body
+ *   hashes are taken while DATA streams in, one per distinct c= / a= / l=
+ * - Key lookups start as soon as the header block is complete, so DNS
+ *   overlaps body reception; finish() waits a bounded time for stragglers
+ *   and reports temperror rather than holding the SMTP reply
+ * - RSA / Ed25519 verifications run on the crypto worker pool; finish()
+ *   returns as soon as a pass for the From domain itself is in, otherwise
+ *   the best of all results
+ */
 class DkimVerifier {
 public:
     DkimAuthResult verify(const std::string& headers,
                           const std::string& body);
+
+    // Streaming: the header block once it is complete, then body chunks
+    // as they arrive; finish() checks against the hashes taken on the way.
+    // maxKeyWaitMs bounds the wait for key lookups still in flight, and
+    // then the wait for verifications still running; -1 waits
+    void beginBody(const std::string& headers);
+    void updateBody(const char* data, size_t len);
+    DkimAuthResult finish(int maxKeyWaitMs = -1);
+
+    static constexpr size_t MAX_SIGNATURES = 8;
+
+    struct Signature;
+    struct Message;
+
+private:
+    std::shared_ptr<Message> msg_;
+    DkimCanon::BodyHashSet bodyHashes_;
 };
@@ -1,6 +1,8 @@
 // src/antispam/dmarc.cpp
 #include "antispam/dmarc_evaluator.h"
+#include "antispam/public_suffix_list.h"
 #include "dns/dns_resolver.h"
+#include "monitoring/metrics.h"
 
 #include <algorithm>
 #include <cctype>
@@ -43,20 +45,14 @@ static std::map<std::string, std::string> parseTags(const std::string& txt) {
     return tags;
 }
 
+// RFC 7489 3.1: same organizational domain
 static bool relaxedAlign(const std::string& a, const std::string& b) {
-    if (a == b) return true;
-    return a.size() > b.size() &&
-           a.compare(a.size() - b.size(), b.size(), b) == 0;
+    auto& psl = PublicSuffixList::instance();
+    return psl.organizationalDomain(a) == psl.organizationalDomain(b);
 }
 
 static bool strictAlign(const std::string& a, const std::string& b) {
-    return a == b;
-}
-
-static std::string parentDomain(const std::string& d) {
-    auto pos = d.find('.');
-    if (pos == std::string::npos) return "";
-    return d.substr(pos + 1);
+    return toLower(a) == toLower(b);
 }
 
 static bool samplePct(int pct) {
@@ -66,70 +62,192 @@ static bool samplePct(int pct) {
     return dist(rng) <= pct;
 }
 
-/* ===================== DMARC ===================== */
+/* ===================== Record cache ===================== */
 
-DmarcResult DmarcEvaluator::evaluate(const DmarcInput& in) {
-    DmarcResult result; // defaults to None/None
+using SteadyClock = std::chrono::steady_clock;
+
+// "v=DMARC1" as the first tag, with nothing but whitespace before ';'
+static bool isDmarcRecord(const std::string& txt) {
+    size_t at = txt.find_first_not_of(" \t");
+    if (at == std::string::npos || txt.compare(at, 8, "v=DMARC1") != 0)
+        return false;
+    size_t end = txt.find_first_not_of(" \t", at + 8);
+    return end == std::string::npos || txt[end] == ';';
+}
+
+static bool validPolicy(const std::string& p) {
+    return p == "none" || p == "quarantine" || p == "reject";
+}
+
+DmarcRecord DmarcRecord::parse(const std::vector<std::string>& txts) {
+    DmarcRecord rec;
+    std::vector<const std::string*> candidates;
+    for (const auto& txt : txts) {
+        if (isDmarcRecord(txt))
+            candidates.push_back(&txt);
+    }
+    if (candidates.empty()) {
+        rec.status = DmarcRecordStatus::NoRecord;
+        return rec;
+    }
+
+    rec.status = DmarcRecordStatus::Invalid;
+    if (candidates.size() > 1)
+        return rec;
+
+    auto tags = parseTags(*candidates[0]);
+    if (!tags.count("p") || !validPolicy(toLower(tags["p"])))
+        return rec;
+    if (tags.count("sp") && !validPolicy(toLower(tags["sp"])))
+        return rec;
+
+    rec.status = DmarcRecordStatus::Ok;
+    rec.p = toLower(tags["p"]);
+    rec.sp = tags.count("sp") ? toLower(tags["sp"]) : rec.p;
+    if (tags.count("adkim")) rec.adkim = toLower(tags["adkim"]);
+    if (tags.count("aspf"))  rec.aspf  = toLower(tags["aspf"]);
+    if (tags.count("pct")) {
+        try {
+            rec.pct = std::clamp(std::stoi(tags["pct"]), 0, 100);
+        } catch (...) {
+            rec.pct = 100;
+        }
+    }
+    return rec;
+}
+
+DmarcRecordCache& DmarcRecordCache::instance() {
+    static DmarcRecordCache cache;
+    return cache;
+}
+
+std::shared_ptr<DmarcRecord> DmarcRecordCache::fetch(const std::string& name) {
+    auto pkt = DnsResolver::instance().queryPacket(name, DnsRecordType::TXT);
+    if (!pkt || (pkt->rcode != DnsResponseCode::NoError &&
+                 pkt->rcode != DnsResponseCode::NxDomain)) {
+        auto rec = std::make_shared<DmarcRecord>();
+        rec->status = DmarcRecordStatus::TempFail;
+        return rec;
+    }
 
-    std::string domain = toLower(in.fromDomain);
     std::vector<std::string> txts;
+    uint32_t ttl = NEGATIVE_TTL_SEC;
+    for (const auto& a : pkt->answers) {
+        if (a.type != DnsRecordType::TXT)
+            continue;
+        txts.push_back(a.data);
+        ttl = txts.size() == 1 ? a.ttl : std::min(ttl, a.ttl);
+    }
 
-    /* ---- RFC 7489: organizational domain discovery ---- */
-    std::string cur = domain;
-    while (true) {
-        std::string q = "_dmarc." + cur;
-        txts = DnsResolver::instance().lookupTxt(q);
-        if (!txts.empty())
-            break;
-
-        std::string parent = parentDomain(cur);
-        if (parent.empty())
-            break;
-        cur = parent;
+    auto rec = std::make_shared<DmarcRecord>(DmarcRecord::parse(txts));
+    // A missing or broken policy may be fixed at any time; don't pin it to
+    // the TTL of whatever unrelated TXT records share the name
+    if (rec->status != DmarcRecordStatus::Ok)
+        ttl = std::min(ttl, NEGATIVE_TTL_SEC);
+    ttl = std::clamp(ttl, MIN_TTL_SEC, MAX_TTL_SEC);
+    rec->expires = SteadyClock::now() + std::chrono::seconds(ttl);
+    return rec;
+}
+
+std::shared_ptr<const DmarcRecord> DmarcRecordCache::get(const std::string& domain) {
+    std::string name = "_dmarc." + toLower(domain);
+    if (name.back() == '.')
+        name.pop_back();
+
+    auto now = SteadyClock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = records_.find(name);
+        if (it != records_.end() && it->second.record->expires > now) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            Metrics::instance().inc("dmarc_record_cache_hits_total");
+            return it->second.record;
+        }
     }
 
-    /* ---- No DMARC record → pass ---- */
-    if (txts.empty()) {
-        result.result = DmarcResultCode::Pass;
-        return result;
+    Metrics::instance().inc("dmarc_record_cache_misses_total");
+
+    // Fetched without the lock; concurrent misses share the DNS query
+    std::shared_ptr<const DmarcRecord> rec = fetch(name);
+    if (rec->status == DmarcRecordStatus::TempFail)
+        return rec;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = records_.find(name);
+    if (it != records_.end()) {
+        it->second.record = rec;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+    } else {
+        if (records_.size() >= MAX_RECORDS) {
+            records_.erase(lru_.back());
+            lru_.pop_back();
+        }
+        lru_.push_front(name);
+        records_.emplace(name, Entry{ rec, lru_.begin() });
     }
+    Metrics::instance().set("dmarc_record_cache_entries", static_cast<int>(records_.size()));
+    return rec;
+}
 
-    /* ---- Multiple DMARC records → permerror ---- */
-    if (txts.size() > 1) {
-        result.result = DmarcResultCode::Fail;
-        result.policy = DmarcPolicy::Reject;
-        return result;
+size_t DmarcRecordCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_.size();
+}
+
+/* ===================== DMARC ===================== */
+
+DmarcResult DmarcEvaluator::evaluate(const DmarcInput& in) {
+    DmarcResult result; // defaults to None/None
+
+    std::string domain = toLower(in.fromDomain);
+    if (!domain.empty() && domain.back() == '.')
+        domain.pop_back();
+
+    /* ---- RFC 7489 6.6.3: From domain, then organizational domain ---- */
+    // A broken record is no policy: it falls back like a missing one
+    auto& cache = DmarcRecordCache::instance();
+    auto rec = cache.get(domain);
+    bool isSubdomain = false;
+    auto noPolicy = [](const DmarcRecord& r) {
+        return r.status == DmarcRecordStatus::NoRecord ||
+               r.status == DmarcRecordStatus::Invalid;
+    };
+    if (rec->status == DmarcRecordStatus::Invalid)
+        Metrics::instance().inc("dmarc_record_invalid_total");
+    if (noPolicy(*rec)) {
+        std::string org = PublicSuffixList::instance().organizationalDomain(domain);
+        if (org != domain) {
+            rec = cache.get(org);
+            isSubdomain = true;
+            if (rec->status == DmarcRecordStatus::Invalid)
+                Metrics::instance().inc("dmarc_record_invalid_total");
+        }
     }
 
-    auto tags = parseTags(txts[0]);
+    /* ---- DNS failure → no verdict ---- */
+    if (rec->status == DmarcRecordStatus::TempFail)
+        return result;
 
-    if (tags["v"] != "DMARC1") {
-        result.result = DmarcResultCode::Fail;
-        result.policy = DmarcPolicy::Reject;
+    /* ---- No usable DMARC record → pass ---- */
+    if (noPolicy(*rec)) {
+        result.result = DmarcResultCode::Pass;
         return result;
     }
 
     /* ---- Policy tags ---- */
-    std::string p     = tags.count("p")     ? tags["p"]     : "none";
-    std::string sp    = tags.count("sp")    ? tags["sp"]    : p;
-    std::string adkim = tags.count("adkim") ? tags["adkim"] : "r";
-    std::string aspf  = tags.count("aspf")  ? tags["aspf"]  : "r";
-    int pct           = tags.count("pct")   ? std::stoi(tags["pct"]) : 100;
-
-    bool isSubdomain = (cur != domain);
-    std::string policyStr = isSubdomain ? sp : p;
+    const std::string& policyStr = isSubdomain ? rec->sp : rec->p;
 
     /* ---- Identifier alignment ---- */
     bool dkimAligned = false;
     if (in.dkimPass) {
-        dkimAligned = (adkim == "s")
+        dkimAligned = (rec->adkim == "s")
             ? strictAlign(in.dkimDomain, domain)
             : relaxedAlign(in.dkimDomain, domain);
     }
 
     bool spfAligned = false;
     if (in.spfPass) {
-        spfAligned = (aspf == "s")
+        spfAligned = (rec->aspf == "s")
             ? strictAlign(in.spfDomain, domain)
             : relaxedAlign(in.spfDomain, domain);
     }
@@ -143,7 +261,7 @@ DmarcResult DmarcEvaluator::evaluate(const DmarcInput& in) {
     }
 
     /* ---- Sampling ---- */
-    if (!samplePct(pct)) {
+    if (!samplePct(rec->pct)) {
         result.result = DmarcResultCode::Pass;
         return result;
     }
@@ -1,5 +1,11 @@
 #pragma once
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "antispam/auth_results.h"
 
 struct DmarcInput {
@@ -14,3 +20,67 @@ class DmarcEvaluator {
 public:
     DmarcResult evaluate(const DmarcInput& in);
 };
+
+/**
+ * DMARC Record Cache
+ *
+ * WHY REQUIRED:
+ * - Policy discovery (RFC 7489 6.6.3) asks _dmarc.<From domain>, then
+ *   _dmarc.<organizational domain> from the Public Suffix List: at most
+ *   two queries for a new domain instead of one per label
+ * - Parsed records, and the absence of one, are kept until the DNS TTL so
+ *   repeat senders cost neither a query nor a parse; no-policy results are
+ *   kept at most NEGATIVE_TTL_SEC
+ * - Only TXT strings starting v=DMARC1 are candidates, so unrelated TXT
+ *   records at _dmarc.<domain> (verification tokens etc.) are ignored
+ * - Bounded by LRU; DNS failures are never cached
+ */
+enum class DmarcRecordStatus {
+    Ok,
+    NoRecord,   // NXDOMAIN, or no TXT starting v=DMARC1 at _dmarc.<domain>
+    Invalid,    // several v=DMARC1 records, or no valid p=; no policy either
+    TempFail    // DNS unreachable / SERVFAIL
+};
+
+struct DmarcRecord {
+    DmarcRecordStatus status = DmarcRecordStatus::TempFail;
+    std::string p = "none";
+    std::string sp = "none";    // defaults to p
+    std::string adkim = "r";
+    std::string aspf = "r";
+    int pct = 100;
+    std::chrono::steady_clock::time_point expires;
+
+    // TXT strings found at _dmarc.<domain>, filtered to v=DMARC1 first
+    // (RFC 7489 6.6.3); never throws
+    static DmarcRecord parse(const std::vector<std::string>& txts);
+};
+
+class DmarcRecordCache {
+public:
+    static DmarcRecordCache& instance();
+
+    // Record published at _dmarc.<domain>; fetched on miss or expiry
+    std::shared_ptr<const DmarcRecord> get(const std::string& domain);
+
+    size_t size() const;
+
+private:
+    DmarcRecordCache() = default;
+
+    std::shared_ptr<DmarcRecord> fetch(const std::string& name);
+
+    static constexpr size_t MAX_RECORDS = 16384;
+    static constexpr uint32_t MIN_TTL_SEC = 60;
+    static constexpr uint32_t MAX_TTL_SEC = 86400;
+    static constexpr uint32_t NEGATIVE_TTL_SEC = 300;
+
+    struct Entry {
+        std::shared_ptr<const DmarcRecord> record;
+        std::list<std::string>::iterator lru;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> records_;
+    std::list<std::string> lru_;            // most recently used first
+};
@@ -0,0 +1,196 @@
+#include "antispam/public_suffix_list.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+static std::vector<std::string> splitLabels(const std::string& domain) {
+    std::vector<std::string> labels;
+    std::string label;
+    std::istringstream in(domain);
+    while (std::getline(in, label, '.'))
+        labels.push_back(label);
+    return labels;
+}
+
+// Last n labels, dot-joined
+static std::string joinTail(const std::vector<std::string>& labels, size_t n) {
+    std::string out;
+    for (size_t i = labels.size() - n; i < labels.size(); ++i) {
+        if (!out.empty()) out += '.';
+        out += labels[i];
+    }
+    return out;
+}
+
+static std::vector<std::string> domainLabels(const std::string& domain) {
+    std::string d = toLower(domain);
+    if (!d.empty() && d.back() == '.')
+        d.pop_back();
+    return splitLabels(d);
+}
+
+/* ===================== Trie ===================== */
+
+void PublicSuffixList::Trie::add(const std::string& rule) {
+    bool exception = !rule.empty() && rule[0] == '!';
+    auto labels = splitLabels(exception ? rule.substr(1) : rule);
+    if (labels.empty())
+        return;
+
+    uint32_t node = 0;
+    for (auto it = labels.rbegin(); it != labels.rend(); ++it) {
+        if (it->empty())
+            return;
+        auto found = nodes[node].children.find(*it);
+        if (found != nodes[node].children.end()) {
+            node = found->second;
+            continue;
+        }
+        uint32_t next = static_cast<uint32_t>(nodes.size());
+        nodes[node].children.emplace(*it, next);
+        nodes.emplace_back();
+        node = next;
+    }
+    nodes[node].flags |= exception ? EXCEPTION : RULE;
+    ++rules;
+}
+
+// Longest rule wins; an exception rule wins outright and makes its parent
+// the suffix. No match: the default "*" rule (one label)
+size_t PublicSuffixList::Trie::suffixLabels(const std::vector<std::string>& labels) const {
+    if (labels.empty())
+        return 0;
+
+    size_t best = 1;
+    uint32_t node = 0;
+    for (size_t depth = 0; depth < labels.size(); ++depth) {
+        const Node& n = nodes[node];
+        auto wildcard = n.children.find("*");
+        if (wildcard != n.children.end() && (nodes[wildcard->second].flags & RULE))
+            best = std::max(best, depth + 1);
+
+        auto child = n.children.find(labels[labels.size() - 1 - depth]);
+        if (child == n.children.end())
+            break;
+        node = child->second;
+        if (nodes[node].flags & EXCEPTION)
+            return depth;
+        if (nodes[node].flags & RULE)
+            best = std::max(best, depth + 1);
+    }
+    return best;
+}
+
+/* ===================== Loading ===================== */
+
+PublicSuffixList& PublicSuffixList::instance() {
+    static PublicSuffixList psl;
+    return psl;
+}
+
+PublicSuffixList::~PublicSuffixList() {
+    stop();
+}
+
+std::shared_ptr<const PublicSuffixList::Trie> PublicSuffixList::compile(const std::string& path,
+                                                                        std::string& error) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+
+    auto trie = std::make_shared<Trie>();
+    std::string line;
+    while (std::getline(in, line)) {
+        // One rule per line, up to the first whitespace; "//" comments
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line.compare(start, 2, "//") == 0)
+            continue;
+        size_t end = line.find_first_of(" \t\r", start);
+        trie->add(toLower(line.substr(start, end == std::string::npos ? std::string::npos
+                                                                      : end - start)));
+    }
+    if (trie->rules == 0) {
+        error = path + " has no rules";
+        return nullptr;
+    }
+    return trie;
+}
+
+void PublicSuffixList::configure(const std::string& path, int reloadIntervalSec) {
+    {
+        std::lock_guard<std::mutex> lock(configMutex_);
+        path_ = path;
+        loadedMtime_ = 0;
+    }
+    reloader_.setInterval(reloadIntervalSec);
+    reload();
+}
+
+void PublicSuffixList::reload() {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    if (path_.empty())
+        return;
+
+    std::error_code ec;
+    auto mtime = fs::last_write_time(path_, ec);
+    long long stamp = ec ? -1 : static_cast<long long>(mtime.time_since_epoch().count());
+    if (stamp == loadedMtime_)
+        return;
+    loadedMtime_ = stamp;   // a broken file is reported once, not every interval
+
+    std::string error;
+    auto trie = ec ? nullptr : compile(path_, error);
+    if (!trie) {
+        Metrics::instance().inc("psl_reload_errors_total");
+        Logger::instance().log(LogLevel::Error,
+            "PSL: " + (ec ? path_ + " unreadable: " + ec.message() : error) +
+            (trie_.load() ? " (keeping the previous list)"
+                                      : " (only the default rule applies)"));
+        return;
+    }
+
+    trie_.store(trie);
+    Metrics::instance().set("psl_rules", static_cast<int>(trie->rules));
+    Logger::instance().log(LogLevel::Info,
+        "PSL: " + std::to_string(trie->rules) + " rules loaded from " + path_);
+}
+
+void PublicSuffixList::start() {
+    reloader_.start();
+}
+
+void PublicSuffixList::stop() {
+    reloader_.stop();
+}
+
+/* ===================== Lookup ===================== */
+
+std::string PublicSuffixList::publicSuffix(const std::string& domain) const {
+    auto labels = domainLabels(domain);
+    auto trie = trie_.load();
+    size_t n = trie ? trie->suffixLabels(labels) : std::min<size_t>(1, labels.size());
+    return joinTail(labels, n);
+}
+
+std::string PublicSuffixList::organizationalDomain(const std::string& domain) const {
+    auto labels = domainLabels(domain);
+    auto trie = trie_.load();
+    size_t n = trie ? trie->suffixLabels(labels) : std::min<size_t>(1, labels.size());
+    return joinTail(labels, std::min(n + 1, labels.size()));
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "core/periodic_reloader.h"
+
+/**
+ * Public Suffix List
+ *
+ * WHY REQUIRED:
+ * - DMARC (RFC 7489 3.2) needs the organizational domain: one label below
+ *   the longest public suffix. Suffix compares get co.uk, github.io and
+ *   friends wrong, and walking up with a DNS query per label is slow
+ * - The list (publicsuffix.org format) is compiled into a label trie once;
+ *   a lookup is one walk over the domain's labels, right to left
+ * - The file is re-checked every reload_interval and swapped in atomically;
+ *   without a list only the default "*" rule applies (last label is the
+ *   suffix)
+ */
+class PublicSuffixList {
+public:
+    static PublicSuffixList& instance();
+
+    void configure(const std::string& path, int reloadIntervalSec);
+    void start();
+    void stop();
+
+    // Re-compile the list if the file changed
+    void reload();
+
+    // Labels of the longest matching rule ("co.uk" for a.b.co.uk)
+    std::string publicSuffix(const std::string& domain) const;
+    // Public suffix plus one label; the domain itself if it is a suffix
+    std::string organizationalDomain(const std::string& domain) const;
+
+private:
+    PublicSuffixList() = default;
+    ~PublicSuffixList();
+
+    struct Trie {
+        static constexpr uint8_t RULE = 0x01;
+        static constexpr uint8_t EXCEPTION = 0x02;
+
+        struct Node {
+            std::unordered_map<std::string, uint32_t> children;
+            uint8_t flags = 0;
+        };
+        std::vector<Node> nodes{ Node{} };  // [0] = root
+        size_t rules = 0;
+
+        void add(const std::string& rule);
+        // Number of trailing labels forming the public suffix
+        size_t suffixLabels(const std::vector<std::string>& labels) const;
+    };
+
+    static std::shared_ptr<const Trie> compile(const std::string& path, std::string& error);
+
+    SharedSnapshot<Trie> trie_;
+
+    std::mutex configMutex_;                        // path_ and loadedMtime_
+    std::string path_;
+    long long loadedMtime_ = 0;
+
+    PeriodicReloader reloader_{ 86400, [this] { reload(); } };   // last: stops first
+};
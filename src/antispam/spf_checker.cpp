@@ -7,6 +7,20 @@ static std::string strip(const std::string& s) {
     return s;
 }
 
+// SpfResultCode and SpfResult list their values in different orders
+static SpfResult toSpfResult(SpfResultCode r) {
+    switch (r) {
+        case SpfResultCode::Pass:      return SpfResult::Pass;
+        case SpfResultCode::Fail:      return SpfResult::Fail;
+        case SpfResultCode::SoftFail:  return SpfResult::SoftFail;
+        case SpfResultCode::Neutral:   return SpfResult::Neutral;
+        case SpfResultCode::None:      return SpfResult::None;
+        case SpfResultCode::TempError: return SpfResult::TempError;
+        case SpfResultCode::PermError: return SpfResult::PermError;
+    }
+    return SpfResult::None;
+}
+
 SpfCheckResult SpfChecker::check(const std::string& ip,
                                  const std::string& mailFrom,
                                  const std::string& heloDomain) {
@@ -22,6 +36,6 @@ SpfCheckResult SpfChecker::check(const std::string& ip,
     SpfEvaluator eval(ip, res.smtpMailFrom, heloDomain);
     auto r = eval.evaluate(domain);
 
-    res.result = static_cast<SpfResult>(r);
+    res.result = toSpfResult(r);
     return res;
 }
@@ -1,45 +1,245 @@
 #include "spf_evaluator.h"
-#include "spf_parser.h"
 #include "spf_macro.h"
 #include "dns/dns_resolver.h"
-#include <stdexcept>
-
-static SpfResultCode mapQ(SpfQualifier q) {
-    switch (q) {
-        case SpfQualifier::Plus: return SpfResultCode::Pass;
-        case SpfQualifier::Minus: return SpfResultCode::Fail;
-        case SpfQualifier::Tilde: return SpfResultCode::SoftFail;
-        case SpfQualifier::Question: return SpfResultCode::Neutral;
-    }
-    return SpfResultCode::Neutral;
-}
+#include <algorithm>
+#include <cstdio>
+#include <future>
 
 SpfEvaluator::SpfEvaluator(const std::string& ip,
                            const std::string& sender,
                            const std::string& helo)
-    : ip_(ip), sender_(sender), helo_(helo) {}
+    : ip_(ip), sender_(sender), helo_(helo) {
+    addrValid_ = SpfAddress::parse(ip_, addr_);
+}
 
 SpfResultCode SpfEvaluator::evaluate(const std::string& domain) {
-    if (++dnsCount_ > 10)
+    if (!addrValid_)
         return SpfResultCode::PermError;
 
-    auto txts = DnsResolver::instance().lookupTxt(domain);
-    std::vector<std::string> spfs;
-    for (auto& t : txts)
-        if (t.find("v=spf1") == 0) spfs.push_back(t);
+    auto policy = SpfPolicyCache::instance().get(domain);
+    return evaluatePolicy(*policy, dnsCount_, 0);
+}
+
+SpfResultCode SpfEvaluator::evaluatePolicy(const SpfPolicy& policy, int base, int depth) {
+    if (!policy.ok())
+        return policy.status;
+    if (depth > MAX_DEPTH)
+        return SpfResultCode::PermError;
+
+    // Lookups spent by dynamic includes, which compile-time counts can't see
+    int extra = 0;
+    auto overLimit = [&](int lookups) { return base + extra + lookups > MAX_DNS_LOOKUPS; };
+
+    prefetchDynamic(policy, base);
+    for (const auto& t : policy.terms) {
+        using Kind = SpfCompiledTerm::Kind;
 
-    if (spfs.empty()) return SpfResultCode::None;
-    if (spfs.size() > 1) return SpfResultCode::PermError;
+        if (t.kind == Kind::AddressSet) {
+            const SpfPrefixTree& tree = addr_.v6 ? t.v6 : t.v4;
+            uint32_t idx = tree.match(addr_.bytes, addr_.bits());
+            if (idx == SpfPrefixTree::NO_MATCH)
+                continue;
+            const auto& e = t.entries[idx];
+            return overLimit(e.lookups) ? SpfResultCode::PermError : e.result;
+        }
 
-    auto record = SpfParser::parse(spfs[0]);
+        if (overLimit(t.lookups))
+            return SpfResultCode::PermError;
 
-    for (auto& m : record.mechanisms) {
-        if (m.type == SpfMechanismType::ALL)
-            return mapQ(m.qualifier);
+        switch (t.kind) {
+        case Kind::All:
+        case Kind::Error:
+            return t.result;
+
+        case Kind::Include: {
+            auto r = evaluatePolicy(*t.include, base + extra + t.lookups, depth + 1);
+            if (r == SpfResultCode::Pass)
+                return t.result;
+            if (r == SpfResultCode::TempError || r == SpfResultCode::PermError)
+                return r;
+            break;
+        }
+
+        case Kind::Dynamic: {
+            auto r = evaluateDynamic(t.mechanism, policy.domain, base + extra + t.lookups,
+                                     depth, extra);
+            if (r)
+                return *r == SpfResultCode::Pass ? t.result : *r;
+            break;
+        }
+
+        default:
+            break;
+        }
     }
 
-    if (record.redirect)
-        return evaluate(*record.redirect);
+    if (policy.redirectError != SpfResultCode::Neutral)
+        return overLimit(policy.redirectLookups) ? SpfResultCode::PermError : policy.redirectError;
+
+    if (policy.redirect || !policy.dynamicRedirect.empty()) {
+        if (overLimit(policy.redirectLookups))
+            return SpfResultCode::PermError;
+        auto target = policy.redirect;
+        if (!target) {
+            target = SpfPolicyCache::instance().get(
+                SpfMacro::expand(policy.dynamicRedirect, ip_, sender_, helo_, policy.domain));
+        }
+        auto r = evaluatePolicy(*target, base + extra + policy.redirectLookups, depth + 1);
+        return r == SpfResultCode::None ? SpfResultCode::PermError : r;
+    }
 
     return SpfResultCode::Neutral;
 }
+
+void SpfEvaluator::prefetchDynamic(const SpfPolicy& policy, int base) {
+    // Answers land in the shared DNS cache; the ordered walk below then
+    // waits on lookups already in flight instead of issuing them one by one
+    DnsRecordType hostType = addr_.v6 ? DnsRecordType::AAAA : DnsRecordType::A;
+    for (const auto& t : policy.terms) {
+        if (t.kind != SpfCompiledTerm::Kind::Dynamic)
+            continue;
+        if (base + t.lookups > MAX_DNS_LOOKUPS)
+            break;
+        switch (t.mechanism.type) {
+        case SpfMechanismType::A:
+            DnsResolver::instance().queryAsync(dynamicTarget(t.mechanism, policy.domain), hostType);
+            break;
+        case SpfMechanismType::MX:
+            DnsResolver::instance().queryAsync(dynamicTarget(t.mechanism, policy.domain), DnsRecordType::MX);
+            break;
+        case SpfMechanismType::EXISTS:
+            DnsResolver::instance().queryAsync(dynamicTarget(t.mechanism, policy.domain), DnsRecordType::A);
+            break;
+        case SpfMechanismType::INCLUDE:
+            DnsResolver::instance().queryAsync(dynamicTarget(t.mechanism, policy.domain), DnsRecordType::TXT);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+std::string SpfEvaluator::dynamicTarget(const SpfMechanism& m, const std::string& domain) {
+    return m.domain.empty()
+        ? domain
+        : spfNormaliseDomain(SpfMacro::expand(m.domain, ip_, sender_, helo_, domain));
+}
+
+std::optional<bool> SpfEvaluator::hostsMatch(const std::vector<std::string>& names,
+                                             int cidr4, int cidr6) {
+    std::vector<std::shared_future<DnsResolver::Result>> pending;
+    DnsRecordType type = addr_.v6 ? DnsRecordType::AAAA : DnsRecordType::A;
+    for (const auto& n : names)
+        pending.push_back(DnsResolver::instance().queryAsync(n, type));
+
+    bool failed = false;
+    for (auto& f : pending) {
+        const auto& r = f.get();
+        if (!r || (r->rcode != DnsResponseCode::NoError && r->rcode != DnsResponseCode::NxDomain)) {
+            failed = true;
+            continue;
+        }
+        for (const auto& a : r->answers) {
+            SpfAddress net;
+            if (a.type == type && SpfAddress::parse(a.data, net) &&
+                addr_.inPrefix(net, addr_.v6 ? cidr6 : cidr4))
+                return true;
+        }
+    }
+    if (failed)
+        return std::nullopt;
+    return false;
+}
+
+// Returns Pass on a match (caller applies the qualifier), an error, or nullopt
+std::optional<SpfResultCode> SpfEvaluator::evaluateDynamic(const SpfMechanism& m,
+                                                           const std::string& domain,
+                                                           int base, int depth, int& extra) {
+    std::string target = dynamicTarget(m, domain);
+    int cidr4 = m.cidr >= 0 ? m.cidr : 32;
+    int cidr6 = m.cidr6 >= 0 ? m.cidr6 : 128;
+
+    std::optional<bool> matched;
+    switch (m.type) {
+    case SpfMechanismType::A:
+        matched = hostsMatch({ target }, cidr4, cidr6);
+        break;
+
+    case SpfMechanismType::MX: {
+        auto mx = DnsResolver::instance().queryPacket(target, DnsRecordType::MX);
+        if (!mx || (mx->rcode != DnsResponseCode::NoError && mx->rcode != DnsResponseCode::NxDomain))
+            return SpfResultCode::TempError;
+        std::vector<std::string> hosts;
+        for (const auto& a : mx->answers)
+            if (a.type == DnsRecordType::MX) hosts.push_back(a.data);
+        if (hosts.size() > 10)
+            return SpfResultCode::PermError;
+        matched = hostsMatch(hosts, cidr4, cidr6);
+        break;
+    }
+
+    case SpfMechanismType::EXISTS: {
+        auto r = DnsResolver::instance().queryPacket(target, DnsRecordType::A);
+        if (!r || (r->rcode != DnsResponseCode::NoError && r->rcode != DnsResponseCode::NxDomain))
+            return SpfResultCode::TempError;
+        matched = std::any_of(r->answers.begin(), r->answers.end(),
+            [](const DnsAnswer& a) { return a.type == DnsRecordType::A; });
+        break;
+    }
+
+    case SpfMechanismType::PTR: {
+        // Validated names: reverse lookup, then forward-confirm (RFC 7208 5.5)
+        std::string rev;
+        char buf[8];
+        if (addr_.v6) {
+            for (int i = 15; i >= 0; --i) {
+                std::snprintf(buf, sizeof(buf), "%x.%x.", addr_.bytes[i] & 0xF, addr_.bytes[i] >> 4);
+                rev += buf;
+            }
+            rev += "ip6.arpa";
+        } else {
+            for (int i = 3; i >= 0; --i) {
+                std::snprintf(buf, sizeof(buf), "%u.", addr_.bytes[i]);
+                rev += buf;
+            }
+            rev += "in-addr.arpa";
+        }
+        auto ptr = DnsResolver::instance().queryPacket(rev, DnsRecordType::PTR);
+        if (!ptr)
+            return std::nullopt; // PTR failures are a non-match, not an error
+        std::vector<std::string> names;
+        for (const auto& a : ptr->answers) {
+            std::string n = spfNormaliseDomain(a.data);
+            if (a.type == DnsRecordType::PTR && names.size() < 10 &&
+                (n == target || (n.size() > target.size() &&
+                 n.compare(n.size() - target.size() - 1, std::string::npos, "." + target) == 0)))
+                names.push_back(n);
+        }
+        auto r = hostsMatch(names, addr_.v6 ? 128 : 32, 128);
+        matched = r && *r;
+        break;
+    }
+
+    case SpfMechanismType::INCLUDE: {
+        auto policy = SpfPolicyCache::instance().get(target);
+        auto r = evaluatePolicy(*policy, base, depth + 1);
+        if (policy->ok())
+            extra += policy->totalLookups;
+        if (r == SpfResultCode::None)
+            return SpfResultCode::PermError;
+        if (r == SpfResultCode::TempError || r == SpfResultCode::PermError)
+            return r;
+        matched = r == SpfResultCode::Pass;
+        break;
+    }
+
+    default:
+        return std::nullopt;
+    }
+
+    if (!matched)
+        return SpfResultCode::TempError;
+    if (*matched)
+        return SpfResultCode::Pass;
+    return std::nullopt;
+}
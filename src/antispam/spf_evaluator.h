@@ -1,5 +1,7 @@
 #pragma once
 #include "spf_record.h"
+#include "spf_policy.h"
+#include <optional>
 #include <string>
 
 class SpfEvaluator {
@@ -11,8 +13,24 @@ public:
     SpfResultCode evaluate(const std::string& domain);
 
 private:
+    SpfResultCode evaluatePolicy(const SpfPolicy& policy, int base, int depth);
+    // Per-message terms; nullopt = no match
+    std::optional<SpfResultCode> evaluateDynamic(const SpfMechanism& m,
+                                                 const std::string& domain,
+                                                 int base, int depth, int& extra);
+    // Start the lookups of every reachable dynamic term before walking them
+    void prefetchDynamic(const SpfPolicy& policy, int base);
+    std::string dynamicTarget(const SpfMechanism& m, const std::string& domain);
+    // Does any A/AAAA of the names fall within the CIDR? nullopt on DNS failure
+    std::optional<bool> hostsMatch(const std::vector<std::string>& names, int cidr4, int cidr6);
+
     std::string ip_;
     std::string sender_;
     std::string helo_;
+    SpfAddress addr_;
+    bool addrValid_ = false;
     int dnsCount_ = 0;
+
+    static constexpr int MAX_DNS_LOOKUPS = 10;    // RFC 7208 4.6.4
+    static constexpr int MAX_DEPTH = 10;
 };
@@ -1,4 +1,6 @@
 #include "spf_parser.h"
+#include <algorithm>
+#include <cctype>
 #include <sstream>
 #include <stdexcept>
 
@@ -12,8 +14,23 @@ static SpfQualifier parseQualifier(char c) {
     }
 }
 
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+        [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+static int parseCidr(const std::string& s, int max) {
+    if (s.empty() || s.size() > 3 || s.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error("Invalid CIDR length");
+    int v = std::stoi(s);
+    if (v > max)
+        throw std::runtime_error("Invalid CIDR length");
+    return v;
+}
+
 SpfRecord SpfParser::parse(const std::string& txt) {
-    if (txt.find("v=spf1") != 0)
+    if (toLower(txt.substr(0, 6)) != "v=spf1" || (txt.size() > 6 && txt[6] != ' '))
         throw std::runtime_error("Invalid SPF");
 
     SpfRecord rec;
@@ -22,13 +39,18 @@ SpfRecord SpfParser::parse(const std::string& txt) {
     iss >> term; // skip v=spf1
 
     while (iss >> term) {
-        if (term.rfind("redirect=", 0) == 0) {
-            rec.redirect = term.substr(9);
-            continue;
-        }
-        if (term.rfind("exp=", 0) == 0) {
-            rec.exp = term.substr(4);
-            continue;
+        // Modifiers: name=value, where '=' precedes any ':' or '/'
+        auto eq = term.find('=');
+        if (eq != std::string::npos && eq < term.find_first_of(":/")) {
+            std::string name = toLower(term.substr(0, eq));
+            if (name == "redirect") {
+                if (rec.redirect) throw std::runtime_error("Duplicate redirect");
+                rec.redirect = term.substr(eq + 1);
+            } else if (name == "exp") {
+                if (rec.exp) throw std::runtime_error("Duplicate exp");
+                rec.exp = term.substr(eq + 1);
+            }
+            continue; // unknown modifiers are ignored (RFC 7208 6)
         }
 
         SpfMechanism mech;
@@ -39,13 +61,23 @@ SpfRecord SpfParser::parse(const std::string& txt) {
 
         auto colon = term.find(':');
         auto slash = term.find('/');
+        std::string name = toLower(term.substr(0, std::min(colon, slash)));
 
-        std::string name = term.substr(0, colon);
-        if (colon != std::string::npos)
-            mech.domain = term.substr(colon + 1);
-
-        if (slash != std::string::npos)
-            mech.cidr = std::stoi(term.substr(slash + 1));
+        // ip6 values contain ':' themselves, so the prefix starts at the last '/'
+        std::string value, cidr;
+        if (colon != std::string::npos && (slash == std::string::npos || colon < slash)) {
+            value = term.substr(colon + 1);
+        } else if (slash != std::string::npos) {
+            cidr = term.substr(slash);
+        }
+        if (!value.empty()) {
+            size_t at = (name == "ip6") ? value.rfind('/') : value.find('/');
+            if (at != std::string::npos) {
+                cidr = value.substr(at);
+                value.erase(at);
+            }
+        }
+        mech.domain = value;
 
         if (name == "ip4") mech.type = SpfMechanismType::IP4;
         else if (name == "ip6") mech.type = SpfMechanismType::IP6;
@@ -57,6 +89,29 @@ SpfRecord SpfParser::parse(const std::string& txt) {
         else if (name == "all") mech.type = SpfMechanismType::ALL;
         else throw std::runtime_error("Unknown mechanism");
 
+        bool needsValue = mech.type == SpfMechanismType::IP4 || mech.type == SpfMechanismType::IP6 ||
+                          mech.type == SpfMechanismType::INCLUDE || mech.type == SpfMechanismType::EXISTS;
+        if (needsValue && mech.domain.empty())
+            throw std::runtime_error("Mechanism needs a value: " + name);
+        if (mech.type == SpfMechanismType::ALL && (!value.empty() || !cidr.empty()))
+            throw std::runtime_error("all takes no arguments");
+
+        // "/n", "//n" or "/n//n"
+        if (!cidr.empty()) {
+            bool dual = mech.type == SpfMechanismType::A || mech.type == SpfMechanismType::MX;
+            auto dbl = cidr.find("//");
+            if (dbl != std::string::npos) {
+                if (!dual) throw std::runtime_error("Unexpected IPv6 CIDR");
+                mech.cidr6 = parseCidr(cidr.substr(dbl + 2), 128);
+                cidr.erase(dbl);
+            }
+            if (!cidr.empty()) {
+                if (!dual && mech.type != SpfMechanismType::IP4 && mech.type != SpfMechanismType::IP6)
+                    throw std::runtime_error("Unexpected CIDR");
+                mech.cidr = parseCidr(cidr.substr(1), mech.type == SpfMechanismType::IP6 ? 128 : 32);
+            }
+        }
+
         rec.mechanisms.push_back(mech);
     }
 
@@ -0,0 +1,543 @@
+#include "spf_policy.h"
+#include "spf_parser.h"
+#include "dns/dns_resolver.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <future>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+using SteadyClock = std::chrono::steady_clock;
+
+static const uint32_t SPF_MAX_TTL = 86400;
+static const uint32_t SPF_NEGATIVE_TTL = 300;   // no record, or a broken one
+static const size_t SPF_MAX_MX_NAMES = 10;      // RFC 7208 4.6.4
+static const int SPF_MAX_LOOKUPS = 10;
+
+SpfResultCode spfQualifierResult(SpfQualifier q) {
+    switch (q) {
+        case SpfQualifier::Plus: return SpfResultCode::Pass;
+        case SpfQualifier::Minus: return SpfResultCode::Fail;
+        case SpfQualifier::Tilde: return SpfResultCode::SoftFail;
+        case SpfQualifier::Question: return SpfResultCode::Neutral;
+    }
+    return SpfResultCode::Neutral;
+}
+
+std::string spfNormaliseDomain(const std::string& domain) {
+    std::string d;
+    d.reserve(domain.size());
+    for (char c : domain)
+        d.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    if (!d.empty() && d.back() == '.')
+        d.pop_back();
+    return d;
+}
+
+/* ===================== Addresses ===================== */
+
+bool SpfAddress::parse(const std::string& text, SpfAddress& out) {
+    out = SpfAddress{};
+    if (text.find(':') == std::string::npos)
+        return inet_pton(AF_INET, text.c_str(), out.bytes) == 1;
+    out.v6 = true;
+    return inet_pton(AF_INET6, text.c_str(), out.bytes) == 1;
+}
+
+bool SpfAddress::inPrefix(const SpfAddress& net, int prefixLen) const {
+    if (v6 != net.v6)
+        return false;
+    int full = prefixLen / 8;
+    if (std::memcmp(bytes, net.bytes, full) != 0)
+        return false;
+    int rest = prefixLen % 8;
+    if (rest == 0)
+        return true;
+    uint8_t mask = static_cast<uint8_t>(0xFF << (8 - rest));
+    return (bytes[full] & mask) == (net.bytes[full] & mask);
+}
+
+static int bitAt(const uint8_t* addr, int i) {
+    return (addr[i / 8] >> (7 - i % 8)) & 1;
+}
+
+void SpfPrefixTree::insert(const uint8_t* addr, int prefixLen, uint32_t index) {
+    int32_t n = 0;
+    for (int i = 0; i < prefixLen; ++i) {
+        int b = bitAt(addr, i);
+        if (nodes_[n].child[b] < 0) {
+            nodes_[n].child[b] = static_cast<int32_t>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        n = nodes_[n].child[b];
+    }
+    nodes_[n].index = std::min(nodes_[n].index, index);
+}
+
+uint32_t SpfPrefixTree::match(const uint8_t* addr, int bits) const {
+    // Every node on the path is a prefix covering addr
+    uint32_t best = nodes_[0].index;
+    int32_t n = 0;
+    for (int i = 0; i < bits; ++i) {
+        n = nodes_[n].child[bitAt(addr, i)];
+        if (n < 0)
+            break;
+        best = std::min(best, nodes_[n].index);
+    }
+    return best;
+}
+
+void SpfCompiledTerm::add(const SpfAddress& net, int length, SpfResultCode r, int lookupCount) {
+    uint32_t idx = static_cast<uint32_t>(entries.size());
+    entries.push_back(Entry{ r, lookupCount });
+    prefixes.push_back(Prefix{ net, length, idx });
+    (net.v6 ? v6 : v4).insert(net.bytes, length, idx);
+}
+
+bool SpfPolicy::ok() const {
+    return status == SpfResultCode::Neutral;
+}
+
+/* ===================== Compilation ===================== */
+
+static bool hasMacro(const std::string& s) {
+    return s.find('%') != std::string::npos;
+}
+
+// Fold a response's TTL into the policy lifetime
+static void lowerTtl(uint32_t& ttl, const DnsPacket& pkt, DnsRecordType type) {
+    uint32_t seen = UINT32_MAX;
+    for (const auto& a : pkt.answers)
+        if (a.type == type) seen = std::min(seen, a.ttl);
+    ttl = std::min(ttl, seen == UINT32_MAX ? SPF_NEGATIVE_TTL : seen);
+}
+
+static bool usable(const DnsResolver::Result& r) {
+    return r && (r->rcode == DnsResponseCode::NoError || r->rcode == DnsResponseCode::NxDomain);
+}
+
+// A and AAAA of every name, all in flight at once; false on a lookup failure
+static bool resolveHosts(const std::vector<std::string>& names,
+                         std::vector<SpfAddress>& out, uint32_t& ttl) {
+    std::vector<std::pair<DnsRecordType, std::shared_future<DnsResolver::Result>>> pending;
+    for (const auto& n : names) {
+        pending.emplace_back(DnsRecordType::A, DnsResolver::instance().queryAsync(n, DnsRecordType::A));
+        pending.emplace_back(DnsRecordType::AAAA, DnsResolver::instance().queryAsync(n, DnsRecordType::AAAA));
+    }
+
+    bool ok = true;
+    for (auto& [type, f] : pending) {
+        const DnsResolver::Result& r = f.get();
+        if (!usable(r)) {
+            ok = false;
+            continue;
+        }
+        lowerTtl(ttl, *r, type);
+        for (const auto& a : r->answers) {
+            SpfAddress addr;
+            if (a.type == type && SpfAddress::parse(a.data, addr))
+                out.push_back(addr);
+        }
+    }
+    return ok;
+}
+
+static SpfCompiledTerm errorTerm(SpfResultCode code, int lookups) {
+    SpfCompiledTerm t;
+    t.kind = SpfCompiledTerm::Kind::Error;
+    t.result = code;
+    t.lookups = lookups;
+    return t;
+}
+
+static uint32_t remainingTtl(const SpfPolicy& p) {
+    auto now = SteadyClock::now();
+    if (p.expires <= now)
+        return 0;
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        p.expires - now).count());
+}
+
+// Address-only policies whose entries all pass can merge into the includer
+static bool flattenable(const SpfPolicy& p) {
+    if (!p.ok() || p.redirect || !p.dynamicRedirect.empty() ||
+        p.redirectError != SpfResultCode::Neutral)
+        return false;
+    for (const auto& t : p.terms) {
+        if (t.kind == SpfCompiledTerm::Kind::All)
+            continue; // always last
+        if (t.kind != SpfCompiledTerm::Kind::AddressSet)
+            return false;
+        for (const auto& e : t.entries)
+            if (e.result != SpfResultCode::Pass) return false;
+    }
+    return true;
+}
+
+SpfPolicyCache& SpfPolicyCache::instance() {
+    static SpfPolicyCache cache;
+    return cache;
+}
+
+std::shared_ptr<const SpfPolicy> SpfPolicyCache::get(const std::string& domain) {
+    std::vector<std::string> chain;
+    return get(domain, chain, SPF_MAX_LOOKUPS);
+}
+
+std::shared_ptr<const SpfPolicy> SpfPolicyCache::get(const std::string& domain,
+                                                     std::vector<std::string>& chain,
+                                                     int budget) {
+    std::string key = spfNormaliseDomain(domain);
+    auto now = SteadyClock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = policies_.find(key);
+        if (it != policies_.end() && it->second->expires > now) {
+            Metrics::instance().inc("spf_policy_cache_hits_total");
+            return it->second;
+        }
+    }
+    Metrics::instance().inc("spf_policy_cache_misses_total");
+
+    // Compiled without the lock: includes re-enter get(), and the DNS
+    // layer already coalesces concurrent fetches of the same name
+    uint32_t ttl = 0;
+    chain.push_back(key);
+    std::shared_ptr<SpfPolicy> p = compile(key, chain, budget, ttl);
+    chain.pop_back();
+    p->expires = SteadyClock::now() + std::chrono::seconds(ttl);
+
+    // Cut short by the includer's remaining budget, or by a loop or depth
+    // limit of this chain: right for that includer only, since a direct
+    // evaluation would resolve further
+    if (p->totalLookups > budget && budget < SPF_MAX_LOOKUPS) {
+        Metrics::instance().inc("spf_policy_budget_truncated_total");
+        return p;
+    }
+    if (p->chainCut) {
+        Metrics::instance().inc("spf_policy_chain_cut_total");
+        return p;
+    }
+
+    if (ttl > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (policies_.size() >= MAX_POLICIES) {
+            for (auto it = policies_.begin(); it != policies_.end();) {
+                if (it->second->expires <= now) it = policies_.erase(it);
+                else ++it;
+            }
+            if (policies_.size() >= MAX_POLICIES)
+                policies_.erase(policies_.begin());
+        }
+        policies_[key] = p;
+        Metrics::instance().set("spf_policy_cache_entries", static_cast<int>(policies_.size()));
+    }
+    return p;
+}
+
+std::shared_ptr<SpfPolicy> SpfPolicyCache::compile(const std::string& domain,
+                                                   std::vector<std::string>& chain,
+                                                   int budget, uint32_t& ttl) {
+    auto p = std::make_shared<SpfPolicy>();
+    p->domain = domain;
+    ttl = SPF_MAX_TTL;
+
+    auto fail = [&](SpfResultCode code, uint32_t failTtl) {
+        p->status = code;
+        p->terms.clear();
+        ttl = std::min(ttl, failTtl);
+        return p;
+    };
+
+    // RFC 7208 4.3: malformed or single-label domains have no policy
+    if (domain.empty() || domain.size() > 253 || domain.find('.') == std::string::npos ||
+        domain.find("..") != std::string::npos)
+        return fail(SpfResultCode::None, SPF_NEGATIVE_TTL);
+
+    auto txt = DnsResolver::instance().queryPacket(domain, DnsRecordType::TXT);
+    if (!usable(txt))
+        return fail(SpfResultCode::TempError, 0);
+
+    std::vector<std::string> records;
+    for (const auto& a : txt->answers) {
+        if (a.type != DnsRecordType::TXT)
+            continue;
+        std::string head = a.data.substr(0, 7);
+        std::transform(head.begin(), head.end(), head.begin(),
+            [](unsigned char c) { return std::tolower(c); });
+        if (head == "v=spf1" || head == "v=spf1 ") {
+            records.push_back(a.data);
+            ttl = std::min(ttl, a.ttl);
+        }
+    }
+    if (records.empty())
+        return fail(SpfResultCode::None, SPF_NEGATIVE_TTL);
+    if (records.size() > 1)
+        return fail(SpfResultCode::PermError, ttl);
+
+    SpfRecord rec;
+    try {
+        rec = SpfParser::parse(records[0]);
+    } catch (...) {
+        return fail(SpfResultCode::PermError, ttl);
+    }
+
+    // Dependency fan-out: every DNS input of this level, include and
+    // redirect records too, is requested before any is waited on, so a
+    // policy costs its depth in round trips, not its length. Only lookup
+    // terms within the budget the includer left are worth starting; the
+    // includes themselves compile in order below, each with the budget
+    // its predecessors left, so the whole tree stays within RFC 7208 4.6.4
+    std::vector<std::shared_future<DnsResolver::Result>> mxPending;
+    int planned = 0;
+    bool recordHasAll = false;
+    for (size_t i = 0; i < rec.mechanisms.size(); ++i) {
+        const auto& m = rec.mechanisms[i];
+        if (m.type == SpfMechanismType::ALL) {
+            recordHasAll = true;
+            break;
+        }
+        if (m.type == SpfMechanismType::IP4 || m.type == SpfMechanismType::IP6)
+            continue;
+        if (++planned > budget)
+            break;
+        if (m.type == SpfMechanismType::PTR || hasMacro(m.domain))
+            continue;
+
+        std::string target = m.domain.empty() ? domain : spfNormaliseDomain(m.domain);
+        auto& dns = DnsResolver::instance();
+        switch (m.type) {
+        case SpfMechanismType::A:
+            dns.queryAsync(target, DnsRecordType::A);
+            dns.queryAsync(target, DnsRecordType::AAAA);
+            break;
+        case SpfMechanismType::MX:
+            mxPending.push_back(dns.queryAsync(target, DnsRecordType::MX));
+            break;
+        case SpfMechanismType::EXISTS:
+            dns.queryAsync(target, DnsRecordType::A);
+            break;
+        case SpfMechanismType::INCLUDE:
+            dns.queryAsync(target, DnsRecordType::TXT);
+            break;
+        default:
+            break;
+        }
+    }
+    if (!recordHasAll && rec.redirect && !hasMacro(*rec.redirect) && planned < budget)
+        DnsResolver::instance().queryAsync(spfNormaliseDomain(*rec.redirect), DnsRecordType::TXT);
+
+    // Exchanger addresses are the second hop of an mx; start them as soon as
+    // the MX answers arrive, while the include branches are still running
+    for (auto& f : mxPending) {
+        const DnsResolver::Result& mx = f.get();
+        if (!usable(mx))
+            continue;
+        size_t hosts = 0;
+        for (const auto& a : mx->answers) {
+            if (a.type != DnsRecordType::MX || ++hosts > SPF_MAX_MX_NAMES)
+                continue;
+            DnsResolver::instance().queryAsync(a.data, DnsRecordType::A);
+            DnsResolver::instance().queryAsync(a.data, DnsRecordType::AAAA);
+        }
+    }
+
+    int lookups = 0;
+    bool hasAll = false;
+
+    auto addressSet = [&]() -> SpfCompiledTerm& {
+        if (p->terms.empty() || p->terms.back().kind != SpfCompiledTerm::Kind::AddressSet) {
+            p->terms.emplace_back();
+            p->terms.back().kind = SpfCompiledTerm::Kind::AddressSet;
+        }
+        return p->terms.back();
+    };
+
+    // Nested policy for include / redirect, given what is left of this
+    // policy's budget; error codes per RFC 7208 5.2
+    auto child = [&](const std::string& target,
+                     SpfResultCode& error) -> std::shared_ptr<const SpfPolicy> {
+        if (chain.size() >= MAX_INCLUDE_DEPTH ||
+            std::find(chain.begin(), chain.end(), target) != chain.end()) {
+            error = SpfResultCode::PermError;   // loop
+            p->chainCut = true;
+            return nullptr;
+        }
+        auto c = get(target, chain, budget - lookups);
+        ttl = std::min(ttl, remainingTtl(*c));
+        p->chainCut = p->chainCut || c->chainCut;
+        if (!c->ok()) {
+            error = c->status == SpfResultCode::None ? SpfResultCode::PermError : c->status;
+            return nullptr;
+        }
+        return c;
+    };
+
+    for (size_t i = 0; i < rec.mechanisms.size(); ++i) {
+        const SpfMechanism& m = rec.mechanisms[i];
+        SpfResultCode result = spfQualifierResult(m.qualifier);
+
+        if (m.type == SpfMechanismType::IP4 || m.type == SpfMechanismType::IP6) {
+            SpfAddress net;
+            if (!SpfAddress::parse(m.domain, net) || net.v6 != (m.type == SpfMechanismType::IP6))
+                return fail(SpfResultCode::PermError, ttl);
+            addressSet().add(net, m.cidr >= 0 ? m.cidr : net.bits(), result, lookups);
+            continue;
+        }
+
+        if (m.type == SpfMechanismType::ALL) {
+            SpfCompiledTerm t;
+            t.kind = SpfCompiledTerm::Kind::All;
+            t.result = result;
+            t.lookups = lookups;
+            p->terms.push_back(std::move(t));
+            hasAll = true;
+            break; // nothing after all is reachable
+        }
+
+        // Everything else costs a DNS lookup when evaluated; past the limit
+        // nothing can match without a PermError, so stop resolving
+        if (++lookups > budget) {
+            p->terms.push_back(errorTerm(SpfResultCode::PermError, lookups));
+            break;
+        }
+        std::string target = m.domain.empty() ? domain : spfNormaliseDomain(m.domain);
+
+        if (m.type == SpfMechanismType::PTR || hasMacro(m.domain)) {
+            SpfCompiledTerm t;
+            t.kind = SpfCompiledTerm::Kind::Dynamic;
+            t.result = result;
+            t.lookups = lookups;
+            t.mechanism = m;
+            p->terms.push_back(std::move(t));
+            continue;
+        }
+
+        switch (m.type) {
+        case SpfMechanismType::A:
+        case SpfMechanismType::MX: {
+            std::vector<std::string> hosts;
+            if (m.type == SpfMechanismType::A) {
+                hosts.push_back(target);
+            } else {
+                auto mx = DnsResolver::instance().queryPacket(target, DnsRecordType::MX);
+                if (!usable(mx)) {
+                    p->terms.push_back(errorTerm(SpfResultCode::TempError, lookups));
+                    ttl = 0;
+                    break;
+                }
+                lowerTtl(ttl, *mx, DnsRecordType::MX);
+                for (const auto& a : mx->answers)
+                    if (a.type == DnsRecordType::MX) hosts.push_back(a.data);
+                if (hosts.size() > SPF_MAX_MX_NAMES) {
+                    p->terms.push_back(errorTerm(SpfResultCode::PermError, lookups));
+                    break;
+                }
+            }
+
+            std::vector<SpfAddress> addrs;
+            if (!resolveHosts(hosts, addrs, ttl)) {
+                p->terms.push_back(errorTerm(SpfResultCode::TempError, lookups));
+                ttl = 0;
+                break;
+            }
+            if (addrs.empty())
+                break;
+            SpfCompiledTerm& set = addressSet();
+            for (const auto& a : addrs)
+                set.add(a, a.v6 ? (m.cidr6 >= 0 ? m.cidr6 : 128) : (m.cidr >= 0 ? m.cidr : 32),
+                        result, lookups);
+            break;
+        }
+
+        case SpfMechanismType::EXISTS: {
+            // Independent of the client address: matches everyone or no one
+            auto r = DnsResolver::instance().queryPacket(target, DnsRecordType::A);
+            if (!usable(r)) {
+                p->terms.push_back(errorTerm(SpfResultCode::TempError, lookups));
+                ttl = 0;
+                break;
+            }
+            lowerTtl(ttl, *r, DnsRecordType::A);
+            bool any = std::any_of(r->answers.begin(), r->answers.end(),
+                [](const DnsAnswer& a) { return a.type == DnsRecordType::A; });
+            if (any) {
+                SpfAddress any4, any6;
+                any6.v6 = true;
+                SpfCompiledTerm& set = addressSet();
+                set.add(any4, 0, result, lookups);
+                set.add(any6, 0, result, lookups);
+            }
+            break;
+        }
+
+        case SpfMechanismType::INCLUDE: {
+            SpfResultCode error = SpfResultCode::Neutral;
+            auto inc = child(target, error);
+            if (!inc) {
+                p->terms.push_back(errorTerm(error, lookups));
+                break;
+            }
+
+            if (flattenable(*inc)) {
+                // Inner passes become this include's qualifier, in inner order
+                SpfCompiledTerm& set = addressSet();
+                for (const auto& t : inc->terms) {
+                    if (t.kind == SpfCompiledTerm::Kind::AddressSet) {
+                        for (const auto& pre : t.prefixes)
+                            set.add(pre.net, pre.length, result, lookups + t.entries[pre.entry].lookups);
+                    } else if (t.kind == SpfCompiledTerm::Kind::All &&
+                               t.result == SpfResultCode::Pass) {
+                        SpfAddress any4, any6;
+                        any6.v6 = true;
+                        set.add(any4, 0, result, lookups + t.lookups);
+                        set.add(any6, 0, result, lookups + t.lookups);
+                    }
+                }
+                Metrics::instance().inc("spf_includes_flattened_total");
+            } else {
+                SpfCompiledTerm t;
+                t.kind = SpfCompiledTerm::Kind::Include;
+                t.result = result;
+                t.lookups = lookups;
+                t.include = inc;
+                p->terms.push_back(std::move(t));
+            }
+            lookups += inc->totalLookups;
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    // redirect= only applies when no all is present (RFC 7208 6.1)
+    if (!hasAll && rec.redirect) {
+        ++lookups;
+        p->redirectLookups = lookups;
+        if (lookups > budget) {
+            p->redirectError = SpfResultCode::PermError;
+        } else if (hasMacro(*rec.redirect)) {
+            p->dynamicRedirect = *rec.redirect;
+        } else {
+            SpfResultCode error = SpfResultCode::Neutral;
+            p->redirect = child(spfNormaliseDomain(*rec.redirect), error);
+            if (p->redirect)
+                lookups += p->redirect->totalLookups;
+            else
+                p->redirectError = error;
+        }
+    }
+
+    p->totalLookups = lookups;
+    return p;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include "spf_record.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Compiled SPF Policies
+ *
+ * WHY REQUIRED:
+ * - Evaluating SPF from scratch costs a TXT fetch, a parse and up to ten
+ *   more DNS lookups per message; repeat senders publish the same policy
+ * - A domain's record is compiled once: ip4/ip6 terms and every a / mx /
+ *   exists / include whose target has no macros are resolved up front
+ * - Consecutive address terms live in one binary radix tree per family;
+ *   a match walks the address bits and keeps the earliest term seen, so
+ *   SPF's first-match order is preserved
+ * - Includes of address-only policies (the usual _spf / _netblocks chains)
+ *   are flattened into the including tree; other includes stay nested
+ * - Includes and redirects compile in record order under the lookup budget
+ *   their includer has left, so one MAIL FROM resolves at most the ten
+ *   lookup terms RFC 7208 4.6.4 allows across the whole include tree
+ * - Policies are cached by domain until the smallest TTL of any DNS answer
+ *   that went into them; a repeat sender is evaluated with no DNS, no parse.
+ *   A policy cut short by its includer's budget, or by an include loop or
+ *   the depth limit of the chain it was compiled in, is not cached
+ * - Terms that depend on the message (macros, ptr) stay dynamic and are
+ *   resolved per evaluation through the shared DNS cache
+ */
+
+SpfResultCode spfQualifierResult(SpfQualifier q);
+std::string spfNormaliseDomain(const std::string& domain);
+
+// Connecting address as 16 bytes (IPv4 in the first four)
+struct SpfAddress {
+    bool v6 = false;
+    uint8_t bytes[16] = {};
+
+    int bits() const { return v6 ? 128 : 32; }
+    static bool parse(const std::string& text, SpfAddress& out);
+    // Same family and equal in the first prefixLen bits
+    bool inPrefix(const SpfAddress& net, int prefixLen) const;
+};
+
+// Binary radix tree over address bits; each prefix carries a term index
+class SpfPrefixTree {
+public:
+    static constexpr uint32_t NO_MATCH = UINT32_MAX;
+
+    // A prefix inserted twice keeps the earlier (smaller) index
+    void insert(const uint8_t* addr, int prefixLen, uint32_t index);
+    // Smallest index among the prefixes covering addr
+    uint32_t match(const uint8_t* addr, int bits) const;
+
+private:
+    struct Node {
+        int32_t child[2] = {-1, -1};
+        uint32_t index = NO_MATCH;
+    };
+    std::vector<Node> nodes_{Node{}};
+};
+
+struct SpfPolicy;
+
+struct SpfCompiledTerm {
+    enum class Kind {
+        AddressSet,     // ip4/ip6 and pre-resolved a/mx/exists/include entries
+        All,
+        Include,        // nested policy that could not be flattened
+        Dynamic,        // macro-bearing or ptr: resolved per evaluation
+        Error           // TempError / PermError, raised only if reached
+    };
+
+    struct Entry {
+        SpfResultCode result;   // outcome when this entry is the first match
+        int lookups;            // DNS-lookup terms spent up to this entry
+    };
+    struct Prefix {
+        SpfAddress net;
+        int length;
+        uint32_t entry;
+    };
+
+    Kind kind = Kind::Error;
+    SpfResultCode result = SpfResultCode::PermError;
+    int lookups = 0;
+
+    // AddressSet
+    SpfPrefixTree v4;
+    SpfPrefixTree v6;
+    std::vector<Entry> entries;
+    std::vector<Prefix> prefixes;   // kept for flattening into an includer
+
+    std::shared_ptr<const SpfPolicy> include;   // Include
+    SpfMechanism mechanism;                     // Dynamic
+
+    void add(const SpfAddress& net, int length, SpfResultCode r, int lookupCount);
+};
+
+struct SpfPolicy {
+    std::string domain;
+    // None / TempError / PermError when the record itself is unusable
+    SpfResultCode status = SpfResultCode::Neutral;
+    std::vector<SpfCompiledTerm> terms;
+
+    std::shared_ptr<const SpfPolicy> redirect;
+    std::string dynamicRedirect;        // redirect= with macros
+    SpfResultCode redirectError = SpfResultCode::Neutral;
+    int redirectLookups = 0;
+
+    int totalLookups = 0;               // lookups if evaluated to the end
+    bool chainCut = false;              // hit an include loop or the depth limit here
+                                        // or below: depends on the chain, never cached
+    std::chrono::steady_clock::time_point expires;
+
+    bool ok() const;
+};
+
+class SpfPolicyCache {
+public:
+    static SpfPolicyCache& instance();
+
+    // Compiled policy for a domain; compiles on miss or expiry
+    std::shared_ptr<const SpfPolicy> get(const std::string& domain);
+
+private:
+    SpfPolicyCache() = default;
+
+    // budget: lookup terms the includer has left for this policy
+    std::shared_ptr<const SpfPolicy> get(const std::string& domain,
+                                         std::vector<std::string>& chain, int budget);
+    std::shared_ptr<SpfPolicy> compile(const std::string& domain,
+                                       std::vector<std::string>& chain,
+                                       int budget, uint32_t& ttl);
+
+    static constexpr size_t MAX_POLICIES = 10000;
+    static constexpr size_t MAX_INCLUDE_DEPTH = 10;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const SpfPolicy>> policies_;
+};
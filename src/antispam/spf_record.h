@@ -18,8 +18,9 @@ enum class SpfMechanismType {
 struct SpfMechanism {
     SpfQualifier qualifier;
     SpfMechanismType type;
-    std::string domain;
-    int cidr = -1;
+    std::string domain;     // domain-spec, or the address for ip4/ip6
+    int cidr = -1;          // ip4 / a / mx IPv4 prefix; ip6 prefix
+    int cidr6 = -1;         // a / mx "//n" IPv6 prefix
 };
 
 struct SpfRecord {
@@ -1,6 +1,7 @@
 #include "core/config_loader.h"
 #include "core/logger.h"
 #include "core/tls_enforcement.h"
+#include <algorithm>
 #include <vector>
 #include <yaml-cpp/yaml.h>
 #include <stdexcept>
@@ -16,6 +17,8 @@ ServerConfig ConfigLoader::loadFromFile(const std::string& path) {
             if (s["host"])       cfg.host     = s["host"].as<std::string>();
             if (s["smtp_port"])  cfg.smtpPort = s["smtp_port"].as<int>();
             if (s["imap_port"])  cfg.imapPort = s["imap_port"].as<int>();
+            if (s["admin_port"]) cfg.adminPort = s["admin_port"].as<int>();
+            if (s["metrics_port"]) cfg.metricsPort = s["metrics_port"].as<int>();
             if (s["domain"])     cfg.domain   = s["domain"].as<std::string>();
             if (s["mail_root"])  cfg.mailRoot = s["mail_root"].as<std::string>();
             if (s["tls_cert"])   cfg.tlsCertFile = s["tls_cert"].as<std::string>();
@@ -47,6 +50,10 @@ ServerConfig ConfigLoader::loadFromFile(const std::string& path) {
             if (ha["redis_password"]) cfg.redisPassword = ha["redis_password"].as<std::string>();
             if (ha["cluster_id"]) cfg.clusterId = ha["cluster_id"].as<std::string>();
             if (ha["node_id"]) cfg.nodeId = ha["node_id"].as<std::string>();
+            if (ha["data_dir"]) cfg.haDataDir = ha["data_dir"].as<std::string>();
+            if (ha["queue_shards"]) cfg.queueShards = ha["queue_shards"].as<int>();
+            if (ha["lease_ms"]) cfg.haLeaseMs = ha["lease_ms"].as<int>();
+            if (ha["renew_ms"]) cfg.haRenewMs = ha["renew_ms"].as<int>();
         }
 
         if (root["admin"]) {
@@ -61,6 +68,92 @@ ServerConfig ConfigLoader::loadFromFile(const std::string& path) {
             if (s["timeout"]) cfg.smtpTimeout = s["timeout"].as<int>();
             if (s["data_timeout"]) cfg.dataTimeout = s["data_timeout"].as<int>();
         }
+
+        if (root["upgrade"]) {
+            auto u = root["upgrade"];
+            if (u["drain_timeout"]) cfg.drainTimeoutSec = u["drain_timeout"].as<int>();
+            if (u["ready_timeout_ms"]) cfg.upgradeReadyTimeoutMs = u["ready_timeout_ms"].as<int>();
+        }
+
+        if (root["dns"]) {
+            auto d = root["dns"];
+            if (d["servers"]) cfg.dnsServers = d["servers"].as<std::vector<std::string>>();
+            if (d["timeout_ms"]) cfg.dnsTimeoutMs = d["timeout_ms"].as<int>();
+            if (d["udp_payload"]) cfg.dnsUdpPayload = d["udp_payload"].as<int>();
+            if (d["min_ttl"]) cfg.dnsMinTtl = d["min_ttl"].as<int>();
+            if (d["max_ttl"]) cfg.dnsMaxTtl = d["max_ttl"].as<int>();
+            if (d["negative_ttl"]) cfg.dnsNegativeTtl = d["negative_ttl"].as<int>();
+            if (d["prefetch"]) cfg.dnsPrefetch = d["prefetch"].as<bool>();
+        }
+
+        if (root["dnsbl"]) {
+            auto b = root["dnsbl"];
+            if (b["zones"]) cfg.dnsblZones = b["zones"].as<std::map<std::string, std::string>>();
+            if (b["remote"]) cfg.dnsblRemote = b["remote"].as<std::vector<std::string>>();
+            if (b["data_dir"]) cfg.dnsblDataDir = b["data_dir"].as<std::string>();
+            if (b["reload_interval"]) cfg.dnsblReloadSec = b["reload_interval"].as<int>();
+        }
+
+        if (root["dmarc"]) {
+            auto m = root["dmarc"];
+            if (m["public_suffix_list"]) cfg.pslFile = m["public_suffix_list"].as<std::string>();
+            if (m["reload_interval"]) cfg.pslReloadSec = m["reload_interval"].as<int>();
+        }
+
+        if (root["dkim"]) {
+            auto k = root["dkim"];
+            if (k["keys"]) {
+                for (const auto& e : k["keys"]) {
+                    DkimKeyConfig key;
+                    if (e["domain"])   key.domain   = e["domain"].as<std::string>();
+                    if (e["selector"]) key.selector = e["selector"].as<std::string>();
+                    if (e["key_file"]) key.keyFile  = e["key_file"].as<std::string>();
+                    if (e["headers"])  key.headers  = e["headers"].as<std::string>();
+                    cfg.dkimKeys.push_back(key);
+                }
+            }
+            if (k["reload_interval"]) cfg.dkimReloadSec = k["reload_interval"].as<int>();
+            if (k["verify_wait_ms"]) cfg.dkimVerifyWaitMs = k["verify_wait_ms"].as<int>();
+        }
+
+        if (root["replication"]) {
+            auto r = root["replication"];
+            if (r["role"]) cfg.replicationRole = r["role"].as<std::string>();
+            if (r["peer_host"]) cfg.replicationPeerHost = r["peer_host"].as<std::string>();
+            if (r["peer_port"]) cfg.replicationPeerPort = r["peer_port"].as<int>();
+            if (r["listen_port"]) cfg.replicationListenPort = r["listen_port"].as<int>();
+            if (r["bind_address"]) cfg.replicationBindAddress = r["bind_address"].as<std::string>();
+            if (r["shared_secret"]) cfg.replicationSecret = r["shared_secret"].as<std::string>();
+            if (r["mode"]) cfg.replicationMode = r["mode"].as<std::string>();
+            if (r["ack_timeout_ms"]) cfg.replicationAckTimeoutMs = r["ack_timeout_ms"].as<int>();
+        }
+
+        if (root["delivery"]) {
+            auto d = root["delivery"];
+            if (d["throttle"]) {
+                for (const auto& it : d["throttle"]) {
+                    DeliveryThrottleOverride o;
+                    auto t = it.second;
+                    if (t["max_concurrency"]) o.maxConcurrency = t["max_concurrency"].as<int>();
+                    if (t["max_per_minute"])  o.maxPerMinute   = t["max_per_minute"].as<int>();
+                    cfg.deliveryThrottle[it.first.as<std::string>()] = o;
+                }
+            }
+        }
+
+        if (root["queue"]) {
+            auto q = root["queue"];
+            if (q["high_senders"]) cfg.queueHighSenders = q["high_senders"].as<std::vector<std::string>>();
+            if (q["bulk_senders"]) cfg.queueBulkSenders = q["bulk_senders"].as<std::vector<std::string>>();
+            if (q["high_users"])   cfg.queueHighUsers   = q["high_users"].as<std::vector<std::string>>();
+            if (q["bulk_users"])   cfg.queueBulkUsers   = q["bulk_users"].as<std::vector<std::string>>();
+            if (q["weights"]) {
+                auto w = q["weights"];
+                if (w["high"])   cfg.queueWeightHigh   = w["high"].as<int>();
+                if (w["normal"]) cfg.queueWeightNormal = w["normal"].as<int>();
+                if (w["bulk"])   cfg.queueWeightBulk   = w["bulk"].as<int>();
+            }
+        }
     } catch (const std::exception& ex) {
         Logger::instance().log(
             LogLevel::Error,
@@ -94,6 +187,19 @@ void ConfigLoader::validateConfig(const ServerConfig& cfg) {
     if (cfg.smtpPort == cfg.imapPort) {
         errors.push_back("server.smtp_port and server.imap_port must be different");
     }
+    if (cfg.adminPort <= 0 || cfg.adminPort > 65535) {
+        errors.push_back("server.admin_port must be between 1-65535");
+    }
+    if (cfg.metricsPort <= 0 || cfg.metricsPort > 65535) {
+        errors.push_back("server.metrics_port must be between 1-65535");
+    }
+    {
+        std::vector<int> ports = { cfg.smtpPort, cfg.imapPort, cfg.adminPort, cfg.metricsPort };
+        std::sort(ports.begin(), ports.end());
+        if (std::adjacent_find(ports.begin(), ports.end()) != ports.end()) {
+            errors.push_back("server.smtp_port, imap_port, admin_port and metrics_port must all differ");
+        }
+    }
 
     // TLS validation
     if (cfg.tlsRequired) {
@@ -127,6 +233,54 @@ void ConfigLoader::validateConfig(const ServerConfig& cfg) {
         errors.push_back("smtp.data_timeout must be at least 60 seconds");
     }
 
+    // DNSBL validation
+    for (const auto& [name, file] : cfg.dnsblZones) {
+        if (name.empty() || name.find_first_not_of(
+                "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._") != std::string::npos) {
+            errors.push_back("dnsbl.zones names may only contain letters, digits, '.' and '_'");
+        }
+        if (file.empty()) {
+            errors.push_back("dnsbl.zones." + name + " needs a zone file path");
+        }
+    }
+    if (cfg.dnsblReloadSec < 1) {
+        errors.push_back("dnsbl.reload_interval must be at least 1");
+    }
+
+    // DMARC validation
+    if (cfg.pslReloadSec < 1) {
+        errors.push_back("dmarc.reload_interval must be at least 1");
+    }
+
+    // DKIM signing validation
+    for (const auto& k : cfg.dkimKeys) {
+        if (k.domain.empty() || k.selector.empty() || k.keyFile.empty()) {
+            errors.push_back("dkim.keys entries need domain, selector and key_file");
+        }
+        if (k.headers.find("from") == std::string::npos) {
+            errors.push_back("dkim.keys." + k.selector + "._domainkey." + k.domain +
+                             " headers must include from");
+        }
+    }
+    if (cfg.dkimReloadSec < 1) {
+        errors.push_back("dkim.reload_interval must be at least 1");
+    }
+    if (cfg.dkimVerifyWaitMs < 0) {
+        errors.push_back("dkim.verify_wait_ms must not be negative");
+    }
+
+    // Delivery throttle validation
+    for (const auto& [domain, o] : cfg.deliveryThrottle) {
+        if (o.maxConcurrency < 0 || o.maxPerMinute < 0) {
+            errors.push_back("delivery.throttle." + domain + " limits must be non-negative");
+        }
+    }
+
+    // Queue weight validation
+    if (cfg.queueWeightHigh < 1 || cfg.queueWeightNormal < 1 || cfg.queueWeightBulk < 1) {
+        errors.push_back("queue.weights must all be at least 1");
+    }
+
     // Log level validation
     std::vector<std::string> validLevels = {"debug", "info", "warn", "warning", "error"};
     if (std::find(validLevels.begin(), validLevels.end(), cfg.logLevel) == validLevels.end()) {
@@ -146,6 +300,66 @@ void ConfigLoader::validateConfig(const ServerConfig& cfg) {
         }
         // node_id is optional and will be auto-generated if empty
     }
+    if (cfg.queueShards < 1 || cfg.queueShards > 4096) {
+        errors.push_back("ha.queue_shards must be between 1-4096");
+    }
+    if (cfg.haLeaseMs < 100) {
+        errors.push_back("ha.lease_ms must be at least 100");
+    }
+    if (cfg.haRenewMs < 50 || cfg.haRenewMs * 2 > cfg.haLeaseMs) {
+        errors.push_back("ha.renew_ms must be at least 50 and at most half of ha.lease_ms");
+    }
+
+    if (cfg.drainTimeoutSec < 0) {
+        errors.push_back("upgrade.drain_timeout must not be negative");
+    }
+    if (cfg.upgradeReadyTimeoutMs < 100) {
+        errors.push_back("upgrade.ready_timeout_ms must be at least 100");
+    }
+
+    // DNS validation
+    if (cfg.dnsTimeoutMs < 50) {
+        errors.push_back("dns.timeout_ms must be at least 50");
+    }
+    if (cfg.dnsUdpPayload < 512 || cfg.dnsUdpPayload > 4096) {
+        errors.push_back("dns.udp_payload must be between 512-4096");
+    }
+    if (cfg.dnsMinTtl < 0 || cfg.dnsMaxTtl < cfg.dnsMinTtl) {
+        errors.push_back("dns.min_ttl must be >= 0 and not exceed dns.max_ttl");
+    }
+    if (cfg.dnsNegativeTtl < 0) {
+        errors.push_back("dns.negative_ttl must not be negative");
+    }
+
+    // Replication validation
+    if (cfg.replicationRole != "off" && cfg.replicationRole != "primary" &&
+        cfg.replicationRole != "replica") {
+        errors.push_back("replication.role must be one of: off, primary, replica");
+    }
+    if (cfg.replicationRole == "primary") {
+        if (cfg.replicationPeerHost.empty()) {
+            errors.push_back("replication.peer_host is required when replication.role=primary");
+        }
+        if (cfg.replicationPeerPort <= 0 || cfg.replicationPeerPort > 65535) {
+            errors.push_back("replication.peer_port must be between 1-65535");
+        }
+    }
+    if (cfg.replicationRole == "replica" &&
+        (cfg.replicationListenPort <= 0 || cfg.replicationListenPort > 65535)) {
+        errors.push_back("replication.listen_port must be between 1-65535");
+    }
+    if (cfg.replicationRole == "replica" && cfg.replicationBindAddress.empty()) {
+        errors.push_back("replication.bind_address is required when replication.role=replica");
+    }
+    if (cfg.replicationRole != "off" && cfg.replicationSecret.size() < 16) {
+        errors.push_back("replication.shared_secret must be at least 16 characters");
+    }
+    if (cfg.replicationMode != "async" && cfg.replicationMode != "sync") {
+        errors.push_back("replication.mode must be async or sync");
+    }
+    if (cfg.replicationAckTimeoutMs < 10) {
+        errors.push_back("replication.ack_timeout_ms must be at least 10");
+    }
 
     if (!errors.empty()) {
         std::string errorMsg = "Configuration validation failed:\n";
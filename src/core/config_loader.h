@@ -1,11 +1,29 @@
 #pragma once
 
 #include <string>
+#include <map>
+#include <vector>
+
+// Static per-destination-domain delivery ceilings (delivery.throttle)
+struct DeliveryThrottleOverride {
+    int maxConcurrency = 0;     // 0 = use default ceiling
+    int maxPerMinute = 0;       // 0 = use default ceiling
+};
+
+// One DKIM signing key (dkim.keys); a domain may list an RSA and an Ed25519 key
+struct DkimKeyConfig {
+    std::string domain;
+    std::string selector;
+    std::string keyFile;        // PEM private key
+    std::string headers = "from:to:cc:subject:date:message-id:mime-version:content-type";
+};
 
 struct ServerConfig {
     std::string host = "0.0.0.0";
     int smtpPort = 25;
     int imapPort = 143;
+    int adminPort = 8080;               // Admin API
+    int metricsPort = 9090;             // Prometheus metrics endpoint
     std::string domain = "example.com";
 
     std::string logFile = "mailserver.log";
@@ -29,6 +47,10 @@ struct ServerConfig {
     int smtpTimeout = 300;             // 5 minutes default timeout
     int dataTimeout = 600;             // 10 minutes for DATA mode
 
+    // Zero-downtime upgrade (SIGHUP)
+    int drainTimeoutSec = 300;         // old process: max wait for sessions to finish
+    int upgradeReadyTimeoutMs = 10000; // new process must be accepting within this
+
     // High Availability (HA) Configuration
     bool enableHA = false;             // Enable distributed authentication
     std::string redisHost = "localhost"; // Redis server host
@@ -36,6 +58,56 @@ struct ServerConfig {
     std::string redisPassword;         // Redis authentication password
     std::string clusterId = "email-cluster"; // Unique cluster identifier
     std::string nodeId;                // Unique node identifier (auto-generated if empty)
+    std::string haDataDir = "data";    // Shard leases/heartbeats (shared FS for multi-node)
+    int queueShards = 16;              // Queue shards spread across live nodes
+    int haLeaseMs = 3000;              // Shard lease duration
+    int haRenewMs = 500;               // Lease renewal interval (< lease/2)
+
+    // Mail store replication to a standby node
+    std::string replicationRole = "off";       // off | primary | replica
+    std::string replicationPeerHost;           // primary: replica address
+    int replicationPeerPort = 2626;            // primary: replica listen port
+    int replicationListenPort = 2626;          // replica: port to accept the stream on
+    std::string replicationBindAddress = "127.0.0.1"; // replica: address to accept the stream on
+    std::string replicationSecret;             // both: shared secret authenticating the peer
+    std::string replicationMode = "async";     // async | sync (250 waits for replica ack)
+    int replicationAckTimeoutMs = 2000;        // sync: fall back to async after this
+
+    // DNS resolver
+    std::vector<std::string> dnsServers; // upstream resolvers (empty = the system's)
+    int dnsTimeoutMs = 2000;           // per-server query timeout
+    int dnsUdpPayload = 1232;          // EDNS0 buffer size (512 = no EDNS)
+    int dnsMinTtl = 30;                // clamp for cached answers (seconds)
+    int dnsMaxTtl = 86400;
+    int dnsNegativeTtl = 300;          // NXDOMAIN / NODATA cache lifetime
+    bool dnsPrefetch = true;           // refresh hot entries before they expire
+
+    // Connection-time blocklists
+    std::map<std::string, std::string> dnsblZones; // local zone name -> rbldnsd zone file
+    std::vector<std::string> dnsblRemote;          // DNSBL suffixes queried via DNS
+    std::string dnsblDataDir = "data/dnsbl";       // compiled tables
+    int dnsblReloadSec = 60;                       // zone file change check interval
+
+    // DMARC organizational domains (publicsuffix.org list)
+    std::string pslFile = "data/public_suffix_list.dat";
+    int pslReloadSec = 86400;                      // list file change check interval
+
+    // Outbound DKIM signing
+    std::vector<DkimKeyConfig> dkimKeys;
+    int dkimReloadSec = 60;                        // key file change check interval
+    int dkimVerifyWaitMs = 1500;                   // inbound: longest wait for keys, then for checks, before 250
+
+    // Outbound delivery
+    std::map<std::string, DeliveryThrottleOverride> deliveryThrottle; // domain -> ceilings
+
+    // Queue priority classes (addresses or "@domain" suffixes)
+    std::vector<std::string> queueHighSenders;
+    std::vector<std::string> queueBulkSenders;
+    std::vector<std::string> queueHighUsers;   // authenticated submitters
+    std::vector<std::string> queueBulkUsers;
+    int queueWeightHigh = 8;           // DRR quanta per round
+    int queueWeightNormal = 4;
+    int queueWeightBulk = 1;
 };
 
 class ConfigLoader {
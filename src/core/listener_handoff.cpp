@@ -0,0 +1,476 @@
+#include "core/listener_handoff.h"
+#include "core/logger.h"
+
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#else
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <windows.h>
+#endif
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+static const char* HANDOFF_ENV = "MAILSERVER_HANDOFF_FD";
+static const size_t MAX_HANDOFF_FDS = 16;
+
+#ifndef _WIN32
+
+// Channel to the predecessor: kept open by it until it exits
+static int g_channel = -1;
+
+static void setCloexec(int fd) {
+    int flags = fcntl(fd, F_GETFD);
+    if (flags >= 0)
+        fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+std::map<std::string, SOCKET> ListenerHandoff::receive() {
+    std::map<std::string, SOCKET> out;
+    const char* env = std::getenv(HANDOFF_ENV);
+    if (!env)
+        return out;
+
+    g_channel = std::atoi(env);
+    unsetenv(HANDOFF_ENV);
+    setCloexec(g_channel);
+
+    // Payload: names separated by '\n', in the same order as the fds
+    char names[1024];
+    char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+    iovec iov{names, sizeof(names) - 1};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(g_channel, &msg, 0);
+    if (n <= 0) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: No listeners received from predecessor");
+        close(g_channel);
+        g_channel = -1;
+        return out;
+    }
+    names[n] = '\0';
+
+    std::vector<int> fds;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = reinterpret_cast<const int*>(CMSG_DATA(c));
+        fds.insert(fds.end(), data, data + count);
+    }
+
+    size_t i = 0;
+    char* save = nullptr;
+    for (char* name = strtok_r(names, "\n", &save); name && i < fds.size();
+         name = strtok_r(nullptr, "\n", &save), ++i) {
+        setCloexec(fds[i]);
+        out[name] = fds[i];
+    }
+
+    Logger::instance().log(LogLevel::Info,
+        "ListenerHandoff: Inherited " + std::to_string(out.size()) + " listener(s) from predecessor");
+    return out;
+}
+
+void ListenerHandoff::notifyReady() {
+    if (g_channel < 0)
+        return;
+    char ready = 'R';
+    if (write(g_channel, &ready, 1) != 1) {
+        Logger::instance().log(LogLevel::Warn, "ListenerHandoff: Failed to signal readiness");
+    }
+}
+
+bool ListenerHandoff::predecessorGone() {
+    if (g_channel < 0)
+        return true;
+    pollfd p{g_channel, POLLIN, 0};
+    if (poll(&p, 1, 0) <= 0)
+        return false;
+    char c;
+    if (read(g_channel, &c, 1) > 0)
+        return false;
+    // EOF: the predecessor closed its end on exit
+    close(g_channel);
+    g_channel = -1;
+    return true;
+}
+
+static std::vector<std::string> currentArgs() {
+    std::ifstream in("/proc/self/cmdline", std::ios::binary);
+    std::string all((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<std::string> args;
+    size_t start = 0;
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (all[i] == '\0') {
+            args.push_back(all.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    return args;
+}
+
+bool ListenerHandoff::upgrade(const std::map<std::string, SOCKET>& listeners, int timeoutMs) {
+    if (listeners.empty() || listeners.size() > MAX_HANDOFF_FDS)
+        return false;
+
+    std::vector<std::string> args = currentArgs();
+    if (args.empty()) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: Cannot read own command line");
+        return false;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: socketpair failed");
+        return false;
+    }
+    setCloexec(sv[0]);
+
+    // Prepare everything the child needs before fork: only async-signal-safe
+    // calls are allowed between fork and exec in a threaded process
+    std::vector<char*> argv;
+    for (auto& a : args) argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+    std::string envEntry = std::string(HANDOFF_ENV) + "=" + std::to_string(sv[1]);
+    std::vector<char*> envp;
+    for (char** e = environ; *e; ++e) {
+        if (std::strncmp(*e, HANDOFF_ENV, std::strlen(HANDOFF_ENV)) != 0)
+            envp.push_back(*e);
+    }
+    envp.push_back(&envEntry[0]);
+    envp.push_back(nullptr);
+    long maxFd = sysconf(_SC_OPEN_MAX);
+    if (maxFd <= 0) maxFd = 1024;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: fork failed");
+        return false;
+    }
+    if (pid == 0) {
+        // Drop client connections and everything else; keep stdio + channel.
+        // Listeners arrive over the channel, not by inheritance.
+        for (int fd = 3; fd < maxFd; ++fd) {
+            if (fd != sv[1]) close(fd);
+        }
+        execve("/proc/self/exe", argv.data(), envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+
+    std::string names;
+    std::vector<int> fds;
+    for (const auto& [name, sock] : listeners) {
+        if (sock < 0) continue;
+        names += name + "\n";
+        fds.push_back(sock);
+    }
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    iovec iov{&names[0], names.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+
+    bool ok = sendmsg(sv[0], &msg, 0) == static_cast<ssize_t>(names.size());
+
+    // Wait for the successor to report it is accepting
+    if (ok) {
+        pollfd p{sv[0], POLLIN, 0};
+        char ready = 0;
+        ok = poll(&p, 1, timeoutMs) > 0 && read(sv[0], &ready, 1) == 1 && ready == 'R';
+    }
+
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error,
+            "ListenerHandoff: Successor (pid " + std::to_string(pid) +
+            ") did not become ready; continuing to serve");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        close(sv[0]);
+        return false;
+    }
+
+    // sv[0] stays open (close-on-exec) until this process exits: the
+    // successor sees EOF and knows the ports and data files are its alone
+    Logger::instance().log(LogLevel::Info,
+        "ListenerHandoff: Successor pid " + std::to_string(pid) + " is accepting; draining");
+    return true;
+}
+
+#else
+
+// Pipes to the predecessor. Its write end stays open until it exits, so a
+// broken pipe tells the successor that it owns the ports and data files
+static HANDLE g_fromPredecessor = INVALID_HANDLE_VALUE;
+static HANDLE g_toPredecessor = INVALID_HANDLE_VALUE;
+static const uint32_t MAX_NAME_LEN = 64;
+
+static bool readExact(HANDLE h, void* data, DWORD len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        DWORD n = 0;
+        if (!ReadFile(h, p, len, &n, NULL) || n == 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool writeExact(HANDLE h, const void* data, DWORD len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        DWORD n = 0;
+        if (!WriteFile(h, p, len, &n, NULL) || n == 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void closeChannel() {
+    if (g_fromPredecessor != INVALID_HANDLE_VALUE) CloseHandle(g_fromPredecessor);
+    if (g_toPredecessor != INVALID_HANDLE_VALUE) CloseHandle(g_toPredecessor);
+    g_fromPredecessor = INVALID_HANDLE_VALUE;
+    g_toPredecessor = INVALID_HANDLE_VALUE;
+}
+
+std::map<std::string, SOCKET> ListenerHandoff::receive() {
+    std::map<std::string, SOCKET> out;
+    const char* env = std::getenv(HANDOFF_ENV);
+    if (!env)
+        return out;
+
+    unsigned long long in = 0, back = 0;
+    bool parsed = std::sscanf(env, "%llu:%llu", &in, &back) == 2;
+    _putenv_s(HANDOFF_ENV, "");
+    if (!parsed) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: Malformed handoff channel");
+        return out;
+    }
+    g_fromPredecessor = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(in));
+    g_toPredecessor = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(back));
+
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    // Payload: u32 count, then per listener u32 name length, name, WSAPROTOCOL_INFOW
+    uint32_t count = 0;
+    bool ok = readExact(g_fromPredecessor, &count, sizeof(count)) && count <= MAX_HANDOFF_FDS;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        uint32_t len = 0;
+        WSAPROTOCOL_INFOW info{};
+        ok = readExact(g_fromPredecessor, &len, sizeof(len)) && len > 0 && len <= MAX_NAME_LEN;
+        std::string name(ok ? len : 0, '\0');
+        ok = ok && readExact(g_fromPredecessor, &name[0], len) &&
+             readExact(g_fromPredecessor, &info, sizeof(info));
+        if (!ok)
+            break;
+
+        SOCKET sock = WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO,
+                                 &info, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_NO_HANDLE_INHERIT);
+        if (sock == INVALID_SOCKET) {
+            Logger::instance().log(LogLevel::Error,
+                "ListenerHandoff: Cannot open inherited listener " + name +
+                " (error " + std::to_string(WSAGetLastError()) + ")");
+            ok = false;
+            break;
+        }
+        out[name] = sock;
+    }
+
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: No listeners received from predecessor");
+        for (auto& [name, sock] : out)
+            closesocket(sock);
+        out.clear();
+        closeChannel();
+        return out;
+    }
+
+    Logger::instance().log(LogLevel::Info,
+        "ListenerHandoff: Inherited " + std::to_string(out.size()) + " listener(s) from predecessor");
+    return out;
+}
+
+void ListenerHandoff::notifyReady() {
+    if (g_toPredecessor == INVALID_HANDLE_VALUE)
+        return;
+    char ready = 'R';
+    if (!writeExact(g_toPredecessor, &ready, 1)) {
+        Logger::instance().log(LogLevel::Warn, "ListenerHandoff: Failed to signal readiness");
+    }
+}
+
+bool ListenerHandoff::predecessorGone() {
+    if (g_fromPredecessor == INVALID_HANDLE_VALUE)
+        return true;
+    DWORD avail = 0;
+    if (PeekNamedPipe(g_fromPredecessor, NULL, 0, NULL, &avail, NULL))
+        return false;
+    // ERROR_BROKEN_PIPE: the predecessor's write end closed on exit
+    closeChannel();
+    return true;
+}
+
+bool ListenerHandoff::upgrade(const std::map<std::string, SOCKET>& listeners, int timeoutMs) {
+    if (listeners.empty() || listeners.size() > MAX_HANDOFF_FDS)
+        return false;
+
+    wchar_t exe[MAX_PATH];
+    DWORD exeLen = GetModuleFileNameW(NULL, exe, MAX_PATH);
+    if (exeLen == 0 || exeLen >= MAX_PATH) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: Cannot read own executable path");
+        return false;
+    }
+
+    // One pipe each way; only the successor's ends are inheritable
+    SECURITY_ATTRIBUTES sa{sizeof(sa), NULL, TRUE};
+    HANDLE toChildRead = NULL, toChildWrite = NULL, fromChildRead = NULL, fromChildWrite = NULL;
+    if (!CreatePipe(&toChildRead, &toChildWrite, &sa, 0)) {
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: CreatePipe failed");
+        return false;
+    }
+    if (!CreatePipe(&fromChildRead, &fromChildWrite, &sa, 0)) {
+        CloseHandle(toChildRead);
+        CloseHandle(toChildWrite);
+        Logger::instance().log(LogLevel::Error, "ListenerHandoff: CreatePipe failed");
+        return false;
+    }
+    SetHandleInformation(toChildWrite, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(fromChildRead, HANDLE_FLAG_INHERIT, 0);
+
+    // Inherit nothing but the two pipe ends: client sockets, data files and
+    // the listeners themselves stay here. Listeners travel as WSAPROTOCOL_INFO
+    HANDLE inherit[2] = {toChildRead, fromChildWrite};
+    SIZE_T attrSize = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attrSize);
+    std::vector<char> attrBuf(attrSize);
+    auto attrs = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attrBuf.data());
+    bool attrsReady = InitializeProcThreadAttributeList(attrs, 1, 0, &attrSize);
+    bool ok = attrsReady &&
+              UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                        inherit, sizeof(inherit), NULL, NULL);
+
+    STARTUPINFOEXW si{};
+    si.StartupInfo.cb = sizeof(si);
+    si.lpAttributeList = attrs;
+    PROCESS_INFORMATION pi{};
+    std::wstring cmd = GetCommandLineW();
+    std::string channel = std::to_string(reinterpret_cast<uintptr_t>(toChildRead)) + ":" +
+                          std::to_string(reinterpret_cast<uintptr_t>(fromChildWrite));
+
+    // The successor copies this process's environment block at creation
+    SetEnvironmentVariableA(HANDOFF_ENV, channel.c_str());
+    ok = ok && CreateProcessW(exe, &cmd[0], NULL, NULL, TRUE, EXTENDED_STARTUPINFO_PRESENT,
+                              NULL, NULL, &si.StartupInfo, &pi);
+    SetEnvironmentVariableA(HANDOFF_ENV, NULL);
+    if (attrsReady)
+        DeleteProcThreadAttributeList(attrs);
+    CloseHandle(toChildRead);
+    CloseHandle(fromChildWrite);
+
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error,
+            "ListenerHandoff: CreateProcess failed (error " + std::to_string(GetLastError()) + ")");
+        CloseHandle(toChildWrite);
+        CloseHandle(fromChildRead);
+        return false;
+    }
+    CloseHandle(pi.hThread);
+
+    // Each listener is duplicated for the successor's pid; the kernel
+    // accept queue is shared, so no SYN is refused during the switch
+    std::string payload;
+    uint32_t count = 0;
+    payload.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& [name, sock] : listeners) {
+        if (sock == INVALID_SOCKET || name.empty() || name.size() > MAX_NAME_LEN)
+            continue;
+        WSAPROTOCOL_INFOW info{};
+        if (WSADuplicateSocketW(sock, pi.dwProcessId, &info) != 0) {
+            Logger::instance().log(LogLevel::Error,
+                "ListenerHandoff: WSADuplicateSocket failed for " + name +
+                " (error " + std::to_string(WSAGetLastError()) + ")");
+            ok = false;
+            break;
+        }
+        uint32_t len = static_cast<uint32_t>(name.size());
+        payload.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        payload += name;
+        payload.append(reinterpret_cast<const char*>(&info), sizeof(info));
+        ++count;
+    }
+    std::memcpy(&payload[0], &count, sizeof(count));
+    ok = ok && writeExact(toChildWrite, payload.data(), static_cast<DWORD>(payload.size()));
+
+    // Wait for the successor to report it is accepting
+    if (ok) {
+        ok = false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (std::chrono::steady_clock::now() < deadline) {
+            DWORD avail = 0;
+            if (!PeekNamedPipe(fromChildRead, NULL, 0, NULL, &avail, NULL))
+                break;                              // successor exited
+            if (avail > 0) {
+                char ready = 0;
+                ok = readExact(fromChildRead, &ready, 1) && ready == 'R';
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error,
+            "ListenerHandoff: Successor (pid " + std::to_string(pi.dwProcessId) +
+            ") did not become ready; continuing to serve");
+        TerminateProcess(pi.hProcess, 1);
+        WaitForSingleObject(pi.hProcess, 5000);
+        CloseHandle(pi.hProcess);
+        CloseHandle(toChildWrite);
+        CloseHandle(fromChildRead);
+        return false;
+    }
+
+    // toChildWrite stays open until this process exits: the successor's
+    // pipe then breaks and it knows the ports and data files are its alone
+    CloseHandle(pi.hProcess);
+    CloseHandle(fromChildRead);
+    Logger::instance().log(LogLevel::Info,
+        "ListenerHandoff: Successor pid " + std::to_string(pi.dwProcessId) + " is accepting; draining");
+    return true;
+}
+
+#endif
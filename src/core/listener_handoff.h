@@ -0,0 +1,44 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#else
+using SOCKET = int;
+#endif
+
+/**
+ * Zero-Downtime Upgrade via Listener Socket Handoff
+ *
+ * WHY REQUIRED:
+ * - SIGHUP used to shut the server down: every deploy dropped live
+ *   sessions and refused connections until the new process bound its ports
+ * - The running process starts a fresh binary and passes its listening
+ *   sockets to it; the kernel accept queue is shared, so no SYN is
+ *   refused during the switch
+ * - POSIX: exec, with the sockets sent over a Unix socket (SCM_RIGHTS)
+ * - Windows: CreateProcess inheriting only a pipe pair, with each listener
+ *   sent as a WSADuplicateSocket protocol-info block for the new pid
+ * - The old process stops accepting and drains; the successor accepts at once
+ */
+class ListenerHandoff {
+public:
+    // Successor side: listeners inherited from the predecessor (name -> socket).
+    // Empty when this process was started normally.
+    static std::map<std::string, SOCKET> receive();
+
+    // Successor side: tell the predecessor we are accepting so it can drain
+    static void notifyReady();
+
+    // Successor side: true once the predecessor has exited (or there was none)
+    static bool predecessorGone();
+
+    // Predecessor side: start the current binary with the same arguments and
+    // hand it the listeners. True once the successor reports ready.
+    static bool upgrade(const std::map<std::string, SOCKET>& listeners, int timeoutMs);
+};
@@ -0,0 +1,56 @@
+#include "core/periodic_reloader.h"
+
+#include <algorithm>
+#include <chrono>
+
+PeriodicReloader::PeriodicReloader(int intervalSec, std::function<void()> reload)
+    : reload_(std::move(reload)), intervalSec_(std::max(1, intervalSec)) {}
+
+PeriodicReloader::~PeriodicReloader() {
+    stop();
+}
+
+void PeriodicReloader::setInterval(int seconds) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        intervalSec_ = std::max(1, seconds);
+        ++generation_;
+    }
+    cv_.notify_all();
+}
+
+void PeriodicReloader::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    thread_ = std::thread(&PeriodicReloader::run, this);
+}
+
+void PeriodicReloader::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void PeriodicReloader::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        uint64_t generation = generation_;
+        bool woken = cv_.wait_for(lock, std::chrono::seconds(intervalSec_), [&] {
+            return !running_ || generation_ != generation;
+        });
+        if (!running_)
+            break;
+        if (woken)
+            continue; // new interval: start the wait over
+
+        lock.unlock();
+        reload_();
+        lock.lock();
+    }
+}
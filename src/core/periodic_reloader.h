@@ -0,0 +1,56 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Periodic Reloader
+ *
+ * WHY REQUIRED:
+ * - DNSBL zones, DKIM signing keys and the Public Suffix List are all
+ *   re-checked on an interval by a background thread that stop() must be
+ *   able to wake at once; one implementation instead of three copies
+ * - setInterval() takes effect immediately: a pending wait restarts with
+ *   the new interval rather than finishing the old one
+ * - The owner's reload() keeps its own lock for its own state; readers
+ *   never take it, they load a SharedSnapshot
+ */
+class PeriodicReloader {
+public:
+    PeriodicReloader(int intervalSec, std::function<void()> reload);
+    ~PeriodicReloader();
+
+    PeriodicReloader(const PeriodicReloader&) = delete;
+    PeriodicReloader& operator=(const PeriodicReloader&) = delete;
+
+    void setInterval(int seconds);
+    void start();
+    // Wakes the thread and joins it; a reload in progress finishes first
+    void stop();
+
+private:
+    void run();
+
+    std::function<void()> reload_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int intervalSec_ = 60;
+    uint64_t generation_ = 0;   // bumped by setInterval() to restart the wait
+    bool running_ = false;
+    std::thread thread_;
+};
+
+// Immutable state swapped in whole by a reload; readers load it lock-free
+template <typename T>
+class SharedSnapshot {
+public:
+    std::shared_ptr<const T> load() const { return std::atomic_load(&ptr_); }
+    void store(std::shared_ptr<const T> next) { std::atomic_store(&ptr_, std::move(next)); }
+
+private:
+    std::shared_ptr<const T> ptr_;
+};
@@ -0,0 +1,59 @@
+#include "core/worker_pool.h"
+#include "core/logger.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threads, const std::string& name)
+    : name_(name) {
+    threads = std::max<size_t>(threads, 1);
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        workers_.emplace_back(&WorkerPool::workerLoop, this);
+
+    Logger::instance().log(LogLevel::Info,
+        "WorkerPool: " + name_ + " started with " + std::to_string(threads) + " thread(s)");
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_)
+        if (t.joinable()) t.join();
+}
+
+WorkerPool& WorkerPool::crypto() {
+    static WorkerPool pool(std::max(2u, std::thread::hardware_concurrency()), "crypto");
+    return pool;
+}
+
+void WorkerPool::post(std::function<void()> job, bool urgent) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        (urgent ? urgent_ : jobs_).push(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+size_t WorkerPool::queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.size() + urgent_.size();
+}
+
+void WorkerPool::workerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return !jobs_.empty() || !urgent_.empty() || !running_; });
+            if (!running_ && jobs_.empty() && urgent_.empty())
+                break;
+            auto& next = urgent_.empty() ? jobs_ : urgent_;
+            job = std::move(next.front());
+            next.pop();
+        }
+        job(); // packaged_task keeps exceptions in the future
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker Pool
+ *
+ * WHY REQUIRED:
+ * - CPU-bound work (signature verification and signing) should not run
+ *   one job after another on a session thread, nor spawn a thread per job
+ * - A fixed set of workers drains a FIFO queue; submit() hands back a
+ *   future, and callers that stop caring can simply drop it
+ * - crypto() is the shared pool for DKIM, sized to the core count
+ * - submitUrgent() jobs run before anything already queued: inbound
+ *   verification, which holds an SMTP reply, goes ahead of bulk signing
+ */
+class WorkerPool {
+public:
+    WorkerPool(size_t threads, const std::string& name);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    static WorkerPool& crypto();
+
+    template <typename F>
+    auto submit(F&& fn) -> std::future<decltype(fn())> {
+        using R = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+        std::future<R> result = task->get_future();
+        post([task] { (*task)(); }, false);
+        return result;
+    }
+
+    template <typename F>
+    auto submitUrgent(F&& fn) -> std::future<decltype(fn())> {
+        using R = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+        std::future<R> result = task->get_future();
+        post([task] { (*task)(); }, true);
+        return result;
+    }
+
+    size_t size() const { return workers_.size(); }
+    size_t queued() const;
+
+private:
+    void post(std::function<void()> job, bool urgent);
+    void workerLoop();
+
+    std::string name_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::queue<std::function<void()>> jobs_;
+    std::queue<std::function<void()>> urgent_;   // drained first
+    bool running_ = true;
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,224 @@
+#include "delivery/destination_health.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+
+using SteadyClock = std::chrono::steady_clock;
+
+DestinationHealth& DestinationHealth::instance() {
+    static DestinationHealth h;
+    return h;
+}
+
+std::string DestinationHealth::domainKey(const std::string& domain) {
+    std::string key = domain;
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return key;
+}
+
+DestinationStats& DestinationHealth::entry(Table& table, const std::string& key) {
+    DestinationStats& s = table[key];
+    s.lastUsed = SteadyClock::now();
+    return s;
+}
+
+// Drop entries nobody has asked about for IDLE_EVICT_SEC: closed ones carry
+// nothing worth keeping, and an open one whose retry time is that far gone
+// would only be probed afresh
+void DestinationHealth::sweepLocked() {
+    auto now = SteadyClock::now();
+    if (now - lastSweep_ < std::chrono::seconds(SWEEP_INTERVAL_SEC))
+        return;
+    lastSweep_ = now;
+
+    auto cutoff = now - std::chrono::seconds(IDLE_EVICT_SEC);
+    size_t evicted = 0;
+    for (Table* table : { &byAddress_, &byDomain_ }) {
+        for (auto it = table->begin(); it != table->end();) {
+            const DestinationStats& s = it->second;
+            bool idle = s.lastUsed < cutoff &&
+                        (s.state == CircuitState::Closed ||
+                         (s.state == CircuitState::Open && s.retryAt < cutoff));
+            if (idle) {
+                it = table->erase(it);
+                ++evicted;
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (evicted > 0)
+        Metrics::instance().inc("delivery_health_evicted_total", static_cast<int>(evicted));
+    Metrics::instance().set("delivery_health_entries",
+                            static_cast<int>(byAddress_.size() + byDomain_.size()));
+}
+
+bool DestinationHealth::allow(Table& table, const std::string& key) {
+    auto it = table.find(key);
+    if (it == table.end())
+        return true;
+
+    DestinationStats& s = it->second;
+    auto now = SteadyClock::now();
+    s.lastUsed = now;
+
+    switch (s.state) {
+    case CircuitState::Closed:
+        return true;
+
+    case CircuitState::Open:
+        if (now < s.retryAt)
+            return false;
+        // Backoff elapsed: this caller becomes the probe
+        s.state = CircuitState::HalfOpen;
+        s.probeStartedAt = now;
+        Logger::instance().log(LogLevel::Info,
+            "DestinationHealth: Probing " + key);
+        return true;
+
+    case CircuitState::HalfOpen:
+        if (now - s.probeStartedAt > std::chrono::seconds(PROBE_TIMEOUT_SEC)) {
+            s.probeStartedAt = now;
+            return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool DestinationHealth::allowDomain(const std::string& domain) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allow(byDomain_, domainKey(domain));
+}
+
+bool DestinationHealth::allowAddress(const std::string& ip) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allow(byAddress_, ip);
+}
+
+void DestinationHealth::onSuccess(DestinationStats& s, double latencyMs) {
+    s.successes++;
+    s.consecutiveFailures = 0;
+    s.openCount = 0;
+    s.state = CircuitState::Closed;
+    s.avgLatencyMs = (s.avgLatencyMs == 0.0)
+        ? latencyMs
+        : LATENCY_ALPHA * latencyMs + (1.0 - LATENCY_ALPHA) * s.avgLatencyMs;
+}
+
+void DestinationHealth::onFailure(DestinationStats& s, const std::string& key) {
+    s.consecutiveFailures++;
+
+    // A failed probe re-opens immediately; otherwise wait for the threshold
+    if (s.state != CircuitState::HalfOpen &&
+        s.consecutiveFailures < FAILURE_THRESHOLD)
+        return;
+
+    int backoff = std::min(MAX_BACKOFF_SEC,
+                           BASE_BACKOFF_SEC << std::min(s.openCount, 6));
+    s.openCount++;
+    s.state = CircuitState::Open;
+    s.retryAt = SteadyClock::now() + std::chrono::seconds(backoff);
+
+    Metrics::instance().inc("delivery_circuit_opened_total");
+    Logger::instance().log(LogLevel::Warn,
+        "DestinationHealth: Circuit open for " + key + " (" +
+        std::to_string(s.consecutiveFailures) + " consecutive failures, retry in " +
+        std::to_string(backoff) + "s)");
+}
+
+void DestinationHealth::publishOpenCount() {
+    int open = 0;
+    for (const auto& [ip, s] : byAddress_)
+        if (s.state != CircuitState::Closed) open++;
+    Metrics::instance().set("delivery_circuit_open_addresses", open);
+}
+
+void DestinationHealth::recordSuccess(const std::string& ip,
+                                      const std::string& domain,
+                                      double latencyMs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    onSuccess(entry(byAddress_, ip), latencyMs);
+    onSuccess(entry(byDomain_, domainKey(domain)), latencyMs);
+    sweepLocked();
+    publishOpenCount();
+}
+
+void DestinationHealth::recordConnectFailure(const std::string& ip,
+                                             const std::string& domain) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = domainKey(domain);
+    DestinationStats& a = entry(byAddress_, ip);
+    DestinationStats& d = entry(byDomain_, key);
+    a.connectFailures++;
+    d.connectFailures++;
+    onFailure(a, ip);
+    onFailure(d, key);
+    sweepLocked();
+    publishOpenCount();
+}
+
+void DestinationHealth::recordResponseFailure(const std::string& ip,
+                                              const std::string& domain) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = domainKey(domain);
+    DestinationStats& a = entry(byAddress_, ip);
+    DestinationStats& d = entry(byDomain_, key);
+    a.responseFailures++;
+    d.responseFailures++;
+    onFailure(a, ip);
+    onFailure(d, key);
+    sweepLocked();
+    publishOpenCount();
+}
+
+void DestinationHealth::recordNoAttempt(const std::string& domain,
+                                        const std::vector<std::string>& ips) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byDomain_.find(domainKey(domain));
+    if (it == byDomain_.end() || it->second.state != CircuitState::HalfOpen)
+        return;
+
+    // Nothing was sent, so nothing was learned: rather than holding the
+    // probe until PROBE_TIMEOUT_SEC, reopen until the earliest address
+    // circuit lets a connection through
+    auto now = SteadyClock::now();
+    auto retryAt = SteadyClock::time_point::max();
+    for (const auto& ip : ips) {
+        auto ait = byAddress_.find(ip);
+        if (ait == byAddress_.end())
+            continue;
+        const DestinationStats& a = ait->second;
+        if (a.state == CircuitState::Open)
+            retryAt = std::min(retryAt, a.retryAt);
+        else if (a.state == CircuitState::HalfOpen)
+            retryAt = std::min(retryAt, a.probeStartedAt + std::chrono::seconds(PROBE_TIMEOUT_SEC));
+    }
+    if (retryAt == SteadyClock::time_point::max())
+        retryAt = now + std::chrono::seconds(BASE_BACKOFF_SEC);
+    it->second.state = CircuitState::Open;
+    it->second.retryAt = std::max(retryAt, now);
+}
+
+int DestinationHealth::secondsUntilRetry(const std::string& domain) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byDomain_.find(domainKey(domain));
+    if (it == byDomain_.end() || it->second.state == CircuitState::Closed)
+        return BASE_BACKOFF_SEC;
+
+    auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
+        it->second.retryAt - SteadyClock::now()).count();
+    return static_cast<int>(std::max<long long>(remaining, BASE_BACKOFF_SEC));
+}
+
+DestinationStats DestinationHealth::stats(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byAddress_.find(key);
+    if (it != byAddress_.end())
+        return it->second;
+    auto dit = byDomain_.find(domainKey(key));
+    return dit != byDomain_.end() ? dit->second : DestinationStats{};
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Destination Health / Delivery Circuit Breaker
+ *
+ * WHY REQUIRED:
+ * - A dead MX costs a full connect timeout for every queued message
+ * - Track connect/response failures and latency per MX IP and per domain
+ * - Open the circuit after repeated failures and defer without connecting
+ * - After a backoff, let a single probe through (half-open) to test recovery
+ * - Domains are keyed lowercase; entries idle for an hour are swept, so
+ *   the tables stay bounded by the destinations actually in use
+ */
+enum class CircuitState {
+    Closed,     // healthy, all attempts allowed
+    Open,       // failing, attempts deferred until retryAt
+    HalfOpen    // backoff elapsed, one probe in flight
+};
+
+struct DestinationStats {
+    CircuitState state = CircuitState::Closed;
+    int consecutiveFailures = 0;
+    int openCount = 0;                 // consecutive openings (drives backoff)
+    uint64_t successes = 0;
+    uint64_t connectFailures = 0;
+    uint64_t responseFailures = 0;
+    double avgLatencyMs = 0.0;         // EWMA of connect+greeting latency
+    std::chrono::steady_clock::time_point retryAt;
+    std::chrono::steady_clock::time_point probeStartedAt;
+    std::chrono::steady_clock::time_point lastUsed;   // drives the idle sweep
+};
+
+class DestinationHealth {
+public:
+    static DestinationHealth& instance();
+
+    // Domain-level gate; false means defer the whole domain now
+    bool allowDomain(const std::string& domain);
+    // Address-level gate; may hand out the single half-open probe
+    bool allowAddress(const std::string& ip);
+
+    void recordSuccess(const std::string& ip, const std::string& domain, double latencyMs);
+    void recordConnectFailure(const std::string& ip, const std::string& domain);
+    void recordResponseFailure(const std::string& ip, const std::string& domain);
+    // The domain was admitted but every address in ips was circuit-open:
+    // hand its probe back (Open again until the first address reopens)
+    void recordNoAttempt(const std::string& domain, const std::vector<std::string>& ips);
+
+    // Seconds until the domain (or, if closed, the address) may be retried
+    int secondsUntilRetry(const std::string& domain) const;
+
+    DestinationStats stats(const std::string& key) const;
+
+private:
+    DestinationHealth() = default;
+
+    using Table = std::unordered_map<std::string, DestinationStats>;
+
+    static std::string domainKey(const std::string& domain);
+    bool allow(Table& table, const std::string& key);
+    DestinationStats& entry(Table& table, const std::string& key);
+    void sweepLocked();
+    void onSuccess(DestinationStats& s, double latencyMs);
+    void onFailure(DestinationStats& s, const std::string& key);
+    void publishOpenCount();
+
+    static constexpr int FAILURE_THRESHOLD = 3;        // consecutive failures
+    static constexpr int BASE_BACKOFF_SEC = 30;
+    static constexpr int MAX_BACKOFF_SEC = 1800;
+    static constexpr int PROBE_TIMEOUT_SEC = 120;      // reclaim a lost probe
+    static constexpr double LATENCY_ALPHA = 0.2;
+    static constexpr int IDLE_EVICT_SEC = 3600;        // forget unused entries
+    static constexpr int SWEEP_INTERVAL_SEC = 300;
+
+    mutable std::mutex mutex_;
+    Table byAddress_;
+    Table byDomain_;
+    std::chrono::steady_clock::time_point lastSweep_ = std::chrono::steady_clock::now();
+};
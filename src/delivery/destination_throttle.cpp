@@ -0,0 +1,268 @@
+#include "delivery/destination_throttle.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+using SteadyClock = std::chrono::steady_clock;
+
+DestinationThrottle& DestinationThrottle::instance() {
+    static DestinationThrottle t;
+    return t;
+}
+
+DestinationThrottle::DestinationThrottle() {
+    std::filesystem::create_directories("data");
+    lastSave_ = SteadyClock::now();
+    load();
+}
+
+std::string DestinationThrottle::normalize(const std::string& domain) {
+    std::string d = domain;
+    while (!d.empty() && (d.back() == '.' || d.back() == '>' || std::isspace((unsigned char)d.back())))
+        d.pop_back();
+    std::transform(d.begin(), d.end(), d.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return d;
+}
+
+void DestinationThrottle::configure(
+    const std::map<std::string, DeliveryThrottleOverride>& overrides) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    overrides_.clear();
+    for (const auto& [domain, o] : overrides)
+        overrides_[normalize(domain)] = o;
+
+    // Clamp anything already learned to the new ceilings
+    for (auto& [domain, d] : domains_) {
+        d.concurrency = std::min(d.concurrency, (double)ceilingConcurrency(domain));
+        d.perMinute = std::min(d.perMinute, (double)ceilingPerMinute(domain));
+    }
+    Logger::instance().log(LogLevel::Info,
+        "DestinationThrottle: " + std::to_string(overrides_.size()) +
+        " static domain override(s)");
+}
+
+int DestinationThrottle::ceilingConcurrency(const std::string& domain) const {
+    auto it = overrides_.find(domain);
+    if (it != overrides_.end() && it->second.maxConcurrency > 0)
+        return it->second.maxConcurrency;
+    return DEFAULT_MAX_CONCURRENCY;
+}
+
+int DestinationThrottle::ceilingPerMinute(const std::string& domain) const {
+    auto it = overrides_.find(domain);
+    if (it != overrides_.end() && it->second.maxPerMinute > 0)
+        return it->second.maxPerMinute;
+    return DEFAULT_MAX_PER_MINUTE;
+}
+
+DestinationThrottle::DomainLimit& DestinationThrottle::entry(const std::string& domain) {
+    auto it = domains_.find(domain);
+    if (it != domains_.end()) {
+        it->second.lastUsed = SteadyClock::now();
+        return it->second;
+    }
+
+    DomainLimit d;
+    d.concurrency = std::min(INITIAL_CONCURRENCY, (double)ceilingConcurrency(domain));
+    d.perMinute = std::min(INITIAL_PER_MINUTE, (double)ceilingPerMinute(domain));
+    d.tokens = 1.0;
+    d.lastRefill = SteadyClock::now();
+    d.lastUsed = d.lastRefill;
+    DomainLimit& added = domains_.emplace(domain, d).first->second;
+    publishUnlocked();
+    return added;
+}
+
+void DestinationThrottle::publishUnlocked() {
+    Metrics::instance().set("delivery_throttle_domains", static_cast<int>(domains_.size()));
+    Metrics::instance().set("delivery_throttle_in_flight", inFlightTotal_);
+}
+
+void DestinationThrottle::refill(DomainLimit& d) {
+    auto now = SteadyClock::now();
+    double elapsed = std::chrono::duration<double>(now - d.lastRefill).count();
+    d.lastRefill = now;
+
+    double perSecond = d.perMinute / 60.0;
+    double depth = std::max(1.0, perSecond * BURST_SECONDS);
+    d.tokens = std::min(depth, d.tokens + elapsed * perSecond);
+}
+
+bool DestinationThrottle::acquire(const std::string& rawDomain) {
+    std::string domain = normalize(rawDomain);
+    std::lock_guard<std::mutex> lock(mutex_);
+    DomainLimit& d = entry(domain);
+    refill(d);
+
+    if (d.inFlight >= std::max(1, (int)d.concurrency) || d.tokens < 1.0) {
+        Metrics::instance().inc("delivery_throttled_total");
+        return false;
+    }
+
+    d.inFlight++;
+    d.tokens -= 1.0;
+    inFlightTotal_++;
+    publishUnlocked();
+    return true;
+}
+
+void DestinationThrottle::release(const std::string& rawDomain, ThrottleSignal signal) {
+    std::string domain = normalize(rawDomain);
+    std::lock_guard<std::mutex> lock(mutex_);
+    DomainLimit& d = entry(domain);
+    if (d.inFlight > 0) {
+        d.inFlight--;
+        inFlightTotal_--;
+    }
+
+    auto now = SteadyClock::now();
+
+    if (signal == ThrottleSignal::Success) {
+        // Additive increase: one concurrency step per window of successes
+        d.concurrency = std::min((double)ceilingConcurrency(domain),
+                                 d.concurrency + 1.0 / std::max(1.0, d.concurrency));
+        d.perMinute = std::min((double)ceilingPerMinute(domain),
+                               d.perMinute + RATE_INCREASE);
+        dirty_ = true;
+    } else if (signal == ThrottleSignal::Deferred) {
+        // Multiplicative decrease, once per holdoff so a burst of 421s
+        // from parallel sessions counts as a single congestion event
+        if (now - d.lastDecrease >= std::chrono::seconds(DECREASE_HOLDOFF_SEC)) {
+            d.lastDecrease = now;
+            d.concurrency = std::max(1.0, std::floor(d.concurrency * DECREASE_FACTOR));
+            d.perMinute = std::max(1.0, d.perMinute * DECREASE_FACTOR);
+            d.tokens = std::min(d.tokens, 1.0);
+            dirty_ = true;
+
+            Metrics::instance().inc("delivery_throttle_backoff_total");
+            Logger::instance().log(LogLevel::Warn,
+                "DestinationThrottle: Backing off " + domain +
+                " to concurrency=" + std::to_string((int)d.concurrency) +
+                " rate=" + std::to_string((int)d.perMinute) + "/min");
+        }
+    }
+
+    publishUnlocked();
+}
+
+int DestinationThrottle::secondsUntilSlot(const std::string& domain) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = domains_.find(normalize(domain));
+    if (it == domains_.end())
+        return 0;
+
+    const DomainLimit& d = it->second;
+    if (d.tokens >= 1.0)
+        return 1; // blocked on concurrency; a slot frees as soon as a session ends
+
+    double perSecond = std::max(d.perMinute / 60.0, 1.0 / 60.0);
+    return std::max(1, (int)std::ceil((1.0 - d.tokens) / perSecond));
+}
+
+void DestinationThrottle::load() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!std::filesystem::exists(dbPath_)) return;
+
+    try {
+        std::ifstream in(dbPath_);
+        json j; in >> j;
+        for (auto& [domain, data] : j.items()) {
+            DomainLimit d;
+            d.concurrency = std::max(1.0, data["concurrency"].get<double>());
+            d.perMinute = std::max(1.0, data["per_minute"].get<double>());
+            d.tokens = 1.0;
+            d.lastRefill = SteadyClock::now();
+            d.lastUsed = d.lastRefill;
+            domains_[normalize(domain)] = d;
+        }
+        Logger::instance().log(LogLevel::Info,
+            "DestinationThrottle: Loaded limits for " +
+            std::to_string(domains_.size()) + " domain(s)");
+    } catch (...) {
+        Logger::instance().log(LogLevel::Error, "DestinationThrottle: Load failed");
+    }
+}
+
+void DestinationThrottle::evictIdleUnlocked() {
+    auto cutoff = SteadyClock::now() - std::chrono::seconds(IDLE_EVICT_SEC);
+    size_t before = domains_.size();
+    for (auto it = domains_.begin(); it != domains_.end();) {
+        if (it->second.inFlight == 0 && it->second.lastUsed < cutoff)
+            it = domains_.erase(it);
+        else
+            ++it;
+    }
+    if (domains_.size() != before) {
+        Metrics::instance().inc("delivery_throttle_evicted_total",
+                                static_cast<int>(before - domains_.size()));
+        dirty_ = true;
+        publishUnlocked();
+    }
+}
+
+// Copy of the learned limits; the caller writes it after dropping mutex_
+std::string DestinationThrottle::snapshotUnlocked() {
+    json j = json::object();
+    for (const auto& [domain, d] : domains_) {
+        j[domain] = {
+            {"concurrency", d.concurrency},
+            {"per_minute", d.perMinute}
+        };
+    }
+    dirty_ = false;
+    lastSave_ = SteadyClock::now();
+    return j.dump(2);
+}
+
+// Called with writeMutex_ held, so snapshots reach the file in order
+void DestinationThrottle::write(const std::string& data) {
+    try {
+        std::string tmp = dbPath_ + ".tmp";
+        std::ofstream out(tmp);
+        out << data;
+        out.close();
+        std::filesystem::rename(tmp, dbPath_);
+    } catch (const std::exception& ex) {
+        Logger::instance().log(LogLevel::Error,
+            std::string("DestinationThrottle: Save failed: ") + ex.what());
+        std::lock_guard<std::mutex> relock(mutex_);
+        dirty_ = true; // try again next interval
+    }
+}
+
+void DestinationThrottle::maintain() {
+    std::lock_guard<std::mutex> writeLock(writeMutex_);
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (SteadyClock::now() - lastSave_ < std::chrono::seconds(SAVE_INTERVAL_SEC))
+            return;
+        evictIdleUnlocked();
+        if (!dirty_) {
+            lastSave_ = SteadyClock::now();
+            return;
+        }
+        data = snapshotUnlocked();
+    }
+    write(data);
+}
+
+void DestinationThrottle::save() {
+    std::lock_guard<std::mutex> writeLock(writeMutex_);
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dirty_)
+            return;
+        data = snapshotUnlocked();
+    }
+    write(data);
+}
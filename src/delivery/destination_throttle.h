@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include "core/config_loader.h"
+
+/**
+ * Destination Throttle / Adaptive Per-Domain Rate and Concurrency
+ *
+ * WHY REQUIRED:
+ * - Large receivers enforce unpublished per-sender rate limits
+ * - Exceeding them earns 421/4xx deferrals or refused connections
+ * - AIMD: grow concurrency and rate additively on success, halve on deferral
+ * - Static per-domain ceilings come from config (delivery.throttle)
+ * - Learned limits persist in data/delivery_throttle.json across restarts;
+ *   the table is copied under the lock and written outside it, from the
+ *   main loop rather than the delivery path
+ * - Domains idle for a day with nothing in flight are forgotten
+ * - Keyed by lowercased domain without trailing dot; metrics are
+ *   aggregates only, never one series per destination domain
+ */
+enum class ThrottleSignal {
+    Success,    // message accepted
+    Deferred,   // 421/4xx or connection refused: back off
+    Neutral     // permanent failure or local error: no information
+};
+
+class DestinationThrottle {
+public:
+    static DestinationThrottle& instance();
+
+    // Apply static per-domain ceilings from config
+    void configure(const std::map<std::string, DeliveryThrottleOverride>& overrides);
+
+    // Reserve a delivery slot; false means defer (concurrency or rate exhausted)
+    bool acquire(const std::string& domain);
+    // Release a slot acquired above and feed back the remote response
+    void release(const std::string& domain, ThrottleSignal signal);
+
+    // Seconds until a rate token is available for the domain
+    int secondsUntilSlot(const std::string& domain) const;
+
+    // Periodic upkeep from the main loop: evict idle domains and, at most
+    // every SAVE_INTERVAL_SEC, write changed limits
+    void maintain();
+    // Flush learned limits to disk
+    void save();
+
+private:
+    DestinationThrottle();
+
+    struct DomainLimit {
+        double concurrency = 0.0;     // learned limit (fractional for AI step)
+        double perMinute = 0.0;       // learned rate
+        int inFlight = 0;
+        double tokens = 0.0;
+        std::chrono::steady_clock::time_point lastRefill;
+        std::chrono::steady_clock::time_point lastDecrease;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    static std::string normalize(const std::string& domain);
+    DomainLimit& entry(const std::string& domain);
+    void publishUnlocked();
+    void refill(DomainLimit& d);
+    int ceilingConcurrency(const std::string& domain) const;
+    int ceilingPerMinute(const std::string& domain) const;
+    void load();
+    void evictIdleUnlocked();
+    std::string snapshotUnlocked();
+    void write(const std::string& data);
+
+    static constexpr double INITIAL_CONCURRENCY = 2.0;
+    static constexpr double INITIAL_PER_MINUTE = 60.0;
+    static constexpr int DEFAULT_MAX_CONCURRENCY = 20;
+    static constexpr int DEFAULT_MAX_PER_MINUTE = 6000;
+    static constexpr double RATE_INCREASE = 1.0;         // msgs/min per success
+    static constexpr double DECREASE_FACTOR = 0.5;
+    static constexpr int DECREASE_HOLDOFF_SEC = 10;      // one cut per burst of deferrals
+    static constexpr double BURST_SECONDS = 5.0;         // bucket depth
+    static constexpr int SAVE_INTERVAL_SEC = 30;
+    static constexpr int IDLE_EVICT_SEC = 86400;
+
+    std::string dbPath_ = "data/delivery_throttle.json";
+    mutable std::mutex mutex_;
+    std::mutex writeMutex_;     // one writer of dbPath_ at a time; taken before mutex_
+    std::unordered_map<std::string, DomainLimit> domains_;
+    std::map<std::string, DeliveryThrottleOverride> overrides_;
+    int inFlightTotal_ = 0;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point lastSave_;
+};
@@ -0,0 +1,201 @@
+#include "delivery/mx_route_cache.h"
+#include "dns/dns_resolver.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+
+using SteadyClock = std::chrono::steady_clock;
+
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+MxRouteCache& MxRouteCache::instance() {
+    static MxRouteCache c;
+    return c;
+}
+
+MxRouteCache::MxRouteCache()
+    : rng_(std::random_device{}()) {}
+
+// Resolves the addresses of every exchanger with all A/AAAA queries in
+// flight at once; ttl is lowered to the smallest answer TTL
+static void resolveHosts(std::vector<MxHost>& hosts,
+                         uint32_t& ttl,
+                         bool& tempFail) {
+    const DnsRecordType types[] = { DnsRecordType::A, DnsRecordType::AAAA };
+    std::vector<std::shared_future<DnsResolver::Result>> pending;
+    pending.reserve(hosts.size() * 2);
+    for (const auto& h : hosts)
+        for (DnsRecordType type : types)
+            pending.push_back(DnsResolver::instance().queryAsync(h.name, type));
+
+    size_t i = 0;
+    for (auto& h : hosts) {
+        for (DnsRecordType type : types) {
+            const auto& pkt = pending[i++].get();
+            if (!pkt || (pkt->rcode != DnsResponseCode::NoError &&
+                         pkt->rcode != DnsResponseCode::NxDomain)) {
+                tempFail = true;
+                continue;
+            }
+            for (const auto& a : pkt->answers) {
+                if (a.type != type || a.data.empty())
+                    continue;
+                h.addresses.push_back(a.data);
+                ttl = std::min(ttl, a.ttl);
+            }
+        }
+    }
+}
+
+MxRoute MxRouteCache::lookup(const std::string& domain) {
+    MxRoute route;
+    uint32_t ttl = MAX_TTL_SEC;
+
+    auto pkt = DnsResolver::instance().queryPacket(domain, DnsRecordType::MX);
+    if (!pkt || (pkt->rcode != DnsResponseCode::NoError &&
+                 pkt->rcode != DnsResponseCode::NxDomain)) {
+        route.status = MxRouteStatus::TempFail;
+        return route;
+    }
+
+    if (pkt->rcode == DnsResponseCode::NxDomain) {
+        route.status = MxRouteStatus::NxDomain;
+        route.expires = SteadyClock::now() + std::chrono::seconds(NEGATIVE_TTL_SEC);
+        return route;
+    }
+
+    bool tempFail = false;
+    for (const auto& a : pkt->answers) {
+        if (a.type != DnsRecordType::MX)
+            continue;
+        ttl = std::min(ttl, a.ttl);
+
+        // RFC 7505 null MX: domain explicitly accepts no mail
+        if (a.data.empty() || a.data == ".") {
+            route.status = MxRouteStatus::NoMx;
+            route.hosts.clear();
+            route.expires = SteadyClock::now() +
+                std::chrono::seconds(std::clamp(ttl, MIN_TTL_SEC, MAX_TTL_SEC));
+            return route;
+        }
+
+        MxHost h;
+        h.name = toLower(a.data);
+        h.preference = a.preference;
+        route.hosts.push_back(std::move(h));
+    }
+
+    // RFC 5321 5.1: no MX records -> the domain itself is the implicit MX
+    if (route.hosts.empty()) {
+        MxHost h;
+        h.name = domain;
+        route.hosts.push_back(std::move(h));
+    }
+
+    std::stable_sort(route.hosts.begin(), route.hosts.end(),
+        [](const MxHost& a, const MxHost& b) {
+            return a.preference < b.preference;
+        });
+
+    resolveHosts(route.hosts, ttl, tempFail);
+
+    route.hosts.erase(
+        std::remove_if(route.hosts.begin(), route.hosts.end(),
+            [](const MxHost& h) { return h.addresses.empty(); }),
+        route.hosts.end());
+
+    if (route.hosts.empty()) {
+        if (tempFail) {
+            route.status = MxRouteStatus::TempFail;
+            return route;
+        }
+        route.status = MxRouteStatus::NoMx;
+        route.expires = SteadyClock::now() + std::chrono::seconds(NEGATIVE_TTL_SEC);
+        return route;
+    }
+
+    // Some exchangers failed to resolve: retry them soon rather than
+    // deliver via the rest for a whole TTL
+    if (tempFail)
+        ttl = MIN_TTL_SEC;
+
+    route.status = MxRouteStatus::Ok;
+    route.expires = SteadyClock::now() +
+        std::chrono::seconds(std::clamp(ttl, MIN_TTL_SEC, MAX_TTL_SEC));
+    return route;
+}
+
+void MxRouteCache::shuffleEqualPreference(std::vector<MxHost>& hosts) {
+    auto first = hosts.begin();
+    while (first != hosts.end()) {
+        auto last = std::find_if(first, hosts.end(),
+            [&](const MxHost& h) { return h.preference != first->preference; });
+        if (std::distance(first, last) > 1)
+            std::shuffle(first, last, rng_);
+        first = last;
+    }
+}
+
+MxRoute MxRouteCache::resolve(const std::string& rawDomain) {
+    std::string domain = toLower(rawDomain);
+    auto now = SteadyClock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = routes_.find(domain);
+        if (it != routes_.end() && it->second.route.expires > now) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            Metrics::instance().inc("delivery_mx_cache_hits_total");
+            MxRoute route = it->second.route;
+            shuffleEqualPreference(route.hosts);
+            return route;
+        }
+    }
+
+    Metrics::instance().inc("delivery_mx_cache_misses_total");
+    MxRoute route = lookup(domain);
+
+    Logger::instance().log(LogLevel::Debug,
+        "MxRouteCache: Resolved " + domain + " (" +
+        std::to_string(route.hosts.size()) + " exchangers)");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (route.status != MxRouteStatus::TempFail) {
+        auto it = routes_.find(domain);
+        if (it != routes_.end()) {
+            it->second.route = route;
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+        } else {
+            if (routes_.size() >= MAX_ROUTES) {
+                routes_.erase(lru_.back());
+                lru_.pop_back();
+            }
+            lru_.push_front(domain);
+            routes_.emplace(domain, Entry{ route, lru_.begin() });
+        }
+        Metrics::instance().set("delivery_mx_cache_entries",
+                                static_cast<int>(routes_.size()));
+    }
+    shuffleEqualPreference(route.hosts);
+    return route;
+}
+
+void MxRouteCache::invalidate(const std::string& domain) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = routes_.find(toLower(domain));
+    if (it == routes_.end())
+        return;
+    lru_.erase(it->second.lru);
+    routes_.erase(it);
+}
+
+size_t MxRouteCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return routes_.size();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+/**
+ * MX Route Cache
+ *
+ * Resolves a recipient domain to an ordered list of mail exchangers and
+ * their addresses (RFC 5321 section 5.1):
+ * - MX records sorted by preference, equal preferences shuffled per call
+ * - A/AAAA of every exchanger resolved once and cached with the route
+ * - Implicit MX (domain A/AAAA) when the domain publishes no MX
+ * - Null MX (RFC 7505), NXDOMAIN and no-MX results are cached negatively
+ * - Route lifetime follows the smallest TTL seen in the answers
+ * - Any DNS error other than NXDOMAIN is a TempFail and never cached; a
+ *   route missing hosts to such errors is kept only for MIN_TTL_SEC
+ * - Bounded by LRU
+ */
+enum class MxRouteStatus {
+    Ok,
+    NxDomain,   // domain does not exist (permanent)
+    NoMx,       // no MX and no address, or null MX (permanent)
+    TempFail    // resolver unreachable / SERVFAIL (retry later)
+};
+
+struct MxHost {
+    std::string name;
+    uint16_t preference = 0;
+    std::vector<std::string> addresses;   // IPv4 first, then IPv6
+};
+
+struct MxRoute {
+    MxRouteStatus status = MxRouteStatus::TempFail;
+    std::vector<MxHost> hosts;
+    std::chrono::steady_clock::time_point expires;
+};
+
+class MxRouteCache {
+public:
+    static MxRouteCache& instance();
+
+    // Cached route for domain; hosts of equal preference are shuffled
+    MxRoute resolve(const std::string& domain);
+
+    void invalidate(const std::string& domain);
+    size_t size() const;
+
+private:
+    MxRouteCache();
+
+    MxRoute lookup(const std::string& domain);
+    void shuffleEqualPreference(std::vector<MxHost>& hosts);
+
+    static constexpr uint32_t MIN_TTL_SEC = 60;
+    static constexpr uint32_t MAX_TTL_SEC = 86400;
+    static constexpr uint32_t NEGATIVE_TTL_SEC = 300;
+    static constexpr size_t MAX_ROUTES = 16384;
+
+    struct Entry {
+        MxRoute route;
+        std::list<std::string>::iterator lru;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> routes_;
+    std::list<std::string> lru_;            // most recently used first
+    std::mt19937 rng_;
+};
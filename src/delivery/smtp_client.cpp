@@ -1,9 +1,12 @@
 #include "delivery/smtp_client.h"
+#include "delivery/destination_health.h"
 #include "core/logger.h"
 #include "dns/dns_resolver.h"
 #include "core/tls_context.h"
+#include "monitoring/metrics.h"
 #include <sstream>
 #include <chrono>
+#include <cstdlib>
 
 #define WIN32_LEAN_AND_MEAN
 #include <winsock2.h>
@@ -17,34 +20,27 @@ SmtpDeliveryClient& SmtpDeliveryClient::instance() {
     return inst;
 }
 
-std::vector<std::string> SmtpDeliveryClient::lookupMX(const std::string& domain) {
-    std::vector<std::string> mxHosts;
-    
+MxRoute SmtpDeliveryClient::lookupMX(const std::string& domain) {
+    MxRoute route;
+
     try {
-        // Use existing DNS resolver to get MX records
-        // TODO: Implement proper MX record lookup using DNSResolver
-        // For now, return the domain itself as fallback
-        Logger::instance().log(LogLevel::Info,
-            "Delivery: Looking up MX records for " + domain);
-        
-        // Placeholder: In production, use DNSResolver to get MX records
-        // For now, assume domain itself is the mail server
-        mxHosts.push_back(domain);
-        
+        route = MxRouteCache::instance().resolve(domain);
     } catch (const std::exception& ex) {
         Logger::instance().log(LogLevel::Error,
             "Delivery: MX lookup failed for " + domain + ": " + ex.what());
+        route.status = MxRouteStatus::TempFail;
     }
-    
-    return mxHosts;
+
+    return route;
 }
 
 DeliveryResult SmtpDeliveryClient::connectAndDeliver(
     const std::string& mxHost,
     int port,
     const std::string& from,
-    const std::string& to,
-    const std::string& rawMessage
+    const std::vector<std::string>& to,
+    const std::string& rawMessage,
+    const std::string& headerPrefix
 ) {
     DeliveryResult result;
     
@@ -54,7 +50,7 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
     try {
         // Resolve hostname
         addrinfo hints{};
-        hints.ai_family = AF_INET;
+        hints.ai_family = AF_UNSPEC;
         hints.ai_socktype = SOCK_STREAM;
         hints.ai_protocol = IPPROTO_TCP;
         
@@ -62,7 +58,6 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         int res = getaddrinfo(mxHost.c_str(), std::to_string(port).c_str(), &hints, &addrInfo);
         if (res != 0 || !addrInfo) {
             result.errorMessage = "DNS resolution failed for " + mxHost;
-            result.retryAfterSeconds = 300; // Retry in 5 minutes
             return result;
         }
         
@@ -70,7 +65,6 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         sock = socket(addrInfo->ai_family, addrInfo->ai_socktype, addrInfo->ai_protocol);
         if (sock == INVALID_SOCKET) {
             result.errorMessage = "Failed to create socket";
-            result.retryAfterSeconds = 60;
             freeaddrinfo(addrInfo);
             return result;
         }
@@ -81,9 +75,11 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
         
         // Connect
+        auto connectStart = std::chrono::steady_clock::now();
         if (connect(sock, addrInfo->ai_addr, (int)addrInfo->ai_addrlen) == SOCKET_ERROR) {
             result.errorMessage = "Connection failed to " + mxHost;
-            result.retryAfterSeconds = 300;
+            result.connectFailed = true;
+            result.connectRefused = (WSAGetLastError() == WSAECONNREFUSED);
             closesocket(sock);
             freeaddrinfo(addrInfo);
             return result;
@@ -96,20 +92,28 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         int n = recv(sock, buffer, sizeof(buffer) - 1, 0);
         if (n <= 0) {
             result.errorMessage = "Failed to read SMTP greeting";
-            result.retryAfterSeconds = 60;
             closesocket(sock);
             return result;
         }
         buffer[n] = '\0';
+        result.smtpCode = std::atoi(buffer);
+        result.latencyMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - connectStart).count();
+        if (buffer[0] != '2') {
+            result.errorMessage = "Greeting rejected: " + std::string(buffer, n);
+            result.permanentFailure = (buffer[0] == '5');
+            closesocket(sock);
+            return result;
+        }
         
         // Send EHLO
         std::string ehlo = "EHLO " + std::string("mailserver.local") + "\r\n";
         send(sock, ehlo.c_str(), (int)ehlo.length(), 0);
         
         n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        if (n > 0) { buffer[n] = '\0'; result.smtpCode = std::atoi(buffer); }
         if (n <= 0 || buffer[0] != '2') {
             result.errorMessage = "EHLO failed";
-            result.retryAfterSeconds = 60;
             closesocket(sock);
             return result;
         }
@@ -119,23 +123,47 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         send(sock, mailFrom.c_str(), (int)mailFrom.length(), 0);
         
         n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        if (n > 0) { buffer[n] = '\0'; result.smtpCode = std::atoi(buffer); }
         if (n <= 0 || buffer[0] != '2') {
-            result.errorMessage = "MAIL FROM rejected: " + std::string(buffer, n);
+            result.errorMessage = "MAIL FROM rejected: " + std::string(buffer, n > 0 ? n : 0);
             result.permanentFailure = (buffer[0] == '5');
-            result.retryAfterSeconds = result.permanentFailure ? 0 : 300;
             closesocket(sock);
             return result;
         }
         
-        // Send RCPT TO
-        std::string rcptTo = "RCPT TO:<" + to + ">\r\n";
-        send(sock, rcptTo.c_str(), (int)rcptTo.length(), 0);
-        
-        n = recv(sock, buffer, sizeof(buffer) - 1, 0);
-        if (n <= 0 || buffer[0] != '2') {
-            result.errorMessage = "RCPT TO rejected: " + std::string(buffer, n);
-            result.permanentFailure = (buffer[0] == '5');
-            result.retryAfterSeconds = result.permanentFailure ? 0 : 300;
+        // Send RCPT TO for each recipient; rejections are per recipient
+        std::vector<std::string> accepted;
+        bool allPermanent = true;
+        for (const auto& rcpt : to) {
+            std::string rcptTo = "RCPT TO:<" + rcpt + ">\r\n";
+            send(sock, rcptTo.c_str(), (int)rcptTo.length(), 0);
+
+            n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+            if (n <= 0) {
+                result.errorMessage = "Connection lost during RCPT TO";
+                result.recipients.clear();
+                closesocket(sock);
+                return result;
+            }
+            buffer[n] = '\0';
+            result.smtpCode = std::atoi(buffer);
+            if (buffer[0] == '2') {
+                accepted.push_back(rcpt);
+                continue;
+            }
+
+            RecipientResult rr;
+            rr.address = rcpt;
+            rr.smtpCode = result.smtpCode;
+            rr.permanentFailure = (buffer[0] == '5');
+            rr.errorMessage = "RCPT TO rejected: " + std::string(buffer, n);
+            allPermanent = allPermanent && rr.permanentFailure;
+            result.recipients.push_back(rr);
+        }
+
+        if (accepted.empty()) {
+            result.errorMessage = "All recipients rejected";
+            result.permanentFailure = allPermanent;
             closesocket(sock);
             return result;
         }
@@ -145,22 +173,24 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         send(sock, data.c_str(), (int)data.length(), 0);
         
         n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        if (n > 0) { buffer[n] = '\0'; result.smtpCode = std::atoi(buffer); }
         if (n <= 0 || buffer[0] != '3') {
             result.errorMessage = "DATA command failed";
-            result.retryAfterSeconds = 60;
             closesocket(sock);
             return result;
         }
         
-        // Send message
+        // Send message (stored signature fields first, body unchanged)
+        if (!headerPrefix.empty())
+            send(sock, headerPrefix.c_str(), (int)headerPrefix.length(), 0);
         send(sock, rawMessage.c_str(), (int)rawMessage.length(), 0);
         send(sock, "\r\n.\r\n", 5, 0);
         
         n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        if (n > 0) { buffer[n] = '\0'; result.smtpCode = std::atoi(buffer); }
         if (n <= 0 || buffer[0] != '2') {
-            result.errorMessage = "Message rejected: " + std::string(buffer, n);
+            result.errorMessage = "Message rejected: " + std::string(buffer, n > 0 ? n : 0);
             result.permanentFailure = (buffer[0] == '5');
-            result.retryAfterSeconds = result.permanentFailure ? 0 : 300;
             closesocket(sock);
             return result;
         }
@@ -171,13 +201,21 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
         
         result.success = true;
         closesocket(sock);
+
+        for (const auto& rcpt : accepted) {
+            RecipientResult rr;
+            rr.address = rcpt;
+            rr.success = true;
+            rr.smtpCode = result.smtpCode;
+            result.recipients.push_back(rr);
+        }
         
         Logger::instance().log(LogLevel::Info,
-            "Delivery: Successfully delivered to " + to + " via " + mxHost);
+            "Delivery: Successfully delivered to " + std::to_string(accepted.size()) +
+            " recipient(s) via " + mxHost);
         
     } catch (const std::exception& ex) {
         result.errorMessage = "Exception during delivery: " + std::string(ex.what());
-        result.retryAfterSeconds = 300;
         if (sock != INVALID_SOCKET) closesocket(sock);
         if (ssl) SSL_free(ssl);
     }
@@ -185,47 +223,166 @@ DeliveryResult SmtpDeliveryClient::connectAndDeliver(
     return result;
 }
 
+// A 5xx is a healthy host refusing the message; only transport errors and
+// 4xx replies count against the destination.
+static void recordHealth(const std::string& address,
+                         const std::string& domain,
+                         const DeliveryResult& result) {
+    auto& health = DestinationHealth::instance();
+    if (result.connectFailed)
+        health.recordConnectFailure(address, domain);
+    else if (result.success || result.permanentFailure)
+        health.recordSuccess(address, domain, result.latencyMs);
+    else
+        health.recordResponseFailure(address, domain);
+}
+
 DeliveryResult SmtpDeliveryClient::deliver(
     const std::string& from,
     const std::string& to,
     const std::string& rawMessage
 ) {
-    // Extract domain from recipient
-    size_t atPos = to.find('@');
+    return deliver(from, std::vector<std::string>{to}, rawMessage);
+}
+
+DeliveryResult SmtpDeliveryClient::deliver(
+    const std::string& from,
+    const std::vector<std::string>& to,
+    const std::string& rawMessage,
+    const std::string& headerPrefix
+) {
+    return deliver(from, to, rawMessage, headerPrefix, nullptr);
+}
+
+DeliveryResult SmtpDeliveryClient::deliver(
+    const std::string& from,
+    const std::vector<std::string>& to,
+    const std::string& rawMessage,
+    const std::string& headerPrefix,
+    const std::function<bool()>& loadBody
+) {
+    // Extract domain from recipient (callers group recipients by domain)
+    size_t atPos = to.empty() ? std::string::npos : to.front().find('@');
     if (atPos == std::string::npos) {
         DeliveryResult result;
         result.permanentFailure = true;
-        result.errorMessage = "Invalid recipient address: " + to;
+        result.errorMessage = "Invalid recipient address: " + (to.empty() ? std::string() : to.front());
         return result;
     }
     
-    std::string domain = to.substr(atPos + 1);
+    std::string domain = to.front().substr(atPos + 1);
     
-    // Lookup MX records
-    auto mxHosts = lookupMX(domain);
-    if (mxHosts.empty()) {
+    // Lookup MX route (cached per domain)
+    MxRoute route = lookupMX(domain);
+    if (route.status == MxRouteStatus::NxDomain ||
+        route.status == MxRouteStatus::NoMx) {
         DeliveryResult result;
         result.permanentFailure = true;
-        result.errorMessage = "No MX records found for " + domain;
+        result.errorMessage = (route.status == MxRouteStatus::NxDomain)
+            ? "Domain does not exist: " + domain
+            : "No MX records found for " + domain;
         return result;
     }
-    
-    // Try each MX host
-    for (const auto& mxHost : mxHosts) {
-        DeliveryResult result = connectAndDeliver(mxHost, DEFAULT_SMTP_PORT, from, to, rawMessage);
-        if (result.success) {
-            return result;
-        }
-        if (result.permanentFailure) {
-            return result; // Don't try other MX hosts for permanent failures
+    if (route.status == MxRouteStatus::TempFail) {
+        DeliveryResult result;
+        result.errorMessage = "MX lookup temporarily failed for " + domain;
+        return result;
+    }
+
+    // Fast-fail: whole domain is circuit-open, defer without connecting
+    if (!DestinationHealth::instance().allowDomain(domain)) {
+        Metrics::instance().inc("delivery_deferred_circuit_open_total");
+        DeliveryResult result;
+        result.errorMessage = "Destination " + domain + " unavailable (circuit open)";
+        result.deferredLocally = true;
+        result.retryAfterSeconds = DestinationHealth::instance().secondsUntilRetry(domain);
+        return result;
+    }
+
+    // Adaptive per-domain concurrency/rate: defer locally instead of
+    // tripping the receiver's own limits
+    auto& throttle = DestinationThrottle::instance();
+    if (!throttle.acquire(domain)) {
+        DeliveryResult result;
+        result.errorMessage = "Delivery to " + domain + " throttled";
+        result.deferredLocally = true;
+        result.retryAfterSeconds = throttle.secondsUntilSlot(domain);
+        return result;
+    }
+
+    // Only now is the body worth reading: a held domain never touches it
+    if (loadBody && !loadBody()) {
+        throttle.release(domain, ThrottleSignal::Neutral);
+        DeliveryResult result;
+        result.errorMessage = "Message body unreadable";
+        return result;
+    }
+
+    ThrottleSignal signal = ThrottleSignal::Neutral;
+    DeliveryResult result = deliverViaRoute(route, domain, from, to, rawMessage, headerPrefix, signal);
+    throttle.release(domain, signal);
+    return result;
+}
+
+DeliveryResult SmtpDeliveryClient::deliverViaRoute(
+    const MxRoute& route,
+    const std::string& domain,
+    const std::string& from,
+    const std::vector<std::string>& to,
+    const std::string& rawMessage,
+    const std::string& headerPrefix,
+    ThrottleSignal& throttleSignal
+) {
+    bool pushedBack = false;
+
+    // Try each MX host in preference order, each of its addresses in turn
+    bool attempted = false;
+    for (const auto& mx : route.hosts) {
+        for (const auto& address : mx.addresses) {
+            if (!DestinationHealth::instance().allowAddress(address))
+                continue;
+            attempted = true;
+
+            DeliveryResult result = connectAndDeliver(address, DEFAULT_SMTP_PORT, from, to, rawMessage, headerPrefix);
+            recordHealth(address, domain, result);
+
+            // 421/4xx deferrals and refused connections mean "slow down"
+            if (result.connectRefused ||
+                (result.smtpCode >= 400 && result.smtpCode < 500))
+                pushedBack = true;
+
+            if (result.success) {
+                throttleSignal = pushedBack ? ThrottleSignal::Deferred
+                                            : ThrottleSignal::Success;
+                return result;
+            }
+            if (result.permanentFailure) {
+                throttleSignal = pushedBack ? ThrottleSignal::Deferred
+                                            : ThrottleSignal::Neutral;
+                return result; // Don't try other MX hosts for permanent failures
+            }
+            // Temporary failure - try next address / MX host
         }
-        // Temporary failure - try next MX host
     }
-    
-    // All MX hosts failed
+
+    throttleSignal = pushedBack ? ThrottleSignal::Deferred : ThrottleSignal::Neutral;
+
     DeliveryResult result;
+    if (!attempted) {
+        // Every address is circuit-open: defer immediately, and give back the
+        // domain's probe if this call held it
+        std::vector<std::string> addresses;
+        for (const auto& mx : route.hosts)
+            addresses.insert(addresses.end(), mx.addresses.begin(), mx.addresses.end());
+        DestinationHealth::instance().recordNoAttempt(domain, addresses);
+        Metrics::instance().inc("delivery_deferred_circuit_open_total");
+        result.errorMessage = "All MX hosts for " + domain + " unavailable (circuit open)";
+        result.deferredLocally = true;
+        result.retryAfterSeconds = DestinationHealth::instance().secondsUntilRetry(domain);
+        return result;
+    }
+
+    // All MX hosts failed
     result.errorMessage = "All MX hosts failed for " + domain;
-    result.retryAfterSeconds = 300;
     return result;
 }
-
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <optional>
+#include "delivery/mx_route_cache.h"
+#include "delivery/destination_throttle.h"
 
 /**
  * SMTP Delivery Client
@@ -15,11 +18,29 @@
  * - Retry with exponential backoff
  * - Bounce handling for permanent failures
  */
+// Outcome for one RCPT within a transaction
+struct RecipientResult {
+    std::string address;
+    bool success = false;
+    bool permanentFailure = false;
+    int smtpCode = 0;
+    std::string errorMessage;
+};
+
 struct DeliveryResult {
     bool success = false;
     bool permanentFailure = false;
     std::string errorMessage;
-    int retryAfterSeconds = 0; // For temporary failures
+    int retryAfterSeconds = 0; // Explicit earliest retry (circuit cooldown,
+                               // throttle slot); 0 = follow the backoff schedule
+    bool connectFailed = false; // TCP connect never completed
+    bool connectRefused = false; // ... because the peer actively refused it
+    bool deferredLocally = false; // never attempted: throttle or open circuit
+    int smtpCode = 0;           // Last SMTP reply code (0 if none)
+    double latencyMs = 0.0;     // Connect + greeting time
+    // Per-recipient outcomes; recipients not listed share the
+    // transaction-level result above
+    std::vector<RecipientResult> recipients;
 };
 
 class SmtpDeliveryClient {
@@ -34,20 +55,53 @@ public:
         const std::string& rawMessage
     );
 
-    // Lookup MX records for a domain
-    std::vector<std::string> lookupMX(const std::string& domain);
+    // Deliver to several recipients of the same domain in one transaction.
+    // headerPrefix (e.g. DKIM-Signature fields) is sent ahead of rawMessage
+    DeliveryResult deliver(
+        const std::string& from,
+        const std::vector<std::string>& to,
+        const std::string& rawMessage,
+        const std::string& headerPrefix = ""
+    );
 
-    // Connect to SMTP server and deliver
+    // As above, but rawMessage / headerPrefix are only filled in by loadBody,
+    // which runs once the domain has passed its circuit and throttle checks.
+    // A false return defers the domain without connecting
+    DeliveryResult deliver(
+        const std::string& from,
+        const std::vector<std::string>& to,
+        const std::string& rawMessage,
+        const std::string& headerPrefix,
+        const std::function<bool()>& loadBody
+    );
+
+    // Lookup MX route (exchangers + addresses) for a domain
+    MxRoute lookupMX(const std::string& domain);
+
+    // Connect to SMTP server (hostname or IP literal) and deliver
     DeliveryResult connectAndDeliver(
         const std::string& mxHost,
         int port,
         const std::string& from,
-        const std::string& to,
-        const std::string& rawMessage
+        const std::vector<std::string>& to,
+        const std::string& rawMessage,
+        const std::string& headerPrefix = ""
     );
 
 private:
     SmtpDeliveryClient() = default;
+
+    // Walk the route's hosts/addresses; sets throttleSignal from the responses
+    DeliveryResult deliverViaRoute(
+        const MxRoute& route,
+        const std::string& domain,
+        const std::string& from,
+        const std::vector<std::string>& to,
+        const std::string& rawMessage,
+        const std::string& headerPrefix,
+        ThrottleSignal& throttleSignal
+    );
+
     static constexpr int DEFAULT_SMTP_PORT = 25;
     static constexpr int CONNECTION_TIMEOUT_SEC = 30;
 };
@@ -0,0 +1,360 @@
+#include "dns_client.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#ifdef _WIN32
+#include <iphlpapi.h>
+#pragma comment(lib, "iphlpapi.lib")
+#endif
+
+using SteadyClock = std::chrono::steady_clock;
+
+static std::string normalizeName(const std::string& name) {
+    std::string out;
+    out.reserve(name.size());
+    for (char c : name)
+        out.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    if (!out.empty() && out.back() == '.')
+        out.pop_back();
+    return out;
+}
+
+DnsClient& DnsClient::instance() {
+    static DnsClient c;
+    return c;
+}
+
+DnsClient::DnsClient()
+    : rng_(std::random_device{}()) {
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    // Unconnected sockets on random ephemeral ports; replies are matched
+    // against the server address ourselves
+    for (size_t i = 0; i < SOCKET_COUNT; ++i) {
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == INVALID_SOCKET)
+            continue;
+        sockaddr_in any{};
+        any.sin_family = AF_INET;
+        any.sin_addr.s_addr = htonl(INADDR_ANY);
+        bind(s, (sockaddr*)&any, sizeof(any));
+        sockets_.push_back(s);
+    }
+
+    // Loopback socket the submitters poke to interrupt select()
+    wakeSock_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    wakeAddr_.sin_family = AF_INET;
+    wakeAddr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (wakeSock_ != INVALID_SOCKET) {
+        bind(wakeSock_, (sockaddr*)&wakeAddr_, sizeof(wakeAddr_));
+        socklen_t len = sizeof(wakeAddr_);
+        getsockname(wakeSock_, (sockaddr*)&wakeAddr_, &len);
+    }
+
+    // System resolvers until configure(); none is not an error yet, since
+    // dns.servers may still supply them
+    for (const auto& ns : systemNameservers()) {
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons(53);
+        if (inet_pton(AF_INET, ns.c_str(), &a.sin_addr) == 1)
+            servers_.push_back(a);
+    }
+    thread_ = std::thread(&DnsClient::run, this);
+}
+
+DnsClient::~DnsClient() {
+    running_ = false;
+    wake();
+    if (thread_.joinable())
+        thread_.join();
+    for (SOCKET s : sockets_)
+        closesocket(s);
+    if (wakeSock_ != INVALID_SOCKET)
+        closesocket(wakeSock_);
+}
+
+std::vector<std::string> DnsClient::systemNameservers() {
+    std::vector<std::string> out;
+#ifdef _WIN32
+    // The resolvers of every adapter, as ipconfig /all lists them
+    ULONG size = 0;
+    if (GetNetworkParams(nullptr, &size) != ERROR_BUFFER_OVERFLOW)
+        return out;
+    std::vector<char> buf(size);
+    auto* info = reinterpret_cast<FIXED_INFO*>(buf.data());
+    if (GetNetworkParams(info, &size) != NO_ERROR)
+        return out;
+    for (IP_ADDR_STRING* s = &info->DnsServerList; s; s = s->Next) {
+        std::string addr = s->IpAddress.String;
+        in_addr probe{};
+        if (inet_pton(AF_INET, addr.c_str(), &probe) == 1 && probe.s_addr != 0 &&
+            std::find(out.begin(), out.end(), addr) == out.end())
+            out.push_back(addr);
+    }
+#else
+    std::ifstream in("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        std::string keyword, addr;
+        if (ls >> keyword >> addr && keyword == "nameserver") {
+            in_addr probe{};
+            if (inet_pton(AF_INET, addr.c_str(), &probe) == 1)
+                out.push_back(addr);
+        }
+    }
+#endif
+    return out;
+}
+
+bool DnsClient::configure(const std::vector<std::string>& servers, int timeoutMs, int attempts,
+                          uint16_t udpPayload) {
+    // No public fallback: queries (sender domains, recipients) must not leak
+    // to a resolver nobody chose
+    std::vector<std::string> list = servers.empty() ? systemNameservers() : servers;
+    if (list.empty()) {
+        Logger::instance().log(LogLevel::Error,
+            "DnsClient: No system nameservers found and dns.servers is not set");
+        return false;
+    }
+
+    std::vector<sockaddr_in> addrs;
+    for (const auto& s : list) {
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons(53);
+        if (inet_pton(AF_INET, s.c_str(), &a.sin_addr) == 1)
+            addrs.push_back(a);
+        else
+            Logger::instance().log(LogLevel::Warn, "DnsClient: Ignoring invalid server " + s);
+    }
+    if (addrs.empty()) {
+        Logger::instance().log(LogLevel::Error, "DnsClient: No usable nameserver");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    servers_ = addrs;
+    timeoutMs_ = timeoutMs;
+    attempts_ = std::max(1, attempts);
+    udpPayload_ = static_cast<uint16_t>(std::min<size_t>(udpPayload, MAX_UDP_PAYLOAD));
+    return true;
+}
+
+void DnsClient::wake() {
+    if (wakeSock_ != INVALID_SOCKET) {
+        char b = 0;
+        sendto(wakeSock_, &b, 1, 0, (sockaddr*)&wakeAddr_, sizeof(wakeAddr_));
+    }
+}
+
+uint16_t DnsClient::allocateIdLocked(size_t socketIndex) {
+    for (;;) {
+        uint16_t id = static_cast<uint16_t>(rng_() & 0xFFFF);
+        if (!pending_.count(key(socketIndex, id)))
+            return id;
+    }
+}
+
+bool DnsClient::sendLocked(Pending& p) {
+    const sockaddr_in& server = servers_[p.serverIndex % servers_.size()];
+    p.deadline = SteadyClock::now() + std::chrono::milliseconds(timeoutMs_);
+    p.attemptsLeft--;
+    return sendto(sockets_[p.socketIndex], (const char*)p.wire.data(), (int)p.wire.size(), 0,
+                  (const sockaddr*)&server, sizeof(server)) != SOCKET_ERROR;
+}
+
+void DnsClient::query(const std::string& name, DnsRecordType type, Callback cb) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (sockets_.empty() || servers_.empty()) {
+        lock.unlock();
+        cb(std::nullopt);
+        return;
+    }
+
+    size_t idx = nextSocket_++ % sockets_.size();
+    uint16_t id = allocateIdLocked(idx);
+
+    Pending p;
+    p.name = normalizeName(name);
+    p.type = static_cast<uint16_t>(type);
+    p.wire = buildDnsQuery(p.name, p.type, id, udpPayload_);
+    p.socketIndex = idx;
+    p.serverIndex = 0;
+    p.attemptsLeft = attempts_;
+    p.timeoutMs = timeoutMs_;
+    p.started = SteadyClock::now();
+    p.cb = std::move(cb);
+
+    // A failed send just waits for the retry timer
+    sendLocked(p);
+    pending_.emplace(key(idx, id), std::move(p));
+    Metrics::instance().set("dns_queries_inflight", (int)pending_.size());
+    lock.unlock();
+
+    // The I/O thread may be sleeping past this query's deadline
+    wake();
+}
+
+std::shared_future<DnsClient::Result> DnsClient::query(const std::string& name, DnsRecordType type) {
+    auto promise = std::make_shared<std::promise<Result>>();
+    std::shared_future<Result> future = promise->get_future().share();
+    query(name, type, [promise](Result r) { promise->set_value(std::move(r)); });
+    return future;
+}
+
+void DnsClient::handleDatagram(size_t socketIndex, const uint8_t* buf, size_t len,
+                               const sockaddr_in& from) {
+    if (len < 12)
+        return;
+    uint16_t id = static_cast<uint16_t>((buf[0] << 8) | buf[1]);
+
+    Callback cb;
+    Result result;
+    std::vector<uint8_t> tcpWire;
+    int tcpTimeoutMs = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_.find(key(socketIndex, id));
+        if (it == pending_.end())
+            return; // late answer after retry/timeout, or spoofed
+
+        bool knownServer = std::any_of(servers_.begin(), servers_.end(),
+            [&](const sockaddr_in& s) {
+                return s.sin_addr.s_addr == from.sin_addr.s_addr && s.sin_port == from.sin_port;
+            });
+        // Match on the view first: spoofed or stray datagrams cost no copies
+        DnsMessageView view;
+        if (!knownServer || !view.parse(buf, len) || !view.hasQuestion() ||
+            view.questionType() != it->second.type ||
+            !view.questionName().equals(it->second.name)) {
+            Metrics::instance().inc("dns_mismatched_responses_total");
+            return;
+        }
+
+        // A broken or lame upstream: ask the next one while attempts remain
+        DnsResponseCode rcode = view.rcode();
+        if ((rcode == DnsResponseCode::ServFail || rcode == DnsResponseCode::Refused) &&
+            !view.truncated()) {
+            Pending& p = it->second;
+            p.failure = toDnsPacket(view);
+            p.serversFailed++;
+            if (p.serversFailed < servers_.size() && p.attemptsLeft > 0) {
+                Metrics::instance().inc("dns_servfail_retries_total");
+                p.serverIndex++;
+                sendLocked(p);
+                return;
+            }
+        }
+
+        cb = std::move(it->second.cb);
+        if (view.truncated()) {
+            // Answer did not fit: same question over TCP, to the server that
+            // truncated it (it has the full answer)
+            Metrics::instance().inc("dns_truncated_total");
+            tcpWire = std::move(it->second.wire);
+            tcpTimeoutMs = it->second.timeoutMs;
+        } else {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                SteadyClock::now() - it->second.started).count();
+            Metrics::instance().inc("dns_query_latency_ms_sum", (int)ms);
+            Metrics::instance().inc("dns_query_latency_ms_count");
+            result = toDnsPacket(view);
+        }
+        pending_.erase(it);
+    }
+
+    if (!tcpWire.empty()) {
+        tcp_.query(from, std::move(tcpWire), tcpTimeoutMs, std::move(cb));
+        return;
+    }
+    cb(std::move(result));
+}
+
+void DnsClient::expireLocked(std::vector<std::pair<Callback, Result>>& done) {
+    auto now = SteadyClock::now();
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        Pending& p = it->second;
+        if (p.deadline > now) {
+            ++it;
+            continue;
+        }
+        if (p.attemptsLeft > 0) {
+            // Next upstream; same ID so a slow first answer still counts
+            p.serverIndex++;
+            Metrics::instance().inc("dns_query_retries_total");
+            sendLocked(p);
+            ++it;
+            continue;
+        }
+        Metrics::instance().inc("dns_query_failures_total");
+        done.emplace_back(std::move(p.cb), std::move(p.failure));
+        it = pending_.erase(it);
+    }
+}
+
+void DnsClient::run() {
+    uint8_t buf[MAX_UDP_PAYLOAD];
+
+    while (running_) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        SOCKET maxFd = 0;
+        for (SOCKET s : sockets_) {
+            FD_SET(s, &readable);
+            maxFd = std::max(maxFd, s);
+        }
+        if (wakeSock_ != INVALID_SOCKET) {
+            FD_SET(wakeSock_, &readable);
+            maxFd = std::max(maxFd, wakeSock_);
+        }
+
+        // Sleep until the earliest retry timer
+        long waitMs = 1000;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto now = SteadyClock::now();
+            for (const auto& [k, p] : pending_) {
+                long left = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    p.deadline - now).count();
+                waitMs = std::min(waitMs, std::max(0L, left));
+            }
+        }
+        timeval tv{ waitMs / 1000, (waitMs % 1000) * 1000 };
+        int ready = select(static_cast<int>(maxFd) + 1, &readable, nullptr, nullptr, &tv);
+
+        if (ready > 0) {
+            if (wakeSock_ != INVALID_SOCKET && FD_ISSET(wakeSock_, &readable)) {
+                char drain[64];
+                recv(wakeSock_, drain, sizeof(drain), 0);
+            }
+            for (size_t i = 0; i < sockets_.size(); ++i) {
+                if (!FD_ISSET(sockets_[i], &readable))
+                    continue;
+                sockaddr_in from{};
+                socklen_t fromLen = sizeof(from);
+                int n = recvfrom(sockets_[i], (char*)buf, sizeof(buf), 0,
+                                 (sockaddr*)&from, &fromLen);
+                if (n > 0)
+                    handleDatagram(i, buf, static_cast<size_t>(n), from);
+            }
+        }
+
+        std::vector<std::pair<Callback, Result>> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            expireLocked(done);
+            Metrics::instance().set("dns_queries_inflight", (int)pending_.size());
+        }
+        for (auto& [cb, r] : done)
+            cb(std::move(r));
+    }
+}
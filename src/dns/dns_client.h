@@ -0,0 +1,105 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string>
+#include <optional>
+#include <functional>
+#include "dns_packet.h"
+#include "dns_tcp_pool.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+
+/**
+ * Asynchronous Multiplexed DNS Client
+ *
+ * WHY REQUIRED:
+ * - A blocking recv() per lookup parks a thread for every query, and SPF
+ *   includes / MX address lookups were issued strictly one after another
+ * - A handful of long-lived UDP sockets carry every query; one I/O thread
+ *   demultiplexes answers by randomized 16-bit ID, source and question
+ * - Per-query timers retry against the next upstream server, and so does
+ *   a SERVFAIL / REFUSED answer; the failure is reported only once every
+ *   server has failed or attempts run out
+ * - Callers get futures or callbacks, so many lookups overlap from one thread
+ * - Upstreams come from config, else the system's resolvers (resolv.conf,
+ *   or the adapter settings on Windows); with neither, configure() fails
+ *   rather than fall back to a public resolver
+ * - EDNS0 advertises a larger UDP buffer; truncated answers are re-asked
+ *   over pooled TCP connections
+ */
+class DnsClient {
+public:
+    using Result = std::optional<DnsPacket>;
+    using Callback = std::function<void(Result)>;
+
+    static DnsClient& instance();
+
+    // Empty servers: use the system's nameservers. False (logged) when that
+    // leaves no usable server. udpPayload <= 512 disables EDNS0.
+    bool configure(const std::vector<std::string>& servers, int timeoutMs, int attempts,
+                   uint16_t udpPayload = DEFAULT_UDP_PAYLOAD);
+
+    // Callback runs on the I/O thread; it must not block
+    void query(const std::string& name, DnsRecordType type, Callback cb);
+    std::shared_future<Result> query(const std::string& name, DnsRecordType type);
+
+    ~DnsClient();
+
+private:
+    DnsClient();
+
+    struct Pending {
+        std::string name;          // lower-case, no trailing dot
+        uint16_t type = 0;
+        std::vector<uint8_t> wire;
+        size_t socketIndex = 0;
+        size_t serverIndex = 0;
+        int timeoutMs = 0;
+        int attemptsLeft = 0;
+        size_t serversFailed = 0;  // distinct SERVFAIL / REFUSED answers
+        Result failure;            // last of them, reported if nothing better arrives
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point started;
+        Callback cb;
+    };
+
+    void run();
+    void wake();
+    bool sendLocked(Pending& p);
+    void handleDatagram(size_t socketIndex, const uint8_t* buf, size_t len, const sockaddr_in& from);
+    void expireLocked(std::vector<std::pair<Callback, Result>>& done);
+    uint16_t allocateIdLocked(size_t socketIndex);
+    static uint32_t key(size_t socketIndex, uint16_t id) {
+        return (static_cast<uint32_t>(socketIndex) << 16) | id;
+    }
+    static std::vector<std::string> systemNameservers();
+
+    static constexpr size_t SOCKET_COUNT = 4;
+    static constexpr uint16_t DEFAULT_UDP_PAYLOAD = 1232;   // DNS flag day 2020
+    static constexpr size_t MAX_UDP_PAYLOAD = 4096;
+
+    std::mutex mutex_;
+    std::vector<SOCKET> sockets_;
+    SOCKET wakeSock_ = INVALID_SOCKET;
+    sockaddr_in wakeAddr_{};
+    std::vector<sockaddr_in> servers_;
+    int timeoutMs_ = 2000;
+    int attempts_ = 3;
+    uint16_t udpPayload_ = DEFAULT_UDP_PAYLOAD;
+    DnsTcpPool tcp_;
+    size_t nextSocket_ = 0;
+    std::map<uint32_t, Pending> pending_;   // (socket, id) -> query
+    std::mt19937 rng_;
+
+    std::atomic<bool> running_{true};
+    std::thread thread_;
+};
@@ -0,0 +1,210 @@
+#include "dns_message_view.h"
+
+#include <cctype>
+#include <cstdio>
+
+static uint16_t get16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// Visits each label of the name at off; fn(label, len) returns false to stop.
+// All reads are bounds-checked and pointers must strictly move backwards.
+template <typename Fn>
+static bool walkName(const uint8_t* buf, size_t len, size_t off, size_t* next, Fn&& fn) {
+    size_t total = 0;
+    int hops = 0;
+    bool jumped = false;
+
+    while (off < len) {
+        uint8_t l = buf[off];
+        if (l == 0) {
+            if (!jumped && next) *next = off + 1;
+            return total <= DnsMessageView::MAX_NAME_LENGTH;
+        }
+        if ((l & 0xC0) == 0xC0) {
+            if (off + 1 >= len || ++hops > DnsMessageView::MAX_POINTER_HOPS)
+                return false;
+            size_t ptr = (static_cast<size_t>(l & 0x3F) << 8) | buf[off + 1];
+            if (ptr >= off)
+                return false; // forward or self pointer: loop
+            if (!jumped && next) *next = off + 2;
+            jumped = true;
+            off = ptr;
+            continue;
+        }
+        if ((l & 0xC0) != 0 || off + 1 + l > len)
+            return false; // reserved label types, or label past the end
+        total += l + 1;
+        if (total > DnsMessageView::MAX_NAME_LENGTH)
+            return false;
+        if (!fn(buf + off + 1, l))
+            return false;
+        off += 1 + l;
+    }
+    return false;
+}
+
+bool DnsMessageView::skipName(const uint8_t* buf, size_t len, size_t off, size_t& next) {
+    return walkName(buf, len, off, &next, [](const uint8_t*, size_t) { return true; });
+}
+
+bool DnsNameView::equals(std::string_view name) const {
+    if (!msg_)
+        return false;
+    if (!name.empty() && name.back() == '.')
+        name.remove_suffix(1);
+
+    size_t pos = 0;
+    bool first = true;
+    bool ok = walkName(msg_, len_, off_, nullptr, [&](const uint8_t* label, size_t l) {
+        if (!first) {
+            if (pos >= name.size() || name[pos] != '.') return false;
+            ++pos;
+        }
+        first = false;
+        if (pos + l > name.size()) return false;
+        for (size_t i = 0; i < l; ++i) {
+            if (std::tolower(label[i]) != std::tolower(static_cast<unsigned char>(name[pos + i])))
+                return false;
+        }
+        pos += l;
+        return true;
+    });
+    return ok && pos == name.size();
+}
+
+std::string DnsNameView::toString() const {
+    std::string out;
+    if (!msg_)
+        return out;
+    bool ok = walkName(msg_, len_, off_, nullptr, [&](const uint8_t* label, size_t l) {
+        if (!out.empty()) out.push_back('.');
+        out.append(reinterpret_cast<const char*>(label), l);
+        return true;
+    });
+    if (!ok)
+        out.clear();
+    return out;
+}
+
+bool DnsMessageView::parse(const uint8_t* buf, size_t len) {
+    buf_ = buf;
+    len_ = len;
+    answers_.clear();
+    hasQuestion_ = false;
+    if (len < 12)
+        return false;
+
+    id_ = get16(buf);
+    flags_ = get16(buf + 2);
+    uint16_t qd = get16(buf + 4);
+    uint16_t an = get16(buf + 6);
+
+    size_t off = 12;
+    for (uint16_t i = 0; i < qd; ++i) {
+        size_t next = 0;
+        if (!skipName(buf, len, off, next) || next + 4 > len)
+            return false;
+        if (i == 0) {
+            hasQuestion_ = true;
+            qname_ = DnsNameView(buf, len, off);
+            qtype_ = get16(buf + next);
+        }
+        off = next + 4;
+    }
+
+    answers_.reserve(an);
+    for (uint16_t i = 0; i < an; ++i) {
+        size_t next = 0;
+        if (!skipName(buf, len, off, next) || next + 10 > len)
+            return false;
+        DnsRecordView rr;
+        rr.name = DnsNameView(buf, len, off);
+        rr.type = get16(buf + next);
+        rr.cls = get16(buf + next + 2);
+        rr.ttl = get32(buf + next + 4);
+        rr.rdataLength = get16(buf + next + 8);
+        rr.rdataOffset = next + 10;
+        if (rr.rdataOffset + rr.rdataLength > len)
+            return false;
+        answers_.push_back(rr);
+        off = rr.rdataOffset + rr.rdataLength;
+    }
+    // Authority/additional sections are not needed by any caller
+    return true;
+}
+
+DnsResponseCode DnsMessageView::rcode() const {
+    switch (flags_ & 0x000F) {
+        case 0:  return DnsResponseCode::NoError;
+        case 2:  return DnsResponseCode::ServFail;
+        case 3:  return DnsResponseCode::NxDomain;
+        case 5:  return DnsResponseCode::Refused;
+        default: return DnsResponseCode::Other;
+    }
+}
+
+bool DnsMessageView::decodeA(const DnsRecordView& rr, std::string& out) const {
+    if (rr.type != static_cast<uint16_t>(DnsRecordType::A) || rr.rdataLength != 4)
+        return false;
+    const uint8_t* p = buf_ + rr.rdataOffset;
+    char ip[16];
+    snprintf(ip, sizeof(ip), "%u.%u.%u.%u", p[0], p[1], p[2], p[3]);
+    out = ip;
+    return true;
+}
+
+bool DnsMessageView::decodeAAAA(const DnsRecordView& rr, std::string& out) const {
+    if (rr.type != static_cast<uint16_t>(DnsRecordType::AAAA) || rr.rdataLength != 16)
+        return false;
+    const uint8_t* p = buf_ + rr.rdataOffset;
+    char ip[40];
+    snprintf(ip, sizeof(ip), "%x:%x:%x:%x:%x:%x:%x:%x",
+             get16(p), get16(p + 2), get16(p + 4), get16(p + 6),
+             get16(p + 8), get16(p + 10), get16(p + 12), get16(p + 14));
+    out = ip;
+    return true;
+}
+
+bool DnsMessageView::decodeMx(const DnsRecordView& rr, uint16_t& preference,
+                              std::string& exchange) const {
+    if (rr.type != static_cast<uint16_t>(DnsRecordType::MX) || rr.rdataLength < 3)
+        return false;
+    preference = get16(buf_ + rr.rdataOffset);
+    // The exchange may be compressed against earlier parts of the message
+    exchange = DnsNameView(buf_, len_, rr.rdataOffset + 2).toString();
+    size_t next = 0;
+    return skipName(buf_, len_, rr.rdataOffset + 2, next) &&
+           next <= rr.rdataOffset + rr.rdataLength;
+}
+
+bool DnsMessageView::decodeTxt(const DnsRecordView& rr, std::string& out) const {
+    if (rr.type != static_cast<uint16_t>(DnsRecordType::TXT))
+        return false;
+    out.clear();
+    size_t p = rr.rdataOffset, end = rr.rdataOffset + rr.rdataLength;
+    while (p < end) {
+        uint8_t sl = buf_[p++];
+        if (p + sl > end)
+            return false;
+        out.append(reinterpret_cast<const char*>(buf_ + p), sl);
+        p += sl;
+    }
+    return true;
+}
+
+bool DnsMessageView::decodeName(const DnsRecordView& rr, std::string& out) const {
+    if (rr.type != static_cast<uint16_t>(DnsRecordType::CNAME) &&
+        rr.type != static_cast<uint16_t>(DnsRecordType::PTR))
+        return false;
+    size_t next = 0;
+    if (!skipName(buf_, len_, rr.rdataOffset, next) || next > rr.rdataOffset + rr.rdataLength)
+        return false;
+    out = DnsNameView(buf_, len_, rr.rdataOffset).toString();
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+#include "dns_types.h"
+
+/**
+ * Zero-Copy DNS Message View
+ *
+ * WHY REQUIRED:
+ * - Every response used to be exploded into std::strings up front, with
+ *   recursive unbounded compression-pointer chasing and reads past len
+ * - parse() walks the packet once in place, bounds-checking every read,
+ *   and records where each section and resource record lives
+ * - Names are views over the packet: compared and printed on demand
+ * - RDATA is decoded lazily, only for the records a caller asks about
+ * - Compression pointers must point backwards and are limited in number,
+ *   so hostile packets cannot loop
+ */
+class DnsNameView {
+public:
+    DnsNameView() = default;
+    DnsNameView(const uint8_t* msg, size_t len, size_t off) : msg_(msg), len_(len), off_(off) {}
+
+    // Case-insensitive compare with a dotted name (trailing dot optional)
+    bool equals(std::string_view name) const;
+    std::string toString() const;
+
+private:
+    const uint8_t* msg_ = nullptr;
+    size_t len_ = 0;
+    size_t off_ = 0;
+};
+
+struct DnsRecordView {
+    DnsNameView name;
+    uint16_t type = 0;
+    uint16_t cls = 0;
+    uint32_t ttl = 0;
+    size_t rdataOffset = 0;    // into the message
+    uint16_t rdataLength = 0;
+};
+
+class DnsMessageView {
+public:
+    // Validates the whole message; false if any part is malformed
+    bool parse(const uint8_t* buf, size_t len);
+
+    uint16_t id() const { return id_; }
+    uint16_t flags() const { return flags_; }
+    DnsResponseCode rcode() const;
+    bool truncated() const { return (flags_ & 0x0200) != 0; }
+
+    bool hasQuestion() const { return hasQuestion_; }
+    const DnsNameView& questionName() const { return qname_; }
+    uint16_t questionType() const { return qtype_; }
+
+    const std::vector<DnsRecordView>& answers() const { return answers_; }
+
+    // Lazy RDATA decoders; false if the record is not of that type or malformed
+    bool decodeA(const DnsRecordView& rr, std::string& out) const;
+    bool decodeAAAA(const DnsRecordView& rr, std::string& out) const;
+    bool decodeMx(const DnsRecordView& rr, uint16_t& preference, std::string& exchange) const;
+    bool decodeTxt(const DnsRecordView& rr, std::string& out) const;     // strings concatenated
+    bool decodeName(const DnsRecordView& rr, std::string& out) const;    // CNAME / PTR target
+
+    // Bounded name walk; returns offset just past the name in place
+    static bool skipName(const uint8_t* buf, size_t len, size_t off, size_t& next);
+
+    static constexpr int MAX_POINTER_HOPS = 16;
+    static constexpr size_t MAX_NAME_LENGTH = 255;
+
+private:
+    const uint8_t* buf_ = nullptr;
+    size_t len_ = 0;
+    uint16_t id_ = 0;
+    uint16_t flags_ = 0;
+    bool hasQuestion_ = false;
+    DnsNameView qname_;
+    uint16_t qtype_ = 0;
+    std::vector<DnsRecordView> answers_;
+};
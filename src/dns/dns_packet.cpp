@@ -1,74 +1,87 @@
 #include "dns_packet.h"
-#include <stdexcept>
+#include <algorithm>
 
-static uint16_t read16(const uint8_t* buf, size_t& off) {
-    uint16_t v = (buf[off] << 8) | buf[off + 1];
-    off += 2;
-    return v;
-}
+DnsPacket toDnsPacket(const DnsMessageView& view) {
+    DnsPacket pkt{};
+    pkt.id = view.id();
+    pkt.rcode = view.rcode();
+    pkt.truncated = view.truncated();
+    if (view.hasQuestion()) {
+        pkt.qname = view.questionName().toString();
+        pkt.qtype = view.questionType();
+    }
 
-static uint32_t read32(const uint8_t* buf, size_t& off) {
-    uint32_t v = (buf[off] << 24) | (buf[off + 1] << 16)
-               | (buf[off + 2] << 8) | buf[off + 3];
-    off += 4;
-    return v;
-}
+    pkt.answers.reserve(view.answers().size());
+    for (const auto& rr : view.answers()) {
+        DnsAnswer a;
+        a.type = static_cast<DnsRecordType>(rr.type);
+        a.ttl = rr.ttl;
 
-static std::string readName(const uint8_t* buf, size_t& off, size_t max) {
-    std::string name;
-    while (off < max) {
-        uint8_t len = buf[off++];
-        if (len == 0) break;
-        if ((len & 0xC0) == 0xC0) {
-            size_t ptr = ((len & 0x3F) << 8) | buf[off++];
-            size_t tmp = ptr;
-            return name + readName(buf, tmp, max);
+        bool ok;
+        switch (a.type) {
+            case DnsRecordType::A:     ok = view.decodeA(rr, a.data); break;
+            case DnsRecordType::AAAA:  ok = view.decodeAAAA(rr, a.data); break;
+            case DnsRecordType::MX:    ok = view.decodeMx(rr, a.preference, a.data); break;
+            case DnsRecordType::TXT:   ok = view.decodeTxt(rr, a.data); break;
+            case DnsRecordType::CNAME:
+            case DnsRecordType::PTR:   ok = view.decodeName(rr, a.data); break;
+            default:                   continue; // OPT, RRSIG, ...: nothing uses them
         }
-        if (!name.empty()) name += '.';
-        name.append(reinterpret_cast<const char*>(buf + off), len);
-        off += len;
+        if (!ok)
+            continue;
+        a.name = rr.name.toString();
+        pkt.answers.push_back(std::move(a));
     }
-    return name;
+    return pkt;
 }
 
 DnsPacket parseDnsResponse(const uint8_t* buf, size_t len) {
-    DnsPacket pkt{};
-    size_t off = 0;
+    DnsMessageView view;
+    if (!view.parse(buf, len)) {
+        DnsPacket bad{};
+        bad.id = len >= 2 ? static_cast<uint16_t>((buf[0] << 8) | buf[1]) : 0;
+        bad.rcode = DnsResponseCode::Other;
+        return bad;
+    }
+    return toDnsPacket(view);
+}
 
-    pkt.id = read16(buf, off);
-    uint16_t flags = read16(buf, off);
-    pkt.rcode = static_cast<DnsResponseCode>(flags & 0x000F);
+std::vector<uint8_t> buildDnsQuery(const std::string& name, uint16_t type, uint16_t id,
+                                   uint16_t udpPayload) {
+    std::vector<uint8_t> q(12);
+    q[0] = id >> 8;
+    q[1] = id & 0xff;
+    q[2] = 0x01; q[3] = 0x00;
 
-    uint16_t qd = read16(buf, off);
-    uint16_t an = read16(buf, off);
-    read16(buf, off); // NS
-    read16(buf, off); // AR
+    q[5] = 0x01;
 
-    for (int i = 0; i < qd; i++) {
-        readName(buf, off, len);
-        off += 4;
+    // QNAME: length-prefixed labels
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) dot = name.size();
+        size_t len = std::min<size_t>(dot - start, 63);
+        if (len > 0) {
+            q.push_back(static_cast<uint8_t>(len));
+            q.insert(q.end(), name.begin() + start, name.begin() + start + len);
+        }
+        start = dot + 1;
     }
+    q.push_back(0);
 
-    for (int i = 0; i < an; i++) {
-        DnsAnswer a;
-        a.name = readName(buf, off, len);
-        a.type = static_cast<DnsRecordType>(read16(buf, off));
-        off += 2; // class
-        a.ttl = read32(buf, off);
-        uint16_t rdlen = read16(buf, off);
+    q.push_back(type >> 8);
+    q.push_back(type & 0xff);
+    q.push_back(0); q.push_back(1);
 
-        if (a.type == DnsRecordType::A && rdlen == 4) {
-            char ip[16];
-            snprintf(ip, sizeof(ip), "%u.%u.%u.%u",
-                     buf[off], buf[off+1], buf[off+2], buf[off+3]);
-            a.data = ip;
-        } else if (a.type == DnsRecordType::TXT) {
-            uint8_t sl = buf[off];
-            a.data.assign(reinterpret_cast<const char*>(buf + off + 1), sl);
-        }
-        off += rdlen;
-        pkt.answers.push_back(a);
+    // EDNS0 (RFC 6891): root name, TYPE=OPT, CLASS=payload size, no options
+    if (udpPayload > 512) {
+        q[11] = 0x01; // ARCOUNT
+        const uint8_t opt[] = { 0, 0, 41,
+                                static_cast<uint8_t>(udpPayload >> 8),
+                                static_cast<uint8_t>(udpPayload & 0xff),
+                                0, 0, 0, 0, 0, 0 };
+        q.insert(q.end(), opt, opt + sizeof(opt));
     }
 
-    return pkt;
+    return q;
 }
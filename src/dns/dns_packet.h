@@ -3,18 +3,29 @@
 #include <vector>
 #include <cstdint>
 #include "dns_types.h"
+#include "dns_message_view.h"
 
 struct DnsAnswer {
     std::string name;
     DnsRecordType type;
     uint32_t ttl;
-    std::string data;
+    std::string data;          // A/AAAA: address text, TXT: string, MX: exchange
+    uint16_t preference = 0;   // MX only
 };
 
 struct DnsPacket {
     uint16_t id;
     DnsResponseCode rcode;
+    std::string qname;         // first question, as echoed by the server
+    uint16_t qtype = 0;
+    bool truncated = false;    // TC bit: retry over TCP
     std::vector<DnsAnswer> answers;
 };
 
+// Owned copy of a validated view (what the resolver caches)
+DnsPacket toDnsPacket(const DnsMessageView& view);
+// Malformed input yields rcode Other and no answers
 DnsPacket parseDnsResponse(const uint8_t* buf, size_t len);
+// udpPayload > 512 adds an EDNS0 OPT record advertising that buffer size
+std::vector<uint8_t> buildDnsQuery(const std::string& name, uint16_t type, uint16_t id,
+                                   uint16_t udpPayload = 0);
@@ -1,64 +1,262 @@
 #include "dns_resolver.h"
 #include "dns_packet.h"
 #include "dns_types.h"
+#include "dns_client.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
 
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
+#include <algorithm>
+#include <cctype>
+#include <functional>
 
-static const char* DNS_SERVER = "8.8.8.8";
+using SteadyClock = std::chrono::steady_clock;
+
+static const int DNS_ATTEMPTS = 3;   // total sends per query across upstreams
 
 DnsResolver& DnsResolver::instance() {
     static DnsResolver inst;
     return inst;
 }
 
-DnsResolver::DnsResolver() {
-    WSADATA wsa;
-    WSAStartup(MAKEWORD(2, 2), &wsa);
+DnsResolver::~DnsResolver() {
+    {
+        std::lock_guard<std::mutex> lock(sweepMutex_);
+        stopping_ = true;
+    }
+    sweepCv_.notify_all();
+    if (sweeper_.joinable())
+        sweeper_.join();
 }
 
-static std::vector<uint8_t> buildQuery(const std::string& name, uint16_t type) {
-    std::vector<uint8_t> q(12);
-    q[0] = rand() & 0xff;
-    q[1] = rand() & 0xff;
-    q[2] = 0x01; q[3] = 0x00;
+bool DnsResolver::configure(const std::vector<std::string>& servers,
+                            int timeoutMs,
+                            uint16_t udpPayload,
+                            uint32_t minTtl,
+                            uint32_t maxTtl,
+                            uint32_t negativeTtl,
+                            bool prefetch) {
+    if (!DnsClient::instance().configure(servers, timeoutMs, DNS_ATTEMPTS, udpPayload))
+        return false;
+
+    std::lock_guard<std::mutex> lock(configMutex_);
+    minTtl_ = minTtl;
+    maxTtl_ = maxTtl;
+    negativeTtl_ = negativeTtl;
+    prefetch_ = prefetch;
+    if (prefetch && !sweeper_.joinable())
+        sweeper_ = std::thread(&DnsResolver::prefetchLoop, this);
 
-    q[5] = 0x01;
+    std::string list;
+    for (const auto& s : servers)
+        list += (list.empty() ? "" : ",") + s;
+    Logger::instance().log(LogLevel::Info,
+        "DnsResolver: Upstream " + (list.empty() ? std::string("system resolvers") : list) +
+        ", timeout " + std::to_string(timeoutMs) +
+        "ms, edns " + std::to_string(udpPayload) +
+        ", ttl " + std::to_string(minTtl_) + "-" + std::to_string(maxTtl_) +
+        "s, negative " + std::to_string(negativeTtl_) + "s" +
+        (prefetch ? ", prefetch on" : ""));
+    return true;
+}
+
+bool DnsResolver::cacheTtl(const DnsPacket& pkt, DnsRecordType type, uint32_t& ttl) const {
+    std::lock_guard<std::mutex> lock(configMutex_);
 
-    for (auto& label : name) {
-        if (label == '.') q.push_back(0);
-        else q.push_back(label);
+    if (pkt.rcode == DnsResponseCode::NxDomain) {
+        ttl = negativeTtl_;
+        return true;
     }
-    q.push_back(0);
+    if (pkt.rcode != DnsResponseCode::NoError)
+        return false; // SERVFAIL etc. are retried, not remembered
 
-    q.push_back(type >> 8);
-    q.push_back(type & 0xff);
-    q.push_back(0); q.push_back(1);
+    uint32_t minSeen = UINT32_MAX;
+    for (const auto& a : pkt.answers) {
+        if (a.type == type)
+            minSeen = std::min(minSeen, a.ttl);
+    }
+    if (minSeen == UINT32_MAX) {
+        ttl = negativeTtl_; // NODATA
+        return true;
+    }
+    ttl = std::clamp(minSeen, minTtl_, maxTtl_);
+    return true;
+}
+
+void DnsResolver::store(Shard& shard, const std::string& key, const std::string& name,
+                        DnsRecordType type, const DnsPacket& pkt, uint32_t ttl) {
+    auto now = SteadyClock::now();
+
+    // A refresh replaces the answer but keeps the entry's popularity
+    auto existing = shard.entries.find(key);
+    if (existing != shard.entries.end()) {
+        CacheEntry& e = existing->second;
+        e.packet = pkt;
+        e.stored = now;
+        e.expires = now + std::chrono::seconds(ttl);
+        return;
+    }
 
-    return q;
+    if (shard.entries.size() >= MAX_ENTRIES_PER_SHARD) {
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            if (it->second.expires <= now) it = shard.entries.erase(it);
+            else ++it;
+        }
+        if (shard.entries.size() >= MAX_ENTRIES_PER_SHARD)
+            shard.entries.erase(shard.entries.begin());
+    }
+    CacheEntry e;
+    e.packet = pkt;
+    e.name = name;
+    e.type = type;
+    e.stored = now;
+    e.expires = now + std::chrono::seconds(ttl);
+    shard.entries.emplace(key, std::move(e));
 }
 
-std::vector<std::string> DnsResolver::query(const std::string& name,
-                                            uint16_t type) {
-    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(53);
-    inet_pton(AF_INET, DNS_SERVER, &addr.sin_addr);
+DnsResolver::Shard& DnsResolver::shardFor(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % SHARD_COUNT];
+}
+
+DnsResolver::Result DnsResolver::queryPacket(const std::string& name, DnsRecordType type) {
+    return queryAsync(name, type).get();
+}
+
+std::shared_future<DnsResolver::Result> DnsResolver::queryAsync(const std::string& name,
+                                                                DnsRecordType type) {
+    std::string key;
+    key.reserve(name.size() + 6);
+    for (char c : name)
+        key.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    if (!key.empty() && key.back() == '.')
+        key.pop_back();
+    key += "/" + std::to_string(static_cast<uint16_t>(type));
+
+    Shard& shard = shardFor(key);
+    auto promise = std::make_shared<std::promise<Result>>();
+    std::shared_future<Result> future = promise->get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        auto now = SteadyClock::now();
+        if (it != shard.entries.end()) {
+            if (it->second.expires > now) {
+                Metrics::instance().inc("dns_cache_hits_total");
+                it->second.lastAccess = now;
+                it->second.hits++;
+                DnsPacket pkt = it->second.packet;
+                uint32_t age = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                    now - it->second.stored).count());
+                for (auto& a : pkt.answers)
+                    a.ttl = a.ttl > age ? a.ttl - age : 0;
+                promise->set_value(std::move(pkt));
+                return future;
+            }
+        }
+
+        // Someone is already asking: share their answer. An expired entry
+        // with a refresh on the wire is kept so the refresh inherits its hits
+        auto inflight = shard.inflight.find(key);
+        if (inflight != shard.inflight.end()) {
+            Metrics::instance().inc("dns_inflight_coalesced_total");
+            return inflight->second;
+        }
+        if (it != shard.entries.end())
+            shard.entries.erase(it);
+
+        Metrics::instance().inc("dns_cache_misses_total");
+        shard.inflight.emplace(key, future);
+    }
+
+    fetch(shard, key, name, type, std::move(promise), false);
+    return future;
+}
+
+void DnsResolver::fetch(Shard& shard, const std::string& key, const std::string& name,
+                        DnsRecordType type, Promise promise, bool prefetch) {
+    // Completes on the DnsClient I/O thread
+    DnsClient::instance().query(name, type,
+        [this, &shard, key, name, type, promise, prefetch](Result result) {
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            uint32_t ttl = 0;
+            if (result && cacheTtl(*result, type, ttl) && ttl > 0)
+                store(shard, key, name, type, *result, ttl);
+            else if (prefetch)
+                Metrics::instance().inc("dns_prefetch_failed_total"); // old answer runs out its TTL
+            shard.inflight.erase(key);
+        }
+        promise->set_value(std::move(result));
+    });
+}
+
+bool DnsResolver::isHot(const CacheEntry& e, SteadyClock::time_point now) const {
+    return e.hits >= PREFETCH_MIN_HITS &&
+           e.lastAccess >= e.stored &&
+           now - e.lastAccess <= std::chrono::seconds(PREFETCH_HOT_WINDOW_SEC);
+}
+
+void DnsResolver::prefetchLoop() {
+    std::unique_lock<std::mutex> sweepLock(sweepMutex_);
+    while (!sweepCv_.wait_for(sweepLock, std::chrono::milliseconds(PREFETCH_SWEEP_MS),
+                              [this] { return stopping_; })) {
+        if (!prefetch_)
+            continue;
+
+        struct Refresh {
+            Shard* shard;
+            std::string key;
+            std::string name;
+            DnsRecordType type;
+            Promise promise;
+        };
+        std::vector<Refresh> due;
+        auto now = SteadyClock::now();
+        size_t hot = 0;
+
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto& [key, e] : shard.entries) {
+                if (e.expires <= now || !isHot(e, now))
+                    continue;
+                hot++;
+
+                auto lifetime = e.expires - e.stored;
+                auto lead = std::max<SteadyClock::duration>(
+                    std::chrono::seconds(PREFETCH_LEAD_MIN_SEC),
+                    lifetime * PREFETCH_LEAD_PERCENT / 100);
+                if (e.expires - now > lead || due.size() >= PREFETCH_MAX_PER_SWEEP)
+                    continue;
+                if (shard.inflight.count(key))
+                    continue; // refresh (or a miss) already on the wire
 
-    auto q = buildQuery(name, type);
-    sendto(s, (char*)q.data(), q.size(), 0,
-           (sockaddr*)&addr, sizeof(addr));
+                // Registered as in-flight so a lookup racing the expiry
+                // waits for this answer instead of sending its own
+                auto promise = std::make_shared<std::promise<Result>>();
+                shard.inflight.emplace(key, promise->get_future().share());
+                due.push_back(Refresh{ &shard, key, e.name, e.type, std::move(promise) });
+            }
+        }
 
-    uint8_t buf[512];
-    int len = recv(s, (char*)buf, sizeof(buf), 0);
-    closesocket(s);
+        // Sent outside the shard locks: the client may complete inline
+        sweepLock.unlock();
+        for (auto& r : due)
+            fetch(*r.shard, r.key, r.name, r.type, std::move(r.promise), true);
+        sweepLock.lock();
 
-    auto pkt = parseDnsResponse(buf, len);
+        if (!due.empty())
+            Metrics::instance().inc("dns_prefetch_total", static_cast<int>(due.size()));
+        Metrics::instance().set("dns_cache_hot_entries", static_cast<int>(hot));
+    }
+}
+
+std::vector<std::string> DnsResolver::query(const std::string& name,
+                                            uint16_t type) {
     std::vector<std::string> out;
+    auto pkt = queryPacket(name, static_cast<DnsRecordType>(type));
+    if (!pkt)
+        return out;
 
-    for (auto& a : pkt.answers)
+    for (auto& a : pkt->answers)
         if ((uint16_t)a.type == type)
             out.push_back(a.data);
 
@@ -75,5 +273,22 @@ std::vector<std::string> DnsResolver::lookupTxt(const std::string& n) {
     return query(n, (uint16_t)DnsRecordType::TXT);
 }
 std::vector<std::string> DnsResolver::lookupMx(const std::string& n) {
-    return query(n, (uint16_t)DnsRecordType::MX);
+    std::vector<std::string> out;
+    auto pkt = queryPacket(n, DnsRecordType::MX);
+    if (!pkt)
+        return out;
+
+    std::vector<DnsAnswer> mx;
+    for (auto& a : pkt->answers)
+        if (a.type == DnsRecordType::MX)
+            mx.push_back(a);
+
+    std::stable_sort(mx.begin(), mx.end(),
+        [](const DnsAnswer& a, const DnsAnswer& b) {
+            return a.preference < b.preference;
+        });
+
+    for (auto& a : mx)
+        out.push_back(a.data);
+    return out;
 }
@@ -1,17 +1,111 @@
 #pragma once
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <condition_variable>
 #include <vector>
 #include <string>
+#include <optional>
+#include <unordered_map>
+#include "dns_packet.h"
 
+/**
+ * DNS Resolver with Shared Answer Cache
+ *
+ * WHY REQUIRED:
+ * - SPF, DKIM, DMARC and MX resolve the same names for every message
+ * - Answers are cached for their TTL (clamped to [min_ttl, max_ttl])
+ * - NXDOMAIN / NODATA are cached negatively for negative_ttl
+ * - Concurrent identical queries share one in-flight upstream request
+ * - Cache is sharded by name so lookups from many sessions don't serialise
+ * - Misses go to the multiplexed DnsClient; queryAsync lets callers keep
+ *   many lookups in flight at once
+ * - Refresh-ahead: entries hit repeatedly during their lifetime are
+ *   re-queried in the background just before they expire, so hot sender
+ *   domains never all miss at once (dns_cache_hot_entries, dns_prefetch_total)
+ */
 class DnsResolver {
 public:
     static DnsResolver& instance();
 
+    // False when no upstream resolver could be determined
+    bool configure(const std::vector<std::string>& servers,
+                   int timeoutMs,
+                   uint16_t udpPayload,
+                   uint32_t minTtl,
+                   uint32_t maxTtl,
+                   uint32_t negativeTtl,
+                   bool prefetch);
+
     std::vector<std::string> lookupA(const std::string& name);
     std::vector<std::string> lookupAAAA(const std::string& name);
     std::vector<std::string> lookupTxt(const std::string& name);
-    std::vector<std::string> lookupMx(const std::string& name);
+    std::vector<std::string> lookupMx(const std::string& name);   // exchanges, by preference
+
+    using Result = std::optional<DnsPacket>;
+
+    // Full response (rcode + TTLs); nullopt on transport failure.
+    // Cached answers carry their remaining TTL.
+    Result queryPacket(const std::string& name, DnsRecordType type);
+    std::shared_future<Result> queryAsync(const std::string& name, DnsRecordType type);
 
 private:
-    DnsResolver();
+    DnsResolver() = default;
+    ~DnsResolver();
     std::vector<std::string> query(const std::string& name, uint16_t type);
+
+    struct CacheEntry {
+        DnsPacket packet;
+        std::string name;                                   // as queried, for refresh
+        DnsRecordType type = DnsRecordType::A;
+        std::chrono::steady_clock::time_point stored;
+        std::chrono::steady_clock::time_point expires;
+        std::chrono::steady_clock::time_point lastAccess;
+        uint32_t hits = 0;                                  // survives refreshes
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, CacheEntry> entries;
+        std::unordered_map<std::string, std::shared_future<Result>> inflight;
+    };
+
+    using Promise = std::shared_ptr<std::promise<Result>>;
+
+    Shard& shardFor(const std::string& key);
+    bool cacheTtl(const DnsPacket& pkt, DnsRecordType type, uint32_t& ttl) const;
+    void store(Shard& shard, const std::string& key, const std::string& name,
+               DnsRecordType type, const DnsPacket& pkt, uint32_t ttl);
+    void fetch(Shard& shard, const std::string& key, const std::string& name,
+               DnsRecordType type, Promise promise, bool prefetch);
+    bool isHot(const CacheEntry& e, std::chrono::steady_clock::time_point now) const;
+    void prefetchLoop();
+
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr size_t MAX_ENTRIES_PER_SHARD = 4096;
+
+    // Refresh-ahead
+    static constexpr uint32_t PREFETCH_MIN_HITS = 2;       // one-off lookups are left to expire
+    static constexpr int PREFETCH_HOT_WINDOW_SEC = 300;    // must also be hit since last refresh
+    static constexpr int PREFETCH_LEAD_MIN_SEC = 2;        // refresh when this close to expiry...
+    static constexpr int PREFETCH_LEAD_PERCENT = 10;       // ...or within the last 10% of the TTL
+    static constexpr int PREFETCH_SWEEP_MS = 1000;
+    static constexpr size_t PREFETCH_MAX_PER_SWEEP = 256;
+
+    std::array<Shard, SHARD_COUNT> shards_;
+
+    std::atomic<bool> prefetch_{false};
+    std::mutex sweepMutex_;
+    std::condition_variable sweepCv_;
+    bool stopping_ = false;
+    std::thread sweeper_;
+
+    mutable std::mutex configMutex_;
+    uint32_t minTtl_ = 30;
+    uint32_t maxTtl_ = 86400;
+    uint32_t negativeTtl_ = 300;
 };
@@ -0,0 +1,320 @@
+#include "dns_tcp_pool.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+using SteadyClock = std::chrono::steady_clock;
+
+static int64_t steadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        SteadyClock::now().time_since_epoch()).count();
+}
+
+static bool sendAll(SOCKET s, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        int n = ::send(s, (const char*)data, (int)len, 0);
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Each chunk must arrive before the deadline: a stalled peer cannot park
+// the reader in the middle of a frame
+static bool recvAll(SOCKET s, uint8_t* data, size_t len, SteadyClock::time_point deadline) {
+    while (len > 0) {
+        long left = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - SteadyClock::now()).count();
+        if (left <= 0)
+            return false;
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s, &readable);
+        timeval tv{ left / 1000, (left % 1000) * 1000 };
+        if (select(static_cast<int>(s) + 1, &readable, nullptr, nullptr, &tv) <= 0)
+            return false;
+        int n = recv(s, (char*)data, (int)len, 0);
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+DnsTcpPool::Connection::Connection(const sockaddr_in& server)
+    : server_(server), rng_(std::random_device{}()) {}
+
+DnsTcpPool::Connection::~Connection() {
+    close();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+bool DnsTcpPool::Connection::open(int connectTimeoutMs) {
+    sock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock_ == INVALID_SOCKET)
+        return false;
+    u_long nonBlocking = 1;
+    ioctlsocket(sock_, FIONBIO, &nonBlocking);
+    if (connect(sock_, (const sockaddr*)&server_, sizeof(server_)) == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err != WSAEWOULDBLOCK && err != WSAEINPROGRESS) {
+            closesocket(sock_);
+            sock_ = INVALID_SOCKET;
+            return false;
+        }
+    }
+
+    connecting_ = true;
+    connectDeadline_ = SteadyClock::now() + std::chrono::milliseconds(connectTimeoutMs);
+    alive_ = true;
+    lastActivityMs_ = steadyMs();
+    thread_ = std::thread(&Connection::reader, this);
+    return true;
+}
+
+// Reader thread: wait for the handshake, then flush what was queued
+bool DnsTcpPool::Connection::finishConnect() {
+    while (alive_) {
+        long left = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+            connectDeadline_ - SteadyClock::now()).count();
+        if (left <= 0)
+            break;
+        left = std::min(left, 200L);
+
+        fd_set writable, failed;
+        FD_ZERO(&writable);
+        FD_ZERO(&failed);
+        FD_SET(sock_, &writable);
+        FD_SET(sock_, &failed);
+        timeval tv{ 0, left * 1000 };
+        int ready = select(static_cast<int>(sock_) + 1, nullptr, &writable, &failed, &tv);
+        if (ready < 0)
+            break;
+        if (ready == 0)
+            continue;
+
+        int err = 0;
+        socklen_t errLen = sizeof(err);
+        getsockopt(sock_, SOL_SOCKET, SO_ERROR, (char*)&err, &errLen);
+        if (err != 0 || FD_ISSET(sock_, &failed))
+            break;
+
+        u_long blocking = 0;
+        ioctlsocket(sock_, FIONBIO, &blocking);
+        int one = 1;
+        setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof(one));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        connecting_ = false;
+        lastActivityMs_ = steadyMs();
+        Metrics::instance().inc("dns_tcp_connections_opened_total");
+        bool sent = queued_.empty() || sendAll(sock_, queued_.data(), queued_.size());
+        queued_.clear();
+        return sent;
+    }
+    Metrics::instance().inc("dns_tcp_connect_failures_total");
+    return false;
+}
+
+bool DnsTcpPool::Connection::usable() const {
+    return alive_ && steadyMs() - lastActivityMs_ < IDLE_CLOSE_MS;
+}
+
+size_t DnsTcpPool::Connection::inflight() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+void DnsTcpPool::Connection::close() {
+    if (alive_.exchange(false) && sock_ != INVALID_SOCKET)
+        shutdown(sock_, SD_BOTH);
+}
+
+bool DnsTcpPool::Connection::send(std::vector<uint8_t>& wire, int timeoutMs, Callback& cb) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!alive_ || wire.size() < 12 || wire.size() > 0xFFFF)
+        return false;
+
+    DnsMessageView question;
+    if (!question.parse(wire.data(), wire.size()) || !question.hasQuestion())
+        return false;
+
+    uint16_t id;
+    do {
+        id = static_cast<uint16_t>(rng_() & 0xFFFF);
+    } while (pending_.count(id));
+    wire[0] = static_cast<uint8_t>(id >> 8);
+    wire[1] = static_cast<uint8_t>(id & 0xff);
+
+    // RFC 1035 4.2.2: two-byte length prefix
+    std::vector<uint8_t> frame;
+    frame.reserve(wire.size() + 2);
+    frame.push_back(static_cast<uint8_t>(wire.size() >> 8));
+    frame.push_back(static_cast<uint8_t>(wire.size() & 0xff));
+    frame.insert(frame.end(), wire.begin(), wire.end());
+    if (connecting_) {
+        queued_.insert(queued_.end(), frame.begin(), frame.end());
+    } else if (!sendAll(sock_, frame.data(), frame.size())) {
+        close();
+        return false;
+    }
+
+    lastActivityMs_ = steadyMs();
+    Pending& p = pending_[id];
+    p.sentAt = SteadyClock::now();
+    p.deadline = p.sentAt + std::chrono::milliseconds(timeoutMs);
+    p.name = question.questionName().toString();
+    p.type = question.questionType();
+    p.cb = std::move(cb);
+    return true;
+}
+
+void DnsTcpPool::Connection::failAll() {
+    std::map<uint16_t, Pending> failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failed.swap(pending_);
+    }
+    for (auto& [id, p] : failed) {
+        Metrics::instance().inc("dns_query_failures_total");
+        p.cb(std::nullopt);
+    }
+}
+
+bool DnsTcpPool::Connection::expireOverdue(SteadyClock::time_point lastFrame) {
+    std::vector<Callback> expired;
+    bool silent = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = SteadyClock::now();
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (it->second.deadline <= now) {
+                silent = silent || lastFrame < it->second.sentAt;
+                expired.push_back(std::move(it->second.cb));
+                it = pending_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& cb : expired) {
+        Metrics::instance().inc("dns_query_failures_total");
+        cb(std::nullopt);
+    }
+    return silent;
+}
+
+void DnsTcpPool::Connection::reader() {
+    std::vector<uint8_t> buf;
+    if (!finishConnect())
+        alive_ = false;
+    auto lastFrame = SteadyClock::now();
+    // Deadlines are checked every pass, not only when select times out: a
+    // server answering other queries must not keep a lost one pending
+    while (alive_ && !expireOverdue(lastFrame)) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(sock_, &readable);
+        timeval tv{ 0, 200 * 1000 };
+        int ready = select(static_cast<int>(sock_) + 1, &readable, nullptr, nullptr, &tv);
+        if (ready < 0)
+            break;
+        if (ready == 0)
+            continue;
+
+        auto frameDeadline = SteadyClock::now() + std::chrono::milliseconds(FRAME_TIMEOUT_MS);
+        uint8_t lenBuf[2];
+        if (!recvAll(sock_, lenBuf, 2, frameDeadline))
+            break;
+        size_t len = (static_cast<size_t>(lenBuf[0]) << 8) | lenBuf[1];
+        buf.resize(len);
+        if (len < 12 || !recvAll(sock_, buf.data(), len, frameDeadline))
+            break;
+        lastActivityMs_ = steadyMs();
+        lastFrame = SteadyClock::now();
+
+        DnsMessageView view;
+        if (!view.parse(buf.data(), len)) {
+            Metrics::instance().inc("dns_mismatched_responses_total");
+            continue;
+        }
+        Callback cb;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Same checks as the UDP path: ID alone is 16 bits of guesswork
+            auto it = pending_.find(view.id());
+            if (it == pending_.end() || !view.hasQuestion() ||
+                view.questionType() != it->second.type ||
+                !view.questionName().equals(it->second.name)) {
+                Metrics::instance().inc("dns_mismatched_responses_total");
+                continue;
+            }
+            cb = std::move(it->second.cb);
+            pending_.erase(it);
+        }
+        cb(toDnsPacket(view));
+    }
+
+    alive_ = false;
+    closesocket(sock_);
+    failAll();
+}
+
+DnsTcpPool::~DnsTcpPool() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pools_.clear();
+}
+
+std::string DnsTcpPool::serverKey(const sockaddr_in& server) {
+    char ip[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &server.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(server.sin_port));
+}
+
+void DnsTcpPool::query(const sockaddr_in& server, std::vector<uint8_t> wire, int timeoutMs, Callback cb) {
+    Metrics::instance().inc("dns_tcp_queries_total");
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& pool = pools_[serverKey(server)];
+
+    // Reap dead/idle connections; their reader threads have finished
+    // or will finish on their own
+    for (auto it = pool.begin(); it != pool.end();) {
+        if (!(*it)->usable() && (*it)->inflight() == 0) {
+            (*it)->close();
+            it = pool.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    Connection* best = nullptr;
+    size_t bestLoad = SIZE_MAX;
+    for (auto& c : pool) {
+        if (!c->usable()) continue;
+        size_t load = c->inflight();
+        if (load < bestLoad) {
+            best = c.get();
+            bestLoad = load;
+        }
+    }
+
+    if ((!best || bestLoad >= PIPELINE_DEPTH) && pool.size() < MAX_CONNECTIONS_PER_SERVER) {
+        auto conn = std::make_unique<Connection>(server);
+        if (conn->open(timeoutMs)) {
+            best = conn.get();
+            pool.push_back(std::move(conn));
+        }
+    }
+
+    if (!best || !best->send(wire, timeoutMs, cb)) {
+        lock.unlock();
+        Metrics::instance().inc("dns_query_failures_total");
+        cb(std::nullopt);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <functional>
+#include "dns_packet.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+
+/**
+ * Pooled, Pipelined DNS-over-TCP Connections
+ *
+ * WHY REQUIRED:
+ * - Truncated UDP answers (TC bit) must be re-asked over TCP
+ * - A fresh TCP handshake per truncated answer doubles its latency
+ * - Connections per upstream are reused and carry many queries at once
+ *   (RFC 7766 pipelining), answers matched back by ID and question
+ * - The handshake runs on the connection's own thread with a deadline;
+ *   queries submitted meanwhile are queued, so the caller never blocks
+ * - A frame that stops arriving part-way drops the connection
+ * - Connections idle past IDLE_CLOSE_MS are dropped before the server
+ *   closes them underneath a new query
+ */
+class DnsTcpPool {
+public:
+    using Result = std::optional<DnsPacket>;
+    using Callback = std::function<void(Result)>;
+
+    ~DnsTcpPool();
+
+    // wire is a complete query; its ID is rewritten per connection
+    void query(const sockaddr_in& server, std::vector<uint8_t> wire, int timeoutMs, Callback cb);
+
+private:
+    class Connection {
+    public:
+        explicit Connection(const sockaddr_in& server);
+        ~Connection();
+
+        // Starts a non-blocking connect; the reader thread completes it
+        bool open(int connectTimeoutMs);
+        bool send(std::vector<uint8_t>& wire, int timeoutMs, Callback& cb);
+        bool usable() const;
+        size_t inflight();
+        void close();
+
+    private:
+        struct Pending {
+            std::chrono::steady_clock::time_point sentAt;
+            std::chrono::steady_clock::time_point deadline;
+            std::string name;
+            uint16_t type = 0;
+            Callback cb;
+        };
+
+        void reader();
+        // Fail overdue queries; true if one went unanswered while the server
+        // sent nothing at all since it was asked (the connection is dead)
+        bool expireOverdue(std::chrono::steady_clock::time_point lastFrame);
+        bool finishConnect();
+        void failAll();
+
+        sockaddr_in server_;
+        SOCKET sock_ = INVALID_SOCKET;
+        std::atomic<bool> alive_{false};
+        bool connecting_ = false;                       // guarded by mutex_
+        std::chrono::steady_clock::time_point connectDeadline_;
+        std::vector<uint8_t> queued_;                   // frames sent once connected
+        std::atomic<int64_t> lastActivityMs_{0};
+        std::mutex mutex_;
+        std::map<uint16_t, Pending> pending_;
+        std::mt19937 rng_;
+        std::thread thread_;
+    };
+
+    static std::string serverKey(const sockaddr_in& server);
+
+    static constexpr size_t MAX_CONNECTIONS_PER_SERVER = 2;
+    static constexpr size_t PIPELINE_DEPTH = 16;   // open another connection beyond this
+    static constexpr int64_t IDLE_CLOSE_MS = 5000;
+    static constexpr int FRAME_TIMEOUT_MS = 2000;  // rest of a frame once its length arrived
+
+    std::mutex mutex_;
+    std::map<std::string, std::list<std::unique_ptr<Connection>>> pools_;
+};
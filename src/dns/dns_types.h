@@ -3,6 +3,7 @@
 
 enum class DnsRecordType : uint16_t {
     A     = 1,
+    CNAME = 5,
     PTR   = 12,
     MX    = 15,
     TXT   = 16,
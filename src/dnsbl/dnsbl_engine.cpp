@@ -0,0 +1,225 @@
+#include "dnsbl/dnsbl_engine.h"
+#include "dns/dns_types.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <cstdio>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+DnsblEngine& DnsblEngine::instance() {
+    static DnsblEngine engine;
+    return engine;
+}
+
+DnsblEngine::~DnsblEngine() {
+    stop();
+}
+
+void DnsblEngine::configure(const std::map<std::string, std::string>& zones,
+                            const std::vector<std::string>& remote,
+                            const std::string& dataDir,
+                            int reloadIntervalSec) {
+    {
+        std::lock_guard<std::mutex> lock(configMutex_);
+        zoneFiles_ = zones;
+        remote_ = remote;
+        dataDir_ = dataDir;
+    }
+    reloader_.setInterval(reloadIntervalSec);
+    reload();
+
+    Logger::instance().log(LogLevel::Info,
+        "DNSBL: " + std::to_string(zones.size()) + " local zone(s), " +
+        std::to_string(remote.size()) + " remote list(s)");
+}
+
+void DnsblEngine::start() {
+    reloader_.start();
+}
+
+void DnsblEngine::stop() {
+    reloader_.stop();
+}
+
+bool DnsblEngine::loadZone(const std::string& name, const std::string& source,
+                           const Zone* current, Zone& out) {
+    std::error_code ec;
+    auto mtime = fs::last_write_time(source, ec);
+    if (ec) {
+        Logger::instance().log(LogLevel::Error,
+            "DNSBL: Zone " + name + " source " + source + " unreadable: " + ec.message());
+        return false;
+    }
+
+    // Compiled tables are immutable and named after the source mtime, so an
+    // unchanged zone keeps its mapping and a changed one never overwrites a
+    // table someone still has mapped
+    out.name = name;
+    out.source = source;
+    out.compiledPath = (fs::path(dataDir_) /
+        (name + "-" + std::to_string(mtime.time_since_epoch().count()) + ".tbl")).string();
+    if (current && current->compiledPath == out.compiledPath && current->table) {
+        out.table = current->table;
+        return true;
+    }
+
+    std::string error;
+    if (fs::exists(out.compiledPath, ec))
+        out.table = DnsblTable::open(out.compiledPath, error);
+
+    if (!out.table) {
+        DnsblTable::CompileStats stats;
+        if (!DnsblTable::compile(source, out.compiledPath, stats, error) ||
+            !(out.table = DnsblTable::open(out.compiledPath, error))) {
+            Logger::instance().log(LogLevel::Error, "DNSBL: Zone " + name + ": " + error);
+            return false;
+        }
+        Logger::instance().log(stats.badLines ? LogLevel::Warn : LogLevel::Info,
+            "DNSBL: Compiled " + name + ": " + std::to_string(stats.v4Ranges) +
+            " IPv4 / " + std::to_string(stats.v6Ranges) + " IPv6 ranges" +
+            (stats.badLines ? ", " + std::to_string(stats.badLines) + " unparsable line(s) skipped" : ""));
+    }
+
+    // Older generations of this zone; ones still mapped elsewhere go next time
+    for (const auto& entry : fs::directory_iterator(dataDir_, ec)) {
+        std::string file = entry.path().filename().string();
+        std::string prefix = name + "-";
+        if (file.size() <= prefix.size() + 4 || file.rfind(prefix, 0) != 0 ||
+            file.compare(file.size() - 4, 4, ".tbl") != 0 ||
+            file.find_first_not_of("-0123456789", prefix.size()) != file.size() - 4)
+            continue;
+        if (entry.path() != fs::path(out.compiledPath)) {
+            std::error_code rmEc;
+            fs::remove(entry.path(), rmEc);
+        }
+    }
+    return true;
+}
+
+void DnsblEngine::reload() {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    std::error_code ec;
+    fs::create_directories(dataDir_, ec);
+
+    auto current = snapshot_.load();
+    auto next = std::make_shared<Snapshot>();
+    next->remote = remote_;
+
+    bool changed = !current || current->remote != remote_ ||
+                   current->zones.size() != zoneFiles_.size();
+    for (const auto& [name, source] : zoneFiles_) {
+        const Zone* old = nullptr;
+        if (current) {
+            for (const auto& z : current->zones)
+                if (z.name == name) old = &z;
+        }
+
+        Zone zone;
+        if (!loadZone(name, source, old, zone)) {
+            Metrics::instance().inc("dnsbl_reload_errors_total");
+            if (!old) {
+                changed = true;
+                continue; // zone unavailable until its file is fixed
+            }
+            zone = *old; // keep serving the last good table
+        }
+        if (!old || old->table != zone.table)
+            changed = true;
+
+        Metrics::instance().set("dnsbl_ranges{zone=\"" + name + "\"}",
+            static_cast<int>(zone.table->v4Ranges() + zone.table->v6Ranges()));
+        next->zones.push_back(std::move(zone));
+    }
+
+    if (changed) {
+        snapshot_.store(std::shared_ptr<const Snapshot>(std::move(next)));
+        Metrics::instance().inc("dnsbl_reloads_total");
+    }
+}
+
+bool DnsblEngine::enabled() const {
+    auto snap = snapshot_.load();
+    return snap && (!snap->zones.empty() || !snap->remote.empty());
+}
+
+DnsblVerdict DnsblEngine::checkLocal(const std::string& ip) const {
+    DnsblVerdict v;
+    auto snap = snapshot_.load();
+    DnsblAddress addr;
+    if (!snap || snap->zones.empty() || !DnsblAddress::parse(ip, addr))
+        return v;
+
+    for (const auto& z : snap->zones) {
+        if (z.table->contains(addr)) {
+            v.listed = true;
+            v.zone = z.name;
+            v.code = z.table->code();
+            Metrics::instance().inc("dnsbl_listed_total{zone=\"" + z.name + "\"}");
+            break;
+        }
+    }
+    return v;
+}
+
+std::string DnsblEngine::reverseName(const DnsblAddress& addr) {
+    char buf[80];
+    if (!addr.v6) {
+        std::snprintf(buf, sizeof(buf), "%u.%u.%u.%u",
+                      addr.v4 & 0xFF, (addr.v4 >> 8) & 0xFF,
+                      (addr.v4 >> 16) & 0xFF, addr.v4 >> 24);
+        return buf;
+    }
+
+    // 32 nibbles, least significant first
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(64);
+    for (int i = 0; i < 32; ++i) {
+        uint64_t half = i < 16 ? addr.lo : addr.hi;
+        out += hex[(half >> (4 * (i % 16))) & 0xF];
+        if (i != 31) out += '.';
+    }
+    return out;
+}
+
+DnsblEngine::RemoteLookup DnsblEngine::queryRemote(const std::string& ip) const {
+    RemoteLookup lookup;
+    auto snap = snapshot_.load();
+    DnsblAddress addr;
+    if (!snap || snap->remote.empty() || !DnsblAddress::parse(ip, addr))
+        return lookup;
+
+    std::string reversed = reverseName(addr);
+    for (const auto& zone : snap->remote) {
+        lookup.pending.emplace_back(zone,
+            DnsResolver::instance().queryAsync(reversed + "." + zone, DnsRecordType::A));
+    }
+    return lookup;
+}
+
+DnsblVerdict DnsblEngine::awaitRemote(const RemoteLookup& lookup) const {
+    DnsblVerdict v;
+    for (const auto& [zone, future] : lookup.pending) {
+        const DnsResolver::Result& result = future.get();
+        if (!result || result->rcode != DnsResponseCode::NoError)
+            continue; // NXDOMAIN = not listed; transport failure fails open
+
+        for (const auto& a : result->answers) {
+            unsigned b0, b1, b2, b3;
+            if (a.type != DnsRecordType::A ||
+                std::sscanf(a.data.c_str(), "%u.%u.%u.%u", &b0, &b1, &b2, &b3) != 4)
+                continue;
+            // 127.0.0.0/8 lists; 127.255.255.x are the lists' own error codes
+            if (b0 != 127 || (b1 == 255 && b2 == 255))
+                continue;
+            v.listed = true;
+            v.zone = zone;
+            v.code = static_cast<uint8_t>(b3);
+            Metrics::instance().inc("dnsbl_listed_total{zone=\"" + zone + "\"}");
+            return v;
+        }
+    }
+    return v;
+}
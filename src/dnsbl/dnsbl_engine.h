@@ -0,0 +1,88 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "core/periodic_reloader.h"
+#include "dnsbl/dnsbl_table.h"
+#include "dns/dns_resolver.h"
+
+/**
+ * DNSBL Engine / Connection-Time Blocklist Checks
+ *
+ * WHY REQUIRED:
+ * - Known-bad senders should be refused at accept time, before a session
+ *   thread, TLS handshake or SPF work is spent on them
+ * - Local zones (rsync'd rbldnsd files) compile to mmap'd interval tables;
+ *   a lookup is a lock-free binary search on the current snapshot
+ * - Zone files are re-checked every reload_interval; a changed zone is
+ *   compiled to a new table and swapped in atomically, readers keep the
+ *   old mapping until they drop it
+ * - Remote lists (zen.spamhaus.org style) fall back to the shared DNS
+ *   resolver; lookups start at accept and are awaited in the session thread
+ */
+struct DnsblVerdict {
+    bool listed = false;
+    std::string zone;
+    uint8_t code = 0;       // 127.0.0.x answer
+};
+
+class DnsblEngine {
+public:
+    static DnsblEngine& instance();
+
+    // zones: name -> rbldnsd zone file; remote: DNSBL zone suffixes
+    void configure(const std::map<std::string, std::string>& zones,
+                   const std::vector<std::string>& remote,
+                   const std::string& dataDir,
+                   int reloadIntervalSec);
+    void start();
+    void stop();
+
+    // Compile changed zone files and swap in a new snapshot
+    void reload();
+
+    bool enabled() const;
+
+    // Local tables only; never blocks
+    DnsblVerdict checkLocal(const std::string& ip) const;
+
+    // Remote lists: issue now, await later
+    struct RemoteLookup {
+        std::vector<std::pair<std::string, std::shared_future<DnsResolver::Result>>> pending;
+    };
+    RemoteLookup queryRemote(const std::string& ip) const;
+    DnsblVerdict awaitRemote(const RemoteLookup& lookup) const;
+
+private:
+    DnsblEngine() = default;
+    ~DnsblEngine();
+
+    struct Zone {
+        std::string name;
+        std::shared_ptr<DnsblTable> table;
+        std::string source;
+        std::string compiledPath;
+    };
+    struct Snapshot {
+        std::vector<Zone> zones;
+        std::vector<std::string> remote;
+    };
+
+    bool loadZone(const std::string& name, const std::string& source,
+                  const Zone* current, Zone& out);
+
+    static std::string reverseName(const DnsblAddress& addr);
+
+    SharedSnapshot<Snapshot> snapshot_;
+
+    std::mutex configMutex_;                        // zone config; held for a whole reload
+    std::map<std::string, std::string> zoneFiles_;
+    std::vector<std::string> remote_;
+    std::string dataDir_ = "data/dnsbl";
+
+    PeriodicReloader reloader_{ 60, [this] { reload(); } };   // last: stops first
+};
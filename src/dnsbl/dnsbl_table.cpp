@@ -0,0 +1,478 @@
+#include "dnsbl/dnsbl_table.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Compiled layout, native byte order (the file never leaves this host):
+//   header | v4 starts[n4] | v4 ends[n4] | pad to 8 | v6 starts[n6] | v6 ends[n6]
+static const char TABLE_MAGIC[4] = {'D', 'B', 'L', 'T'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const uint16_t TABLE_VERSION = 1;
+
+struct TableHeader {
+    char magic[4];
+    uint32_t byteOrder;
+    uint16_t version;
+    uint8_t code;
+    uint8_t reserved0;
+    uint32_t reserved1;
+    uint64_t v4Count;
+    uint64_t v6Count;
+    uint64_t fileSize;
+};
+static_assert(sizeof(TableHeader) == 40, "compiled DNSBL header layout");
+
+static size_t v6Offset(uint64_t n4) {
+    size_t off = sizeof(TableHeader) + static_cast<size_t>(n4) * 8;
+    return (off + 7) & ~static_cast<size_t>(7);
+}
+
+static size_t tableSize(uint64_t n4, uint64_t n6) {
+    return v6Offset(n4) + static_cast<size_t>(n6) * 32;
+}
+
+// ---------------------------------------------------------------------------
+// Address parsing
+
+static void v6FromBytes(const unsigned char* b, uint64_t& hi, uint64_t& lo) {
+    hi = lo = 0;
+    for (int i = 0; i < 8; ++i) hi = (hi << 8) | b[i];
+    for (int i = 8; i < 16; ++i) lo = (lo << 8) | b[i];
+}
+
+bool DnsblAddress::parse(const std::string& text, DnsblAddress& out) {
+    out = DnsblAddress{};
+    if (text.find(':') == std::string::npos) {
+        in_addr a{};
+        if (inet_pton(AF_INET, text.c_str(), &a) != 1)
+            return false;
+        out.v4 = ntohl(a.s_addr);
+        return true;
+    }
+
+    unsigned char b[16];
+    if (inet_pton(AF_INET6, text.c_str(), b) != 1)
+        return false;
+    static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+    if (std::memcmp(b, mapped, 12) == 0) {
+        out.v4 = (uint32_t(b[12]) << 24) | (uint32_t(b[13]) << 16) |
+                 (uint32_t(b[14]) << 8) | b[15];
+        return true;
+    }
+    out.v6 = true;
+    v6FromBytes(b, out.hi, out.lo);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Interval arithmetic shared by both families
+
+using Key6 = std::pair<uint64_t, uint64_t>;
+
+template <typename K>
+struct Range {
+    K start;
+    K end;
+};
+
+static bool successor(uint32_t k, uint32_t& out) {
+    if (k == UINT32_MAX) return false;
+    out = k + 1;
+    return true;
+}
+
+static bool predecessor(uint32_t k, uint32_t& out) {
+    if (k == 0) return false;
+    out = k - 1;
+    return true;
+}
+
+static bool successor(const Key6& k, Key6& out) {
+    if (k.second != UINT64_MAX) { out = {k.first, k.second + 1}; return true; }
+    if (k.first == UINT64_MAX) return false;
+    out = {k.first + 1, 0};
+    return true;
+}
+
+static bool predecessor(const Key6& k, Key6& out) {
+    if (k.second != 0) { out = {k.first, k.second - 1}; return true; }
+    if (k.first == 0) return false;
+    out = {k.first - 1, UINT64_MAX};
+    return true;
+}
+
+// Sort and coalesce overlapping or adjacent ranges
+template <typename K>
+static void normalise(std::vector<Range<K>>& v) {
+    std::sort(v.begin(), v.end(),
+        [](const Range<K>& a, const Range<K>& b) { return a.start < b.start; });
+
+    size_t w = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (w > 0) {
+            Range<K>& last = v[w - 1];
+            K after;
+            if (v[i].start <= last.end ||
+                (successor(last.end, after) && after == v[i].start)) {
+                last.end = std::max(last.end, v[i].end);
+                continue;
+            }
+        }
+        v[w++] = v[i];
+    }
+    v.resize(w);
+}
+
+// inc minus exc; both normalised
+template <typename K>
+static std::vector<Range<K>> subtract(const std::vector<Range<K>>& inc,
+                                      const std::vector<Range<K>>& exc) {
+    std::vector<Range<K>> out;
+    size_t j = 0;
+    for (const auto& r : inc) {
+        while (j < exc.size() && exc[j].end < r.start)
+            ++j;
+
+        K s = r.start;
+        bool alive = true;
+        for (size_t k = j; alive && k < exc.size() && exc[k].start <= r.end; ++k) {
+            K before;
+            if (s < exc[k].start && predecessor(exc[k].start, before))
+                out.push_back({s, before});
+            K after;
+            if (r.end <= exc[k].end || !successor(exc[k].end, after))
+                alive = false;
+            else
+                s = after;
+        }
+        if (alive)
+            out.push_back({s, r.end});
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Zone file parsing (rbldnsd ip4set / ip6 syntax)
+
+// 1-4 dotted octets; returns the count parsed
+static int parseOctets(const std::string& s, uint32_t octets[4]) {
+    int n = 0;
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        if (n == 4) return 0;
+        size_t dot = s.find('.', pos);
+        std::string part = s.substr(pos, dot == std::string::npos ? std::string::npos : dot - pos);
+        if (part.empty() || part.size() > 3 ||
+            part.find_first_not_of("0123456789") != std::string::npos)
+            return 0;
+        uint32_t v = static_cast<uint32_t>(std::stoul(part));
+        if (v > 255) return 0;
+        octets[n++] = v;
+        if (dot == std::string::npos) break;
+        pos = dot + 1;
+    }
+    return n;
+}
+
+static uint32_t packOctets(const uint32_t o[4], int n, uint32_t fill) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v = (v << 8) | (i < n ? o[i] : fill);
+    return v;
+}
+
+// a.b.c.d | a.b.c (= /24) | a.b.c.d/n | a.b.c.d-e.f.g.h | a.b.c-e (tail replaced)
+static bool parseV4Entry(const std::string& tok, Range<uint32_t>& out) {
+    size_t slash = tok.find('/');
+    if (slash != std::string::npos) {
+        uint32_t o[4];
+        std::string bits = tok.substr(slash + 1);
+        if (parseOctets(tok.substr(0, slash), o) != 4 || bits.empty() || bits.size() > 2 ||
+            bits.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        int prefix = std::stoi(bits);
+        if (prefix > 32) return false;
+        uint32_t mask = prefix == 0 ? 0 : (UINT32_MAX << (32 - prefix));
+        uint32_t base = packOctets(o, 4, 0) & mask;
+        out = {base, base | ~mask};
+        return true;
+    }
+
+    size_t dash = tok.find('-');
+    uint32_t a[4];
+    int na = parseOctets(tok.substr(0, dash), a);
+    if (na == 0) return false;
+    if (dash == std::string::npos) {
+        out = {packOctets(a, na, 0), packOctets(a, na, 255)};
+        return true;
+    }
+
+    uint32_t b[4];
+    int nb = parseOctets(tok.substr(dash + 1), b);
+    if (nb == 0 || nb > na) return false;
+    uint32_t e[4];
+    for (int i = 0; i < na; ++i)
+        e[i] = i < na - nb ? a[i] : b[i - (na - nb)];
+    out = {packOctets(a, na, 0), packOctets(e, na, 255)};
+    return out.start <= out.end;
+}
+
+static bool parseV6Address(const std::string& s, Key6& out) {
+    unsigned char b[16];
+    if (inet_pton(AF_INET6, s.c_str(), b) != 1)
+        return false;
+    v6FromBytes(b, out.first, out.second);
+    return true;
+}
+
+// addr | addr/n | addr-addr
+static bool parseV6Entry(const std::string& tok, Range<Key6>& out) {
+    size_t slash = tok.find('/');
+    if (slash != std::string::npos) {
+        Key6 base;
+        std::string bits = tok.substr(slash + 1);
+        if (!parseV6Address(tok.substr(0, slash), base) || bits.empty() || bits.size() > 3 ||
+            bits.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        int prefix = std::stoi(bits);
+        if (prefix > 128) return false;
+        uint64_t maskHi = prefix >= 64 ? UINT64_MAX : (prefix == 0 ? 0 : UINT64_MAX << (64 - prefix));
+        uint64_t maskLo = prefix <= 64 ? 0 : (prefix == 128 ? UINT64_MAX : UINT64_MAX << (128 - prefix));
+        out.start = {base.first & maskHi, base.second & maskLo};
+        out.end = {base.first | ~maskHi, base.second | ~maskLo};
+        return true;
+    }
+
+    size_t dash = tok.find('-');
+    if (!parseV6Address(tok.substr(0, dash), out.start))
+        return false;
+    if (dash == std::string::npos) {
+        out.end = out.start;
+        return true;
+    }
+    return parseV6Address(tok.substr(dash + 1), out.end) && out.start <= out.end;
+}
+
+bool DnsblTable::compile(const std::string& zonePath, const std::string& outPath,
+                         CompileStats& stats, std::string& error) {
+    stats = CompileStats{};
+    std::ifstream in(zonePath);
+    if (!in.is_open()) {
+        error = "cannot open " + zonePath;
+        return false;
+    }
+
+    std::vector<Range<uint32_t>> v4, v4Excluded;
+    std::vector<Range<Key6>> v6, v6Excluded;
+    uint8_t code = 2;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t b = line.find_first_not_of(" \t\r");
+        if (b == std::string::npos || line[b] == '#' || line[b] == ';' || line[b] == '$')
+            continue;
+
+        // ":127.0.0.x:text" sets the zone's default answer
+        if (line[b] == ':') {
+            uint32_t o[4];
+            size_t e = line.find(':', b + 1);
+            if (parseOctets(line.substr(b + 1, e == std::string::npos ? std::string::npos : e - b - 1), o) == 4)
+                code = static_cast<uint8_t>(o[3]);
+            continue;
+        }
+
+        bool exclude = line[b] == '!';
+        if (exclude) ++b;
+        size_t e = line.find_first_of(" \t\r", b);
+        std::string tok = line.substr(b, e == std::string::npos ? std::string::npos : e - b);
+
+        bool ok;
+        if (tok.find(':') != std::string::npos) {
+            Range<Key6> r;
+            ok = parseV6Entry(tok, r);
+            if (ok) (exclude ? v6Excluded : v6).push_back(r);
+        } else {
+            Range<uint32_t> r;
+            ok = parseV4Entry(tok, r);
+            if (ok) (exclude ? v4Excluded : v4).push_back(r);
+        }
+        if (!ok) stats.badLines++;
+    }
+
+    normalise(v4);
+    normalise(v4Excluded);
+    normalise(v6);
+    normalise(v6Excluded);
+    v4 = subtract(v4, v4Excluded);
+    v6 = subtract(v6, v6Excluded);
+    stats.v4Ranges = v4.size();
+    stats.v6Ranges = v6.size();
+
+    TableHeader h{};
+    std::memcpy(h.magic, TABLE_MAGIC, 4);
+    h.byteOrder = BYTE_ORDER_MARK;
+    h.version = TABLE_VERSION;
+    h.code = code;
+    h.v4Count = v4.size();
+    h.v6Count = v6.size();
+    h.fileSize = tableSize(h.v4Count, h.v6Count);
+
+    std::vector<uint32_t> starts4, ends4;
+    for (const auto& r : v4) { starts4.push_back(r.start); ends4.push_back(r.end); }
+    std::vector<uint64_t> starts6, ends6;
+    for (const auto& r : v6) {
+        starts6.push_back(r.start.first); starts6.push_back(r.start.second);
+        ends6.push_back(r.end.first);     ends6.push_back(r.end.second);
+    }
+
+    // Unique temp name: two processes may compile the same zone during an upgrade
+    std::string tmp = outPath + ".tmp" + std::to_string(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            error = "cannot write " + tmp;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(starts4.data()), starts4.size() * 4);
+        out.write(reinterpret_cast<const char*>(ends4.data()), ends4.size() * 4);
+        static const char pad[8] = {};
+        out.write(pad, v6Offset(h.v4Count) - (sizeof(h) + v4.size() * 8));
+        out.write(reinterpret_cast<const char*>(starts6.data()), starts6.size() * 8);
+        out.write(reinterpret_cast<const char*>(ends6.data()), ends6.size() * 8);
+        if (!out.good()) {
+            error = "short write to " + tmp;
+            out.close();
+            std::filesystem::remove(tmp);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, outPath, ec);
+    if (ec) {
+        error = "rename to " + outPath + ": " + ec.message();
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Mapping and lookup
+
+std::shared_ptr<DnsblTable> DnsblTable::open(const std::string& path, std::string& error) {
+    std::shared_ptr<DnsblTable> t(new DnsblTable());
+
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    t->file_ = f;
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(f, &size) || size.QuadPart < (LONGLONG)sizeof(TableHeader)) {
+        error = "truncated table " + path;
+        return nullptr;
+    }
+    HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m) {
+        error = "cannot map " + path;
+        return nullptr;
+    }
+    t->mapping_ = m;
+    t->base_ = static_cast<const uint8_t*>(MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0));
+    t->size_ = static_cast<size_t>(size.QuadPart);
+    if (!t->base_) {
+        error = "cannot map " + path;
+        return nullptr;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TableHeader)) {
+        ::close(fd);
+        error = "truncated table " + path;
+        return nullptr;
+    }
+    void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        error = "cannot map " + path;
+        return nullptr;
+    }
+    t->base_ = static_cast<const uint8_t*>(p);
+    t->size_ = static_cast<size_t>(st.st_size);
+#endif
+
+    TableHeader h;
+    std::memcpy(&h, t->base_, sizeof(h));
+    if (std::memcmp(h.magic, TABLE_MAGIC, 4) != 0 || h.byteOrder != BYTE_ORDER_MARK ||
+        h.version != TABLE_VERSION || h.fileSize != t->size_ ||
+        h.v4Count > t->size_ / 8 || h.v6Count > t->size_ / 32 ||
+        tableSize(h.v4Count, h.v6Count) != t->size_) {
+        error = "malformed table " + path;
+        return nullptr;
+    }
+
+    t->code_ = h.code;
+    t->v4Count_ = static_cast<size_t>(h.v4Count);
+    t->v6Count_ = static_cast<size_t>(h.v6Count);
+    t->v4Starts_ = reinterpret_cast<const uint32_t*>(t->base_ + sizeof(TableHeader));
+    t->v4Ends_ = t->v4Starts_ + t->v4Count_;
+    t->v6Starts_ = reinterpret_cast<const V6*>(t->base_ + v6Offset(h.v4Count));
+    t->v6Ends_ = t->v6Starts_ + t->v6Count_;
+    return t;
+}
+
+DnsblTable::~DnsblTable() {
+#ifdef _WIN32
+    if (base_) UnmapViewOfFile(base_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+#else
+    if (base_) ::munmap(const_cast<uint8_t*>(base_), size_);
+#endif
+}
+
+bool DnsblTable::contains(const DnsblAddress& addr) const {
+    if (!addr.v6) {
+        // Last range starting at or below the address
+        const uint32_t* it = std::upper_bound(v4Starts_, v4Starts_ + v4Count_, addr.v4);
+        if (it == v4Starts_) return false;
+        return addr.v4 <= v4Ends_[it - v4Starts_ - 1];
+    }
+
+    auto less = [](const V6& a, const V6& b) {
+        return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+    };
+    V6 key{addr.hi, addr.lo};
+    const V6* it = std::upper_bound(v6Starts_, v6Starts_ + v6Count_, key, less);
+    if (it == v6Starts_) return false;
+    return !less(v6Ends_[it - v6Starts_ - 1], key);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Compiled DNSBL Zone (memory-mapped interval table)
+ *
+ * WHY REQUIRED:
+ * - Blocklists are checked on every accepted connection; a remote DNSBL
+ *   query per connection costs a network round-trip
+ * - rsync'd rbldnsd-style zone files (ip4set / ip6 entries, CIDRs, ranges,
+ *   '!' exclusions) are compiled once into sorted, merged, non-overlapping
+ *   IPv4 and IPv6 intervals
+ * - The compiled file is mapped read-only and searched in place: a binary
+ *   search over a flat array, no allocation, no lock
+ * - Compiled files are immutable; a reload writes a new file and swaps tables
+ */
+
+// Parsed connecting address; v4-mapped IPv6 is folded to IPv4
+struct DnsblAddress {
+    bool v6 = false;
+    uint32_t v4 = 0;
+    uint64_t hi = 0;    // IPv6, big-endian halves as integers
+    uint64_t lo = 0;
+
+    static bool parse(const std::string& text, DnsblAddress& out);
+};
+
+class DnsblTable {
+public:
+    ~DnsblTable();
+    DnsblTable(const DnsblTable&) = delete;
+    DnsblTable& operator=(const DnsblTable&) = delete;
+
+    struct CompileStats {
+        size_t v4Ranges = 0;
+        size_t v6Ranges = 0;
+        size_t badLines = 0;
+    };
+
+    // Zone file -> compiled table. Written to a temp file and renamed into place.
+    static bool compile(const std::string& zonePath, const std::string& outPath,
+                        CompileStats& stats, std::string& error);
+
+    // Map a compiled table; nullptr (with error) if missing or malformed
+    static std::shared_ptr<DnsblTable> open(const std::string& path, std::string& error);
+
+    bool contains(const DnsblAddress& addr) const;
+
+    // Last octet of the zone's A answer (127.0.0.x); 2 unless the zone sets one
+    uint8_t code() const { return code_; }
+    size_t v4Ranges() const { return v4Count_; }
+    size_t v6Ranges() const { return v6Count_; }
+
+private:
+    DnsblTable() = default;
+
+    struct V6 {
+        uint64_t hi;
+        uint64_t lo;
+    };
+
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+
+    const uint32_t* v4Starts_ = nullptr;
+    const uint32_t* v4Ends_ = nullptr;
+    size_t v4Count_ = 0;
+    const V6* v6Starts_ = nullptr;
+    const V6* v6Ends_ = nullptr;
+    size_t v6Count_ = 0;
+    uint8_t code_ = 2;
+};
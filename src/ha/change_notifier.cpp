@@ -0,0 +1,104 @@
+#include "ha/change_notifier.h"
+#include "core/logger.h"
+
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+ChangeNotifier::ChangeNotifier(const std::string& dir, const std::string& suffix)
+    : dir_(dir), suffix_(suffix) {
+#ifdef _WIN32
+    HANDLE h = FindFirstChangeNotificationA(
+        dir_.c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (h != INVALID_HANDLE_VALUE)
+        handle_ = h;
+#elif defined(__linux__)
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ >= 0) {
+        // Lease writes land via rename, so MOVED_TO sees every update
+        watch_ = inotify_add_watch(fd_, dir_.c_str(), IN_MOVED_TO | IN_DELETE);
+        if (watch_ < 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+#endif
+
+#ifdef _WIN32
+    bool ok = handle_ != nullptr;
+#else
+    bool ok = fd_ >= 0;
+#endif
+    if (!ok) {
+        Logger::instance().log(LogLevel::Warn,
+            "HA: Change notification unavailable for " + dir_ + ", polling instead");
+    }
+}
+
+ChangeNotifier::~ChangeNotifier() {
+#ifdef _WIN32
+    if (handle_)
+        FindCloseChangeNotification(static_cast<HANDLE>(handle_));
+#else
+    if (fd_ >= 0)
+        close(fd_);
+#endif
+}
+
+bool ChangeNotifier::wait(std::chrono::milliseconds timeout, std::vector<std::string>* names) {
+    if (names)
+        names->clear();
+#ifdef _WIN32
+    if (handle_) {
+        DWORD rc = WaitForSingleObject(static_cast<HANDLE>(handle_),
+                                       static_cast<DWORD>(timeout.count()));
+        if (rc == WAIT_OBJECT_0) {
+            FindNextChangeNotification(static_cast<HANDLE>(handle_));
+            return true;
+        }
+        return false;
+    }
+#elif defined(__linux__)
+    if (fd_ >= 0) {
+        // Temp files and claim files churn on every renewal; keep waiting
+        // until an event names a file that matters
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        bool matched = false;
+        while (!matched) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+                return false;
+            pollfd pfd{fd_, POLLIN, 0};
+            if (poll(&pfd, 1, static_cast<int>(left.count())) <= 0)
+                return false;
+
+            alignas(inotify_event) char buf[4096];
+            ssize_t len;
+            while ((len = read(fd_, buf, sizeof(buf))) > 0) {
+                for (ssize_t off = 0; off < len;) {
+                    auto* ev = reinterpret_cast<const inotify_event*>(buf + off);
+                    off += sizeof(inotify_event) + ev->len;
+                    std::string name = ev->len ? ev->name : "";
+                    if (name.size() < suffix_.size() ||
+                        name.compare(name.size() - suffix_.size(), suffix_.size(), suffix_) != 0)
+                        continue;
+                    matched = true;
+                    if (names)
+                        names->push_back(name);
+                }
+            }
+        }
+        return true;
+    }
+#endif
+    std::this_thread::sleep_for(timeout);
+    return false;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <vector>
+
+/**
+ * Directory Change Notifier
+ *
+ * WHY REQUIRED:
+ * - Followers should react to a released or taken-over lease immediately
+ *   instead of discovering it on their next poll
+ * - inotify on Linux, FindFirstChangeNotification on Windows; elsewhere
+ *   wait() degrades to a plain timed sleep
+ *
+ * Both APIs only see changes made through this host's kernel: a lease
+ * released or taken by a node on another host (shared filesystem) raises
+ * nothing here. The notifier only shortens failover between nodes on one
+ * host; the lease-expiry poll is what makes failover work at all.
+ */
+class ChangeNotifier {
+public:
+    // Only names ending in suffix count as changes (Linux; Windows reports
+    // no names, so every change there counts)
+    explicit ChangeNotifier(const std::string& dir, const std::string& suffix = "");
+    ~ChangeNotifier();
+
+    ChangeNotifier(const ChangeNotifier&) = delete;
+    ChangeNotifier& operator=(const ChangeNotifier&) = delete;
+
+    // Block until a matching name in the directory changes or timeout
+    // elapses. Returns true if woken by a change; names (if given) receives
+    // the changed entries, empty when the platform cannot tell.
+    bool wait(std::chrono::milliseconds timeout, std::vector<std::string>* names = nullptr);
+
+private:
+    std::string dir_;
+    std::string suffix_;
+#ifdef _WIN32
+    void* handle_{nullptr};
+#else
+    int fd_{-1};
+    int watch_{-1};
+#endif
+};
@@ -1,18 +1,45 @@
 // ha/ha_controller.cpp
 #include "ha/ha_controller.h"
-#include "ha/leader_election.h"
 #include "queue/retry_worker.h"
+#include "queue/mail_queue.h"
 #include "core/logger.h"
+#include "monitoring/metrics.h"
 
+#include <algorithm>
 #include <chrono>
+#include <random>
+#include <sstream>
 
 using namespace std::chrono;
 
-HaController::HaController(const std::string& dataDir)
-    : dataDir_(dataDir) {
+static std::string generateNodeId() {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(0, 15);
 
-    election_ = std::make_unique<LeaderElection>(
-        dataDir_ + "/queue-leader.lock");
+    std::stringstream ss;
+    ss << "node-" << std::hex;
+    for (int i = 0; i < 8; ++i) {
+        ss << dis(gen);
+    }
+    return ss.str();
+}
+
+HaController::HaController(const std::string& dataDir,
+                           const std::string& nodeId,
+                           int shardCount,
+                           int leaseMs,
+                           int renewMs,
+                           std::unique_ptr<ShardLeaseBackend> backend)
+    : dataDir_(dataDir),
+      nodeId_(nodeId.empty() ? generateNodeId() : nodeId),
+      shardCount_(std::max(1, shardCount)),
+      leaseTtl_(std::max(100, leaseMs)),
+      renewInterval_(std::max(50, std::min(renewMs, leaseMs / 2))),
+      backend_(std::move(backend)) {
+
+    if (!backend_)
+        backend_ = std::make_unique<FileShardLeaseBackend>(dataDir_);
 }
 
 HaController::~HaController() {
@@ -24,46 +51,219 @@ void HaController::start() {
     running_ = true;
 
     Logger::instance().log(LogLevel::Info,
-        "HA Controller starting");
+        "HA Controller starting as " + nodeId_ + " (" +
+        std::to_string(shardCount_) + " queue shards, lease " +
+        std::to_string(leaseTtl_.count()) + "ms, renew " +
+        std::to_string(renewInterval_.count()) + "ms)");
+
+    MailQueue::instance().setFence([this](int shard) { return holdsShard(shard); });
 
     thread_ = std::thread(&HaController::run, this);
+    workerThread_ = std::thread(&HaController::deliverLoop, this);
 }
 
 void HaController::stop() {
     if (!running_) return;
     running_ = false;
+    {
+        // Pair with the waiters' predicate check so the wakeup is not lost
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    ownershipCv_.notify_all();
 
+    if (workerThread_.joinable())
+        workerThread_.join();
     if (thread_.joinable())
         thread_.join();
 
-    election_->releaseLeadership();
+    releaseAll();
+    MailQueue::instance().setFence(nullptr);
 
     Logger::instance().log(LogLevel::Info,
         "HA Controller stopped");
 }
 
 bool HaController::isLeader() const {
-    return leader_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !owned_.empty();
+}
+
+std::vector<int> HaController::ownedShards() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int> out;
+    for (const auto& [shard, tenure] : owned_)
+        out.push_back(shard);
+    return out;
+}
+
+bool HaController::holdsShard(int shard) {
+    Tenure tenure;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = owned_.find(shard);
+        if (it == owned_.end())
+            return false;
+        tenure = it->second;
+    }
+
+    // Local expiry first: a node that stalled past its lease must assume
+    // it was replaced even before reading the lease back
+    if (steady_clock::now() - tenure.renewedAt >= leaseTtl_)
+        return false;
+    return backend_->validate(shard, nodeId_, tenure.token);
+}
+
+// Rendezvous (highest random weight) hashing: FNV-1a is stable across
+// nodes and builds, unlike std::hash
+std::string HaController::preferredOwner(const std::vector<std::string>& live, int shard) {
+    std::string best;
+    uint64_t bestScore = 0;
+    for (const auto& node : live) {
+        uint64_t h = 1469598103934665603ULL;
+        std::string key = node + ":" + std::to_string(shard);
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        if (best.empty() || h > bestScore) {
+            best = node;
+            bestScore = h;
+        }
+    }
+    return best;
+}
+
+void HaController::rebalance() {
+    backend_->heartbeat(nodeId_);
+    std::vector<std::string> live = backend_->liveNodes(leaseTtl_);
+    if (std::find(live.begin(), live.end(), nodeId_) == live.end())
+        live.push_back(nodeId_);
+
+    std::map<int, Tenure> previous;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        previous = owned_;
+        live_ = live;
+    }
+
+    std::map<int, Tenure> owned;
+    for (int shard = 0; shard < shardCount_; ++shard) {
+        bool held = previous.count(shard) > 0;
+
+        if (preferredOwner(live, shard) == nodeId_) {
+            auto started = steady_clock::now();
+            uint64_t token = backend_->acquire(shard, nodeId_, leaseTtl_);
+            if (token != 0)
+                owned[shard] = {token, started};
+        } else if (held) {
+            // Hand over to the node the hash now prefers
+            backend_->release(shard, nodeId_);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        owned_ = owned;
+    }
+    publishOwnership(previous);
+
+    Metrics::instance().set("ha_live_nodes", static_cast<int>(live.size()));
+}
+
+void HaController::claimFreed() {
+    std::vector<std::string> live;
+    std::map<int, Tenure> previous;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live = live_;
+        previous = owned_;
+    }
+    if (live.empty())
+        return;
+
+    bool changed = false;
+    for (int shard = 0; shard < shardCount_; ++shard) {
+        if (previous.count(shard) || preferredOwner(live, shard) != nodeId_)
+            continue;
+        if (!backend_->available(shard))
+            continue;
+
+        auto started = steady_clock::now();
+        uint64_t token = backend_->acquire(shard, nodeId_, leaseTtl_);
+        if (token != 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            owned_[shard] = {token, started};
+            changed = true;
+        }
+    }
+
+    if (changed)
+        publishOwnership(previous);
+}
+
+void HaController::publishOwnership(const std::map<int, Tenure>& previous) {
+    std::vector<int> before, after;
+    for (const auto& [shard, tenure] : previous)
+        before.push_back(shard);
+    after = ownedShards();
+
+    if (after != before) {
+        Logger::instance().log(LogLevel::Info,
+            "HA: Node " + nodeId_ + " owns " + std::to_string(after.size()) + "/" +
+            std::to_string(shardCount_) + " shards");
+        MailQueue::instance().setOwnedShards(shardCount_, after);
+        ownershipCv_.notify_all();
+    }
+    Metrics::instance().set("ha_owned_shards", static_cast<int>(after.size()));
+}
+
+void HaController::releaseAll() {
+    std::vector<int> owned = ownedShards();
+    for (int shard : owned)
+        backend_->release(shard, nodeId_);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        owned_.clear();
+    }
+    MailQueue::instance().setOwnedShards(shardCount_, {});
 }
 
 void HaController::run() {
-    RetryWorker worker;
+    auto nextRenewal = steady_clock::now();
 
     while (running_) {
-        if (election_->tryBecomeLeader()) {
-            if (!leader_) {
-                Logger::instance().log(LogLevel::Info, "HA: Node is LEADER");
-            }
-            leader_ = true;
-            worker.runOnce();
+        auto now = steady_clock::now();
+        if (now >= nextRenewal) {
+            rebalance();
+            nextRenewal = steady_clock::now() + renewInterval_;
         } else {
-            if (leader_) {
-                Logger::instance().log(LogLevel::Info, "HA: Node is FOLLOWER");
-            }
-            leader_ = false;
+            claimFreed();
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+        // Sleep until the next renewal unless a lease file changes first
+        auto remaining = duration_cast<milliseconds>(nextRenewal - steady_clock::now());
+        if (remaining.count() > 0)
+            backend_->waitForChange(remaining);
     }
 }
 
+void HaController::deliverLoop() {
+    RetryWorker worker;
+
+    while (running_) {
+        {
+            // Followers block until they are handed a shard
+            std::unique_lock<std::mutex> lock(mutex_);
+            ownershipCv_.wait(lock, [this] { return !running_ || !owned_.empty(); });
+        }
+        if (!running_)
+            break;
+
+        if (!worker.runOnce()) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ownershipCv_.wait_for(lock, milliseconds(IDLE_WAIT_MS),
+                                  [this] { return !running_.load(); });
+        }
+    }
+}
@@ -3,26 +3,75 @@
 #include <thread>
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>
 #include <string>
-class LeaderElection;
+#include <vector>
+#include "ha/shard_lease.h"
 
+/**
+ * HA Controller / Multi-Active Queue Shards
+ *
+ * WHY REQUIRED:
+ * - Every healthy node delivers mail for the shards it owns
+ * - Shard owners follow rendezvous hashing over live nodes, so a join or
+ *   death only moves that node's share
+ * - Leases are renewed well inside their duration (sub-second by default);
+ *   a dead or hung node loses its shards when its leases lapse
+ * - Released/expired leases are noticed via change notification, not polling
+ * - Queue operations are fenced: they proceed only while this node still
+ *   holds the shard's current fencing token
+ */
 class HaController {
 public:
-    explicit HaController(const std::string& dataDir);
+    HaController(const std::string& dataDir,
+                 const std::string& nodeId,
+                 int shardCount,
+                 int leaseMs = 3000,
+                 int renewMs = 500,
+                 std::unique_ptr<ShardLeaseBackend> backend = nullptr);
     ~HaController();
 
     void start();
     void stop();
 
+    // True while this node owns at least one queue shard
     bool isLeader() const;
+    std::vector<int> ownedShards() const;
+
+    // Fencing check used by MailQueue before moving an entry of shard
+    bool holdsShard(int shard);
 
 private:
-    void run();
+    struct Tenure {
+        uint64_t token = 0;
+        std::chrono::steady_clock::time_point renewedAt; // start of the renewing call
+    };
+
+    void run();            // heartbeats + lease renewal + rebalancing
+    void deliverLoop();    // drains owned shards
+    void rebalance();
+    void claimFreed();     // react to a released/expired preferred shard
+    void releaseAll();
+    void publishOwnership(const std::map<int, Tenure>& previous);
+    static std::string preferredOwner(const std::vector<std::string>& live, int shard);
+
+    static constexpr int IDLE_WAIT_MS = 200;
 
     std::string dataDir_;
+    std::string nodeId_;
+    int shardCount_;
+    std::chrono::milliseconds leaseTtl_;
+    std::chrono::milliseconds renewInterval_;
     std::atomic<bool> running_{false};
-    std::atomic<bool> leader_{false};
 
-    std::unique_ptr<LeaderElection> election_;
+    std::unique_ptr<ShardLeaseBackend> backend_;
+    mutable std::mutex mutex_;
+    std::condition_variable ownershipCv_;
+    std::map<int, Tenure> owned_;
+    std::vector<std::string> live_;   // from the last heartbeat round
     std::thread thread_;
+    std::thread workerThread_;   // separate so slow deliveries never delay renewals
 };
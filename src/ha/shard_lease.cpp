@@ -0,0 +1,206 @@
+#include "ha/shard_lease.h"
+#include "ha/change_notifier.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+FileShardLeaseBackend::FileShardLeaseBackend(const std::string& dataDir)
+    : nodesDir_(dataDir + "/ha/nodes"),
+      shardsDir_(dataDir + "/ha/shards") {
+    fs::create_directories(nodesDir_);
+    fs::create_directories(shardsDir_);
+    notifier_ = std::make_unique<ChangeNotifier>(shardsDir_, ".lease");
+    ownersChanged({});
+}
+
+FileShardLeaseBackend::~FileShardLeaseBackend() = default;
+
+long long FileShardLeaseBackend::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool FileShardLeaseBackend::writeAtomic(const std::string& path, const std::string& content) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << content;
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+bool FileShardLeaseBackend::heartbeat(const std::string& nodeId) {
+    return writeAtomic(nodesDir_ + "/" + nodeId + ".hb", std::to_string(nowMs()));
+}
+
+std::vector<std::string> FileShardLeaseBackend::liveNodes(std::chrono::milliseconds ttl) {
+    std::vector<std::string> live;
+    long long now = nowMs();
+
+    std::error_code ec;
+    for (auto& f : fs::directory_iterator(nodesDir_, ec)) {
+        if (f.path().extension() != ".hb")
+            continue;
+
+        std::ifstream in(f.path());
+        long long beat = 0;
+        if (!(in >> beat))
+            continue;
+
+        if (now - beat <= ttl.count()) {
+            live.push_back(f.path().stem().string());
+        } else if (now - beat > 10 * ttl.count()) {
+            // Long gone: tidy up so the directory does not grow forever
+            std::error_code rmEc;
+            fs::remove(f.path(), rmEc);
+        }
+    }
+    return live;
+}
+
+std::string FileShardLeaseBackend::leasePath(int shard) const {
+    return shardsDir_ + "/" + std::to_string(shard) + ".lease";
+}
+
+bool FileShardLeaseBackend::readLease(int shard, Lease& out) const {
+    std::ifstream in(leasePath(shard));
+    if (!in)
+        return false;
+    if (!(in >> out.owner >> out.expiresMs))
+        return false;
+    in >> out.token; // absent in pre-fencing lease files
+    return true;
+}
+
+bool FileShardLeaseBackend::writeLease(int shard, const Lease& lease) {
+    return writeAtomic(leasePath(shard),
+                       lease.owner + " " + std::to_string(lease.expiresMs) + " " +
+                       std::to_string(lease.token) + "\n");
+}
+
+// Exclusive create is atomic on local and NFSv3+ filesystems
+bool FileShardLeaseBackend::claim(int shard, std::chrono::milliseconds ttl) {
+    std::string path = leasePath(shard) + ".claim";
+    FILE* f = std::fopen(path.c_str(), "wx");
+    if (f) {
+        std::fclose(f);
+        return true;
+    }
+
+    // A claimant that crashed mid-update leaves its claim behind
+    std::error_code ec;
+    auto mtime = fs::last_write_time(path, ec);
+    if (!ec && fs::file_time_type::clock::now() - mtime > ttl) {
+        fs::remove(path, ec);
+    }
+    return false;
+}
+
+void FileShardLeaseBackend::unclaim(int shard) {
+    std::error_code ec;
+    fs::remove(leasePath(shard) + ".claim", ec);
+}
+
+uint64_t FileShardLeaseBackend::acquire(int shard, const std::string& nodeId,
+                                        std::chrono::milliseconds ttl) {
+    if (!claim(shard, ttl)) {
+        // Contended this round; keep a lease we still validly hold
+        Lease current;
+        if (readLease(shard, current) && current.owner == nodeId &&
+            current.expiresMs > nowMs())
+            return current.token;
+        return 0;
+    }
+
+    Lease current;
+    bool exists = readLease(shard, current);
+    long long now = nowMs();
+
+    uint64_t token = 0;
+    bool renewal = exists && current.owner == nodeId && current.expiresMs > now;
+    if (!exists || renewal || current.expiresMs <= now) {
+        if (exists && !renewal && current.owner != nodeId && current.owner != "-") {
+            Logger::instance().log(LogLevel::Warn,
+                "HA: Taking over shard " + std::to_string(shard) +
+                " from expired owner " + current.owner);
+        }
+        // A new tenure (anything but a live renewal) gets a new token
+        Lease next{nodeId, now + ttl.count(), renewal ? current.token : current.token + 1};
+        if (writeLease(shard, next))
+            token = next.token;
+    }
+
+    unclaim(shard);
+    return token;
+}
+
+void FileShardLeaseBackend::release(int shard, const std::string& nodeId) {
+    // Best effort: an unreleased lease simply expires
+    if (!claim(shard, std::chrono::milliseconds(5000)))
+        return;
+
+    Lease current;
+    if (readLease(shard, current) && current.owner == nodeId) {
+        // Keep the token so the next owner's is strictly greater
+        writeLease(shard, {"-", 0, current.token});
+    }
+    unclaim(shard);
+}
+
+bool FileShardLeaseBackend::available(int shard) {
+    Lease current;
+    return !readLease(shard, current) || current.expiresMs <= nowMs();
+}
+
+bool FileShardLeaseBackend::validate(int shard, const std::string& nodeId, uint64_t token) {
+    Lease current;
+    return token != 0 && readLease(shard, current) &&
+           current.owner == nodeId && current.token == token &&
+           current.expiresMs > nowMs();
+}
+
+bool FileShardLeaseBackend::ownersChanged(const std::vector<std::string>& names) {
+    std::vector<std::string> files = names;
+    if (files.empty()) {
+        std::error_code ec;
+        for (auto& f : fs::directory_iterator(shardsDir_, ec)) {
+            if (f.path().extension() == ".lease")
+                files.push_back(f.path().filename().string());
+        }
+    }
+
+    bool changed = false;
+    for (const auto& name : files) {
+        std::ifstream in(shardsDir_ + "/" + name);
+        std::string owner;
+        if (!(in >> owner))
+            owner.clear();
+        auto& seen = owners_[name];
+        changed = changed || seen != owner;
+        seen = owner;
+    }
+    return changed;
+}
+
+bool FileShardLeaseBackend::waitForChange(std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<std::string> names;
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0 || !notifier_->wait(left, &names))
+            return false;
+        if (ownersChanged(names))
+            return true;
+        Metrics::instance().inc("ha_lease_wakeups_ignored_total");
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <thread>
+
+class ChangeNotifier;
+
+/**
+ * Queue Shard Leases
+ *
+ * WHY REQUIRED:
+ * - A single queue leader leaves every other node idle
+ * - The queue is split into N shards; each is owned through a renewable lease
+ * - Nodes publish heartbeats so survivors can pick up a dead node's shards
+ * - Backends are pluggable: shared-filesystem files by default, a
+ *   coordination service (etcd/Consul/Redis) can implement the same interface
+ * - Every takeover bumps the shard's fencing token; queue operations present
+ *   it so a stale (hung, then resumed) owner cannot move messages
+ */
+class ShardLeaseBackend {
+public:
+    virtual ~ShardLeaseBackend() = default;
+
+    // Publish this node's liveness
+    virtual bool heartbeat(const std::string& nodeId) = 0;
+    // Nodes whose last heartbeat is within ttl
+    virtual std::vector<std::string> liveNodes(std::chrono::milliseconds ttl) = 0;
+
+    // Acquire, or renew if already held, the lease on a shard.
+    // Returns the fencing token (0 if not held); renewals keep the token.
+    virtual uint64_t acquire(int shard, const std::string& nodeId,
+                             std::chrono::milliseconds ttl) = 0;
+    // Give the shard up (no-op if not held by nodeId)
+    virtual void release(int shard, const std::string& nodeId) = 0;
+
+    // Cheap read-only check: lease free, released or expired
+    virtual bool available(int shard) = 0;
+    // True if nodeId still holds shard under token and the lease is live
+    virtual bool validate(int shard, const std::string& nodeId, uint64_t token) = 0;
+
+    // Block until lease state may have changed, or timeout
+    virtual bool waitForChange(std::chrono::milliseconds timeout) {
+        std::this_thread::sleep_for(timeout);
+        return false;
+    }
+};
+
+// Lease and heartbeat files under <dir>/ha; safe on a shared filesystem
+// (exclusive-create claim files serialise read-modify-write of a lease).
+// Expiry uses wall-clock time, so nodes must keep their clocks in sync.
+class FileShardLeaseBackend : public ShardLeaseBackend {
+public:
+    explicit FileShardLeaseBackend(const std::string& dataDir);
+    ~FileShardLeaseBackend() override;
+
+    bool heartbeat(const std::string& nodeId) override;
+    std::vector<std::string> liveNodes(std::chrono::milliseconds ttl) override;
+    uint64_t acquire(int shard, const std::string& nodeId,
+                     std::chrono::milliseconds ttl) override;
+    void release(int shard, const std::string& nodeId) override;
+    bool available(int shard) override;
+    bool validate(int shard, const std::string& nodeId, uint64_t token) override;
+    // Wakes only when a lease changes hands; renewals by the same owner are
+    // ignored. Same-host changes only: see ChangeNotifier
+    bool waitForChange(std::chrono::milliseconds timeout) override;
+
+private:
+    struct Lease {
+        std::string owner;           // "-" once released
+        long long expiresMs = 0;
+        uint64_t token = 0;          // survives release so tokens never repeat
+    };
+
+    std::string leasePath(int shard) const;
+    bool readLease(int shard, Lease& out) const;
+    bool writeLease(int shard, const Lease& lease);
+    bool claim(int shard, std::chrono::milliseconds ttl);
+    void unclaim(int shard);
+
+    static long long nowMs();
+    static bool writeAtomic(const std::string& path, const std::string& content);
+    // Re-read the named lease files (all of them if names is empty); true if
+    // any owner differs from the last one seen
+    bool ownersChanged(const std::vector<std::string>& names);
+
+    std::string nodesDir_;
+    std::string shardsDir_;
+    std::unique_ptr<ChangeNotifier> notifier_;
+    std::map<std::string, std::string> owners_;   // lease file -> owner; waiting thread only
+};
@@ -23,18 +23,31 @@ void ImapServer::start() {
     thread_ = std::thread(&ImapServer::run, this);
 }
 
-void ImapServer::stop() {
-    if (!running_) return;
+void ImapServer::adoptListener(SOCKET sock) {
+    listenSock_ = sock;
+    adopted_ = true;
+}
+
+void ImapServer::stopAccepting() {
     running_ = false;
-    if (thread_.joinable()) {
-        // closing the listening socket will interrupt accept() in run()
-        if (listenSock_ != INVALID_SOCKET) {
-            shutdown(listenSock_, SD_BOTH);
-            closesocket(listenSock_);
-            listenSock_ = INVALID_SOCKET;
-        }
+    // Shared with the successor: close our descriptor, never shutdown()
+    if (thread_.joinable())
         thread_.join();
+    SOCKET s = listenSock_.exchange(INVALID_SOCKET);
+    if (s != INVALID_SOCKET)
+        closesocket(s);
+}
+
+void ImapServer::stop() {
+    running_ = false;
+    // closing the listening socket will interrupt accept() in run()
+    SOCKET ls = listenSock_.exchange(INVALID_SOCKET);
+    if (ls != INVALID_SOCKET) {
+        shutdown(ls, SD_BOTH);
+        closesocket(ls);
     }
+    if (thread_.joinable())
+        thread_.join();
 
     // Join any active session threads
     {
@@ -56,44 +69,56 @@ void ImapServer::run() {
         return;
     }
 
-    listenSock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (listenSock_ == INVALID_SOCKET) {
-        Logger::instance().log(LogLevel::Error, "IMAP socket() failed");
-        WSACleanup();
-        return;
-    }
+    if (!adopted_) {
+        listenSock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSock_ == INVALID_SOCKET) {
+            Logger::instance().log(LogLevel::Error, "IMAP socket() failed");
+            WSACleanup();
+            return;
+        }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(static_cast<uint16_t>(port_));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<uint16_t>(port_));
 
-    if (bind(listenSock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
-        Logger::instance().log(LogLevel::Error, "IMAP bind() failed");
-        closesocket(listenSock_);
-        WSACleanup();
-        return;
-    }
+        if (bind(listenSock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
+            Logger::instance().log(LogLevel::Error, "IMAP bind() failed");
+            closesocket(listenSock_);
+            listenSock_ = INVALID_SOCKET;
+            WSACleanup();
+            return;
+        }
 
-    if (listen(listenSock_, SOMAXCONN) == SOCKET_ERROR) {
-        Logger::instance().log(LogLevel::Error, "IMAP listen() failed");
-        closesocket(listenSock_);
-        listenSock_ = INVALID_SOCKET;
-        WSACleanup();
-        return;
+        if (listen(listenSock_, SOMAXCONN) == SOCKET_ERROR) {
+            Logger::instance().log(LogLevel::Error, "IMAP listen() failed");
+            closesocket(listenSock_);
+            listenSock_ = INVALID_SOCKET;
+            WSACleanup();
+            return;
+        }
     }
 
-    static std::atomic<int> activeConnections{0};
-
     while (running_) {
-        if (activeConnections.load() >= ctx_.config.globalMaxConnections) {
+        if (activeConnections_.load() >= ctx_.config.globalMaxConnections) {
             Logger::instance().log(LogLevel::Warn, 
-                "IMAP Max connections reached: " + std::to_string(activeConnections.load()));
+                "IMAP Max connections reached: " + std::to_string(activeConnections_.load()));
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             continue;
         }
 
-        SOCKET client = accept(listenSock_, nullptr, nullptr);
+        // Poll so stopAccepting() can end the loop without shutting down
+        // a listening socket shared with an upgraded successor
+        SOCKET ls = listenSock_;
+        if (ls == INVALID_SOCKET) break;
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(ls, &readable);
+        timeval tv{0, ACCEPT_POLL_MS * 1000};
+        if (select(static_cast<int>(ls) + 1, &readable, nullptr, nullptr, &tv) <= 0)
+            continue;
+
+        SOCKET client = accept(ls, nullptr, nullptr);
         if (client == INVALID_SOCKET) {
             if (!running_) break;
             Logger::instance().log(LogLevel::Warn, "IMAP accept() failed");
@@ -121,7 +146,7 @@ void ImapServer::run() {
         Logger::instance().inc_connections_total();
 
         std::thread t([this, client, ip]() {
-            activeConnections++;
+            activeConnections_++;
             
             SslPtr ssl = nullptr;
             
@@ -135,7 +160,7 @@ void ImapServer::run() {
                     // session wasn't started; free ssl and cleanup
                     if (raw) SSL_free(raw);
                     closesocket(client);
-                    activeConnections--;
+                    activeConnections_--;
                     RateLimiter::instance().releaseConnection(ip);
                     return;
                 }
@@ -151,7 +176,7 @@ void ImapServer::run() {
             Logger::instance().observe_imap_session(duration_ms);
             // session owns ssl_ and will free it in its destructor
             closesocket(client);
-            activeConnections--;
+            activeConnections_--;
             RateLimiter::instance().releaseConnection(ip);
         });
         {
@@ -159,10 +184,6 @@ void ImapServer::run() {
             sessions_.push_back(std::move(t));
         }
     }
-    if (listenSock_ != INVALID_SOCKET) {
-        closesocket(listenSock_);
-        listenSock_ = INVALID_SOCKET;
-    }
     WSACleanup();
     Logger::instance().log(LogLevel::Info, "IMAP server stopped");
 }
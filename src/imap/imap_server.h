@@ -29,6 +29,13 @@ public:
     void start();
     void stop();
 
+    // Upgrade handoff: serve an inherited listening socket instead of binding
+    void adoptListener(SOCKET sock);
+    SOCKET listener() const { return listenSock_; }
+    // Stop accepting without touching live sessions (successor owns the port)
+    void stopAccepting();
+    int activeSessions() const { return activeConnections_; }
+
 private:
     void run();
 
@@ -36,7 +43,10 @@ private:
     int port_;
     std::thread thread_;
     std::atomic<bool> running_{false};
-    SOCKET listenSock_{INVALID_SOCKET};
+    std::atomic<SOCKET> listenSock_{INVALID_SOCKET};
+    bool adopted_ = false;
+    std::atomic<int> activeConnections_{0};
+    static constexpr int ACCEPT_POLL_MS = 500;
     std::vector<std::thread> sessions_;
     std::mutex sessionsMutex_;
 };
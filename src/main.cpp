@@ -12,6 +12,7 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <stdexcept>
 #include "monitoring/http_metrics_server.h"
 #include "admin/admin_server.h"
 #include "admin/admin_auth.h"
@@ -19,9 +20,23 @@
 #include "virus/sandbox_provider_anyrun.h"
 #include "virus/cloud_scanner.h"
 #include "virus/cloud_provider_virustotal.h"
+#include "delivery/destination_throttle.h"
+#include "dns/dns_resolver.h"
+#include "dnsbl/dnsbl_engine.h"
+#include "antispam/dkim_key_registry.h"
+#include "antispam/public_suffix_list.h"
+#include "queue/mail_queue.h"
+#include "queue/priority_classifier.h"
+#include "ha/ha_controller.h"
+#include "replication/store_replicator.h"
+#include "replication/replica_receiver.h"
+#include "core/listener_handoff.h"
+#include <memory>
 
 // Global flag for graceful shutdown
 std::atomic<bool> g_running{true};
+// SIGHUP (SIGBREAK on Windows): hand listeners to a fresh binary, then drain
+std::atomic<bool> g_upgrade{false};
 
 void signalHandler(int signal) {
     Logger::instance().log(
@@ -31,6 +46,14 @@ void signalHandler(int signal) {
     g_running = false;
 }
 
+void upgradeHandler(int) {
+    g_upgrade = true;
+#ifdef _WIN32
+    // The CRT resets a handler to SIG_DFL before calling it
+    std::signal(SIGBREAK, upgradeHandler);
+#endif
+}
+
 LogLevel logLevelFromString(const std::string& s) {
     if (s == "debug")   return LogLevel::Debug;
     if (s == "info")    return LogLevel::Info;
@@ -45,7 +68,9 @@ int main() {
         std::signal(SIGINT, signalHandler);
         std::signal(SIGTERM, signalHandler);
 #ifndef _WIN32
-        std::signal(SIGHUP, signalHandler);
+        std::signal(SIGHUP, upgradeHandler);
+#else
+        std::signal(SIGBREAK, upgradeHandler);
 #endif
 
         // Parse command-line args
@@ -95,6 +120,44 @@ int main() {
         );
         SandboxEngine::instance().start();
 
+        // Shared DNS cache for SPF/DKIM/DMARC/MX
+        if (!DnsResolver::instance().configure(
+                cfg.dnsServers, cfg.dnsTimeoutMs,
+                static_cast<uint16_t>(cfg.dnsUdpPayload),
+                static_cast<uint32_t>(cfg.dnsMinTtl),
+                static_cast<uint32_t>(cfg.dnsMaxTtl),
+                static_cast<uint32_t>(cfg.dnsNegativeTtl),
+                cfg.dnsPrefetch)) {
+            throw std::runtime_error(
+                "No DNS resolvers: set dns.servers or configure the host's resolvers");
+        }
+
+        // Blocklists checked at SMTP accept
+        DnsblEngine::instance().configure(cfg.dnsblZones, cfg.dnsblRemote,
+                                          cfg.dnsblDataDir, cfg.dnsblReloadSec);
+        DnsblEngine::instance().start();
+
+        // Public Suffix List for DMARC organizational domains
+        PublicSuffixList::instance().configure(cfg.pslFile, cfg.pslReloadSec);
+        PublicSuffixList::instance().start();
+
+        // Outbound DKIM signing keys, loaded once and reloaded on change
+        std::vector<DkimSignConfig> dkimKeys;
+        for (const auto& k : cfg.dkimKeys)
+            dkimKeys.push_back({ k.domain, k.selector, k.keyFile, k.headers });
+        DkimKeyRegistry::instance().configure(dkimKeys, cfg.dkimReloadSec);
+        DkimKeyRegistry::instance().start();
+
+        // Outbound delivery: static per-domain throttle ceilings
+        DestinationThrottle::instance().configure(cfg.deliveryThrottle);
+
+        // Queue priority classes + weighted fair scheduling
+        PriorityClassifier::instance().configure(
+            cfg.queueHighSenders, cfg.queueBulkSenders,
+            cfg.queueHighUsers, cfg.queueBulkUsers);
+        MailQueue::instance().setClassWeights(
+            cfg.queueWeightHigh, cfg.queueWeightNormal, cfg.queueWeightBulk);
+
         // 5️⃣ Server context
         ServerContext ctx(cfg);
 
@@ -137,44 +200,135 @@ int main() {
             return 2;
         }
 
+        // Started by an upgrade: the predecessor keeps its fixed ports,
+        // leases and change log until it exits
+        std::map<std::string, SOCKET> inherited = ListenerHandoff::receive();
+        bool successor = !inherited.empty();
+
         // 7️⃣ Metrics + admin servers
         HttpMetricsServer metrics;
-        metrics.start(9090);
-
         AdminServer admin;
-        admin.start(8080);
 
         Logger::instance().log(LogLevel::Info, "Mailserver starting up");
         Logger::instance().log(
             LogLevel::Info,
             "Host=" + cfg.host +
             " SMTP=" + std::to_string(cfg.smtpPort) +
-            " IMAP=" + std::to_string(cfg.imapPort)
+            " IMAP=" + std::to_string(cfg.imapPort) +
+            " admin=" + std::to_string(cfg.adminPort) +
+            " metrics=" + std::to_string(cfg.metricsPort)
         );
 
+        // Outbound delivery: this node drains its share of queue shards
+        HaController ha(cfg.haDataDir, cfg.nodeId, cfg.queueShards,
+                        cfg.haLeaseMs, cfg.haRenewMs);
+        std::unique_ptr<ReplicaReceiver> replica;
+
+        auto startBackground = [&]() {
+            metrics.start(cfg.metricsPort);
+            admin.start(cfg.adminPort);
+
+            // Mail store replication
+            if (cfg.replicationRole == "primary") {
+                StoreReplicator::instance().configure(
+                    cfg.replicationMode == "sync" ? StoreReplicator::Mode::Sync
+                                                  : StoreReplicator::Mode::Async,
+                    cfg.replicationPeerHost, cfg.replicationPeerPort,
+                    cfg.mailRoot, cfg.replicationAckTimeoutMs, cfg.replicationSecret);
+                StoreReplicator::instance().attach(&ctx.mailStore);
+                StoreReplicator::instance().start();
+            } else if (cfg.replicationRole == "replica") {
+                replica = std::make_unique<ReplicaReceiver>(
+                    ctx.mailStore, cfg.mailRoot, cfg.replicationBindAddress,
+                    cfg.replicationListenPort, cfg.replicationSecret);
+                replica->start();
+            }
+
+            ha.start();
+        };
+
+        // Replication must see every store, so it starts before SMTP
+        if (successor) {
+            StoreReplicator::instance().deferUntilConfigured();
+        } else {
+            startBackground();
+        }
+
         // 8️⃣ SMTP / IMAP
         SmtpServer smtp(ctx, cfg.smtpPort);
         ImapServer imap(ctx, cfg.imapPort);
+        if (inherited.count("smtp")) smtp.adoptListener(inherited["smtp"]);
+        if (inherited.count("imap")) imap.adoptListener(inherited["imap"]);
         smtp.start();
         imap.start();
 
+        if (successor) {
+            ListenerHandoff::notifyReady();
+        }
+
         Logger::instance().log(
             LogLevel::Info,
             "Mailserver running. Waiting for shutdown signal..."
         );
 
         // 9️⃣ Wait loop
+        bool draining = false;
         while (g_running) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            DestinationThrottle::instance().maintain();
+
+            if (successor && ListenerHandoff::predecessorGone()) {
+                Logger::instance().log(LogLevel::Info,
+                    "Predecessor exited, starting background services");
+                successor = false;
+                startBackground();
+            }
+
+            if (g_upgrade.exchange(false) && !successor) {
+                Logger::instance().log(LogLevel::Info, "Upgrade requested, handing off listeners");
+                std::map<std::string, SOCKET> listeners;
+                if (smtp.listener() != INVALID_SOCKET) listeners["smtp"] = smtp.listener();
+                if (imap.listener() != INVALID_SOCKET) listeners["imap"] = imap.listener();
+                if (ListenerHandoff::upgrade(listeners, cfg.upgradeReadyTimeoutMs)) {
+                    draining = true;
+                    break;
+                }
+            }
+        }
+
+        if (draining) {
+            // Successor accepts from here on; finish the sessions we own
+            smtp.stopAccepting();
+            imap.stopAccepting();
+            // Leases go first so the successor's delivery takes over promptly
+            ha.stop();
+
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::seconds(cfg.drainTimeoutSec);
+            while ((smtp.activeSessions() > 0 || imap.activeSessions() > 0) &&
+                   std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+            Logger::instance().log(LogLevel::Info,
+                "Drain finished with " +
+                std::to_string(smtp.activeSessions() + imap.activeSessions()) +
+                " session(s) still open");
         }
 
         // 🔟 Shutdown
         Logger::instance().log(LogLevel::Info, "Shutting down servers...");
         smtp.stop();
         imap.stop();
+        ha.stop();
+        StoreReplicator::instance().stop();
+        if (replica) replica->stop();
         admin.stop();
         metrics.stop();
         SandboxEngine::instance().stop();
+        DnsblEngine::instance().stop();
+        DkimKeyRegistry::instance().stop();
+        PublicSuffixList::instance().stop();
+        DestinationThrottle::instance().save();
         Logger::instance().log(LogLevel::Info, "Shutdown complete");
     }
     catch (const std::exception& ex) {
@@ -2,6 +2,10 @@
 #include "queue/mail_queue.h"
 #include "core/logger.h"
 #include "monitoring/metrics.h"
+#include "queue/retry_policy.h"
+#include "queue/queue_entry.h"
+#include "antispam/dkim_signer.h"
+#include "core/worker_pool.h"
 
 #include <filesystem>
 #include <fstream>
@@ -116,11 +120,35 @@ std::string MailQueue::genId() {
 }
 
 
+bool MailQueue::isDue(const QueueMessage& msg) {
+    auto now = SysClock::now();
+    for (const auto& r : msg.recipients) {
+        if (r.status == RecipientStatus::Pending)
+            return true;
+        if (r.status == RecipientStatus::Deferred && r.nextAttemptAt <= now)
+            return true;
+    }
+    return false;
+}
+
 std::string MailQueue::enqueue(
     const std::string& from,
     const std::string& to,
     const std::string& raw
 ) {
+    return enqueue(from, std::vector<std::string>{to}, raw);
+}
+
+std::string MailQueue::enqueue(
+    const std::string& from,
+    const std::vector<std::string>& to,
+    const std::string& raw,
+    const std::string& authUser
+) {
+    if (to.empty()) {
+        throw std::runtime_error("Queue: Message has no recipients");
+    }
+
     // CRITICAL FIX: Check queue depth to prevent disk exhaustion
     static constexpr int MAX_QUEUE_DEPTH = 100000; // Configurable limit
     int currentDepth = 0;
@@ -144,23 +172,44 @@ std::string MailQueue::enqueue(
     std::string id = genId();
     fs::path p = "queue/active/" + id + ".msg";
 
+    QueueMessage m;
+    m.id = id;
+    m.from = from;
+    m.enqueuedAt = SysClock::now();
+    m.priority = PriorityClassifier::instance().classify(from, authUser, raw);
+    bool sign = !DkimSigner::forMessage(raw).empty();
+    if (sign)
+        m.flags |= QueueEntryCodec::FLAG_NEEDS_SIGNING;
+    for (const auto& addr : to) {
+        QueueRecipient r;
+        r.address = addr;
+        m.recipients.push_back(r);
+    }
+
     // CRITICAL FIX: Build message content and use atomic write with fsync
-    std::string content;
-    content.reserve(raw.size() + 256); // Pre-allocate
-    content += "FROM: " + from + "\n";
-    content += "TO: " + to + "\n";
-    content += "---RAW---\n";
+    std::string content = QueueEntryCodec::encodeEnvelope(m, raw.size());
+    content.reserve(content.size() + raw.size());
     content += raw;
-
     if (!atomicWriteFile(p.string(), content)) {
         Logger::instance().log(LogLevel::Error,
             "Queue: Atomic write failed for message " + id);
         throw std::runtime_error("Failed to durably enqueue message");
     }
 
+    {
+        std::lock_guard<std::mutex> lock(schedMutex_);
+        if (sign)
+            signAsyncLocked(id, p.string());
+        else
+            pushReadyLocked(m.priority, id, p.string());
+        publishReadyLocked();
+    }
+
     Logger::instance().log(
         LogLevel::Info,
-        "Queue: Enqueued " + id + " (depth: " + std::to_string(currentDepth + 1) + ")"
+        "Queue: Enqueued " + id + " [" + priorityClassName(m.priority) + "] for " +
+        std::to_string(to.size()) + " recipient(s) (depth: " +
+        std::to_string(currentDepth + 1) + ")"
     );
     
     // Update queue depth metric
@@ -228,112 +277,326 @@ std::optional<QueueMessage> MailQueue::fetchReady() {
         }
     }
 
-    /* Lease a ready message */
-    for (auto& f : fs::directory_iterator("queue/active")) {
-        if (f.path().extension() != ".msg")
-            continue;
+    std::lock_guard<std::mutex> lock(schedMutex_);
+
+    bool empty = std::all_of(ready_.begin(), ready_.end(),
+                             [](const std::deque<ReadyRef>& q) { return q.empty(); });
+    if (empty || std::chrono::steady_clock::now() - lastScan_ >=
+                     std::chrono::seconds(RESCAN_INTERVAL_SEC))
+        rescanLocked();
+
+    /* Deficit round robin: each visit adds the class quantum; a class is
+       served while its deficit covers one message, empty classes forfeit */
+    for (int step = 0; step < 2 * PRIORITY_CLASS_COUNT; ++step) {
+        int c = drrCurrent_;
+        if (!drrFresh_) {
+            deficit_[c] += quantum_[c];
+            drrFresh_ = true;
+        }
 
-        fs::path inflight =
-            "queue/inflight/" + f.path().filename().string();
+        while (deficit_[c] >= 1 && !ready_[c].empty()) {
+            ReadyRef ref = ready_[c].front();
+            ready_[c].pop_front();
+            queued_.erase(ref.id);
 
-        // CRITICAL FIX: Better error handling for atomic lease operation
-        try {
-            // Check if destination already exists (race condition protection)
-            if (fs::exists(inflight)) {
-                continue; // Already leased by another process
-            }
-            
-            // Atomic rename operation (filesystem-level atomicity)
-            fs::rename(f.path(), inflight);
-            
-            // Verify rename succeeded (defensive check)
-            if (!fs::exists(inflight)) {
-                Logger::instance().log(LogLevel::Error,
-                    "Queue: Atomic lease failed for " + f.path().string());
+            auto m = lease(ref.path);
+            if (!m)
                 continue;
+
+            deficit_[c] -= 1;
+            if (deficit_[c] < 1) {
+                drrCurrent_ = (c + 1) % PRIORITY_CLASS_COUNT;
+                drrFresh_ = false;
             }
-        } catch (const fs::filesystem_error& ex) {
-            // Filesystem errors (permissions, disk full, etc.)
-            Logger::instance().log(LogLevel::Error,
-                "Queue: Filesystem error during lease: " + std::string(ex.what()));
-            continue;
-        } catch (const std::exception& ex) {
-            Logger::instance().log(LogLevel::Error,
-                "Queue: Error during lease: " + std::string(ex.what()));
-            continue;
-        } catch (...) {
-            // Someone else got it or other error
-            continue;
+            publishReadyLocked();
+            return m;
         }
 
-        // CRITICAL FIX: Better error handling for file read
-        std::ifstream in(inflight, std::ios::binary);
-        if (!in.is_open()) {
+        if (ready_[c].empty())
+            deficit_[c] = 0;
+        drrCurrent_ = (c + 1) % PRIORITY_CLASS_COUNT;
+        drrFresh_ = false;
+    }
+
+    publishReadyLocked();
+    return std::nullopt;
+}
+
+void MailQueue::setClassWeights(int high, int normal, int bulk) {
+    std::lock_guard<std::mutex> lock(schedMutex_);
+    quantum_ = {{std::max(1, high), std::max(1, normal), std::max(1, bulk)}};
+}
+
+int MailQueue::shardOf(const std::string& id, int shardCount) {
+    if (shardCount <= 1)
+        return 0;
+    // FNV-1a: stable across nodes, unlike std::hash
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : id) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return static_cast<int>(h % static_cast<uint64_t>(shardCount));
+}
+
+bool MailQueue::ownsLocked(const std::string& id) const {
+    if (shardCount_ == 0)
+        return true;
+    return ownedShards_[shardOf(id, shardCount_)];
+}
+
+void MailQueue::setFence(std::function<bool(int)> fence) {
+    std::lock_guard<std::mutex> lock(schedMutex_);
+    fence_ = std::move(fence);
+}
+
+bool MailQueue::fencedOut(const std::string& id) {
+    std::function<bool(int)> fence;
+    int shards = 0;
+    {
+        std::lock_guard<std::mutex> lock(schedMutex_);
+        fence = fence_;
+        shards = shardCount_;
+    }
+    if (!fence || shards == 0 || fence(shardOf(id, shards)))
+        return false;
+
+    Metrics::instance().inc("ha_fenced_operations_total");
+    Logger::instance().log(LogLevel::Warn,
+        "Queue: Refusing to move " + id + ": shard lease lost (stale fencing token)");
+    return true;
+}
+
+void MailQueue::setOwnedShards(int shardCount, const std::vector<int>& owned) {
+    std::lock_guard<std::mutex> lock(schedMutex_);
+    shardCount_ = std::max(1, shardCount);
+    ownedShards_.assign(shardCount_, false);
+    for (int s : owned) {
+        if (s >= 0 && s < shardCount_)
+            ownedShards_[s] = true;
+    }
+
+    // Drop entries of shards we no longer own; force a rescan for new ones
+    for (auto& q : ready_) {
+        for (auto it = q.begin(); it != q.end();) {
+            if (!ownsLocked(it->id)) {
+                queued_.erase(it->id);
+                it = q.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    lastScan_ = std::chrono::steady_clock::time_point{};
+    publishReadyLocked();
+}
+
+void MailQueue::pushReadyLocked(PriorityClass c,
+                                const std::string& id,
+                                const std::string& path) {
+    if (!ownsLocked(id))
+        return; // another node's shard; its owner picks it up on rescan
+    if (!queued_.insert(id).second)
+        return;
+    ready_[static_cast<int>(c)].push_back({id, path});
+}
+
+void MailQueue::publishReadyLocked() {
+    for (int c = 0; c < PRIORITY_CLASS_COUNT; ++c) {
+        Metrics::instance().set(
+            std::string("mail_queue_ready{class=\"") +
+                priorityClassName(static_cast<PriorityClass>(c)) + "\"}",
+            static_cast<int>(ready_[c].size()));
+    }
+}
+
+// Pick up entries not yet in a ready queue: new ones in active/ (written by
+// another node or reclaimed from expired leases) and deferred ones now due
+void MailQueue::rescanLocked() {
+    lastScan_ = std::chrono::steady_clock::now();
+
+    for (const char* dir : {"queue/active", "queue/failure"}) {
+        bool deferredDir = (std::string(dir) == "queue/failure");
+        try {
+            for (auto& f : fs::directory_iterator(dir)) {
+                if (f.path().extension() != ".msg")
+                    continue;
+                std::string id = f.path().stem().string();
+                if (queued_.count(id) || signing_.count(id) || !ownsLocked(id))
+                    continue;
+
+                QueueMessage probe;
+                if (!QueueEntryCodec::readMetadata(f.path().string(), probe))
+                    continue;
+                if (probe.flags & QueueEntryCodec::FLAG_NEEDS_SIGNING) {
+                    // Enqueued before a crash or a failed signing attempt
+                    signAsyncLocked(id, f.path().string());
+                    continue;
+                }
+                if (deferredDir && !isDue(probe))
+                    continue;
+                pushReadyLocked(probe.priority, id, f.path().string());
+            }
+        } catch (const std::exception& ex) {
             Logger::instance().log(LogLevel::Error,
-                "Queue: Failed to open leased message: " + inflight.string());
-            // Try to recover: move back to active
-            try {
-                fs::rename(inflight, f.path());
-            } catch (...) {}
-            continue;
+                std::string("Queue: Rescan of ") + dir + " failed: " + ex.what());
         }
-        
-        std::string raw(
-            (std::istreambuf_iterator<char>(in)),
-            std::istreambuf_iterator<char>()
-        );
-        in.close();
-        
-        if (raw.empty()) {
-            Logger::instance().log(LogLevel::Warn,
-                "Queue: Leased message is empty: " + inflight.string());
-            // Move to permanent failure
-            try {
-                fs::rename(inflight, "queue/permanent_fail/" + inflight.filename().string());
-            } catch (...) {}
-            continue;
+    }
+}
+
+void MailQueue::signAsyncLocked(const std::string& id, const std::string& path) {
+    if (!signing_.insert(id).second)
+        return;
+    signBacklog_.push_back({id, path});
+    startSignLocked();
+}
+
+void MailQueue::startSignLocked() {
+    while (signRunning_ < SIGN_IN_FLIGHT && !signBacklog_.empty()) {
+        ReadyRef next = std::move(signBacklog_.front());
+        signBacklog_.pop_front();
+        ++signRunning_;
+        signIo_.submit([this, next] { signEntry(next.id, next.path); });
+    }
+    Metrics::instance().set("dkim_sign_backlog", static_cast<int>(signBacklog_.size()));
+}
+
+void MailQueue::signEntry(const std::string& id, const std::string& path) {
+    QueueMessage m;
+    m.id = id;
+    bool ok = false;
+    try {
+        ok = QueueEntryCodec::readMetadata(path, m) && QueueEntryCodec::readBody(m);
+        if (ok && (m.flags & QueueEntryCodec::FLAG_NEEDS_SIGNING)) {
+            const std::string& raw = m.rawData;
+            std::string signature = WorkerPool::crypto().submit([&raw] {
+                return DkimSigner::forMessage(raw).signMessage(raw);
+            }).get();
+            if (signature.empty()) {
+                // Key removed since enqueue, or signing failed: send unsigned
+                Metrics::instance().inc("dkim_sign_failures_total");
+                Logger::instance().log(LogLevel::Warn,
+                    "Queue: " + id + " could not be DKIM-signed, delivering unsigned");
+            } else {
+                signature += "\r\n";
+                Metrics::instance().inc("dkim_signed_total");
+            }
+            ok = QueueEntryCodec::writeSignature(m, signature);
         }
+    } catch (const std::exception& ex) {
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Signing " + id + " failed: " + ex.what());
+        ok = false;
+    }
 
-        // Parse FROM and TO from message headers
-        QueueMessage m;
-        m.id = inflight.stem().string();
-        m.rawData = raw;
+    std::lock_guard<std::mutex> lock(schedMutex_);
+    signing_.erase(id);
+    --signRunning_;
+    startSignLocked();
+    if (ok) {
+        pushReadyLocked(m.priority, id, path);
+        publishReadyLocked();
+    } else {
+        // Still flagged on disk; the next rescan tries again
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Failed to store DKIM signature for " + id);
+    }
+}
+
+std::optional<QueueMessage> MailQueue::lease(const std::string& path) {
+    fs::path src = path;
+    fs::path inflight = "queue/inflight/" + src.filename().string();
+
+    // Fencing (schedMutex_ is held by fetchReady)
+    if (fence_ && shardCount_ > 0 &&
+        !fence_(shardOf(src.stem().string(), shardCount_))) {
+        Metrics::instance().inc("ha_fenced_operations_total");
+        return std::nullopt;
+    }
+
+    // CRITICAL FIX: Better error handling for atomic lease operation
+    try {
+        // Check if destination already exists (race condition protection)
+        if (!fs::exists(src) || fs::exists(inflight)) {
+            return std::nullopt; // Already leased by another process
+        }
         
-        // Extract FROM and TO from raw message (simplified parsing)
-        size_t fromPos = raw.find("FROM: ");
-        if (fromPos != std::string::npos) {
-            size_t fromEnd = raw.find('\n', fromPos);
-            if (fromEnd != std::string::npos) {
-                m.from = raw.substr(fromPos + 6, fromEnd - fromPos - 6);
-                // Trim whitespace
-                while (!m.from.empty() && (m.from.back() == ' ' || m.from.back() == '\r')) {
-                    m.from.pop_back();
-                }
-            }
+        // Atomic rename operation (filesystem-level atomicity)
+        fs::rename(src, inflight);
+
+        // A rename keeps the old mtime; isLeaseExpired measures the lease
+        // from it, so an entry queued long ago would be reclaimed at once
+        std::error_code ec;
+        fs::last_write_time(inflight, fs::file_time_type::clock::now(), ec);
+        if (ec) {
+            Logger::instance().log(LogLevel::Error,
+                "Queue: Could not stamp lease time on " + inflight.string() +
+                ": " + ec.message());
+            fs::rename(inflight, src);
+            return std::nullopt;
         }
         
-        size_t toPos = raw.find("TO: ");
-        if (toPos != std::string::npos) {
-            size_t toEnd = raw.find('\n', toPos);
-            if (toEnd != std::string::npos) {
-                m.to = raw.substr(toPos + 4, toEnd - toPos - 4);
-                while (!m.to.empty() && (m.to.back() == ' ' || m.to.back() == '\r')) {
-                    m.to.pop_back();
-                }
-            }
+        // Verify rename succeeded (defensive check)
+        if (!fs::exists(inflight)) {
+            Logger::instance().log(LogLevel::Error,
+                "Queue: Atomic lease failed for " + src.string());
+            return std::nullopt;
         }
+    } catch (const fs::filesystem_error& ex) {
+        // Filesystem errors (permissions, disk full, etc.)
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Filesystem error during lease: " + std::string(ex.what()));
+        return std::nullopt;
+    } catch (const std::exception& ex) {
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Error during lease: " + std::string(ex.what()));
+        return std::nullopt;
+    } catch (...) {
+        // Someone else got it or other error
+        return std::nullopt;
+    }
 
-        Logger::instance().log(
-            LogLevel::Debug,
-            "Queue: Leased " + m.id
-        );
-        return m;
+    // Metadata only (one small pread); the body stays on disk until needed
+    QueueMessage m;
+    m.id = inflight.stem().string();
+    bool ok = QueueEntryCodec::readMetadata(inflight.string(), m);
+    
+    if (!ok || m.recipients.empty() || m.bodyLength == 0) {
+        Logger::instance().log(LogLevel::Warn,
+            "Queue: Leased message is malformed or empty: " + inflight.string());
+        // Move to permanent failure
+        try {
+            fs::rename(inflight, "queue/permanent_fail/" + inflight.filename().string());
+        } catch (...) {}
+        return std::nullopt;
     }
 
-    return std::nullopt;
+    m.to = m.recipients.front().address;
+    bool firstAttempt = true;
+    for (const auto& r : m.recipients) {
+        m.retryCount = std::max(m.retryCount, r.attempts);
+        firstAttempt = firstAttempt && r.status == RecipientStatus::Pending;
+    }
+
+    // Per-class scheduling latency: enqueue -> first lease
+    if (firstAttempt) {
+        auto waited = std::chrono::duration_cast<std::chrono::seconds>(
+            SysClock::now() - m.enqueuedAt).count();
+        std::string cls = priorityClassName(m.priority);
+        Metrics::instance().inc("mail_queue_wait_seconds_sum{class=\"" + cls + "\"}",
+                                static_cast<int>(std::max<long long>(0, waited)));
+        Metrics::instance().inc("mail_queue_wait_seconds_count{class=\"" + cls + "\"}");
+    }
+
+    Logger::instance().log(
+        LogLevel::Debug,
+        "Queue: Leased " + m.id + " [" + priorityClassName(m.priority) + "]"
+    );
+    return m;
 }
 
 void MailQueue::markSuccess(const std::string& id) {
+    if (fencedOut(id)) return;
     fs::path p = "queue/inflight/" + id + ".msg";
     if (fs::exists(p)) {
         fs::remove(p);
@@ -348,21 +611,27 @@ void MailQueue::markTempFail(
     const QueueMessage& msg,
     const std::string& reason
 ) {
-    fs::path src = "queue/inflight/" + msg.id + ".msg";
-    fs::path dst = "queue/failure/" + msg.id + ".msg";
-    try {
-        fs::rename(src, dst);
-        Logger::instance().log(
-            LogLevel::Warn,
-            "Queue: TempFail " + msg.id + " → " + reason
-        );
-    } catch (...) {}
+    QueueMessage deferred = msg;
+    auto next = SysClock::now() + std::chrono::seconds(computeBackoff(msg.retryCount));
+    for (auto& r : deferred.recipients) {
+        if (r.isFinal())
+            continue;
+        r.status = RecipientStatus::Deferred;
+        r.attempts++;
+        r.nextAttemptAt = next;
+    }
+    Logger::instance().log(
+        LogLevel::Warn,
+        "Queue: TempFail " + msg.id + " → " + reason
+    );
+    update(deferred);
 }
 
 void MailQueue::markPermFail(
     const QueueMessage& msg,
     const std::string& reason
 ) {
+    if (fencedOut(msg.id)) return;
     fs::path src = "queue/inflight/" + msg.id + ".msg";
     fs::path dst = "queue/permanent_fail/" + msg.id + ".msg";
     try {
@@ -373,3 +642,76 @@ void MailQueue::markPermFail(
         );
     } catch (...) {}
 }
+
+void MailQueue::update(const QueueMessage& msg) {
+    // A stale owner must not move the entry; the live owner reclaims it
+    // once the inflight lease expires
+    if (fencedOut(msg.id)) return;
+
+    fs::path src = "queue/inflight/" + msg.id + ".msg";
+
+    int delivered = 0, failed = 0, open = 0;
+    for (const auto& r : msg.recipients) {
+        if (r.status == RecipientStatus::Delivered) delivered++;
+        else if (r.status == RecipientStatus::Failed) failed++;
+        else open++;
+    }
+
+    try {
+        if (open == 0) {
+            // Per-class end-to-end latency: enqueue -> all recipients final
+            auto took = std::chrono::duration_cast<std::chrono::seconds>(
+                SysClock::now() - msg.enqueuedAt).count();
+            std::string cls = priorityClassName(msg.priority);
+            Metrics::instance().inc("mail_queue_latency_seconds_sum{class=\"" + cls + "\"}",
+                                    static_cast<int>(std::max<long long>(0, took)));
+            Metrics::instance().inc("mail_queue_latency_seconds_count{class=\"" + cls + "\"}");
+        }
+
+        if (open == 0 && failed == 0) {
+            fs::remove(src);
+            Logger::instance().log(LogLevel::Info,
+                "Queue: Delivered " + msg.id + " to all " +
+                std::to_string(delivered) + " recipient(s)");
+            return;
+        }
+
+        // Update the fixed-size recipient records in place; legacy text
+        // entries are rewritten once in the binary format
+        if (!QueueEntryCodec::writeRecords(msg)) {
+            QueueMessage copy = msg;
+            if (!QueueEntryCodec::readBody(copy) ||
+                !atomicWriteFile(src.string(),
+                    QueueEntryCodec::encodeEnvelope(copy, copy.rawData.size()) +
+                        copy.rawData + copy.dkimSignature)) {
+                Logger::instance().log(LogLevel::Error,
+                    "Queue: Failed to persist recipient state for " + msg.id);
+                return; // lease expiry will retry the whole entry
+            }
+        }
+
+        if (open == 0) {
+            fs::rename(src, "queue/permanent_fail/" + msg.id + ".msg");
+            Logger::instance().log(LogLevel::Error,
+                "Queue: PermFail " + msg.id + " (" + std::to_string(failed) +
+                " of " + std::to_string(msg.recipients.size()) + " recipient(s) failed)");
+        } else {
+            fs::rename(src, "queue/failure/" + msg.id + ".msg");
+            Logger::instance().log(LogLevel::Debug,
+                "Queue: Deferred " + msg.id + " (" + std::to_string(open) +
+                " recipient(s) pending)");
+        }
+    } catch (const std::exception& ex) {
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Failed to update " + msg.id + ": " + ex.what());
+    }
+}
+
+bool MailQueue::loadBody(QueueMessage& msg) {
+    if (!QueueEntryCodec::readBody(msg)) {
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Failed to read body of " + msg.id);
+        return false;
+    }
+    return true;
+}
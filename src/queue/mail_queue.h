@@ -6,11 +6,49 @@
 #include <mutex>
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
+#include <array>
+#include <deque>
+#include <unordered_set>
+#include <functional>
+#include "queue/priority_classifier.h"
+#include "core/worker_pool.h"
+
+enum class RecipientStatus {
+    Pending,    // not yet attempted
+    Delivered,  // final
+    Deferred,   // temporary failure, retry at nextAttemptAt
+    Failed      // final
+};
+
+struct QueueRecipient {
+    std::string address;
+    RecipientStatus status = RecipientStatus::Pending;
+    int attempts = 0;
+    std::chrono::system_clock::time_point nextAttemptAt;
+
+    bool isFinal() const {
+        return status == RecipientStatus::Delivered ||
+               status == RecipientStatus::Failed;
+    }
+};
+
 struct QueueMessage {
     std::string id;
     std::string from;
-    std::string to;
-    std::string rawData;
+    std::string to;                          // first recipient (for logging/scanners)
+    std::vector<QueueRecipient> recipients;  // one body, many recipients
+    std::string rawData;                     // body only; loaded on demand
+    std::string dkimSignature;               // DKIM-Signature fields sent ahead of rawData
+    PriorityClass priority = PriorityClass::Normal;
+    uint8_t flags = 0;
+    uint16_t signatureLength = 0;
+
+    // On-disk location (see queue/queue_entry.h)
+    std::string path;
+    uint64_t bodyOffset = 0;
+    uint64_t bodyLength = 0;
+    bool legacyFormat = false;               // pre-binary text entry
     int retryCount = 0;
     std::chrono::system_clock::time_point enqueuedAt;
     std::chrono::system_clock::time_point nextRetryAt;
@@ -25,12 +63,40 @@ public:
         const std::string& to,
         const std::string& raw
     );
+    // authUser (if the message was submitted authenticated) feeds
+    // priority classification alongside sender and headers
+    std::string enqueue(
+        const std::string& from,
+        const std::vector<std::string>& to,
+        const std::string& raw,
+        const std::string& authUser = ""
+    );
 
+    // Leases the next entry chosen by deficit round robin across classes.
+    // Only metadata is read; call loadBody() before delivering.
     std::optional<QueueMessage> fetchReady();
+    bool loadBody(QueueMessage& msg);
+
+    // DRR quanta (messages per round) for high/normal/bulk
+    void setClassWeights(int high, int normal, int bulk);
+
+    // Multi-active HA: only entries in owned shards are leased here.
+    // Until this is called every entry is considered owned.
+    void setOwnedShards(int shardCount, const std::vector<int>& owned);
+    static int shardOf(const std::string& id, int shardCount);
+
+    // Fencing: called with an entry's shard before it is leased or its
+    // state is written; false means this node's tenure is stale
+    void setFence(std::function<bool(int)> fence);
 
     void markSuccess(const std::string& id);
     void markTempFail(const QueueMessage& msg, const std::string& reason);
     void markPermFail(const QueueMessage& msg, const std::string& reason);
+
+    // Persist per-recipient state after a delivery pass. The entry is
+    // removed once every recipient is final (moved to permanent_fail if
+    // any failed); otherwise it is parked in queue/failure until due.
+    void update(const QueueMessage& msg);
     static int countReadyMessages() {
         std::lock_guard<std::mutex> lock(queueMutex_);
         return std::count_if(retryQueue_.begin(), retryQueue_.end(),
@@ -48,4 +114,46 @@ private:
 
     // CRITICAL FIX: Recovery of orphaned temp files
     void recoverOrphanedTempFiles();
+
+    struct ReadyRef {
+        std::string id;
+        std::string path;   // active/ or failure/ location at scan time
+    };
+
+    std::optional<QueueMessage> lease(const std::string& path);
+    void rescanLocked();
+    void pushReadyLocked(PriorityClass c, const std::string& id, const std::string& path);
+    void publishReadyLocked();
+    bool ownsLocked(const std::string& id) const;
+    bool fencedOut(const std::string& id);
+
+    // Outbound DKIM: entries flagged at enqueue are signed once and only
+    // become ready after that. The entry is read and rewritten on signIo_;
+    // only the signature itself runs on the crypto pool, SIGN_IN_FLIGHT at
+    // a time, so a signing backlog never queues inbound verification
+    void signAsyncLocked(const std::string& id, const std::string& path);
+    void startSignLocked();
+    void signEntry(const std::string& id, const std::string& path);
+
+    static constexpr int RESCAN_INTERVAL_SEC = 10;
+    static constexpr size_t SIGN_IN_FLIGHT = 2;
+
+    std::mutex schedMutex_;
+    std::array<std::deque<ReadyRef>, PRIORITY_CLASS_COUNT> ready_;
+    std::unordered_set<std::string> queued_;   // ids currently in ready_
+    std::unordered_set<std::string> signing_;  // ids accepted for signing
+    std::deque<ReadyRef> signBacklog_;         // accepted, not yet started
+    size_t signRunning_ = 0;
+    std::array<int, PRIORITY_CLASS_COUNT> quantum_{{8, 4, 1}};
+    std::array<int, PRIORITY_CLASS_COUNT> deficit_{};
+    int drrCurrent_ = 0;
+    bool drrFresh_ = false;                    // quantum not yet added this visit
+    std::chrono::steady_clock::time_point lastScan_;
+    int shardCount_ = 0;                       // 0 = unsharded (own everything)
+    std::vector<bool> ownedShards_;
+    std::function<bool(int)> fence_;
+
+    static bool isDue(const QueueMessage& msg);
+
+    WorkerPool signIo_{SIGN_IN_FLIGHT, "queue-sign"};   // last: joined first
 };
@@ -0,0 +1,130 @@
+#include "queue/priority_classifier.h"
+#include "core/logger.h"
+
+#include <algorithm>
+#include <cctype>
+
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return s;
+}
+
+static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string::npos) return "";
+    size_t e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+const char* priorityClassName(PriorityClass c) {
+    switch (c) {
+    case PriorityClass::High:   return "high";
+    case PriorityClass::Normal: return "normal";
+    case PriorityClass::Bulk:   return "bulk";
+    }
+    return "normal";
+}
+
+PriorityClass priorityClassFromName(const std::string& name) {
+    if (name == "high") return PriorityClass::High;
+    if (name == "bulk") return PriorityClass::Bulk;
+    return PriorityClass::Normal;
+}
+
+PriorityClassifier& PriorityClassifier::instance() {
+    static PriorityClassifier c;
+    return c;
+}
+
+void PriorityClassifier::configure(const std::vector<std::string>& highSenders,
+                                   const std::vector<std::string>& bulkSenders,
+                                   const std::vector<std::string>& highUsers,
+                                   const std::vector<std::string>& bulkUsers) {
+    auto lower = [](std::vector<std::string> v) {
+        for (auto& s : v) s = toLower(s);
+        return v;
+    };
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    highSenders_ = lower(highSenders);
+    bulkSenders_ = lower(bulkSenders);
+    highUsers_ = lower(highUsers);
+    bulkUsers_ = lower(bulkUsers);
+
+    Logger::instance().log(LogLevel::Info,
+        "PriorityClassifier: " +
+        std::to_string(highSenders_.size() + highUsers_.size()) + " high, " +
+        std::to_string(bulkSenders_.size() + bulkUsers_.size()) + " bulk rule(s)");
+}
+
+bool PriorityClassifier::matches(const std::vector<std::string>& list,
+                                 const std::string& addr) {
+    for (const auto& entry : list) {
+        if (entry.empty())
+            continue;
+        if (entry[0] == '@') {
+            if (addr.size() >= entry.size() &&
+                addr.compare(addr.size() - entry.size(), entry.size(), entry) == 0)
+                return true;
+        } else if (addr == entry) {
+            return true;
+        }
+    }
+    return false;
+}
+
+PriorityClass PriorityClassifier::classifyHeaders(const std::string& raw) {
+    // Header block only: stop at the first empty line
+    size_t end = raw.find("\r\n\r\n");
+    if (end == std::string::npos) end = raw.find("\n\n");
+    if (end == std::string::npos) end = raw.size();
+
+    PriorityClass result = PriorityClass::Normal;
+    size_t pos = 0;
+    while (pos < end) {
+        size_t eol = raw.find('\n', pos);
+        if (eol == std::string::npos || eol > end) eol = end;
+        std::string line = raw.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || line.empty() ||
+            line[0] == ' ' || line[0] == '\t')
+            continue;
+
+        std::string name = toLower(trim(line.substr(0, colon)));
+        std::string value = toLower(trim(line.substr(colon + 1)));
+
+        // Bulk markers win over any sender-set priority
+        if (name == "precedence" &&
+            (value == "bulk" || value == "list" || value == "junk"))
+            return PriorityClass::Bulk;
+        if (name == "list-unsubscribe" || name == "list-id")
+            return PriorityClass::Bulk;
+
+        if ((name == "x-priority" && (value.rfind("1", 0) == 0 || value.rfind("2", 0) == 0)) ||
+            (name == "importance" && value == "high") ||
+            (name == "priority" && value == "urgent"))
+            result = PriorityClass::High;
+    }
+    return result;
+}
+
+PriorityClass PriorityClassifier::classify(const std::string& from,
+                                           const std::string& authUser,
+                                           const std::string& raw) const {
+    std::string sender = toLower(from);
+    std::string user = toLower(authUser);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Explicit configuration takes precedence over headers
+        if (!user.empty() && matches(highUsers_, user)) return PriorityClass::High;
+        if (!user.empty() && matches(bulkUsers_, user)) return PriorityClass::Bulk;
+        if (matches(highSenders_, sender)) return PriorityClass::High;
+        if (matches(bulkSenders_, sender)) return PriorityClass::Bulk;
+    }
+
+    return classifyHeaders(raw);
+}
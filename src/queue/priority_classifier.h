@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+/**
+ * Queue Priority Classes
+ *
+ * WHY REQUIRED:
+ * - A bulk blast must not delay password resets and transactional mail
+ * - Each class has its own ready queue in MailQueue, served by weighted
+ *   deficit round robin
+ * - Class comes from configured senders/authenticated users, then from
+ *   message headers (Precedence, List-Unsubscribe, X-Priority, Importance)
+ */
+enum class PriorityClass {
+    High = 0,
+    Normal = 1,
+    Bulk = 2
+};
+
+static constexpr int PRIORITY_CLASS_COUNT = 3;
+
+const char* priorityClassName(PriorityClass c);
+PriorityClass priorityClassFromName(const std::string& name);
+
+class PriorityClassifier {
+public:
+    static PriorityClassifier& instance();
+
+    // Entries are full addresses ("alerts@example.com") or "@domain" suffixes
+    void configure(const std::vector<std::string>& highSenders,
+                   const std::vector<std::string>& bulkSenders,
+                   const std::vector<std::string>& highUsers,
+                   const std::vector<std::string>& bulkUsers);
+
+    PriorityClass classify(const std::string& from,
+                           const std::string& authUser,
+                           const std::string& raw) const;
+
+private:
+    PriorityClassifier() = default;
+
+    static bool matches(const std::vector<std::string>& list, const std::string& addr);
+    static PriorityClass classifyHeaders(const std::string& raw);
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> highSenders_;
+    std::vector<std::string> bulkSenders_;
+    std::vector<std::string> highUsers_;
+    std::vector<std::string> bulkUsers_;
+};
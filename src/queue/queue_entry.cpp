@@ -0,0 +1,395 @@
+#include "queue/queue_entry.h"
+#include "queue/mail_queue.h"
+#include "core/logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using SysClock = std::chrono::system_clock;
+
+static const char ENTRY_MAGIC[4] = {'M', 'Q', 'E', 'H'};
+
+static void put16(std::string& b, uint16_t v) {
+    b.push_back(static_cast<char>(v & 0xFF));
+    b.push_back(static_cast<char>((v >> 8) & 0xFF));
+}
+
+static void put32(std::string& b, uint32_t v) {
+    for (int i = 0; i < 4; ++i) b.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+static void put64(std::string& b, uint64_t v) {
+    for (int i = 0; i < 8; ++i) b.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+static uint64_t getLE(const std::string& b, size_t off, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; --i)
+        v = (v << 8) | static_cast<unsigned char>(b[off + i]);
+    return v;
+}
+
+static int64_t toEpoch(SysClock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        t.time_since_epoch()).count();
+}
+
+static SysClock::time_point fromEpoch(int64_t secs) {
+    return SysClock::time_point(std::chrono::seconds(secs));
+}
+
+// [offset, offset + length) lies inside a file of fileSize bytes
+static bool withinFile(uint64_t offset, uint64_t length, uint64_t fileSize) {
+    return offset <= fileSize && length <= fileSize - offset;
+}
+
+std::string QueueEntryCodec::encodeRecords(const QueueMessage& msg) {
+    std::string b;
+    b.reserve(msg.recipients.size() * RECORD_SIZE);
+    for (const auto& r : msg.recipients) {
+        b.push_back(static_cast<char>(r.status));
+        b.push_back(0);
+        put16(b, static_cast<uint16_t>(std::min(r.attempts, 0xFFFF)));
+        put32(b, 0);
+        put64(b, static_cast<uint64_t>(toEpoch(r.nextAttemptAt)));
+    }
+    return b;
+}
+
+std::string QueueEntryCodec::encodeEnvelope(const QueueMessage& msg, uint64_t bodyLength) {
+    std::string tail;
+    put32(tail, static_cast<uint32_t>(msg.from.size()));
+    tail += msg.from;
+    for (const auto& r : msg.recipients) {
+        put32(tail, static_cast<uint32_t>(r.address.size()));
+        tail += r.address;
+    }
+
+    uint64_t bodyOffset = HEADER_SIZE + msg.recipients.size() * RECORD_SIZE + tail.size();
+
+    std::string b;
+    b.reserve(bodyOffset);
+    b.append(ENTRY_MAGIC, 4);
+    put16(b, VERSION);
+    put16(b, static_cast<uint16_t>(HEADER_SIZE));
+    b.push_back(static_cast<char>(msg.priority));
+    b.push_back(static_cast<char>(msg.flags));
+    put16(b, static_cast<uint16_t>(msg.dkimSignature.size()));
+    put32(b, static_cast<uint32_t>(msg.recipients.size()));
+    put64(b, static_cast<uint64_t>(toEpoch(msg.enqueuedAt)));
+    put64(b, bodyOffset);
+    put64(b, bodyLength);
+    b += encodeRecords(msg);
+    b += tail;
+    return b;
+}
+
+bool QueueEntryCodec::decode(const std::string& buf, QueueMessage& msg, size_t& required) {
+    required = 0;
+    if (buf.size() < HEADER_SIZE) {
+        required = HEADER_SIZE;
+        return false;
+    }
+    if (std::memcmp(buf.data(), ENTRY_MAGIC, 4) != 0)
+        return false;
+
+    uint16_t version = static_cast<uint16_t>(getLE(buf, 4, 2));
+    size_t headerSize = static_cast<size_t>(getLE(buf, 6, 2));
+    if (version != VERSION || headerSize < HEADER_SIZE)
+        return false;
+
+    uint8_t priority = static_cast<uint8_t>(buf[8]);
+    uint32_t count = static_cast<uint32_t>(getLE(buf, 12, 4));
+    uint64_t bodyOffset = getLE(buf, 24, 8);
+    if (priority >= PRIORITY_CLASS_COUNT || bodyOffset < headerSize + (uint64_t)count * RECORD_SIZE)
+        return false;
+
+    // Everything up to the body is metadata; ask for it in one more read
+    if (buf.size() < bodyOffset) {
+        required = static_cast<size_t>(bodyOffset);
+        return false;
+    }
+
+    msg.priority = static_cast<PriorityClass>(priority);
+    msg.flags = static_cast<uint8_t>(buf[9]);
+    msg.signatureLength = static_cast<uint16_t>(getLE(buf, 10, 2));
+    msg.enqueuedAt = fromEpoch(static_cast<int64_t>(getLE(buf, 16, 8)));
+    msg.bodyOffset = bodyOffset;
+    msg.bodyLength = getLE(buf, 32, 8);
+    msg.recipients.clear();
+    msg.recipients.reserve(count);
+
+    size_t off = headerSize;
+    for (uint32_t i = 0; i < count; ++i, off += RECORD_SIZE) {
+        uint8_t status = static_cast<uint8_t>(buf[off]);
+        if (status > static_cast<uint8_t>(RecipientStatus::Failed))
+            return false;
+        QueueRecipient r;
+        r.status = static_cast<RecipientStatus>(status);
+        r.attempts = static_cast<int>(getLE(buf, off + 2, 2));
+        r.nextAttemptAt = fromEpoch(static_cast<int64_t>(getLE(buf, off + 8, 8)));
+        msg.recipients.push_back(r);
+    }
+
+    auto readField = [&](std::string& out) {
+        if (off + 4 > bodyOffset) return false;
+        uint32_t len = static_cast<uint32_t>(getLE(buf, off, 4));
+        off += 4;
+        if (off + len > bodyOffset) return false;
+        out.assign(buf, off, len);
+        off += len;
+        return true;
+    };
+
+    if (!readField(msg.from))
+        return false;
+    for (auto& r : msg.recipients) {
+        if (!readField(r.address))
+            return false;
+    }
+    return true;
+}
+
+bool QueueEntryCodec::readLegacyText(const std::string& path, QueueMessage& msg) {
+    // Pre-binary entries: "FROM: ..\nTO: ..\n---RAW---\n<body>"
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line == "---RAW---") {
+            msg.bodyOffset = static_cast<uint64_t>(in.tellg());
+            in.seekg(0, std::ios::end);
+            msg.bodyLength = static_cast<uint64_t>(in.tellg()) - msg.bodyOffset;
+            msg.legacyFormat = true;
+            return !msg.recipients.empty();
+        }
+        if (line.rfind("FROM: ", 0) == 0) {
+            msg.from = line.substr(6);
+        } else if (line.rfind("TO: ", 0) == 0) {
+            QueueRecipient r;
+            r.address = line.substr(4);
+            msg.recipients.push_back(r);
+        }
+    }
+    return false;
+}
+
+bool QueueEntryCodec::readMetadata(const std::string& path, QueueMessage& msg) {
+    msg.path = path;
+
+    std::string buf;
+    uint64_t fileSize = 0;
+    if (!preadAt(path, 0, METADATA_PROBE, buf, &fileSize))
+        return false;
+
+    if (buf.rfind("FROM: ", 0) == 0)
+        return readLegacyText(path, msg);
+
+    size_t required = 0;
+    bool ok = decode(buf, msg, required);
+    if (!ok) {
+        // Large recipient lists: a second read covers the rest of the envelope.
+        // A header claiming more envelope than the file holds is corrupt
+        if (required <= buf.size() || required > fileSize)
+            return false;
+        if (!preadAt(path, 0, required, buf) || buf.size() < required)
+            return false;
+        ok = decode(buf, msg, required);
+    }
+
+    // Body and trailer must fit too, or readBody would size its buffer from
+    // a corrupt header
+    if (ok && (!withinFile(msg.bodyOffset, msg.bodyLength, fileSize) ||
+               !withinFile(msg.bodyOffset + msg.bodyLength, msg.signatureLength, fileSize))) {
+        Logger::instance().log(LogLevel::Warn,
+            "Queue: Entry " + path + " claims more than its " +
+            std::to_string(fileSize) + " bytes, ignored");
+        return false;
+    }
+    return ok;
+}
+
+bool QueueEntryCodec::readBody(QueueMessage& msg) {
+    if (!msg.rawData.empty() || msg.bodyLength == 0)
+        return msg.bodyLength == msg.rawData.size();
+
+    // Body and signature trailer in one read; the trailer is split off the end.
+    // preadAt never allocates past the end of the file, and a file shorter
+    // than the header claims fails the size check below
+    uint64_t fileSize = 0;
+    if (msg.bodyLength > SIZE_MAX - msg.signatureLength)
+        return false;
+    size_t total = static_cast<size_t>(msg.bodyLength) + msg.signatureLength;
+    if (!preadAt(msg.path, msg.bodyOffset, total, msg.rawData, &fileSize))
+        return false;
+    if (msg.rawData.size() != total || !withinFile(msg.bodyOffset, total, fileSize)) {
+        msg.rawData.clear();
+        return false;
+    }
+    msg.dkimSignature.assign(msg.rawData, static_cast<size_t>(msg.bodyLength), std::string::npos);
+    msg.rawData.resize(static_cast<size_t>(msg.bodyLength));
+    return true;
+}
+
+bool QueueEntryCodec::writeSignature(QueueMessage& msg, const std::string& signature) {
+    if (msg.legacyFormat || signature.size() > 0xFFFF)
+        return false;
+
+    // Trailer first, then the header that makes it visible: a crash in
+    // between leaves the entry flagged and it is simply signed again
+    if (!writeTrailer(msg.path, msg.bodyOffset + msg.bodyLength, signature))
+        return false;
+
+    uint8_t flags = msg.flags & ~FLAG_NEEDS_SIGNING;
+    std::string header;
+    header.push_back(static_cast<char>(flags));
+    put16(header, static_cast<uint16_t>(signature.size()));
+    if (!pwriteAt(msg.path, 9, header))
+        return false;
+
+    msg.flags = flags;
+    msg.signatureLength = static_cast<uint16_t>(signature.size());
+    msg.dkimSignature = signature;
+    return true;
+}
+
+bool QueueEntryCodec::writeRecords(const QueueMessage& msg) {
+    if (msg.legacyFormat)
+        return false;
+    return pwriteAt(msg.path, HEADER_SIZE, encodeRecords(msg));
+}
+
+bool QueueEntryCodec::preadAt(const std::string& path, uint64_t offset, size_t len,
+                              std::string& out, uint64_t* fileSize) {
+    out.clear();
+    size_t got = 0;
+
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size)) {
+        CloseHandle(h);
+        return false;
+    }
+    uint64_t total = static_cast<uint64_t>(size.QuadPart);
+    // Never size the buffer past the end of the file, whatever len says
+    len = offset < total ? static_cast<size_t>(std::min<uint64_t>(len, total - offset)) : 0;
+    out.assign(len, '\0');
+    while (got < len) {
+        OVERLAPPED ov{};
+        uint64_t at = offset + got;
+        ov.Offset = static_cast<DWORD>(at & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(at >> 32);
+        DWORD n = 0;
+        if (!ReadFile(h, &out[got], static_cast<DWORD>(len - got), &n, &ov) || n == 0)
+            break;
+        got += n;
+    }
+    CloseHandle(h);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    uint64_t total = static_cast<uint64_t>(st.st_size);
+    // Never size the buffer past the end of the file, whatever len says
+    len = offset < total ? static_cast<size_t>(std::min<uint64_t>(len, total - offset)) : 0;
+    out.assign(len, '\0');
+    while (got < len) {
+        ssize_t n = ::pread(fd, &out[got], len - got, static_cast<off_t>(offset + got));
+        if (n <= 0)
+            break;
+        got += static_cast<size_t>(n);
+    }
+    ::close(fd);
+#endif
+
+    if (fileSize)
+        *fileSize = total;
+    out.resize(got); // short read at EOF is not an error
+    return true;
+}
+
+bool QueueEntryCodec::pwriteAt(const std::string& path, uint64_t offset, const std::string& data) {
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    OVERLAPPED ov{};
+    ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD n = 0;
+    bool ok = WriteFile(h, data.data(), static_cast<DWORD>(data.size()), &n, &ov) &&
+              n == data.size() && FlushFileBuffers(h);
+    CloseHandle(h);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+    bool ok = ::pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset)) ==
+                  static_cast<ssize_t>(data.size()) &&
+              ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error,
+            "Queue: In-place record update failed for " + path);
+    }
+    return ok;
+}
+
+// Truncate at offset (dropping any earlier trailer), append data, flush
+bool QueueEntryCodec::writeTrailer(const std::string& path, uint64_t offset, const std::string& data) {
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(offset);
+    DWORD n = 0;
+    bool ok = SetFilePointerEx(h, end, NULL, FILE_BEGIN) && SetEndOfFile(h) &&
+              (data.empty() ||
+               (WriteFile(h, data.data(), static_cast<DWORD>(data.size()), &n, NULL) &&
+                n == data.size())) &&
+              FlushFileBuffers(h);
+    CloseHandle(h);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+    bool ok = ::ftruncate(fd, static_cast<off_t>(offset)) == 0 &&
+              ::pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset)) ==
+                  static_cast<ssize_t>(data.size()) &&
+              ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error,
+            "Queue: Signature trailer write failed for " + path);
+    }
+    return ok;
+}
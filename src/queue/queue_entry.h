@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+struct QueueMessage;
+
+/**
+ * Queue Entry On-Disk Format
+ *
+ * WHY REQUIRED:
+ * - Text "FROM:/TO:" envelopes were located with find() and could match body text
+ * - Metadata must be readable with one small pread, without loading the body
+ * - Fixed-size recipient records let delivery state be updated in place
+ * - DKIM signatures are added after the fact as a trailer behind the body,
+ *   so signing never rewrites the body
+ *
+ * Layout (little-endian):
+ *   0   magic "MQEH"            4
+ *   4   version                 2
+ *   6   header size             2
+ *   8   priority class          1
+ *   9   flags                   1   FLAG_NEEDS_SIGNING
+ *   10  signature length        2   DKIM-Signature trailer, 0 = none
+ *   12  recipient count         4
+ *   16  enqueued at (epoch s)   8
+ *   24  body offset             8
+ *   32  body length             8
+ *   40  recipient records       count x 16
+ *         status 1, reserved 1, attempts 2, reserved 4, next attempt 8
+ *       sender                  u32 length + bytes
+ *       recipient addresses     u32 length + bytes, in record order
+ *   bodyOffset: message body
+ *   bodyOffset + bodyLength: DKIM-Signature fields (CRLF-terminated),
+ *                            sent ahead of the body
+ */
+class QueueEntryCodec {
+public:
+    static constexpr uint16_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 40;
+    static constexpr size_t RECORD_SIZE = 16;
+    static constexpr size_t METADATA_PROBE = 4096;   // first pread size
+
+    static constexpr uint8_t FLAG_NEEDS_SIGNING = 0x01; // queued, not yet DKIM-signed
+
+    // Header + records + envelope; the body is appended by the caller
+    static std::string encodeEnvelope(const QueueMessage& msg, uint64_t bodyLength);
+
+    // Read metadata (one pread for typical entries); fills path/body offsets
+    static bool readMetadata(const std::string& path, QueueMessage& msg);
+    // Load msg.rawData (and msg.dkimSignature) from msg.path
+    static bool readBody(QueueMessage& msg);
+    // Store the signature trailer and clear FLAG_NEEDS_SIGNING, flushed;
+    // an empty signature just clears the flag
+    static bool writeSignature(QueueMessage& msg, const std::string& signature);
+    // Rewrite the recipient records of msg.path in place and flush
+    static bool writeRecords(const QueueMessage& msg);
+
+private:
+    // true: parsed. false with required > buf.size(): read more. false with 0: corrupt
+    static bool decode(const std::string& buf, QueueMessage& msg, size_t& required);
+    static std::string encodeRecords(const QueueMessage& msg);
+    static bool readLegacyText(const std::string& path, QueueMessage& msg);
+
+    // Reads at most what the file holds past offset; fileSize gets its size
+    static bool preadAt(const std::string& path, uint64_t offset, size_t len, std::string& out,
+                        uint64_t* fileSize = nullptr);
+    static bool pwriteAt(const std::string& path, uint64_t offset, const std::string& data);
+    static bool writeTrailer(const std::string& path, uint64_t offset, const std::string& data);
+};
@@ -5,3 +5,6 @@ inline long computeBackoff(int retryCount) {
     if (retryCount >= 6) return table[5];
     return table[retryCount];
 }
+
+// Give up on recipients still deferred this long after enqueue (5 days)
+static constexpr long MAX_QUEUE_LIFETIME_SEC = 5L * 86400;
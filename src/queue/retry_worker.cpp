@@ -5,51 +5,132 @@
 #include "virus/sandbox_engine.h"
 #include "delivery/smtp_client.h"
 #include "core/logger.h" 
+#include "monitoring/metrics.h"
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <map>
 
-void RetryWorker::runOnce() {
+bool RetryWorker::runOnce() {
     int backlog = MailQueue::instance().countReadyMessages();
     Logger::instance().set_queue_backlog(backlog); 
     
     auto msg = MailQueue::instance().fetchReady();
-    if (!msg) return;
-
-    // Raw message is already loaded from inflight
-    const std::string& raw = msg->rawData;
-    if (raw.empty()) {
-        MailQueue::instance().markTempFail(*msg, "Empty message");
-        return;
-    }
+    if (!msg) return false;
 
     // CRITICAL FIX: Actually deliver the message (this was missing!)
-    // Extract from/to from message (simplified - in production, parse headers properly)
     std::string from = msg->from.empty() ? "unknown@localhost" : msg->from;
-    std::string to = msg->to.empty() ? "unknown@localhost" : msg->to;
-    
-    Logger::instance().log(LogLevel::Info,
-        "RetryWorker: Attempting delivery of " + msg->id + " to " + to);
-    
-    // Deliver message
-    DeliveryResult result = SmtpDeliveryClient::instance().deliver(from, to, raw);
-    
-    if (result.success) {
+
+    // Only metadata was read at lease time. The body is read the first time
+    // a domain gets past its circuit and throttle checks, so a message whose
+    // destinations are all held back costs no body I/O
+    bool bodyRead = false, bodyOk = false;
+    auto loadBody = [&]() {
+        if (!bodyRead) {
+            bodyRead = true;
+            bodyOk = MailQueue::instance().loadBody(*msg) && !msg->rawData.empty();
+        }
+        return bodyOk;
+    };
+
+    // Group due recipients by destination domain: one transaction per domain
+    auto now = std::chrono::system_clock::now();
+    std::map<std::string, std::vector<size_t>> byDomain;
+    for (size_t i = 0; i < msg->recipients.size(); ++i) {
+        const auto& r = msg->recipients[i];
+        bool due = r.status == RecipientStatus::Pending ||
+                   (r.status == RecipientStatus::Deferred && r.nextAttemptAt <= now);
+        if (!due)
+            continue;
+
+        size_t at = r.address.find('@');
+        std::string domain = (at == std::string::npos) ? "" : r.address.substr(at + 1);
+        std::transform(domain.begin(), domain.end(), domain.begin(),
+                       [](unsigned char c) { return (char)std::tolower(c); });
+        byDomain[domain].push_back(i);
+    }
+
+    for (const auto& [domain, indices] : byDomain) {
+        std::vector<std::string> to;
+        for (size_t i : indices)
+            to.push_back(msg->recipients[i].address);
+
         Logger::instance().log(LogLevel::Info,
-            "RetryWorker: Successfully delivered " + msg->id);
-        MailQueue::instance().markSuccess(msg->id);
-    } else if (result.permanentFailure) {
-        Logger::instance().log(LogLevel::Error,
-            "RetryWorker: Permanent failure for " + msg->id + ": " + result.errorMessage);
-        MailQueue::instance().markPermFail(*msg, result.errorMessage);
-    } else {
-        // Temporary failure - will retry later
-        Logger::instance().log(LogLevel::Warn,
-            "RetryWorker: Temporary failure for " + msg->id + ": " + result.errorMessage + 
-            " (retry after " + std::to_string(result.retryAfterSeconds) + "s)");
-        MailQueue::instance().markTempFail(*msg, result.errorMessage);
+            "RetryWorker: Attempting delivery of " + msg->id + " to " +
+            std::to_string(to.size()) + " recipient(s) at " + domain);
+
+        // Signed once at enqueue; the stored fields go out ahead of the body
+        DeliveryResult result = SmtpDeliveryClient::instance().deliver(
+            from, to, msg->rawData, msg->dkimSignature, loadBody);
+        if (bodyRead && !bodyOk) {
+            MailQueue::instance().markTempFail(*msg, "Empty message");
+            return true;
+        }
+
+        for (size_t i : indices) {
+            QueueRecipient& r = msg->recipients[i];
+
+            // Per-RCPT outcome if the server gave one, else the transaction's
+            bool ok = result.success, perm = result.permanentFailure;
+            std::string error = result.errorMessage;
+            for (const auto& rr : result.recipients) {
+                if (rr.address == r.address) {
+                    ok = rr.success;
+                    perm = rr.permanentFailure;
+                    error = rr.errorMessage;
+                    break;
+                }
+            }
+
+            if (ok) {
+                r.status = RecipientStatus::Delivered;
+                Metrics::instance().inc("delivery_recipients_delivered_total");
+                continue;
+            }
+
+            // Held back locally (throttle / open circuit): nothing was
+            // attempted, so the retry budget is not spent
+            if (result.deferredLocally) {
+                r.status = RecipientStatus::Deferred;
+                r.nextAttemptAt = now + std::chrono::seconds(std::max(1, result.retryAfterSeconds));
+                Metrics::instance().inc("delivery_recipients_held_total");
+                continue;
+            }
+
+            r.attempts++;
+            // Backoff schedule; an explicit hint (e.g. a circuit-breaker
+            // cooldown) only ever pushes the retry further out
+            long delay = std::max<long>(computeBackoff(r.attempts - 1),
+                                        result.retryAfterSeconds);
+            r.nextAttemptAt = now + std::chrono::seconds(delay);
+
+            bool expired = r.nextAttemptAt - msg->enqueuedAt >
+                           std::chrono::seconds(MAX_QUEUE_LIFETIME_SEC);
+            if (perm || expired) {
+                r.status = RecipientStatus::Failed;
+                Metrics::instance().inc("delivery_recipients_failed_total");
+                Logger::instance().log(LogLevel::Error,
+                    "RetryWorker: Permanent failure for " + msg->id + " to " +
+                    r.address + ": " + (expired ? "queue lifetime exceeded" : error));
+            } else {
+                r.status = RecipientStatus::Deferred;
+                Metrics::instance().inc("delivery_recipients_deferred_total");
+                // Temporary failure - will retry later
+                Logger::instance().log(LogLevel::Warn,
+                    "RetryWorker: Temporary failure for " + msg->id + " to " +
+                    r.address + ": " + error +
+                    " (retry after " + std::to_string(delay) + "s)");
+            }
+        }
     }
 
+    MailQueue::instance().update(*msg);
+
     // Note: Virus scanning happens asynchronously and doesn't block delivery
     // Messages are scanned in background, quarantined if malicious
-    CloudScanner::instance().scanAsync(*msg);
-    SandboxEngine::instance().submit(msg->id, raw);
+    if (bodyOk) {
+        CloudScanner::instance().scanAsync(*msg);
+        SandboxEngine::instance().submit(msg->id, msg->rawData);
+    }
+    return true;
 }
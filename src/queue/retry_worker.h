@@ -5,6 +5,6 @@ class RetryWorker {
 public:
     RetryWorker() = default;
 
-    // Run a single retry pass (HA-safe)
-    void runOnce();
+    // Run a single retry pass (HA-safe); false when nothing was ready
+    bool runOnce();
 };
@@ -0,0 +1,271 @@
+#include "replication/replica_receiver.h"
+#include "storage/mail_store.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace fs = std::filesystem;
+
+ReplicaReceiver::ReplicaReceiver(MailStore& store, const std::string& mailRoot,
+                                 const std::string& bindAddress, int port,
+                                 const std::string& secret)
+    : store_(store), bindAddress_(bindAddress), port_(port), secret_(secret) {
+    fs::path dir = fs::path(mailRoot) / ".replication";
+    fs::create_directories(dir);
+    statePath_ = (dir / "applied").string();
+    loadApplied();
+}
+
+ReplicaReceiver::~ReplicaReceiver() {
+    stop();
+}
+
+void ReplicaReceiver::start() {
+    if (running_) return;
+    running_ = true;
+    thread_ = std::thread(&ReplicaReceiver::run, this);
+}
+
+void ReplicaReceiver::stop() {
+    if (!running_) return;
+    running_ = false;
+    if (listenSock_ != INVALID_SOCKET)
+        closesocket(listenSock_);
+    if (thread_.joinable())
+        thread_.join();
+    listenSock_ = INVALID_SOCKET;
+}
+
+void ReplicaReceiver::run() {
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        Logger::instance().log(LogLevel::Error, "ReplicaReceiver: WSAStartup failed");
+        return;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+
+    std::string where = bindAddress_ + ":" + std::to_string(port_);
+    addrinfo* ai = nullptr;
+    if (getaddrinfo(bindAddress_.c_str(), std::to_string(port_).c_str(), &hints, &ai) != 0 || !ai) {
+        Logger::instance().log(LogLevel::Error,
+            "ReplicaReceiver: Invalid bind address " + bindAddress_);
+        return;
+    }
+
+    listenSock_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (listenSock_ == INVALID_SOCKET) {
+        freeaddrinfo(ai);
+        return;
+    }
+
+    bool bound = bind(listenSock_, ai->ai_addr, (int)ai->ai_addrlen) != SOCKET_ERROR &&
+                 listen(listenSock_, 4) != SOCKET_ERROR;
+    freeaddrinfo(ai);
+    if (!bound) {
+        Logger::instance().log(LogLevel::Error,
+            "ReplicaReceiver: Cannot listen on " + where);
+        closesocket(listenSock_);
+        listenSock_ = INVALID_SOCKET;
+        return;
+    }
+
+    Logger::instance().log(LogLevel::Info,
+        "ReplicaReceiver: Listening on " + where +
+        ", applied seq " + std::to_string(appliedSeq_));
+
+    // Accepting continues while a stream is served: a primary that comes
+    // back after a crash or partition replaces the stream it left behind
+    while (running_) {
+        SOCKET client = accept(listenSock_, nullptr, nullptr);
+        if (client == INVALID_SOCKET) {
+            if (!running_) break;
+            continue;
+        }
+
+        ReplicationProtocol::Channel channel;
+        if (!authenticate(client, channel)) {
+            closesocket(client);
+            continue;
+        }
+
+        endSession();
+        {
+            std::lock_guard<std::mutex> lock(clientMutex_);
+            clientSock_ = client;
+        }
+        session_ = std::thread(&ReplicaReceiver::serve, this, channel);
+    }
+    endSession();
+}
+
+bool ReplicaReceiver::authenticate(SOCKET sock, ReplicationProtocol::Channel& channel) {
+    // An unauthenticated peer must not hold up the accept loop
+    DWORD timeout = HANDSHAKE_TIMEOUT_MS;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+    if (!ReplicationProtocol::authenticateReplica(sock, secret_, channel)) {
+        Metrics::instance().inc("replica_auth_failures_total");
+        Logger::instance().log(LogLevel::Warn,
+            "ReplicaReceiver: Peer failed authentication, dropping connection");
+        return false;
+    }
+
+    // The primary sends a heartbeat batch while idle; silence past this
+    // means it is gone without a FIN
+    timeout = IDLE_TIMEOUT_MS;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+    BOOL keepAlive = TRUE;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (char*)&keepAlive, sizeof(keepAlive));
+    return true;
+}
+
+void ReplicaReceiver::endSession() {
+    {
+        std::lock_guard<std::mutex> lock(clientMutex_);
+        if (clientSock_ != INVALID_SOCKET)
+            shutdown(clientSock_, SD_BOTH);
+    }
+    if (session_.joinable())
+        session_.join();
+}
+
+void ReplicaReceiver::serve(ReplicationProtocol::Channel channel) {
+    Metrics::instance().set("replica_connected", 1);
+    receive(channel);
+    {
+        std::lock_guard<std::mutex> lock(clientMutex_);
+        clientSock_ = INVALID_SOCKET;
+        closesocket(channel.sock);
+    }
+    Metrics::instance().set("replica_connected", 0);
+}
+
+void ReplicaReceiver::receive(ReplicationProtocol::Channel& channel) {
+    if (!ReplicationProtocol::sendSealedU64(channel, appliedSeq_))
+        return;
+
+    std::string payload;
+    std::vector<ReplicationRecord> batch;
+    while (running_) {
+        if (!ReplicationProtocol::recvSealed(channel, payload)) {
+            Logger::instance().log(LogLevel::Warn,
+                "ReplicaReceiver: Stream from the primary closed, timed out or failed its MAC");
+            break;
+        }
+        if (!ReplicationProtocol::decodeBatch(payload, batch)) {
+            Logger::instance().log(LogLevel::Error,
+                "ReplicaReceiver: Malformed batch, dropping connection");
+            break;
+        }
+
+        uint64_t before = appliedSeq_;
+        bool ok = true;
+        for (const auto& r : batch) {
+            if (r.seq <= appliedSeq_)
+                continue; // replayed after reconnect
+            if (!apply(r)) {
+                ok = false;
+                break;
+            }
+            appliedSeq_ = r.seq;
+        }
+        // Heartbeats and replays move nothing; only a new position is written
+        bool saved = appliedSeq_ == before || saveApplied();
+
+        Metrics::instance().inc("replica_records_applied_total", (int)batch.size());
+        Metrics::instance().set("replica_applied_seq", (int)appliedSeq_);
+
+        // Without a durable position the ack could run ahead of a crash;
+        // drop the stream and let the primary replay from the last saved seq
+        if (!saved) {
+            appliedSeq_ = 0;
+            loadApplied();
+            break;
+        }
+        if (!ReplicationProtocol::sendSealedU64(channel, appliedSeq_) || !ok)
+            break;
+    }
+}
+
+// One path component: no separators, drive letters, parent references or
+// control bytes, so every record stays inside mail_root
+bool ReplicaReceiver::safeName(const std::string& name) {
+    if (name.empty() || name == "." || name.find("..") != std::string::npos)
+        return false;
+    for (unsigned char c : name) {
+        if (c < 0x20 || c == 0x7F || c == '/' || c == '\\' || c == ':')
+            return false;
+    }
+    return true;
+}
+
+bool ReplicaReceiver::apply(const ReplicationRecord& r) {
+    if (!safeName(r.user) || !safeName(r.id)) {
+        Metrics::instance().inc("replica_rejected_records_total");
+        Logger::instance().log(LogLevel::Error,
+            "ReplicaReceiver: Rejecting record " + std::to_string(r.seq) +
+            " with an unsafe user or message id");
+        return false;
+    }
+
+    switch (r.op) {
+    case ReplicationOp::Store:
+        if (r.body.empty())
+            return true; // deleted on the primary before it was shipped
+        if (!store_.storeRaw(r.user, r.id, r.body)) {
+            Logger::instance().log(LogLevel::Error,
+                "ReplicaReceiver: Failed to apply store of " + r.id);
+            return false;
+        }
+        return true;
+    case ReplicationOp::Quarantine:
+        // Missing source is fine: the move may already have been applied
+        store_.moveToQuarantine(r.user, r.id);
+        return true;
+    case ReplicationOp::Delete:
+        store_.deleteMessage(r.user, r.id);
+        return true;
+    }
+    return false;
+}
+
+void ReplicaReceiver::loadApplied() {
+    std::ifstream in(statePath_);
+    uint64_t seq = 0;
+    if (in >> seq)
+        appliedSeq_ = seq;
+}
+
+bool ReplicaReceiver::saveApplied() {
+    // Acks follow this write, so it must be on disk before one is sent
+    std::string tmp = statePath_ + ".tmp";
+    std::string content = std::to_string(appliedSeq_) + "\n";
+
+    HANDLE h = CreateFileA(tmp.c_str(), GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    DWORD n = 0;
+    bool ok = h != INVALID_HANDLE_VALUE &&
+              WriteFile(h, content.data(), static_cast<DWORD>(content.size()), &n, NULL) &&
+              n == content.size() && FlushFileBuffers(h);
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    ok = ok && MoveFileExA(tmp.c_str(), statePath_.c_str(),
+                           MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!ok) {
+        DeleteFileA(tmp.c_str());
+        Logger::instance().log(LogLevel::Error,
+            "ReplicaReceiver: Failed to persist applied seq to " + statePath_);
+    }
+    return ok;
+}
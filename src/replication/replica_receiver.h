@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include "replication/replication_protocol.h"
+
+class MailStore;
+
+/**
+ * Replica Receiver (standby side)
+ *
+ * WHY REQUIRED:
+ * - Applies the primary's change stream to the local mail store
+ * - Listens only on bind_address, and the primary must prove it holds
+ *   the shared secret before anything is read or applied
+ * - User and message ids are checked before they reach a path; a name
+ *   that could leave mail_root fails the batch
+ * - Records are applied strictly in seq order and acked after fsync,
+ *   so a replayed batch after reconnect is skipped (idempotent)
+ * - One stream at a time: a newly authenticated primary replaces the
+ *   current one, and a stream silent past the heartbeat timeout is dropped
+ * - Applied position persists in <mail_root>/.replication/applied
+ */
+class ReplicaReceiver {
+public:
+    ReplicaReceiver(MailStore& store, const std::string& mailRoot,
+                    const std::string& bindAddress, int port, const std::string& secret);
+    ~ReplicaReceiver();
+
+    void start();
+    void stop();
+
+private:
+    void run();
+    bool authenticate(SOCKET sock, ReplicationProtocol::Channel& channel);
+    void endSession();
+    void serve(ReplicationProtocol::Channel channel);
+    void receive(ReplicationProtocol::Channel& channel);
+    bool apply(const ReplicationRecord& r);
+    static bool safeName(const std::string& name);
+    void loadApplied();
+    bool saveApplied();
+
+    MailStore& store_;
+    std::string statePath_;
+    std::string bindAddress_;
+    int port_;
+    std::string secret_;
+
+    std::atomic<bool> running_{false};
+    std::thread thread_;     // accept loop
+    std::thread session_;    // the stream being applied
+    SOCKET listenSock_ = INVALID_SOCKET;
+    std::mutex clientMutex_;
+    SOCKET clientSock_ = INVALID_SOCKET;
+    uint64_t appliedSeq_ = 0;   // session thread only; the accept loop joins it first
+
+    static constexpr DWORD HANDSHAKE_TIMEOUT_MS = 10000;
+    static constexpr DWORD IDLE_TIMEOUT_MS = 30000;   // six primary heartbeats
+};
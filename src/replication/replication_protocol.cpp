@@ -0,0 +1,237 @@
+#include "replication/replication_protocol.h"
+
+#include <algorithm>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+namespace ReplicationProtocol {
+
+static void putLE(std::string& b, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i)
+        b.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+static bool getLE(const std::string& b, size_t& off, int bytes, uint64_t& v) {
+    if (off + bytes > b.size())
+        return false;
+    v = 0;
+    for (int i = bytes - 1; i >= 0; --i)
+        v = (v << 8) | static_cast<unsigned char>(b[off + i]);
+    off += bytes;
+    return true;
+}
+
+static bool getBytes(const std::string& b, size_t& off, size_t len, std::string& out) {
+    if (off + len > b.size())
+        return false;
+    out.assign(b, off, len);
+    off += len;
+    return true;
+}
+
+std::string encodeBatch(const std::vector<ReplicationRecord>& records) {
+    std::string b;
+    putLE(b, records.size(), 4);
+    for (const auto& r : records) {
+        putLE(b, r.seq, 8);
+        putLE(b, static_cast<uint8_t>(r.op), 1);
+        putLE(b, r.user.size(), 2);
+        b += r.user;
+        putLE(b, r.id.size(), 2);
+        b += r.id;
+        putLE(b, r.body.size(), 4);
+        b += r.body;
+    }
+    return b;
+}
+
+bool decodeBatch(const std::string& payload, std::vector<ReplicationRecord>& out) {
+    size_t off = 0;
+    uint64_t count = 0;
+    if (!getLE(payload, off, 4, count))
+        return false;
+
+    out.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        ReplicationRecord r;
+        uint64_t op = 0, len = 0;
+        if (!getLE(payload, off, 8, r.seq) || !getLE(payload, off, 1, op))
+            return false;
+        if (op < 1 || op > 3)
+            return false;
+        r.op = static_cast<ReplicationOp>(op);
+        if (!getLE(payload, off, 2, len) || !getBytes(payload, off, len, r.user)) return false;
+        if (!getLE(payload, off, 2, len) || !getBytes(payload, off, len, r.id)) return false;
+        if (!getLE(payload, off, 4, len) || !getBytes(payload, off, len, r.body)) return false;
+        out.push_back(std::move(r));
+    }
+    return off == payload.size();
+}
+
+bool sendAll(SOCKET sock, const char* data, size_t len) {
+    while (len > 0) {
+        int n = send(sock, data, static_cast<int>(std::min<size_t>(len, 1 << 20)), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool recvAll(SOCKET sock, char* data, size_t len) {
+    while (len > 0) {
+        int n = recv(sock, data, static_cast<int>(std::min<size_t>(len, 1 << 20)), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool sendU64(SOCKET sock, uint64_t v) {
+    std::string b;
+    putLE(b, v, 8);
+    return sendAll(sock, b.data(), b.size());
+}
+
+bool recvU64(SOCKET sock, uint64_t& v) {
+    std::string b(8, '\0');
+    if (!recvAll(sock, &b[0], 8))
+        return false;
+    size_t off = 0;
+    return getLE(b, off, 8, v);
+}
+
+bool sendFrame(SOCKET sock, const std::string& payload) {
+    std::string hdr;
+    putLE(hdr, payload.size(), 4);
+    return sendAll(sock, hdr.data(), hdr.size()) &&
+           sendAll(sock, payload.data(), payload.size());
+}
+
+bool recvFrame(SOCKET sock, std::string& payload) {
+    std::string hdr(4, '\0');
+    if (!recvAll(sock, &hdr[0], 4))
+        return false;
+    size_t off = 0;
+    uint64_t len = 0;
+    getLE(hdr, off, 4, len);
+    if (len > MAX_FRAME_BYTES)
+        return false;
+    payload.assign(static_cast<size_t>(len), '\0');
+    return len == 0 || recvAll(sock, &payload[0], static_cast<size_t>(len));
+}
+
+static constexpr size_t NONCE_BYTES = 32;
+static constexpr size_t MAC_BYTES = 32;
+
+static std::string hmac(const std::string& key, const std::string& msg) {
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int macLen = 0;
+    HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()),
+         reinterpret_cast<const unsigned char*>(msg.data()), msg.size(), mac, &macLen);
+    return std::string(reinterpret_cast<char*>(mac), macLen);
+}
+
+// The role label keeps one side's answer from being reflected back as the other's
+static std::string proof(const std::string& secret, const char* role, const std::string& nonce) {
+    return hmac(secret, std::string(role) + nonce);
+}
+
+static void openChannel(Channel& channel, SOCKET sock, const std::string& secret,
+                        const std::string& replicaNonce, const std::string& primaryNonce,
+                        bool primary) {
+    channel = Channel{};
+    channel.sock = sock;
+    channel.key = hmac(secret, "session" + replicaNonce + primaryNonce);
+    channel.sendRole = primary ? "primary" : "replica";
+    channel.recvRole = primary ? "replica" : "primary";
+}
+
+static std::string frameMac(const Channel& channel, const char* role, uint64_t number,
+                            const std::string& payload) {
+    std::string msg = role;
+    putLE(msg, number, 8);
+    msg += payload;
+    return hmac(channel.key, msg);
+}
+
+static bool newNonce(std::string& nonce) {
+    nonce.assign(NONCE_BYTES, '\0');
+    return RAND_bytes(reinterpret_cast<unsigned char*>(&nonce[0]), NONCE_BYTES) == 1;
+}
+
+static bool sameMac(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// Replica side: challenge first, answer only a primary that passed
+bool authenticateReplica(SOCKET sock, const std::string& secret, Channel& channel) {
+    std::string ours;
+    if (secret.empty() || !newNonce(ours) || !sendAll(sock, ours.data(), ours.size()))
+        return false;
+
+    std::string reply(MAC_BYTES + NONCE_BYTES, '\0');
+    if (!recvAll(sock, &reply[0], reply.size()))
+        return false;
+    if (!sameMac(reply.substr(0, MAC_BYTES), proof(secret, "primary", ours)))
+        return false;
+
+    std::string answer = proof(secret, "replica", reply.substr(MAC_BYTES));
+    if (!sendAll(sock, answer.data(), answer.size()))
+        return false;
+    openChannel(channel, sock, secret, ours, reply.substr(MAC_BYTES), false);
+    return true;
+}
+
+bool authenticatePrimary(SOCKET sock, const std::string& secret, Channel& channel) {
+    std::string theirs(NONCE_BYTES, '\0');
+    if (secret.empty() || !recvAll(sock, &theirs[0], theirs.size()))
+        return false;
+
+    std::string ours;
+    if (!newNonce(ours))
+        return false;
+    std::string reply = proof(secret, "primary", theirs) + ours;
+    if (!sendAll(sock, reply.data(), reply.size()))
+        return false;
+
+    std::string answer(MAC_BYTES, '\0');
+    if (!recvAll(sock, &answer[0], answer.size()))
+        return false;
+    if (!sameMac(answer, proof(secret, "replica", ours)))
+        return false;
+    openChannel(channel, sock, secret, theirs, ours, true);
+    return true;
+}
+
+bool sendSealed(Channel& channel, const std::string& payload) {
+    std::string mac = frameMac(channel, channel.sendRole, channel.sent++, payload);
+    return sendFrame(channel.sock, payload) && sendAll(channel.sock, mac.data(), mac.size());
+}
+
+bool recvSealed(Channel& channel, std::string& payload) {
+    std::string mac(MAC_BYTES, '\0');
+    if (!recvFrame(channel.sock, payload) || !recvAll(channel.sock, &mac[0], mac.size()))
+        return false;
+    return sameMac(mac, frameMac(channel, channel.recvRole, channel.received++, payload));
+}
+
+bool sendSealedU64(Channel& channel, uint64_t v) {
+    std::string b;
+    putLE(b, v, 8);
+    return sendSealed(channel, b);
+}
+
+bool recvSealedU64(Channel& channel, uint64_t& v) {
+    std::string b;
+    size_t off = 0;
+    return recvSealed(channel, b) && b.size() == 8 && getLE(b, off, 8, v);
+}
+
+} // namespace ReplicationProtocol
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+
+/**
+ * Mail Store Replication Wire Protocol
+ *
+ * WHY REQUIRED:
+ * - A lost disk must not lose every stored .eml
+ * - Primary ships an ordered change log (store/quarantine/delete) plus
+ *   message bodies; the replica applies records in sequence and acks
+ *
+ * Framing (little-endian):
+ *   replica -> primary on connect:  32-byte nonce
+ *   primary -> replica:             HMAC-SHA256(secret, "primary" nonce),
+ *                                   32-byte nonce
+ *   replica -> primary:             HMAC-SHA256(secret, "replica" nonce)
+ *
+ * Everything after the handshake is a sealed frame: u32 payload length,
+ * payload, HMAC-SHA256(session key, role, u64 frame number, payload).
+ * The session key is HMAC-SHA256(secret, "session" replica nonce primary
+ * nonce), so frames cannot be altered, replayed, reordered or moved to
+ * another connection. Bodies are not encrypted: run the link over a
+ * private network or a tunnel when mail must not be readable in transit.
+ *   replica -> primary:             u64 last applied seq
+ *   primary -> replica batch:       u32 count, records (count 0: heartbeat)
+ *     record: u64 seq, u8 op, u16 user len, user, u16 id len, id,
+ *             u32 body len, body (store only)
+ *   replica -> primary ack:         u64 highest applied seq
+ */
+enum class ReplicationOp : uint8_t {
+    Store = 1,
+    Quarantine = 2,
+    Delete = 3
+};
+
+struct ReplicationRecord {
+    uint64_t seq = 0;
+    ReplicationOp op = ReplicationOp::Store;
+    std::string user;
+    std::string id;
+    std::string body;                 // filled for Store when shipped
+    int64_t createdMs = 0;            // for lag measurement (primary only)
+};
+
+namespace ReplicationProtocol {
+
+static constexpr size_t MAX_BATCH_RECORDS = 256;
+static constexpr size_t MAX_BATCH_BYTES = 8 * 1024 * 1024;
+static constexpr size_t MAX_FRAME_BYTES = 64 * 1024 * 1024;
+
+// An authenticated connection; frame numbers run per direction
+struct Channel {
+    SOCKET sock = INVALID_SOCKET;
+    std::string key;
+    const char* sendRole = "";
+    const char* recvRole = "";
+    uint64_t sent = 0;
+    uint64_t received = 0;
+};
+
+std::string encodeBatch(const std::vector<ReplicationRecord>& records);
+bool decodeBatch(const std::string& payload, std::vector<ReplicationRecord>& out);
+
+bool sendAll(SOCKET sock, const char* data, size_t len);
+bool recvAll(SOCKET sock, char* data, size_t len);
+bool sendU64(SOCKET sock, uint64_t v);
+bool recvU64(SOCKET sock, uint64_t& v);
+bool sendFrame(SOCKET sock, const std::string& payload);
+bool recvFrame(SOCKET sock, std::string& payload);
+
+// Mutual challenge-response on the shared secret; each side proves it
+// holds the secret before any store data moves and gets the channel that
+// seals the rest of the stream. False on mismatch or I/O error
+bool authenticateReplica(SOCKET sock, const std::string& secret, Channel& channel);
+bool authenticatePrimary(SOCKET sock, const std::string& secret, Channel& channel);
+
+// False on I/O error or a frame whose MAC does not verify
+bool sendSealed(Channel& channel, const std::string& payload);
+bool recvSealed(Channel& channel, std::string& payload);
+bool sendSealedU64(Channel& channel, uint64_t v);
+bool recvSealedU64(Channel& channel, uint64_t& v);
+
+} // namespace ReplicationProtocol
@@ -0,0 +1,402 @@
+#include "replication/store_replicator.h"
+#include "storage/mail_store.h"
+#include "core/logger.h"
+#include "monitoring/metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace fs = std::filesystem;
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+StoreReplicator& StoreReplicator::instance() {
+    static StoreReplicator r;
+    return r;
+}
+
+void StoreReplicator::configure(Mode mode,
+                                const std::string& peerHost,
+                                int peerPort,
+                                const std::string& mailRoot,
+                                int ackTimeoutMs,
+                                const std::string& secret) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    mode_ = mode;
+    peerHost_ = peerHost;
+    peerPort_ = peerPort;
+    ackTimeoutMs_ = ackTimeoutMs;
+    secret_ = secret;
+    stateDir_ = (fs::path(mailRoot) / ".replication").string();
+    logPath_ = (fs::path(stateDir_) / "changes.log").string();
+    fs::create_directories(stateDir_);
+    loadState();
+
+    // Changes made while the predecessor was draining follow its records
+    for (auto& r : early_) {
+        r.seq = nextSeq_++;
+        appendLog(r);
+        pending_.push_back(std::move(r));
+    }
+    early_.clear();
+    deferring_ = false;
+    enabled_ = true;
+
+    Logger::instance().log(LogLevel::Info,
+        "StoreReplicator: Primary -> " + peerHost_ + ":" + std::to_string(peerPort_) +
+        (mode_ == Mode::Sync ? " (sync)" : " (async)") +
+        ", " + std::to_string(pending_.size()) + " unacked change(s)");
+}
+
+void StoreReplicator::attach(MailStore* store) {
+    store_ = store;
+}
+
+void StoreReplicator::deferUntilConfigured() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deferring_ = true;
+}
+
+void StoreReplicator::start() {
+    if (!enabled_ || running_) return;
+    running_ = true;
+    thread_ = std::thread(&StoreReplicator::run, this);
+}
+
+void StoreReplicator::stop() {
+    if (!running_) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        // Unblock a sender waiting on the replica's ack
+        if (activeSock_ != INVALID_SOCKET)
+            shutdown(activeSock_, SD_BOTH);
+    }
+    pendingCv_.notify_all();
+    ackCv_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+uint64_t StoreReplicator::recordStore(const std::string& user, const std::string& id) {
+    return record(ReplicationOp::Store, user, id);
+}
+
+uint64_t StoreReplicator::recordQuarantine(const std::string& user, const std::string& id) {
+    return record(ReplicationOp::Quarantine, user, id);
+}
+
+uint64_t StoreReplicator::recordDelete(const std::string& user, const std::string& id) {
+    return record(ReplicationOp::Delete, user, id);
+}
+
+uint64_t StoreReplicator::record(ReplicationOp op, const std::string& user, const std::string& id) {
+    ReplicationRecord r;
+    r.op = op;
+    r.user = user;
+    r.id = id;
+    r.createdMs = nowMs();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!enabled_) {
+            if (deferring_)
+                early_.push_back(r);
+            return 0;
+        }
+        r.seq = nextSeq_++;
+        appendLog(r);
+        pending_.push_back(r);
+        updateLagMetricsLocked();
+    }
+    pendingCv_.notify_one();
+    return r.seq;
+}
+
+bool StoreReplicator::waitReplicated(uint64_t seq) {
+    if (!enabled_ || mode_ != Mode::Sync || seq == 0)
+        return true;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool acked = ackCv_.wait_for(lock, std::chrono::milliseconds(ackTimeoutMs_),
+        [&] { return ackedSeq_ >= seq || !running_; });
+    if (acked && ackedSeq_ >= seq)
+        return true;
+
+    // Degrade to async for this message: it is durable locally and stays
+    // in the change log until the replica catches up
+    Metrics::instance().inc("replication_sync_timeouts_total");
+    Logger::instance().log(LogLevel::Warn,
+        "StoreReplicator: Replica ack timed out for seq " + std::to_string(seq) +
+        ", accepting asynchronously");
+    return false;
+}
+
+SOCKET StoreReplicator::connectPeer() {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* ai = nullptr;
+    if (getaddrinfo(peerHost_.c_str(), std::to_string(peerPort_).c_str(), &hints, &ai) != 0 || !ai)
+        return INVALID_SOCKET;
+
+    SOCKET sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock != INVALID_SOCKET &&
+        connect(sock, ai->ai_addr, (int)ai->ai_addrlen) == SOCKET_ERROR) {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    freeaddrinfo(ai);
+
+    if (sock != INVALID_SOCKET) {
+        // A replica that stops acking is treated as disconnected
+        DWORD timeout = 30000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof(one));
+    }
+    return sock;
+}
+
+void StoreReplicator::run() {
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    bool warned = false;
+    while (running_) {
+        SOCKET sock = connectPeer();
+        if (sock == INVALID_SOCKET) {
+            if (!warned) {
+                Logger::instance().log(LogLevel::Warn,
+                    "StoreReplicator: Replica " + peerHost_ + ":" +
+                    std::to_string(peerPort_) + " unreachable, retrying");
+                warned = true;
+            }
+            Metrics::instance().set("replication_connected", 0);
+            std::unique_lock<std::mutex> lock(mutex_);
+            pendingCv_.wait_for(lock, std::chrono::milliseconds(RECONNECT_MS),
+                                [&] { return !running_; });
+            continue;
+        }
+
+        warned = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            activeSock_ = sock;
+        }
+        Metrics::instance().set("replication_connected", 1);
+        Logger::instance().log(LogLevel::Info,
+            "StoreReplicator: Connected to replica " + peerHost_ + ":" + std::to_string(peerPort_));
+
+        session(sock);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            activeSock_ = INVALID_SOCKET;
+        }
+        closesocket(sock);
+        Metrics::instance().set("replication_connected", 0);
+        if (running_) {
+            Logger::instance().log(LogLevel::Warn, "StoreReplicator: Replica connection lost");
+        }
+    }
+}
+
+bool StoreReplicator::session(SOCKET sock) {
+    ReplicationProtocol::Channel channel;
+    if (!ReplicationProtocol::authenticatePrimary(sock, secret_, channel)) {
+        Metrics::instance().inc("replication_auth_failures_total");
+        Logger::instance().log(LogLevel::Error,
+            "StoreReplicator: Replica " + peerHost_ + ":" + std::to_string(peerPort_) +
+            " failed authentication; check replication.shared_secret on both nodes");
+        return false;
+    }
+
+    // The replica opens with the last seq it has applied
+    uint64_t replicaSeq = 0;
+    if (!ReplicationProtocol::recvSealedU64(channel, replicaSeq))
+        return false;
+
+    uint64_t acked;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        acked = ackedSeq_;
+    }
+    if (replicaSeq > acked) {
+        // Replica applied records whose ack we never persisted
+        onAcked(replicaSeq);
+    } else if (replicaSeq < acked) {
+        Logger::instance().log(LogLevel::Warn,
+            "StoreReplicator: Replica is at seq " + std::to_string(replicaSeq) +
+            " but changes up to " + std::to_string(acked) +
+            " were already acknowledged; seed a new replica from a copy of mail_root");
+    }
+
+    while (running_) {
+        std::vector<ReplicationRecord> batch;
+        {
+            // An idle stream still carries an empty batch every heartbeat,
+            // so the replica can tell a quiet primary from a dead one
+            std::unique_lock<std::mutex> lock(mutex_);
+            pendingCv_.wait_for(lock, std::chrono::milliseconds(HEARTBEAT_MS),
+                                [&] { return !running_ || !pending_.empty(); });
+            if (!running_) return true;
+            for (const auto& r : pending_) {
+                if (batch.size() >= ReplicationProtocol::MAX_BATCH_RECORDS) break;
+                batch.push_back(r);
+            }
+        }
+
+        // Bodies are read without holding the replicator lock: MailStore
+        // calls into us while holding its own mutex
+        size_t bytes = 0, keep = 0;
+        for (auto& r : batch) {
+            if (r.op == ReplicationOp::Store && store_) {
+                // Missing body: the message was deleted since; the replica
+                // skips the write and applies the later delete
+                store_->readStored(r.user, r.id, r.body);
+            }
+            bytes += r.body.size() + r.user.size() + r.id.size() + 32;
+            ++keep;
+            if (bytes >= ReplicationProtocol::MAX_BATCH_BYTES) break;
+        }
+        batch.resize(keep);
+
+        std::string payload = ReplicationProtocol::encodeBatch(batch);
+        if (!ReplicationProtocol::sendSealed(channel, payload))
+            return false;
+        Metrics::instance().inc("replication_bytes_sent_total", (int)payload.size());
+        Metrics::instance().inc("replication_records_sent_total", (int)batch.size());
+
+        uint64_t ackSeq = 0;
+        if (!ReplicationProtocol::recvSealedU64(channel, ackSeq))
+            return false;
+        onAcked(ackSeq);
+    }
+    return true;
+}
+
+void StoreReplicator::onAcked(uint64_t seq) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (seq <= ackedSeq_) return;
+        ackedSeq_ = seq;
+        while (!pending_.empty() && pending_.front().seq <= seq)
+            pending_.pop_front();
+
+        std::string path = (fs::path(stateDir_) / "acked").string();
+        if (!writeDurable(path, std::to_string(ackedSeq_) + " " + std::to_string(nextSeq_) + "\n")) {
+            Logger::instance().log(LogLevel::Error,
+                "StoreReplicator: Failed to persist ack to " + path);
+        }
+
+        if (pending_.empty())
+            compactLogLocked();
+        updateLagMetricsLocked();
+    }
+    ackCv_.notify_all();
+}
+
+void StoreReplicator::loadState() {
+    pending_.clear();
+    ackedSeq_ = 0;
+    nextSeq_ = 1;
+
+    std::ifstream ackIn((fs::path(stateDir_) / "acked").string());
+    uint64_t savedNext = 0;
+    if (ackIn >> ackedSeq_) {
+        ackIn >> savedNext;
+    }
+
+    // changes.log: seq \t op \t createdMs \t user \t id
+    std::ifstream in(logPath_);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        std::string seqStr, opStr, createdStr, user, id;
+        if (!std::getline(ls, seqStr, '\t') || !std::getline(ls, opStr, '\t') ||
+            !std::getline(ls, createdStr, '\t') || !std::getline(ls, user, '\t') ||
+            !std::getline(ls, id)) {
+            continue; // torn final line after a crash
+        }
+        try {
+            ReplicationRecord r;
+            r.seq = std::stoull(seqStr);
+            int op = std::stoi(opStr);
+            if (op < 1 || op > 3) continue;
+            r.op = static_cast<ReplicationOp>(op);
+            r.createdMs = std::stoll(createdStr);
+            r.user = user;
+            r.id = id;
+            nextSeq_ = std::max(nextSeq_, r.seq + 1);
+            if (r.seq > ackedSeq_)
+                pending_.push_back(std::move(r));
+        } catch (...) {
+            continue;
+        }
+    }
+
+    // Never reuse a sequence number the replica may already have seen
+    nextSeq_ = std::max({nextSeq_, ackedSeq_ + 1, savedNext});
+    updateLagMetricsLocked();
+}
+
+void StoreReplicator::appendLog(const ReplicationRecord& r) {
+    std::string line = std::to_string(r.seq) + '\t' + std::to_string(static_cast<int>(r.op)) +
+                       '\t' + std::to_string(r.createdMs) + '\t' + r.user + '\t' + r.id + '\n';
+
+    // Flushed before the caller's 250: an unlogged change would never ship
+    HANDLE h = CreateFileA(logPath_.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    DWORD n = 0;
+    bool ok = h != INVALID_HANDLE_VALUE &&
+              WriteFile(h, line.data(), static_cast<DWORD>(line.size()), &n, NULL) &&
+              n == line.size() && FlushFileBuffers(h);
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    if (!ok) {
+        Logger::instance().log(LogLevel::Error,
+            "StoreReplicator: Failed to append change log " + logPath_);
+    }
+}
+
+// Temp file, flush, rename: the ack position survives a crash or power loss
+bool StoreReplicator::writeDurable(const std::string& path, const std::string& content) {
+    std::string tmp = path + ".tmp";
+    HANDLE h = CreateFileA(tmp.c_str(), GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    DWORD n = 0;
+    bool ok = h != INVALID_HANDLE_VALUE &&
+              WriteFile(h, content.data(), static_cast<DWORD>(content.size()), &n, NULL) &&
+              n == content.size() && FlushFileBuffers(h);
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    ok = ok && MoveFileExA(tmp.c_str(), path.c_str(),
+                           MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!ok)
+        DeleteFileA(tmp.c_str());
+    return ok;
+}
+
+void StoreReplicator::compactLogLocked() {
+    // Everything is acknowledged: start a fresh log
+    std::ofstream out(logPath_, std::ios::trunc);
+}
+
+void StoreReplicator::updateLagMetricsLocked() {
+    Metrics::instance().set("replication_lag_records", (int)pending_.size());
+    Metrics::instance().set("replication_lag_ms",
+        pending_.empty() ? 0 : (int)(nowMs() - pending_.front().createdMs));
+    Metrics::instance().set("replication_acked_seq", (int)ackedSeq_);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include "replication/replication_protocol.h"
+
+class MailStore;
+
+/**
+ * Store Replicator (primary side)
+ *
+ * WHY REQUIRED:
+ * - Mail accepted with 250 lives on one disk until now
+ * - Every MailStore change is appended to a durable change log and
+ *   streamed in batches (with bodies) to a standby replica
+ * - async: 250 is sent after the local fsync; the replica trails by the lag
+ * - sync: 250 waits for the replica's ack, up to ack_timeout_ms, then
+ *   degrades to async for that message rather than stalling SMTP
+ * - Unacked records survive restarts in <mail_root>/.replication/changes.log;
+ *   each record is flushed to disk before the change is acknowledged
+ * - Nothing is shipped until the replica proves it holds the shared secret;
+ *   every later frame carries a MAC under the session key
+ */
+class StoreReplicator {
+public:
+    enum class Mode { Async, Sync };
+
+    static StoreReplicator& instance();
+
+    void configure(Mode mode,
+                   const std::string& peerHost,
+                   int peerPort,
+                   const std::string& mailRoot,
+                   int ackTimeoutMs,
+                   const std::string& secret);
+    void attach(MailStore* store);
+
+    // Upgrade successor: the predecessor still owns the change log, so
+    // buffer records in memory until configure() takes it over
+    void deferUntilConfigured();
+
+    void start();
+    void stop();
+
+    bool enabled() const { return enabled_; }
+
+    // Called by MailStore after each durable change; returns 0 when disabled
+    uint64_t recordStore(const std::string& user, const std::string& id);
+    uint64_t recordQuarantine(const std::string& user, const std::string& id);
+    uint64_t recordDelete(const std::string& user, const std::string& id);
+
+    // Sync mode: block until the replica has applied seq (or timeout)
+    bool waitReplicated(uint64_t seq);
+
+private:
+    StoreReplicator() = default;
+
+    uint64_t record(ReplicationOp op, const std::string& user, const std::string& id);
+    void run();
+    bool session(SOCKET sock);
+    SOCKET connectPeer();
+    void onAcked(uint64_t seq);
+    void loadState();
+    void appendLog(const ReplicationRecord& r);
+    static bool writeDurable(const std::string& path, const std::string& content);
+    void compactLogLocked();
+    void updateLagMetricsLocked();
+
+    static constexpr int RECONNECT_MS = 1000;
+    static constexpr int HEARTBEAT_MS = 5000;   // well inside the replica's idle timeout
+
+    Mode mode_ = Mode::Async;
+    std::string peerHost_;
+    int peerPort_ = 0;
+    std::string stateDir_;
+    std::string logPath_;
+    int ackTimeoutMs_ = 2000;
+    std::string secret_;
+    MailStore* store_ = nullptr;
+
+    std::atomic<bool> enabled_{false};
+    bool deferring_ = false;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    std::mutex mutex_;
+    std::condition_variable pendingCv_;   // new records for the sender
+    std::condition_variable ackCv_;       // acks for sync waiters
+    std::deque<ReplicationRecord> pending_; // unacked, in seq order
+    std::vector<ReplicationRecord> early_;  // recorded before configure()
+    uint64_t nextSeq_ = 1;
+    uint64_t ackedSeq_ = 0;
+    SOCKET activeSock_ = INVALID_SOCKET;
+};
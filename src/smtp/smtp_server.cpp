@@ -5,6 +5,7 @@
 #include "core/logger.h"
 #include "core/rate_limiter.h"
 #include "core/connection_manager.h"
+#include "dnsbl/dnsbl_engine.h"
 #include <chrono>
 #include <algorithm>
 #define WIN32_LEAN_AND_MEAN
@@ -49,6 +50,19 @@ bool SmtpServer::isCircuitBreakerTripped() const {
     return recentFailures_.load() >= FAILURE_THRESHOLD;
 }
 
+void SmtpServer::rejectListed(SOCKET client, const std::string& ip, const DnsblVerdict& v) const {
+    Logger::instance().log(LogLevel::Warn,
+        "SMTP: Refusing " + ip + " listed in " + v.zone +
+        " (127.0.0." + std::to_string(v.code) + ")");
+
+    // Implicit-TLS clients expect a handshake, not a greeting
+    if (port_ == 465)
+        return;
+    std::string line = "554 5.7.1 Service unavailable; client [" + ip +
+                       "] blocked using " + v.zone + "\r\n";
+    send(client, line.c_str(), static_cast<int>(line.size()), 0);
+}
+
 void SmtpServer::resetCircuitBreakerIfExpired() {
     auto now = std::chrono::steady_clock::now();
     auto timeSinceLastFailure = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -81,14 +95,34 @@ void SmtpServer::start() {
     thread_ = std::thread(&SmtpServer::run, this);
 }
 
+void SmtpServer::adoptListener(SOCKET sock) {
+    listenSock_ = sock;
+    adopted_ = true;
+}
+
+void SmtpServer::stopAccepting() {
+    running_ = false;
+    // The accept loop polls, so it notices within one interval. The socket
+    // is shared with the successor: close our descriptor, never shutdown()
+    if (thread_.joinable())
+        thread_.join();
+    SOCKET s = listenSock_.exchange(INVALID_SOCKET);
+    if (s != INVALID_SOCKET)
+        closesocket(s);
+}
+
+size_t SmtpServer::activeSessions() {
+    std::lock_guard<std::mutex> lk(clientsMutex_);
+    return clientSockets_.size();
+}
+
 void SmtpServer::stop() {
-    if (!running_) return;
     running_ = false;
     // Close listener to interrupt blocking accept()
-    if (listenSock_ != INVALID_SOCKET) {
-        shutdown(listenSock_, SD_BOTH);
-        closesocket(listenSock_);
-        listenSock_ = INVALID_SOCKET;
+    SOCKET ls = listenSock_.exchange(INVALID_SOCKET);
+    if (ls != INVALID_SOCKET) {
+        shutdown(ls, SD_BOTH);
+        closesocket(ls);
     }
 
     if (thread_.joinable())
@@ -127,28 +161,31 @@ void SmtpServer::run() {
         return;
     }
 
-    listenSock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (listenSock_ == INVALID_SOCKET) {
-        WSACleanup();
-        return;
-    }
+    if (!adopted_) {
+        listenSock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSock_ == INVALID_SOCKET) {
+            WSACleanup();
+            return;
+        }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(static_cast<uint16_t>(port_));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<uint16_t>(port_));
 
-    if (bind(listenSock_, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-        closesocket(listenSock_);
-        WSACleanup();
-        return;
-    }
+        if (bind(listenSock_, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            closesocket(listenSock_);
+            listenSock_ = INVALID_SOCKET;
+            WSACleanup();
+            return;
+        }
 
-    if (listen(listenSock_, SOMAXCONN) == SOCKET_ERROR) {
-        closesocket(listenSock_);
-        listenSock_ = INVALID_SOCKET;
-        WSACleanup();
-        return;
+        if (listen(listenSock_, SOMAXCONN) == SOCKET_ERROR) {
+            closesocket(listenSock_);
+            listenSock_ = INVALID_SOCKET;
+            WSACleanup();
+            return;
+        }
     }
 
     while (running_) {
@@ -184,7 +221,18 @@ void SmtpServer::run() {
             continue;
         }
 
-        SOCKET client = accept(listenSock_, nullptr, nullptr);
+        // Poll so stopAccepting() can end the loop without shutting down
+        // a listening socket shared with an upgraded successor
+        SOCKET ls = listenSock_;
+        if (ls == INVALID_SOCKET) break;
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(ls, &readable);
+        timeval tv{0, ACCEPT_POLL_MS * 1000};
+        if (select(static_cast<int>(ls) + 1, &readable, nullptr, nullptr, &tv) <= 0)
+            continue;
+
+        SOCKET client = accept(ls, nullptr, nullptr);
         if (client == INVALID_SOCKET) {
             if (!running_) break;
             continue;
@@ -206,6 +254,15 @@ void SmtpServer::run() {
             continue;
         }
 
+        // Locally listed sources never reach the rate limiter or a session
+        DnsblVerdict listed = DnsblEngine::instance().checkLocal(ip);
+        if (listed.listed) {
+            rejectListed(client, ip, listed);
+            ConnectionManager::instance().releaseConnection(ip);
+            closesocket(client);
+            continue;
+        }
+
         if (!RateLimiter::instance().allowConnection(ip)) {
             Logger::instance().log(LogLevel::Warn,
                 "SMTP rate limit exceeded for " + ip);
@@ -216,15 +273,29 @@ void SmtpServer::run() {
         
         Logger::instance().inc_connections_total();
 
+        // Remote lists resolve while the session thread starts
+        auto remoteLookup = DnsblEngine::instance().queryRemote(ip);
+
         {
             std::lock_guard<std::mutex> lk(clientsMutex_);
             clientSockets_.push_back(client);
         }
 
-        std::thread t([this, client, ip]() {
+        std::thread t([this, client, ip, remoteLookup]() {
             bool sessionFailed = false;
             SslPtr ssl = nullptr;
             try {
+                DnsblVerdict remote = DnsblEngine::instance().awaitRemote(remoteLookup);
+                if (remote.listed) {
+                    rejectListed(client, ip, remote);
+                    closesocket(client);
+                    RateLimiter::instance().releaseConnection(ip);
+                    ConnectionManager::instance().releaseConnection(ip);
+                    std::lock_guard<std::mutex> lk(clientsMutex_);
+                    clientSockets_.erase(std::remove(clientSockets_.begin(), clientSockets_.end(), client), clientSockets_.end());
+                    return;
+                }
+
                 if (port_ == 465) {
                     SSL* raw = TlsContext::instance().createSSL(client);
                     if (!raw || SSL_accept(raw) <= 0) {
@@ -298,9 +369,5 @@ void SmtpServer::run() {
         }
     }
 
-    if (listenSock_ != INVALID_SOCKET) {
-        closesocket(listenSock_);
-        listenSock_ = INVALID_SOCKET;
-    }
     WSACleanup();
 }
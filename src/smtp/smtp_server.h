@@ -21,6 +21,7 @@ constexpr SOCKET INVALID_SOCKET = -1;
 #endif
 
 class ServerContext; // forward declaration
+struct DnsblVerdict;
 
 class SmtpServer {
 public:
@@ -30,6 +31,13 @@ public:
     void start();   // start listener thread
     void stop();    // stop listener and join
 
+    // Upgrade handoff: serve an inherited listening socket instead of binding
+    void adoptListener(SOCKET sock);
+    SOCKET listener() const { return listenSock_; }
+    // Stop accepting without touching live sessions (successor owns the port)
+    void stopAccepting();
+    size_t activeSessions();
+
 private:
     void run();     // listener loop
 
@@ -38,7 +46,8 @@ private:
     std::thread thread_;
     std::atomic<bool> running_{false};
     // Listener socket so we can close it to interrupt accept()
-    SOCKET listenSock_{INVALID_SOCKET};
+    std::atomic<SOCKET> listenSock_{INVALID_SOCKET};
+    bool adopted_ = false;
 
     // Track active session threads and client sockets so we can shutdown cleanly
     std::vector<std::thread> sessions_;
@@ -51,6 +60,10 @@ private:
     std::atomic<std::chrono::steady_clock::time_point> lastFailureTime_;
     static constexpr int FAILURE_THRESHOLD = 10;  // Failures per minute
     static constexpr int CIRCUIT_BREAKER_TIMEOUT_MS = 30000;  // 30 seconds
+    static constexpr int ACCEPT_POLL_MS = 500;     // stopAccepting() latency
+
+    // 554 greeting (plaintext ports) for a blocklisted client
+    void rejectListed(SOCKET client, const std::string& ip, const DnsblVerdict& v) const;
 
     bool isCircuitBreakerTripped() const;
     void resetCircuitBreakerIfExpired();
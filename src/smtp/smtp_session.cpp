@@ -9,6 +9,7 @@
 #include "mime/mime_parser.h"
 #include "policy/attachment_policy.h"
 #include "core/rate_limiter.h"
+#include "replication/store_replicator.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <winsock2.h>
@@ -19,8 +20,31 @@
 #include <sstream>
 #include <algorithm>
 #include <vector>
+#include <cctype>
 #include <ctime>
 
+// An Authentication-Results field naming our own authserv-id can only have
+// been forged upstream (RFC 8601 5)
+static bool isOwnAuthResults(const std::string& line, const std::string& authServId) {
+    static const std::string name = "authentication-results:";
+    if (line.size() <= name.size())
+        return false;
+    for (size_t i = 0; i < name.size(); ++i)
+        if (std::tolower(static_cast<unsigned char>(line[i])) != name[i])
+            return false;
+
+    size_t start = line.find_first_not_of(" \t", name.size());
+    if (start == std::string::npos)
+        return false;
+    size_t end = line.find_first_of(" \t;", start);
+    std::string id = line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    return id.size() == authServId.size() &&
+           std::equal(id.begin(), id.end(), authServId.begin(), [](char a, char b) {
+               return std::tolower(static_cast<unsigned char>(a)) ==
+                      std::tolower(static_cast<unsigned char>(b));
+           });
+}
+
 
 SmtpSession::SmtpSession(ServerContext& ctx, int clientSock)
     : context_(ctx), sock_(clientSock), ssl_(nullptr), tlsActive_(false), 
@@ -525,6 +549,12 @@ void SmtpSession::handleData() {
     const size_t maxSize = context_.config.maxMessageSize;
     int consecutiveErrors = 0;
 
+    // DKIM body hashes are taken line by line while the body arrives
+    DkimVerifier dkim;
+    std::string headerBlock;
+    bool inBody = false;
+    bool forgedField = false;
+
     while (readLine(line)) {
         if (line == ".")
             break;
@@ -550,7 +580,21 @@ void SmtpSession::handleData() {
         }
         
         try {
-            message << line << "\n";
+            if (!inBody && !line.empty() && line[0] != ' ' && line[0] != '\t')
+                forgedField = isOwnAuthResults(line, context_.config.domain);
+            if (inBody || line.empty() || !forgedField)
+                message << line << "\n";
+
+            if (inBody) {
+                dkim.updateBody(line.data(), line.size());
+                dkim.updateBody("\r\n", 2);
+            } else if (line.empty()) {
+                inBody = true;
+                dkim.beginBody(headerBlock);
+            } else {
+                headerBlock += line;
+                headerBlock += "\r\n";
+            }
         } catch (const std::bad_alloc&) {
             Logger::instance().log(LogLevel::Error,
                 "SMTP DATA command out of memory (" + peerIp_ + ")");
@@ -570,6 +614,11 @@ void SmtpSession::handleData() {
         }
     }
 
+    if (!inBody)
+        dkim.beginBody(headerBlock);
+    // Key lookups overlapped the body; a slow one is temperror, not a stall
+    authResults_.dkim = dkim.finish(context_.config.dkimVerifyWaitMs);
+
     // CRITICAL FIX: Durable message storage with at-least-once delivery guarantee
     // Only acknowledge acceptance AFTER message is durably stored
     try {
@@ -577,11 +626,14 @@ void SmtpSession::handleData() {
         msg.id = "";
         msg.from = mailFrom_;
         msg.recipients = rcptTo_;
-        msg.rawData = message.str();
+        msg.rawData = "Authentication-Results: " +
+                      authResults_.dkimHeaderValue(context_.config.domain) + "\n" +
+                      message.str();
         msg.mailboxUser = rcptTo_[0];
 
         // Store message durably (atomic write + fsync + rename)
-        std::string storedId = context_.mailStore.store(msg);
+        uint64_t replicationSeq = 0;
+        std::string storedId = context_.mailStore.store(msg, &replicationSeq);
 
         if (storedId.empty()) {
             Logger::instance().log(LogLevel::Error,
@@ -590,6 +642,9 @@ void SmtpSession::handleData() {
             return;
         }
 
+        // Sync replication: hold the 250 until the standby has the message
+        StoreReplicator::instance().waitReplicated(replicationSeq);
+
         // CRITICAL FIX: Only acknowledge AFTER durable storage succeeds
         sendLine("250 Message accepted for delivery");
 
@@ -1,5 +1,6 @@
 #include "storage/mail_store.h"
 #include "core/logger.h"
+#include "replication/store_replicator.h"
 
 #include <filesystem>
 #include <fstream>
@@ -129,6 +130,7 @@ bool MailStore::moveToQuarantine(const std::string& user,
         Logger::instance().log(
             LogLevel::Warn,
             "MailStore: quarantined message " + id);
+        StoreReplicator::instance().recordQuarantine(user, id);
         return true;
     } catch (...) {
         return false;
@@ -145,13 +147,14 @@ bool MailStore::deleteMessage(const std::string& user,
         Logger::instance().log(
             LogLevel::Warn,
             "MailStore: deleted message " + id);
+        StoreReplicator::instance().recordDelete(user, id);
         return true;
     } catch (...) {
         return false;
     }
 }
 
-std::string MailStore::store(const StoredMessage& msg) {
+std::string MailStore::store(const StoredMessage& msg, uint64_t* replicationSeq) {
     std::lock_guard<std::mutex> lock(mutex_);
 
     if (msg.mailboxUser.empty()) {
@@ -198,5 +201,41 @@ std::string MailStore::store(const StoredMessage& msg) {
         " for user " + msg.mailboxUser +
         " at " + path);
 
+    uint64_t seq = StoreReplicator::instance().recordStore(msg.mailboxUser, id);
+    if (replicationSeq)
+        *replicationSeq = seq;
+
     return id;
 }
+
+bool MailStore::storeRaw(const std::string& user,
+                         const std::string& id,
+                         const std::string& content) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::string inboxDir = makeUserInboxDir(user);
+    if (!ensureDirExists(inboxDir))
+        return false;
+    return atomicWriteFile(makeMessagePath(user, id), content);
+}
+
+bool MailStore::readStored(const std::string& user,
+                           const std::string& id,
+                           std::string& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Quarantined since the change was logged: ship it from there
+    fs::path candidates[] = {
+        makeMessagePath(user, id),
+        fs::path(rootDir_) / user / "Quarantine" / (id + ".eml")
+    };
+    for (const auto& p : candidates) {
+        std::ifstream in(p, std::ios::binary);
+        if (!in.is_open())
+            continue;
+        out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+    out.clear();
+    return false;
+}
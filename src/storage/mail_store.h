@@ -4,6 +4,7 @@
 #include <vector>
 #include <mutex>
 #include <filesystem>
+#include <cstdint>
 
 struct StoredMessage {
     std::string id;                 // unique id (optional; generated if empty)
@@ -17,14 +18,23 @@ class MailStore {
 public:
     explicit MailStore(const std::string& rootDir);
 
-    // Store message on disk; returns message id or empty string on failure
-    std::string store(const StoredMessage& msg);
+    // Store message on disk; returns message id or empty string on failure.
+    // replicationSeq receives the change-log position (0 when not replicating)
+    std::string store(const StoredMessage& msg, uint64_t* replicationSeq = nullptr);
     bool moveToQuarantine(const std::string& user,
                       const std::string& id);
 
     bool deleteMessage(const std::string& user,
                    const std::string& id);
 
+    // Replication: write a shipped message verbatim / read one for shipping
+    bool storeRaw(const std::string& user,
+                  const std::string& id,
+                  const std::string& content);
+    bool readStored(const std::string& user,
+                    const std::string& id,
+                    std::string& out) const;
+
 private:
     std::string rootDir_;           // base: e.g. "data/mail"
     mutable std::mutex mutex_;
@@ -0,0 +1,238 @@
+// tests/spf_policy_test.cpp
+//
+// SPF policy compiler + evaluator against a fixed zone. DnsResolver is
+// replaced by an in-memory table (this file defines the members the SPF
+// code calls), so every case is deterministic and every query is counted.
+// Each case uses its own names: the policy cache is never shared between
+// cases unless a case means to test that.
+#include "antispam/spf_evaluator.h"
+#include "antispam/spf_policy.h"
+#include "dns/dns_resolver.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* ===================== Fake resolver ===================== */
+
+static std::map<std::pair<std::string, DnsRecordType>, std::vector<std::string>> g_zone;
+static std::map<std::string, int> g_queries;
+static std::mutex g_zoneMutex;
+
+static void txt(const std::string& name, const std::string& value) {
+    g_zone[{ name, DnsRecordType::TXT }].push_back(value);
+}
+static void a(const std::string& name, const std::string& addr) {
+    g_zone[{ name, DnsRecordType::A }].push_back(addr);
+}
+static void mx(const std::string& name, const std::string& exchange) {
+    g_zone[{ name, DnsRecordType::MX }].push_back(exchange);
+}
+
+DnsResolver& DnsResolver::instance() {
+    static DnsResolver resolver;
+    return resolver;
+}
+
+DnsResolver::~DnsResolver() = default;
+
+DnsResolver::Result DnsResolver::queryPacket(const std::string& name, DnsRecordType type) {
+    std::lock_guard<std::mutex> lock(g_zoneMutex);
+    ++g_queries[name];
+    DnsPacket pkt{};
+    pkt.qname = name;
+    pkt.qtype = static_cast<uint16_t>(type);
+    auto it = g_zone.find({ name, type });
+    bool exists = it != g_zone.end();
+    for (const auto& [key, values] : g_zone)
+        exists = exists || key.first == name;
+    pkt.rcode = exists ? DnsResponseCode::NoError : DnsResponseCode::NxDomain;
+    if (it != g_zone.end()) {
+        uint16_t preference = 10;
+        for (const auto& v : it->second)
+            pkt.answers.push_back(DnsAnswer{ name, type, 300, v, preference++ });
+    }
+    return pkt;
+}
+
+std::shared_future<DnsResolver::Result> DnsResolver::queryAsync(const std::string& name,
+                                                                DnsRecordType type) {
+    std::promise<Result> p;
+    p.set_value(queryPacket(name, type));
+    return p.get_future().share();
+}
+
+/* ===================== Cases ===================== */
+
+static int g_failures = 0;
+static int g_cases = 0;
+
+static const char* name(SpfResultCode r) {
+    switch (r) {
+    case SpfResultCode::Pass:      return "pass";
+    case SpfResultCode::Fail:      return "fail";
+    case SpfResultCode::SoftFail:  return "softfail";
+    case SpfResultCode::Neutral:   return "neutral";
+    case SpfResultCode::None:      return "none";
+    case SpfResultCode::TempError: return "temperror";
+    case SpfResultCode::PermError: return "permerror";
+    }
+    return "?";
+}
+
+struct Case {
+    const char* what;
+    std::string domain;
+    std::string ip;
+    SpfResultCode want;
+};
+
+static void check(const Case& c) {
+    ++g_cases;
+    SpfEvaluator eval(c.ip, "user@" + c.domain, "helo." + c.domain);
+    SpfResultCode got = eval.evaluate(c.domain);
+    if (got != c.want) {
+        ++g_failures;
+        std::fprintf(stderr, "FAIL %s: %s from %s = %s, want %s\n", c.what,
+                     c.domain.c_str(), c.ip.c_str(), name(got), name(c.want));
+    }
+}
+
+// n lookup terms that resolve to nothing
+static std::string misses(const std::string& prefix, int n) {
+    std::string terms;
+    for (int i = 0; i < n; ++i)
+        terms += " a:" + prefix + "miss" + std::to_string(i) + ".test";
+    return terms;
+}
+
+// ...then one that matches 192.0.2.1
+static std::string lookupChain(const std::string& prefix, int n) {
+    a(prefix + "hit.test", "192.0.2.1");
+    return misses(prefix, n) + " a:" + prefix + "hit.test";
+}
+
+// Every node includes `fanout` children down to `depth`
+static void hostileTree(const std::string& node, int fanout, int depth) {
+    std::string rec = "v=spf1";
+    if (depth > 0) {
+        for (int i = 0; i < fanout; ++i) {
+            std::string child = std::to_string(i) + "." + node;
+            rec += " include:" + child;
+            hostileTree(child, fanout, depth - 1);
+        }
+    } else {
+        rec += " a:host." + node;
+    }
+    txt(node, rec + " -all");
+}
+
+int main() {
+    std::vector<Case> cases;
+
+    // First match wins across a flattened include, with the include's qualifier
+    txt("order.test", "v=spf1 -ip4:192.0.2.1 include:_spf.order.test ~all");
+    txt("_spf.order.test", "v=spf1 ip4:192.0.2.0/24 -all");
+    cases.push_back({ "earlier term beats a broader flattened prefix", "order.test", "192.0.2.1", SpfResultCode::Fail });
+    cases.push_back({ "flattened include matches", "order.test", "192.0.2.9", SpfResultCode::Pass });
+    cases.push_back({ "no match falls through to all", "order.test", "198.51.100.1", SpfResultCode::SoftFail });
+
+    txt("qual.test", "v=spf1 -include:_spf.qual.test ip4:192.0.2.0/24 -all");
+    txt("_spf.qual.test", "v=spf1 ip4:192.0.2.5 ip6:2001:db8::/32 -all");
+    cases.push_back({ "include qualifier applies to flattened entries", "qual.test", "192.0.2.5", SpfResultCode::Fail });
+    cases.push_back({ "later broader term after the include", "qual.test", "192.0.2.6", SpfResultCode::Pass });
+    cases.push_back({ "flattened ip6 entry", "qual.test", "2001:db8::1", SpfResultCode::Fail });
+
+    // RFC 7208 4.6.4: ten lookup terms are allowed, the eleventh is a PermError
+    txt("ten.test", "v=spf1" + lookupChain("ten", 9) + " -all");
+    txt("eleven.test", "v=spf1" + lookupChain("eleven", 10) + " -all");
+    cases.push_back({ "tenth lookup matches", "ten.test", "192.0.2.1", SpfResultCode::Pass });
+    cases.push_back({ "eleventh lookup is over the limit", "eleven.test", "192.0.2.1", SpfResultCode::PermError });
+    cases.push_back({ "ten lookups, no match", "ten.test", "198.51.100.1", SpfResultCode::Fail });
+
+    // The limit counts across includes: include + 8 + hit = 10, include + 9 + hit = 11
+    txt("inc10.test", "v=spf1 include:_spf.inc10.test" + lookupChain("inc10", 0) + " -all");
+    txt("_spf.inc10.test", "v=spf1" + misses("inc10in", 8) + " -all");
+    txt("inc11.test", "v=spf1 include:_spf.inc11.test" + lookupChain("inc11", 0) + " -all");
+    txt("_spf.inc11.test", "v=spf1" + misses("inc11in", 9) + " -all");
+    cases.push_back({ "ten lookups across an include", "inc10.test", "192.0.2.1", SpfResultCode::Pass });
+    cases.push_back({ "eleven lookups across an include", "inc11.test", "192.0.2.1", SpfResultCode::PermError });
+
+    // exists matches any client when the name has an A record
+    txt("exists.test", "v=spf1 exists:yes.exists.test -all");
+    a("yes.exists.test", "127.0.0.2");
+    txt("notexists.test", "v=spf1 exists:no.notexists.test ~all");
+    cases.push_back({ "exists with an A record", "exists.test", "198.51.100.7", SpfResultCode::Pass });
+    cases.push_back({ "exists without one", "notexists.test", "198.51.100.7", SpfResultCode::SoftFail });
+
+    // redirect= replaces the policy when nothing matched
+    txt("redir.test", "v=spf1 ip4:203.0.113.1 redirect=_spf.redir.test");
+    txt("_spf.redir.test", "v=spf1 ip4:192.0.2.1 -all");
+    txt("redirnone.test", "v=spf1 redirect=missing.redirnone.test");
+    cases.push_back({ "own term before the redirect", "redir.test", "203.0.113.1", SpfResultCode::Pass });
+    cases.push_back({ "redirect target matches", "redir.test", "192.0.2.1", SpfResultCode::Pass });
+    cases.push_back({ "redirect target fails", "redir.test", "192.0.2.2", SpfResultCode::Fail });
+    cases.push_back({ "redirect to no record", "redirnone.test", "192.0.2.1", SpfResultCode::PermError });
+
+    // include of a domain with no SPF record is a PermError (RFC 7208 5.2)
+    txt("incnone.test", "v=spf1 include:missing.incnone.test -all");
+    txt("incnone2.test", "v=spf1 ip4:192.0.2.1 include:missing.incnone2.test -all");
+    cases.push_back({ "include -> none", "incnone.test", "192.0.2.1", SpfResultCode::PermError });
+    cases.push_back({ "match before include -> none", "incnone2.test", "192.0.2.1", SpfResultCode::Pass });
+
+    // mx: ten exchange names are allowed, eleven are a PermError
+    txt("mx10.test", "v=spf1 mx -all");
+    txt("mx11.test", "v=spf1 mx -all");
+    for (int i = 0; i < 11; ++i) {
+        std::string host = "mx" + std::to_string(i) + ".example.test";
+        a(host, "198.51.100." + std::to_string(i + 1));
+        if (i < 10) mx("mx10.test", host);
+        mx("mx11.test", host);
+    }
+    cases.push_back({ "tenth exchange matches", "mx10.test", "198.51.100.10", SpfResultCode::Pass });
+    cases.push_back({ "no exchange matches", "mx10.test", "198.51.100.11", SpfResultCode::Fail });
+    cases.push_back({ "eleven exchanges", "mx11.test", "198.51.100.1", SpfResultCode::PermError });
+
+    // Include loop
+    txt("loopa.test", "v=spf1 include:loopb.test -all");
+    txt("loopb.test", "v=spf1 include:loopa.test -all");
+    cases.push_back({ "include loop", "loopa.test", "192.0.2.1", SpfResultCode::PermError });
+
+    for (const auto& c : cases)
+        check(c);
+
+    // A policy cut short by its chain is not cached: d0 -> ... -> d10 runs
+    // into the depth limit at d9, but d5 evaluated on its own is fine
+    for (int i = 0; i < 10; ++i)
+        txt("d" + std::to_string(i) + ".depth.test",
+            "v=spf1 include:d" + std::to_string(i + 1) + ".depth.test -all");
+    txt("d10.depth.test", "v=spf1 ip4:192.0.2.1 -all");
+    check({ "eleven deep", "d0.depth.test", "192.0.2.1", SpfResultCode::PermError });
+    check({ "five deep after the eleven-deep walk", "d5.depth.test", "192.0.2.1", SpfResultCode::Pass });
+
+    // Likewise a child truncated by its includer's remaining budget
+    txt("budget.test", "v=spf1" + lookupChain("budget", 8) + " include:_spf.budget.test -all");
+    txt("_spf.budget.test", "v=spf1" + lookupChain("budgetin", 3) + " -all");
+    check({ "include past the budget", "budget.test", "192.0.2.1", SpfResultCode::Pass });
+    check({ "truncated child on its own", "_spf.budget.test", "192.0.2.1", SpfResultCode::Pass });
+
+    // Amplification: 10 includes per level, 4 levels deep (11110 names) must
+    // not resolve more than the lookup limit allows
+    hostileTree("hostile.test", 10, 4);
+    g_queries.clear();
+    check({ "hostile fan-out", "hostile.test", "192.0.2.1", SpfResultCode::PermError });
+    int queries = 0;
+    for (const auto& [n, count] : g_queries)
+        queries += count;
+    ++g_cases;
+    if (queries > 64) {
+        ++g_failures;
+        std::fprintf(stderr, "FAIL hostile fan-out: %d DNS queries\n", queries);
+    }
+    std::printf("hostile fan-out: %d DNS queries for 11111 policies\n", queries);
+
+    std::printf("%d case(s), %d failure(s)\n", g_cases, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}